@@ -0,0 +1,208 @@
+// ----------------------------------------------------------------------------
+// asset_pack.h
+//
+// Description: Single file holding the assets needed at startup: textures,
+//              decoded and with their mipmaps, shader sources and meshes.
+//              tools/asset_packer.cpp builds it; at runtime it is mapped with
+//              one file open and its contents are handed to OpenGL straight
+//              from the mapping, with nothing to decode or parse.
+// ----------------------------------------------------------------------------
+
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// ---- Binary file layout ----------------------------------------------------
+// [AssetPackHeader][numEntries * AssetPackEntry][padding][asset][padding][asset]...
+// Entries are sorted by name; assets start on kAssetPackAlignment boundaries. Offsets inside an asset are
+// relative to its start.
+
+const static char kAssetPackMagic[8] = { 'A', 'S', 'S', 'E', 'T', 'P', 'K', '2' };
+const static uint64_t kAssetPackAlignment = 4096; // a page: each asset maps on its own pages
+const static uint32_t kAssetNameSize = 64;
+const static uint32_t kMaxTextureLevels = 16;
+
+enum AssetType {
+    kAssetTexture = 1, // PackedTexture, then its levels
+    kAssetShader = 2,  // GLSL source, not NUL-terminated
+    kAssetMesh = 3     // PackedMesh, then its arrays
+};
+
+struct AssetPackHeader {
+    char magic[8];
+    uint32_t numEntries;
+    uint32_t entrySize; // sizeof(AssetPackEntry)
+    uint64_t entriesOffset;
+};
+
+struct AssetPackEntry {
+    char name[kAssetNameSize]; // NUL-terminated: the path the asset is loaded from, e.g. "media/earth.jpg"
+    uint32_t type;             // AssetType
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct PackedTextureLevel {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset; // tightly packed rows of 8 bit texels
+    uint64_t size;
+};
+
+struct PackedTexture {
+    uint32_t components; // 1 to 4
+    uint32_t numLevels;  // down to 1x1
+    uint64_t sourceHash; // hashFNV1a of the bytes of the source file, which keys its cache (see texture_cache.h)
+    uint64_t sourceSize;
+    PackedTextureLevel levels[kMaxTextureLevels];
+};
+
+struct PackedMesh {
+    uint32_t numVertices;
+    uint32_t numIndices;     // triangles
+    uint64_t positionsOffset; // 3 floats per vertex
+    uint64_t normalsOffset;   // 3 floats per vertex
+    uint64_t texCoordsOffset; // 2 floats per vertex
+    uint64_t indicesOffset;   // uint32_t
+};
+
+// 64 bit FNV-1a: enough to tell a changed source, not meant against forgery.
+inline uint64_t hashFNV1a(const unsigned char* data, const size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// ---- Runtime access -----------------------------------------------------------
+
+class AssetPack {
+public:
+    // Maps a pack produced by tools/asset_packer and checks that every asset lies within the file, so that the
+    // accessors can be trusted. Returns false on a missing or malformed file.
+    bool open(const std::string& filename) {
+        close();
+        if (!m_file.open(filename)) {
+            return false;
+        }
+        const AssetPackHeader* header = m_file.at<AssetPackHeader>(0);
+        if (!header || std::memcmp(header->magic, kAssetPackMagic, sizeof(kAssetPackMagic)) != 0 ||
+            header->entrySize != sizeof(AssetPackEntry)) {
+            close();
+            return false;
+        }
+        const AssetPackEntry* entries = m_file.at<AssetPackEntry>(static_cast<size_t>(header->entriesOffset), header->numEntries);
+        if (!entries) {
+            close();
+            return false;
+        }
+        for (uint32_t i = 0; i < header->numEntries; ++i) {
+            if (!isValid(entries[i])) {
+                close();
+                return false;
+            }
+        }
+        m_entries = entries;
+        m_numEntries = header->numEntries;
+        return true;
+    }
+
+    void close() {
+        m_file.close();
+        m_entries = nullptr;
+        m_numEntries = 0;
+    }
+
+    inline bool isOpen() const { return m_entries != nullptr; }
+    inline uint32_t getNumEntries() const { return m_numEntries; }
+    inline const AssetPackEntry& getEntry(const uint32_t i) const { return m_entries[i]; }
+    inline size_t getSize() const { return m_file.size(); }
+
+    // Entry of the given name and type, or nullptr.
+    const AssetPackEntry* find(const std::string& name, const AssetType type) const {
+        const AssetPackEntry* end = m_entries + m_numEntries;
+        const AssetPackEntry* entry = std::lower_bound(m_entries, end, name.c_str(),
+            [](const AssetPackEntry& e, const char* n) { return std::strncmp(e.name, n, kAssetNameSize) < 0; });
+        if (entry == end || std::strncmp(entry->name, name.c_str(), kAssetNameSize) != 0 || entry->type != static_cast<uint32_t>(type)) {
+            return nullptr;
+        }
+        return entry;
+    }
+
+    inline const unsigned char* getData(const AssetPackEntry& entry) const { return m_file.data() + entry.offset; }
+
+    // Typed views of an asset, or nullptr when there is none of that name.
+    const PackedTexture* findTexture(const std::string& name) const {
+        const AssetPackEntry* entry = find(name, kAssetTexture);
+        return entry ? reinterpret_cast<const PackedTexture*>(getData(*entry)) : nullptr;
+    }
+    const PackedMesh* findMesh(const std::string& name) const {
+        const AssetPackEntry* entry = find(name, kAssetMesh);
+        return entry ? reinterpret_cast<const PackedMesh*>(getData(*entry)) : nullptr;
+    }
+    const char* findShader(const std::string& name, size_t& length) const {
+        const AssetPackEntry* entry = find(name, kAssetShader);
+        length = entry ? static_cast<size_t>(entry->size) : 0;
+        return entry ? reinterpret_cast<const char*>(getData(*entry)) : nullptr;
+    }
+
+    // Arrays of a packed asset, which is followed by them in the mapping.
+    inline static const unsigned char* getLevel(const PackedTexture* texture, const uint32_t level) {
+        return reinterpret_cast<const unsigned char*>(texture) + texture->levels[level].offset;
+    }
+    template <typename T>
+    inline static const T* getArray(const PackedMesh* mesh, const uint64_t offset) {
+        return reinterpret_cast<const T*>(reinterpret_cast<const unsigned char*>(mesh) + offset);
+    }
+
+private:
+    // Whether [offset, offset + size) of the asset is within it.
+    static bool contains(const AssetPackEntry& entry, const uint64_t offset, const uint64_t size) {
+        return offset <= entry.size && size <= entry.size - offset;
+    }
+
+    bool isValid(const AssetPackEntry& entry) const {
+        if (entry.offset % kAssetPackAlignment != 0 || entry.offset > m_file.size() || entry.size > m_file.size() - entry.offset ||
+            entry.name[kAssetNameSize - 1] != '\0') {
+            return false;
+        }
+        if (entry.type == kAssetTexture) {
+            const PackedTexture* texture = reinterpret_cast<const PackedTexture*>(m_file.data() + entry.offset);
+            if (!contains(entry, 0, sizeof(PackedTexture)) || texture->numLevels == 0 || texture->numLevels > kMaxTextureLevels ||
+                texture->components == 0 || texture->components > 4) {
+                return false;
+            }
+            for (uint32_t l = 0; l < texture->numLevels; ++l) {
+                const PackedTextureLevel& level = texture->levels[l];
+                if (level.size != uint64_t(level.width) * level.height * texture->components || !contains(entry, level.offset, level.size)) {
+                    return false;
+                }
+            }
+        }
+        else if (entry.type == kAssetMesh) {
+            const PackedMesh* mesh = reinterpret_cast<const PackedMesh*>(m_file.data() + entry.offset);
+            if (!contains(entry, 0, sizeof(PackedMesh))) {
+                return false;
+            }
+            const uint64_t n = mesh->numVertices;
+            return contains(entry, mesh->positionsOffset, 3 * n * sizeof(float)) && contains(entry, mesh->normalsOffset, 3 * n * sizeof(float)) &&
+                   contains(entry, mesh->texCoordsOffset, 2 * n * sizeof(float)) &&
+                   contains(entry, mesh->indicesOffset, uint64_t(mesh->numIndices) * sizeof(uint32_t));
+        }
+        return true;
+    }
+
+    MappedFile m_file;
+    const AssetPackEntry* m_entries = nullptr;
+    uint32_t m_numEntries = 0;
+};
+
+#endif // ASSET_PACK_H
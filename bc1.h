@@ -0,0 +1,177 @@
+// ----------------------------------------------------------------------------
+// bc1.h
+//
+// Description: CPU encoder and decoder of BC1 (DXT1), the block compression
+//              of opaque RGB textures read by every desktop GPU: each 4x4
+//              block of texels is two RGB565 endpoints and a 2 bit index per
+//              texel into the four colors between them, 8 bytes instead of 48.
+//              The endpoints are the texels lying furthest apart along the
+//              principal axis of the colors of the block, found by a few power
+//              iterations of their covariance; each texel takes the nearest
+//              of the four colors.
+// ----------------------------------------------------------------------------
+
+#ifndef BC1_H
+#define BC1_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+const static uint32_t kBC1BlockBytes = 8;
+const static int kBC1PowerIterations = 4; // enough for the principal axis of 16 colors
+
+// Bytes of a level of BC1 blocks: partial blocks at the edges are whole blocks.
+inline size_t computeBC1Size(const uint32_t width, const uint32_t height) {
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * kBC1BlockBytes;
+}
+
+inline uint16_t packRGB565(const unsigned char* rgb) {
+    return static_cast<uint16_t>(((rgb[0] * 31 + 127) / 255) << 11 | ((rgb[1] * 63 + 127) / 255) << 5 | ((rgb[2] * 31 + 127) / 255));
+}
+
+inline void unpackRGB565(const uint16_t color, int rgb[3]) {
+    const int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// The four colors of a block whose first endpoint is the greater: both, then the ones at 1/3 and 2/3.
+inline void computeBC1Palette(const uint16_t color0, const uint16_t color1, int palette[4][3]) {
+    unpackRGB565(color0, palette[0]);
+    unpackRGB565(color1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+}
+
+// Encodes 16 RGB texels, in rows.
+inline void encodeBC1Block(const unsigned char texels[16][3], unsigned char block[8]) {
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int t = 0; t < 16; ++t) {
+        for (int c = 0; c < 3; ++c) {
+            mean[c] += texels[t][c] / 16.0f;
+        }
+    }
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f }; // rr, rg, rb, gg, gb, bb
+    for (int t = 0; t < 16; ++t) {
+        const float r = texels[t][0] - mean[0], g = texels[t][1] - mean[1], b = texels[t][2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int i = 0; i < kBC1PowerIterations; ++i) {
+        const float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        const float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        const float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        const float norm = std::max(std::max(std::abs(x), std::abs(y)), std::abs(z));
+        if (norm <= 0.0f) {
+            break; // flat block: any axis
+        }
+        axis[0] = x / norm;
+        axis[1] = y / norm;
+        axis[2] = z / norm;
+    }
+    int lowest = 0, highest = 0;
+    float low = 0.0f, high = 0.0f;
+    for (int t = 0; t < 16; ++t) {
+        const float p = texels[t][0] * axis[0] + texels[t][1] * axis[1] + texels[t][2] * axis[2];
+        if (t == 0 || p < low) {
+            low = p;
+            lowest = t;
+        }
+        if (t == 0 || p > high) {
+            high = p;
+            highest = t;
+        }
+    }
+    uint16_t color0 = packRGB565(texels[highest]);
+    uint16_t color1 = packRGB565(texels[lowest]);
+    if (color0 < color1) {
+        std::swap(color0, color1); // four-color mode needs the greater first
+    }
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        int palette[4][3];
+        computeBC1Palette(color0, color1, palette);
+        for (int t = 0; t < 16; ++t) {
+            int best = 0, bestDistance = 0;
+            for (int i = 0; i < 4; ++i) {
+                const int r = texels[t][0] - palette[i][0], g = texels[t][1] - palette[i][1], b = texels[t][2] - palette[i][2];
+                const int distance = r * r + g * g + b * b;
+                if (i == 0 || distance < bestDistance) {
+                    bestDistance = distance;
+                    best = i;
+                }
+            }
+            indices |= static_cast<uint32_t>(best) << (2 * t);
+        }
+    }
+    block[0] = static_cast<unsigned char>(color0 & 0xFF);
+    block[1] = static_cast<unsigned char>(color0 >> 8);
+    block[2] = static_cast<unsigned char>(color1 & 0xFF);
+    block[3] = static_cast<unsigned char>(color1 >> 8);
+    for (int i = 0; i < 4; ++i) {
+        block[4 + i] = static_cast<unsigned char>(indices >> (8 * i));
+    }
+}
+
+// Encodes the rows of blocks [firstRow, lastRow) of a tightly packed RGB image into its BC1 level, whose blocks
+// are in rows too. Texels past the edges repeat the last ones.
+inline void encodeBC1(const unsigned char* rgb, const uint32_t width, const uint32_t height, unsigned char* blocks,
+                      const uint32_t firstRow, const uint32_t lastRow) {
+    const uint32_t blocksPerRow = (width + 3) / 4;
+    unsigned char texels[16][3];
+    for (uint32_t by = firstRow; by < lastRow; ++by) {
+        for (uint32_t bx = 0; bx < blocksPerRow; ++bx) {
+            for (uint32_t t = 0; t < 16; ++t) {
+                const uint32_t x = std::min(4 * bx + t % 4, width - 1), y = std::min(4 * by + t / 4, height - 1);
+                const unsigned char* texel = rgb + (size_t(y) * width + x) * 3;
+                texels[t][0] = texel[0];
+                texels[t][1] = texel[1];
+                texels[t][2] = texel[2];
+            }
+            encodeBC1Block(texels, blocks + (size_t(by) * blocksPerRow + bx) * kBC1BlockBytes);
+        }
+    }
+}
+
+// Decodes a BC1 level into a tightly packed RGB image, for drivers without the format.
+inline void decodeBC1(const unsigned char* blocks, const uint32_t width, const uint32_t height, unsigned char* rgb) {
+    const uint32_t blocksPerRow = (width + 3) / 4;
+    for (uint32_t by = 0; by < (height + 3) / 4; ++by) {
+        for (uint32_t bx = 0; bx < blocksPerRow; ++bx) {
+            const unsigned char* block = blocks + (size_t(by) * blocksPerRow + bx) * kBC1BlockBytes;
+            const uint16_t color0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+            const uint16_t color1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+            int palette[4][3];
+            computeBC1Palette(color0, color1, palette);
+            if (color0 <= color1) { // three-color mode, never written by the encoder but valid
+                for (int c = 0; c < 3; ++c) {
+                    palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                    palette[3][c] = 0;
+                }
+            }
+            const uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | static_cast<uint32_t>(block[7]) << 24;
+            for (uint32_t t = 0; t < 16; ++t) {
+                const uint32_t x = 4 * bx + t % 4, y = 4 * by + t / 4;
+                if (x < width && y < height) {
+                    const int* color = palette[(indices >> (2 * t)) & 3];
+                    unsigned char* texel = rgb + (size_t(y) * width + x) * 3;
+                    texel[0] = static_cast<unsigned char>(color[0]);
+                    texel[1] = static_cast<unsigned char>(color[1]);
+                    texel[2] = static_cast<unsigned char>(color[2]);
+                }
+            }
+        }
+    }
+}
+
+#endif // BC1_H
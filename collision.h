@@ -0,0 +1,271 @@
+// ----------------------------------------------------------------------------
+// collision.h
+//
+// Description: Collision detection between moving spheres.
+//
+//              The broadphase bins the boxes swept by the bodies during a step
+//              in a uniform grid: each box is entered in every cell it overlaps,
+//              the entries are radix sorted by cell, and only bodies sharing a
+//              cell are compared. A pair is reported by the one cell holding the
+//              min corner of the intersection of the two boxes, so it is never
+//              reported twice. The few bodies much larger than the cells (a sun
+//              among particles) are tested against every body instead.
+//
+//              Candidate pairs are then tested exactly, assuming linear relative
+//              motion over the step.
+// ----------------------------------------------------------------------------
+
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct CollisionContact {
+    uint32_t first;  // lower index of the pair
+    uint32_t second;
+    double time;     // fraction of the step at first contact, in [0, 1]
+};
+
+// Earliest fraction t in [0, 1] of the step where two spheres moving linearly from (p0, q0) to (p1, q1)
+// touch. Spheres already overlapping at the start touch at t = 0. Returns false if they never touch.
+inline bool sweptSphereContact(const glm::dvec3& p0, const glm::dvec3& p1, const glm::dvec3& q0, const glm::dvec3& q1,
+                               const double radius, double& t) {
+    const glm::dvec3 d0 = q0 - p0;
+    const glm::dvec3 motion = (q1 - p1) - d0;
+    const double c = glm::dot(d0, d0) - radius * radius;
+    if (c <= 0.0) {
+        t = 0.0;
+        return true;
+    }
+    const double a = glm::dot(motion, motion);
+    const double b = glm::dot(d0, motion);
+    if (a == 0.0 || b >= 0.0) {
+        return false; // not moving relative to each other, or moving apart
+    }
+    const double discriminant = b * b - a * c;
+    if (discriminant < 0.0) {
+        return false;
+    }
+    t = (-b - std::sqrt(discriminant)) / a;
+    return t <= 1.0;
+}
+
+class CollisionGrid {
+public:
+    // Contacts between the spheres moving from start to end during the step, sorted by time of contact
+    // (then by indices, so that the order is deterministic). Bodies with a zero radius are ignored.
+    void findContacts(const std::vector<glm::dvec3>& start, const std::vector<glm::dvec3>& end,
+                      const std::vector<double>& radii, std::vector<CollisionContact>& contacts) {
+        contacts.clear();
+        m_candidatePairs = 0;
+        m_start = &start;
+        m_end = &end;
+        m_radii = &radii;
+        m_contacts = &contacts;
+
+        if (!buildBoxes()) {
+            return;
+        }
+        chooseCells();
+        binBoxes();
+
+        // Small bodies: all pairs inside each cell
+        const size_t numEntries = m_entries.size();
+        for (size_t first = 0; first < numEntries;) {
+            size_t last = first + 1;
+            while (last < numEntries && m_entries[last].key == m_entries[first].key) {
+                ++last;
+            }
+            for (size_t a = first; a < last; ++a) {
+                for (size_t b = a + 1; b < last; ++b) {
+                    testPair(m_entries[a].body, m_entries[b].body, m_entries[a].key);
+                }
+            }
+            first = last;
+        }
+
+        // Large bodies: against everything, each pair once
+        for (size_t k = 0; k < m_large.size(); ++k) {
+            const uint32_t i = m_large[k];
+            for (size_t j = 0; j < m_boxes.size(); ++j) {
+                if (m_boxes[j].valid && (!m_isLarge[j] || j > i)) {
+                    testPair(i, static_cast<uint32_t>(j), kNoCell);
+                }
+            }
+        }
+        std::sort(contacts.begin(), contacts.end(), earlier);
+    }
+
+    inline uint64_t getLastCandidatePairs() const { return m_candidatePairs; }
+
+private:
+    const static uint64_t kNoCell = ~uint64_t(0);
+    const static int kCellBits = 21; // per axis, three of them packed in the 64-bit key of a cell
+    const static uint64_t kCellMask = (uint64_t(1) << kCellBits) - 1;
+    const static uint64_t kMaxCellsPerBody = 64; // beyond, the body is large
+    const static int kRadixBits = 11;
+
+    struct SweptBox {
+        glm::dvec3 min;
+        glm::dvec3 max;
+        bool valid;
+    };
+
+    struct Entry {
+        uint64_t key;
+        uint32_t body;
+    };
+
+    static bool earlier(const CollisionContact& a, const CollisionContact& b) {
+        if (a.time != b.time) {
+            return a.time < b.time;
+        }
+        return a.first < b.first || (a.first == b.first && a.second < b.second);
+    }
+
+    bool buildBoxes() {
+        const size_t n = m_start->size();
+        m_boxes.resize(n);
+        bool any = false;
+        for (size_t i = 0; i < n; ++i) {
+            SweptBox& box = m_boxes[i];
+            const double r = (*m_radii)[i];
+            box.valid = r > 0.0;
+            box.min = glm::min((*m_start)[i], (*m_end)[i]) - r;
+            box.max = glm::max((*m_start)[i], (*m_end)[i]) + r;
+            if (box.valid) {
+                m_sceneMin = any ? glm::min(m_sceneMin, box.min) : box.min;
+                m_sceneMax = any ? glm::max(m_sceneMax, box.max) : box.max;
+                any = true;
+            }
+        }
+        return any;
+    }
+
+    // Cells twice the median box: most boxes overlap a handful of cells, and cells hold few bodies.
+    void chooseCells() {
+        m_extents.clear();
+        for (size_t i = 0; i < m_boxes.size(); ++i) {
+            if (m_boxes[i].valid) {
+                const glm::dvec3 e = m_boxes[i].max - m_boxes[i].min;
+                m_extents.push_back(std::max(e.x, std::max(e.y, e.z)));
+            }
+        }
+        std::nth_element(m_extents.begin(), m_extents.begin() + m_extents.size() / 2, m_extents.end());
+        const glm::dvec3 span = m_sceneMax - m_sceneMin;
+        const double maxSpan = std::max(span.x, std::max(span.y, span.z));
+        m_cellSize = std::max(2.0 * m_extents[m_extents.size() / 2], maxSpan / static_cast<double>(kCellMask));
+        if (!(m_cellSize > 0.0)) {
+            m_cellSize = 1.0; // all boxes degenerate at the same point
+        }
+    }
+
+    inline glm::u64vec3 cellOf(const glm::dvec3& p) const {
+        const glm::dvec3 c = glm::clamp((p - m_sceneMin) / m_cellSize, 0.0, static_cast<double>(kCellMask));
+        return glm::u64vec3(c);
+    }
+
+    inline static uint64_t cellKey(const glm::u64vec3& c) { return (c.x << (2 * kCellBits)) | (c.y << kCellBits) | c.z; }
+
+    void binBoxes() {
+        m_entries.clear();
+        m_large.clear();
+        m_isLarge.assign(m_boxes.size(), 0);
+        for (size_t i = 0; i < m_boxes.size(); ++i) {
+            const SweptBox& box = m_boxes[i];
+            if (!box.valid) {
+                continue;
+            }
+            const glm::u64vec3 lo = cellOf(box.min);
+            const glm::u64vec3 hi = cellOf(box.max);
+            const glm::u64vec3 count = hi - lo + glm::u64vec3(1);
+            if (count.x * count.y * count.z > kMaxCellsPerBody) {
+                m_large.push_back(static_cast<uint32_t>(i));
+                m_isLarge[i] = 1;
+                continue;
+            }
+            Entry entry;
+            entry.body = static_cast<uint32_t>(i);
+            for (uint64_t x = lo.x; x <= hi.x; ++x) {
+                for (uint64_t y = lo.y; y <= hi.y; ++y) {
+                    for (uint64_t z = lo.z; z <= hi.z; ++z) {
+                        entry.key = cellKey(glm::u64vec3(x, y, z));
+                        m_entries.push_back(entry);
+                    }
+                }
+            }
+        }
+        radixSort();
+    }
+
+    // Stable LSD radix sort of the entries by key; entries of a cell stay in body order.
+    void radixSort() {
+        const size_t n = m_entries.size();
+        m_sorted.resize(n);
+        const size_t numBuckets = size_t(1) << kRadixBits;
+        std::vector<size_t> offsets(numBuckets);
+        for (int shift = 0; shift < 3 * kCellBits; shift += kRadixBits) {
+            std::fill(offsets.begin(), offsets.end(), 0);
+            for (size_t k = 0; k < n; ++k) {
+                ++offsets[(m_entries[k].key >> shift) & (numBuckets - 1)];
+            }
+            if (n == 0 || offsets[(m_entries[0].key >> shift) & (numBuckets - 1)] == n) {
+                continue; // same digit everywhere, e.g., the upper bits of a small grid
+            }
+            size_t sum = 0;
+            for (size_t b = 0; b < numBuckets; ++b) {
+                const size_t count = offsets[b];
+                offsets[b] = sum;
+                sum += count;
+            }
+            for (size_t k = 0; k < n; ++k) {
+                m_sorted[offsets[(m_entries[k].key >> shift) & (numBuckets - 1)]++] = m_entries[k];
+            }
+            m_entries.swap(m_sorted);
+        }
+    }
+
+    void testPair(const uint32_t i, const uint32_t j, const uint64_t cell) {
+        const SweptBox& bi = m_boxes[i];
+        const SweptBox& bj = m_boxes[j];
+        if (bj.min.x > bi.max.x || bi.min.x > bj.max.x || bj.min.y > bi.max.y || bi.min.y > bj.max.y ||
+            bj.min.z > bi.max.z || bi.min.z > bj.max.z) {
+            return;
+        }
+        if (cell != kNoCell && cellKey(cellOf(glm::max(bi.min, bj.min))) != cell) {
+            return; // reported by another cell shared by both boxes
+        }
+        ++m_candidatePairs;
+        double t;
+        if (sweptSphereContact((*m_start)[i], (*m_end)[i], (*m_start)[j], (*m_end)[j], (*m_radii)[i] + (*m_radii)[j], t)) {
+            CollisionContact contact;
+            contact.first = std::min(i, j);
+            contact.second = std::max(i, j);
+            contact.time = t;
+            m_contacts->push_back(contact);
+        }
+    }
+
+    const std::vector<glm::dvec3>* m_start = nullptr;
+    const std::vector<glm::dvec3>* m_end = nullptr;
+    const std::vector<double>* m_radii = nullptr;
+    std::vector<CollisionContact>* m_contacts = nullptr;
+
+    std::vector<SweptBox> m_boxes;
+    std::vector<double> m_extents;
+    std::vector<Entry> m_entries;
+    std::vector<Entry> m_sorted;
+    std::vector<uint32_t> m_large;
+    std::vector<uint8_t> m_isLarge;
+    glm::dvec3 m_sceneMin = glm::dvec3(0.0);
+    glm::dvec3 m_sceneMax = glm::dvec3(0.0);
+    double m_cellSize = 1.0;
+    uint64_t m_candidatePairs = 0;
+};
+
+#endif // COLLISION_H
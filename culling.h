@@ -0,0 +1,479 @@
+// ----------------------------------------------------------------------------
+// culling.h
+//
+// Description: View-frustum culling of bounding spheres.
+//
+//              The spheres are organized in a bounding volume hierarchy of
+//              boxes, built by median splits and refit every frame as the bodies
+//              move; it is rebuilt only when refitting has loosened it too much.
+//              Traversal drops the subtrees outside of the frustum and accepts
+//              the ones fully inside without testing their spheres. Spheres of
+//              the leaves that straddle a plane are tested four at a time with
+//              SSE when available. With a job system, large hierarchies are
+//              culled in parallel, one subtree per job, in the same order.
+//
+//              The same hierarchy answers ray queries, for picking: nearest
+//              sphere along a ray, or all of them, visiting the boxes nearest
+//              first and skipping the ones beyond the best hit.
+//
+//              Positions are in double world space; frustum tests are done in
+//              float relative to the camera (see world.h), ray tests in double.
+// ----------------------------------------------------------------------------
+
+#ifndef CULLING_H
+#define CULLING_H
+
+#include "jobs.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_SSE2
+#include <emmintrin.h>
+#endif
+
+const static double kCullingRebuildCostFactor = 2.0; // rebuild once the refit boxes are twice as costly as fresh ones
+const static uint32_t kCullingParallelSpheres = 8192; // below, a job costs more than the traversal it saves
+
+// Sphere hit by a ray: distance along the ray and point of the sphere.
+struct RayHit {
+    uint32_t sphere;
+    double distance;
+    glm::dvec3 point;
+};
+
+// Planes (normal, offset) with normals pointing inside: a point p is inside when dot(normal, p) + offset >= 0.
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+// Frustum of a camera-relative projection * view matrix. With the logarithmic depth of the shaders, nothing is
+// clipped in front of the near plane, only behind the camera, so the near plane goes through the eye.
+inline Frustum computeFrustum(const glm::mat4& projView) {
+    const glm::vec4 row0(projView[0][0], projView[1][0], projView[2][0], projView[3][0]);
+    const glm::vec4 row1(projView[0][1], projView[1][1], projView[2][1], projView[3][1]);
+    const glm::vec4 row2(projView[0][2], projView[1][2], projView[2][2], projView[3][2]);
+    const glm::vec4 row3(projView[0][3], projView[1][3], projView[2][3], projView[3][3]);
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0; // left
+    frustum.planes[1] = row3 - row0; // right
+    frustum.planes[2] = row3 + row1; // bottom
+    frustum.planes[3] = row3 - row1; // top
+    frustum.planes[4] = row3 - row2; // far
+    frustum.planes[5] = row3;        // eye
+    for (int p = 0; p < 6; ++p) {
+        frustum.planes[p] /= glm::length(glm::vec3(frustum.planes[p]));
+    }
+    return frustum;
+}
+
+class FrustumCuller {
+public:
+    // Refits the hierarchy to the new spheres, or rebuilds it when their number changed or the boxes grew too
+    // loose. Spheres with a negative radius are never visible.
+    void update(const std::vector<glm::dvec3>& centers, const std::vector<double>& radii) {
+        const uint32_t n = static_cast<uint32_t>(centers.size());
+        if (n != m_order.size()) {
+            build(centers, radii);
+            return;
+        }
+        gatherLeaves(centers, radii);
+        refit();
+        m_rebuilt = computeCost() > kCullingRebuildCostFactor * m_builtCost;
+        if (m_rebuilt) {
+            build(centers, radii);
+        }
+    }
+
+    // Indices of the spheres intersecting the frustum of a camera at origin. With jobs, the subtrees below the
+    // top levels are traversed in parallel and their results concatenated in traversal order.
+    void cull(const Frustum& frustum, const glm::dvec3& origin, std::vector<uint32_t>& visible, JobSystem* jobs = nullptr) {
+        visible.clear();
+        m_testedSpheres = 0;
+        if (m_nodes.empty()) {
+            return;
+        }
+        if (!jobs || jobs->getNumThreads() == 1 || m_order.size() < kCullingParallelSpheres) {
+            m_testedSpheres = traverse(frustum, origin, 0, m_stack, visible);
+            return;
+        }
+        // Frontier of subtrees, left to right: the top levels are split until there are enough for the threads
+        m_frontier.assign(1, 0);
+        const size_t wanted = jobs->getNumThreads() * kJobChunksPerThread;
+        while (m_frontier.size() < wanted) {
+            m_next.clear();
+            for (size_t f = 0; f < m_frontier.size(); ++f) {
+                const Node& node = m_nodes[m_frontier[f]];
+                if (node.child == kNoChild) {
+                    m_next.push_back(m_frontier[f]);
+                }
+                else {
+                    m_next.push_back(node.child);
+                    m_next.push_back(node.child + 1);
+                }
+            }
+            if (m_next.size() == m_frontier.size()) {
+                break; // only leaves left
+            }
+            m_frontier.swap(m_next);
+        }
+        m_subtreeVisible.resize(m_frontier.size());
+        m_subtreeTested.assign(m_frontier.size(), 0);
+        jobs->parallelFor(0, m_frontier.size(), 1, [this, &frustum, &origin](size_t first, size_t last) {
+            std::vector<uint32_t> stack;
+            for (size_t f = first; f < last; ++f) {
+                m_subtreeVisible[f].clear();
+                m_subtreeTested[f] = traverse(frustum, origin, m_frontier[f], stack, m_subtreeVisible[f]);
+            }
+        });
+        for (size_t f = 0; f < m_frontier.size(); ++f) {
+            visible.insert(visible.end(), m_subtreeVisible[f].begin(), m_subtreeVisible[f].end());
+            m_testedSpheres += m_subtreeTested[f];
+        }
+    }
+
+    // Nearest sphere hit by the ray origin + t direction (unit direction, t >= 0), among the spheres of the last
+    // update. Spheres are widened by `tolerance` radians seen from the origin, so that the ones smaller than a
+    // pixel can be hit too; a widened hit is reported at the point of the sphere nearest to the ray.
+    bool intersectRay(const glm::dvec3& origin, const glm::dvec3& direction, const double tolerance, RayHit& hit) const {
+        std::vector<RayHit> hits;
+        traverseRay(origin, direction, tolerance, true, hits);
+        if (hits.empty()) {
+            return false;
+        }
+        hit = hits[0];
+        return true;
+    }
+
+    // Every sphere hit by the ray, nearest first.
+    void collectRayHits(const glm::dvec3& origin, const glm::dvec3& direction, const double tolerance, std::vector<RayHit>& hits) const {
+        hits.clear();
+        traverseRay(origin, direction, tolerance, false, hits);
+        std::sort(hits.begin(), hits.end(), [](const RayHit& a, const RayHit& b) { return a.distance < b.distance; });
+    }
+
+    inline size_t getNumNodes() const { return m_nodes.size(); }
+    inline bool wasRebuilt() const { return m_rebuilt; }                // by the last update
+    inline uint32_t getLastTestedSpheres() const { return m_testedSpheres; } // individually, by the last cull
+
+private:
+    const static uint32_t kNoChild = 0xFFFFFFFFu;
+    const static uint32_t kLeafSize = 4; // one SSE batch
+
+    // Box of a subtree, which covers the spheres [first, first + count) of the leaf order. Children are
+    // allocated in pairs after their parent, so a reverse pass refits children before parents.
+    struct Node {
+        glm::dvec3 min;
+        glm::dvec3 max;
+        uint32_t first;
+        uint32_t count;
+        uint32_t child; // first of the two children, or kNoChild for a leaf
+    };
+
+    void build(const std::vector<glm::dvec3>& centers, const std::vector<double>& radii) {
+        const uint32_t n = static_cast<uint32_t>(centers.size());
+        m_order.resize(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            m_order[i] = i;
+        }
+        m_centers = &centers;
+        m_nodes.clear();
+        if (n > 0) {
+            m_nodes.push_back(Node());
+            split(0, 0, n);
+        }
+        gatherLeaves(centers, radii);
+        refit();
+        m_builtCost = computeCost();
+        m_rebuilt = true;
+    }
+
+    // Median split of the spheres [first, first + count) along the longest axis of their centers.
+    void split(const uint32_t nodeIndex, const uint32_t first, const uint32_t count) {
+        m_nodes[nodeIndex].first = first;
+        m_nodes[nodeIndex].count = count;
+        m_nodes[nodeIndex].child = kNoChild;
+        if (count <= kLeafSize) {
+            return;
+        }
+        glm::dvec3 lo = (*m_centers)[m_order[first]];
+        glm::dvec3 hi = lo;
+        for (uint32_t k = first + 1; k < first + count; ++k) {
+            lo = glm::min(lo, (*m_centers)[m_order[k]]);
+            hi = glm::max(hi, (*m_centers)[m_order[k]]);
+        }
+        const glm::dvec3 span = hi - lo;
+        const int axis = (span.x >= span.y && span.x >= span.z) ? 0 : (span.y >= span.z ? 1 : 2);
+        const uint32_t half = count / 2;
+        const std::vector<glm::dvec3>& centers = *m_centers;
+        std::nth_element(m_order.begin() + first, m_order.begin() + first + half, m_order.begin() + first + count,
+                         [&centers, axis](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+
+        const uint32_t child = static_cast<uint32_t>(m_nodes.size());
+        m_nodes[nodeIndex].child = child;
+        m_nodes.push_back(Node());
+        m_nodes.push_back(Node());
+        split(child, first, half);
+        split(child + 1, first + half, count - half);
+    }
+
+    // Spheres in leaf order, so that the spheres of a node are contiguous.
+    void gatherLeaves(const std::vector<glm::dvec3>& centers, const std::vector<double>& radii) {
+        const size_t n = m_order.size();
+        m_x.resize(n);
+        m_y.resize(n);
+        m_z.resize(n);
+        m_radii.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            const uint32_t i = m_order[k];
+            m_x[k] = centers[i].x;
+            m_y[k] = centers[i].y;
+            m_z[k] = centers[i].z;
+            m_radii[k] = radii[i];
+        }
+    }
+
+    void refit() {
+        for (size_t j = m_nodes.size(); j-- > 0;) {
+            Node& node = m_nodes[j];
+            if (node.child != kNoChild) {
+                node.min = glm::min(m_nodes[node.child].min, m_nodes[node.child + 1].min);
+                node.max = glm::max(m_nodes[node.child].max, m_nodes[node.child + 1].max);
+                continue;
+            }
+            // Spheres with a negative radius (absorbed bodies) are left out: a leaf of only those stays empty
+            node.min = glm::dvec3(HUGE_VAL);
+            node.max = glm::dvec3(-HUGE_VAL);
+            for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                const double r = m_radii[k];
+                if (r < 0.0) {
+                    continue;
+                }
+                const glm::dvec3 c(m_x[k], m_y[k], m_z[k]);
+                node.min = glm::min(node.min, c - r);
+                node.max = glm::max(node.max, c + r);
+            }
+        }
+    }
+
+    // Box of no visible sphere.
+    static inline bool isEmpty(const Node& node) { return node.min.x > node.max.x; }
+
+    // Sum of the surface areas of the boxes: proportional to the expected cost of a traversal.
+    double computeCost() const {
+        double cost = 0.0;
+        for (size_t j = 0; j < m_nodes.size(); ++j) {
+            if (isEmpty(m_nodes[j])) {
+                continue;
+            }
+            const glm::dvec3 e = m_nodes[j].max - m_nodes[j].min;
+            cost += e.x * e.y + e.y * e.z + e.z * e.x;
+        }
+        return cost;
+    }
+
+    // Appends the visible spheres of the subtree; returns the number of spheres tested individually.
+    uint32_t traverse(const Frustum& frustum, const glm::dvec3& origin, const uint32_t root, std::vector<uint32_t>& stack,
+                      std::vector<uint32_t>& visible) const {
+        uint32_t tested = 0;
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty()) {
+            const Node& node = m_nodes[stack.back()];
+            stack.pop_back();
+            if (isEmpty(node)) {
+                continue;
+            }
+            const glm::vec3 center(0.5 * (node.min + node.max) - origin);
+            const glm::vec3 extent(0.5 * (node.max - node.min));
+            bool inside = true;
+            bool outside = false;
+            for (int p = 0; p < 6 && !outside; ++p) {
+                const glm::vec4& plane = frustum.planes[p];
+                const float s = glm::dot(glm::vec3(plane), center) + plane.w;
+                const float r = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                outside = s + r < 0.0f;
+                inside = inside && s - r >= 0.0f;
+            }
+            if (outside) {
+                continue;
+            }
+            if (inside) {
+                for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                    if (m_radii[k] >= 0.0) {
+                        visible.push_back(m_order[k]);
+                    }
+                }
+            }
+            else if (node.child == kNoChild) {
+                testLeaf(frustum, origin, node, visible);
+                tested += node.count;
+            }
+            else {
+                stack.push_back(node.child + 1);
+                stack.push_back(node.child);
+            }
+        }
+        return tested;
+    }
+
+    void testLeaf(const Frustum& frustum, const glm::dvec3& origin, const Node& node, std::vector<uint32_t>& visible) const {
+        // Camera-relative spheres of the leaf; unused lanes get a radius that no plane accepts
+        float x[kLeafSize], y[kLeafSize], z[kLeafSize], r[kLeafSize];
+        for (uint32_t k = 0; k < kLeafSize; ++k) {
+            const bool used = k < node.count;
+            const uint32_t s = node.first + (used ? k : 0);
+            x[k] = used ? static_cast<float>(m_x[s] - origin.x) : 0.0f;
+            y[k] = used ? static_cast<float>(m_y[s] - origin.y) : 0.0f;
+            z[k] = used ? static_cast<float>(m_z[s] - origin.z) : 0.0f;
+            r[k] = (used && m_radii[s] >= 0.0) ? static_cast<float>(m_radii[s]) : -1e30f;
+        }
+#ifdef CULLING_SSE2
+        const __m128 px = _mm_loadu_ps(x), py = _mm_loadu_ps(y), pz = _mm_loadu_ps(z);
+        const __m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r));
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; ++p) {
+            const glm::vec4& plane = frustum.planes[p];
+            __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), px), _mm_mul_ps(_mm_set1_ps(plane.y), py));
+            d = _mm_add_ps(d, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), pz), _mm_set1_ps(plane.w)));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negR));
+        }
+        const int mask = _mm_movemask_ps(outside);
+#else
+        int mask = 0;
+        for (uint32_t k = 0; k < kLeafSize; ++k) {
+            for (int p = 0; p < 6; ++p) {
+                const glm::vec4& plane = frustum.planes[p];
+                if (plane.x * x[k] + plane.y * y[k] + plane.z * z[k] + plane.w < -r[k]) {
+                    mask |= 1 << k;
+                    break;
+                }
+            }
+        }
+#endif
+        for (uint32_t k = 0; k < node.count; ++k) {
+            if (!(mask & (1 << k))) {
+                visible.push_back(m_order[node.first + k]);
+            }
+        }
+    }
+
+    // Entry distance of the ray into the box widened by the tolerance at its far side, or HUGE_VAL if it misses.
+    static double intersectBox(const Node& node, const glm::dvec3& origin, const glm::dvec3& inverseDirection, const double tolerance) {
+        if (isEmpty(node)) {
+            return HUGE_VAL;
+        }
+        const glm::dvec3 center = 0.5 * (node.min + node.max);
+        const glm::dvec3 extent = 0.5 * (node.max - node.min);
+        const double reach = glm::length(center - origin) + glm::length(extent);
+        const glm::dvec3 margin(reach * tolerance);
+        const glm::dvec3 t0 = (node.min - margin - origin) * inverseDirection;
+        const glm::dvec3 t1 = (node.max + margin - origin) * inverseDirection;
+        const glm::dvec3 tNear = glm::min(t0, t1);
+        const glm::dvec3 tFar = glm::max(t0, t1);
+        const double enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0));
+        const double exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+        return enter <= exit ? enter : HUGE_VAL;
+    }
+
+    // Hit of the sphere of leaf slot k, widened by the tolerance at its distance.
+    bool intersectSphere(const uint32_t k, const glm::dvec3& origin, const glm::dvec3& direction, const double tolerance, RayHit& hit) const {
+        if (m_radii[k] < 0.0) {
+            return false;
+        }
+        const glm::dvec3 center(m_x[k], m_y[k], m_z[k]);
+        const glm::dvec3 toCenter = center - origin;
+        const double along = glm::dot(toCenter, direction);
+        const double r = m_radii[k];
+        const double d2 = glm::dot(toCenter, toCenter) - along * along; // squared distance from the center to the line
+        const double widened = r + std::max(along, 0.0) * tolerance;
+        if (d2 > widened * widened || (along < 0.0 && glm::dot(toCenter, toCenter) > r * r)) {
+            return false; // missed, or behind the origin
+        }
+        hit.sphere = m_order[k];
+        if (d2 <= r * r) {
+            const double half = std::sqrt(r * r - d2);
+            hit.distance = (along - half >= 0.0) ? along - half : along + half; // from inside: the way out
+            hit.point = origin + hit.distance * direction;
+        }
+        else {
+            hit.point = center + r * glm::normalize(origin + along * direction - center);
+            hit.distance = along;
+        }
+        return true;
+    }
+
+    void traverseRay(const glm::dvec3& origin, const glm::dvec3& direction, const double tolerance, const bool nearestOnly,
+                     std::vector<RayHit>& hits) const {
+        if (m_nodes.empty()) {
+            return;
+        }
+        const glm::dvec3 inverseDirection(1.0 / (direction.x != 0.0 ? direction.x : 1e-300), 1.0 / (direction.y != 0.0 ? direction.y : 1e-300),
+                                          1.0 / (direction.z != 0.0 ? direction.z : 1e-300));
+        double best = HUGE_VAL;
+        std::vector<std::pair<double, uint32_t> > stack; // entry distance, node
+        const double rootEnter = intersectBox(m_nodes[0], origin, inverseDirection, tolerance);
+        if (rootEnter != HUGE_VAL) {
+            stack.push_back(std::make_pair(rootEnter, 0u));
+        }
+        while (!stack.empty()) {
+            const std::pair<double, uint32_t> top = stack.back();
+            stack.pop_back();
+            if (nearestOnly && top.first > best) {
+                continue;
+            }
+            const Node& node = m_nodes[top.second];
+            if (node.child == kNoChild) {
+                for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                    RayHit hit;
+                    if (intersectSphere(k, origin, direction, tolerance, hit) && (!nearestOnly || hit.distance < best)) {
+                        if (nearestOnly) {
+                            hits.assign(1, hit);
+                            best = hit.distance;
+                        }
+                        else {
+                            hits.push_back(hit);
+                        }
+                    }
+                }
+                continue;
+            }
+            // Nearest child on top of the stack, visited first
+            const double enter0 = intersectBox(m_nodes[node.child], origin, inverseDirection, tolerance);
+            const double enter1 = intersectBox(m_nodes[node.child + 1], origin, inverseDirection, tolerance);
+            const bool firstNearer = enter0 <= enter1;
+            const double nearEnter = firstNearer ? enter0 : enter1, farEnter = firstNearer ? enter1 : enter0;
+            const uint32_t nearChild = firstNearer ? node.child : node.child + 1, farChild = firstNearer ? node.child + 1 : node.child;
+            if (farEnter != HUGE_VAL) {
+                stack.push_back(std::make_pair(farEnter, farChild));
+            }
+            if (nearEnter != HUGE_VAL) {
+                stack.push_back(std::make_pair(nearEnter, nearChild));
+            }
+        }
+    }
+
+    const std::vector<glm::dvec3>* m_centers = nullptr; // during a build
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_order; // sphere index of each leaf slot
+    std::vector<double> m_x;
+    std::vector<double> m_y;
+    std::vector<double> m_z;
+    std::vector<double> m_radii;
+    std::vector<uint32_t> m_stack;
+    std::vector<uint32_t> m_frontier; // parallel cull: roots of the subtrees given to jobs
+    std::vector<uint32_t> m_next;
+    std::vector<std::vector<uint32_t> > m_subtreeVisible;
+    std::vector<uint32_t> m_subtreeTested;
+    double m_builtCost = 0.0;
+    bool m_rebuilt = false;
+    uint32_t m_testedSpheres = 0;
+};
+
+#endif // CULLING_H
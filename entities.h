@@ -0,0 +1,426 @@
+// ----------------------------------------------------------------------------
+// entities.h
+//
+// Description: Entity-component store. An entity is an id; its data lives in
+//              component pools, one per kind of component, each keeping one
+//              dense array per field (structure of arrays) in slot order. A
+//              sparse table maps entities to slots, and removals move the last
+//              slot into the hole, so the arrays stay contiguous and systems
+//              iterate them linearly.
+//
+//              Systems declare the components they read and write; a schedule
+//              groups consecutive systems that do not conflict, and the systems
+//              of a group may run in parallel, as jobs (see jobs.h).
+// ----------------------------------------------------------------------------
+
+#ifndef ENTITIES_H
+#define ENTITIES_H
+
+#include "jobs.h"
+#include "scene.h"
+#include "transforms.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+typedef uint32_t Entity;
+const static Entity kNoEntity = 0xFFFFFFFFu;
+
+enum ComponentType {
+    kComponentTransform = 1 << 0,
+    kComponentOrbit = 1 << 1,
+    kComponentRender = 1 << 2,
+    kComponentPhysics = 1 << 3,
+    kComponentLabel = 1 << 4
+};
+
+// Sparse set of the entities having a component. Derived pools own the field arrays and keep them in slot order.
+class ComponentPool {
+public:
+    virtual ~ComponentPool() {}
+
+    inline uint32_t size() const { return static_cast<uint32_t>(m_entities.size()); }
+    inline bool has(const Entity e) const { return e < m_slots.size() && m_slots[e] != kNoSlot; }
+    inline uint32_t getSlot(const Entity e) const { return m_slots[e]; }
+    inline Entity getEntity(const uint32_t slot) const { return m_entities[slot]; }
+
+    // Slot of the component of e, or kNoSlot
+    inline uint32_t findSlot(const Entity e) const { return has(e) ? m_slots[e] : kNoSlot; }
+
+    void remove(const Entity e) {
+        if (!has(e)) {
+            return;
+        }
+        const uint32_t slot = m_slots[e];
+        const uint32_t last = size() - 1;
+        if (slot != last) {
+            moveSlot(last, slot);
+            m_entities[slot] = m_entities[last];
+            m_slots[m_entities[slot]] = slot;
+        }
+        m_entities.pop_back();
+        popSlot();
+        m_slots[e] = kNoSlot;
+    }
+
+    void clear() {
+        m_entities.clear();
+        m_slots.clear();
+        clearFields();
+    }
+
+    const static uint32_t kNoSlot = 0xFFFFFFFFu;
+
+protected:
+    // Slot of a new component of e, or kNoSlot if e already has one. The derived pool appends its fields.
+    uint32_t insert(const Entity e) {
+        if (has(e)) {
+            return kNoSlot;
+        }
+        if (e >= m_slots.size()) {
+            m_slots.resize(e + 1, static_cast<uint32_t>(kNoSlot));
+        }
+        m_slots[e] = size();
+        m_entities.push_back(e);
+        return m_slots[e];
+    }
+
+    virtual void moveSlot(uint32_t from, uint32_t to) = 0;
+    virtual void popSlot() = 0;
+    virtual void clearFields() = 0;
+
+private:
+    std::vector<Entity> m_entities; // per slot
+    std::vector<uint32_t> m_slots;  // per entity
+};
+
+// Placement in the transform hierarchy, which stores the transforms themselves (depth first, see transforms.h),
+// and the spin of the entity about its tilted axis.
+class TransformPool : public ComponentPool {
+public:
+    uint32_t add(const Entity e, const uint32_t node, const float axialTilt, const double spinPeriod) {
+        const uint32_t slot = insert(e);
+        if (slot != kNoSlot) {
+            nodes.push_back(node);
+            axialTilts.push_back(axialTilt);
+            spinPeriods.push_back(spinPeriod);
+        }
+        return slot;
+    }
+
+    inline TransformHierarchy& getHierarchy() { return m_hierarchy; }
+    inline const TransformHierarchy& getHierarchy() const { return m_hierarchy; }
+
+    std::vector<uint32_t> nodes;
+    std::vector<float> axialTilts;   // radians
+    std::vector<double> spinPeriods; // 0 for none
+
+private:
+    void moveSlot(const uint32_t from, const uint32_t to) override {
+        nodes[to] = nodes[from];
+        axialTilts[to] = axialTilts[from];
+        spinPeriods[to] = spinPeriods[from];
+    }
+    void popSlot() override {
+        nodes.pop_back();
+        axialTilts.pop_back();
+        spinPeriods.pop_back();
+    }
+    void clearFields() override {
+        nodes.clear();
+        axialTilts.clear();
+        spinPeriods.clear();
+        m_hierarchy.clear();
+    }
+
+    TransformHierarchy m_hierarchy;
+};
+
+// Keplerian orbit the entity was placed on, and its trail.
+class OrbitPool : public ComponentPool {
+public:
+    const static uint32_t kNoTrail = 0xFFFFFFFFu;
+
+    uint32_t add(const Entity e, const Entity parent, const SceneOrbit& orbit, const uint32_t trail, const glm::vec3& color) {
+        const uint32_t slot = insert(e);
+        if (slot != kNoSlot) {
+            parents.push_back(parent);
+            elements.push_back(orbit);
+            trails.push_back(trail);
+            colors.push_back(color);
+        }
+        return slot;
+    }
+
+    std::vector<Entity> parents;
+    std::vector<SceneOrbit> elements;
+    std::vector<uint32_t> trails; // slot in the trail renderer, or kNoTrail
+    std::vector<glm::vec3> colors;
+
+private:
+    void moveSlot(const uint32_t from, const uint32_t to) override {
+        parents[to] = parents[from];
+        elements[to] = elements[from];
+        trails[to] = trails[from];
+        colors[to] = colors[from];
+    }
+    void popSlot() override {
+        parents.pop_back();
+        elements.pop_back();
+        trails.pop_back();
+        colors.pop_back();
+    }
+    void clearFields() override {
+        parents.clear();
+        elements.clear();
+        trails.clear();
+        colors.clear();
+    }
+};
+
+// Mesh and material.
+class RenderPool : public ComponentPool {
+public:
+    const static uint32_t kNoVirtualTexture = 0xFFFFFFFFu;
+    const static uint32_t kNoTextureSlot = 0xFFFFFFFFu;
+
+    uint32_t add(const Entity e, const uint32_t mesh, const GLuint texture, const glm::vec3& color, const bool isEmissive,
+                 const uint32_t virtualTexture = kNoVirtualTexture, const uint32_t textureSlot = kNoTextureSlot) {
+        const uint32_t slot = insert(e);
+        if (slot != kNoSlot) {
+            meshes.push_back(mesh);
+            textures.push_back(texture);
+            textureSlots.push_back(textureSlot);
+            virtualTextures.push_back(virtualTexture);
+            colors.push_back(color);
+            emissive.push_back(isEmissive ? 1 : 0);
+        }
+        return slot;
+    }
+
+    std::vector<uint32_t> meshes; // index in the meshes of the renderer
+    std::vector<GLuint> textures; // as added: the loader replaces the ones of a texture slot
+    std::vector<uint32_t> textureSlots; // slot of the texture in the loader of the renderer, for its residency and name, or kNoTextureSlot
+    std::vector<uint32_t> virtualTextures; // index in the virtual textures of the renderer, sampled instead, or kNoVirtualTexture
+    std::vector<glm::vec3> colors;  // mean color, for the point impostor (see points.h)
+    std::vector<uint8_t> emissive; // lights the scene and is drawn unlit
+
+private:
+    void moveSlot(const uint32_t from, const uint32_t to) override {
+        meshes[to] = meshes[from];
+        textures[to] = textures[from];
+        textureSlots[to] = textureSlots[from];
+        virtualTextures[to] = virtualTextures[from];
+        colors[to] = colors[from];
+        emissive[to] = emissive[from];
+    }
+    void popSlot() override {
+        meshes.pop_back();
+        textures.pop_back();
+        textureSlots.pop_back();
+        virtualTextures.pop_back();
+        colors.pop_back();
+        emissive.pop_back();
+    }
+    void clearFields() override {
+        meshes.clear();
+        textures.clear();
+        textureSlots.clear();
+        virtualTextures.clear();
+        colors.clear();
+        emissive.clear();
+    }
+};
+
+// Body of the simulation, with a copy of its state as of the last sync (see simulation.h).
+class PhysicsPool : public ComponentPool {
+public:
+    uint32_t add(const Entity e, const uint32_t body) {
+        const uint32_t slot = insert(e);
+        if (slot != kNoSlot) {
+            bodies.push_back(body);
+            positions.push_back(glm::dvec3(0.0));
+            radii.push_back(0.0);
+            absorbed.push_back(0);
+            newlyAbsorbed.push_back(0);
+        }
+        return slot;
+    }
+
+    std::vector<uint32_t> bodies; // simulation id
+    std::vector<glm::dvec3> positions;
+    std::vector<double> radii;
+    std::vector<uint8_t> absorbed;      // merged into another body
+    std::vector<uint8_t> newlyAbsorbed; // since the previous sync
+
+private:
+    void moveSlot(const uint32_t from, const uint32_t to) override {
+        bodies[to] = bodies[from];
+        positions[to] = positions[from];
+        radii[to] = radii[from];
+        absorbed[to] = absorbed[from];
+        newlyAbsorbed[to] = newlyAbsorbed[from];
+    }
+    void popSlot() override {
+        bodies.pop_back();
+        positions.pop_back();
+        radii.pop_back();
+        absorbed.pop_back();
+        newlyAbsorbed.pop_back();
+    }
+    void clearFields() override {
+        bodies.clear();
+        positions.clear();
+        radii.clear();
+        absorbed.clear();
+        newlyAbsorbed.clear();
+    }
+};
+
+// Display name; the text is owned by the caller (usually the string table of the scene).
+class LabelPool : public ComponentPool {
+public:
+    uint32_t add(const Entity e, const char* text) {
+        const uint32_t slot = insert(e);
+        if (slot != kNoSlot) {
+            texts.push_back(text);
+        }
+        return slot;
+    }
+
+    std::vector<const char*> texts;
+
+private:
+    void moveSlot(const uint32_t from, const uint32_t to) override { texts[to] = texts[from]; }
+    void popSlot() override { texts.pop_back(); }
+    void clearFields() override { texts.clear(); }
+};
+
+class EntityRegistry {
+public:
+    // Ids of destroyed entities are reused.
+    Entity create() {
+        if (!m_free.empty()) {
+            const Entity e = m_free.back();
+            m_free.pop_back();
+            m_alive[e] = 1;
+            return e;
+        }
+        m_alive.push_back(1);
+        return static_cast<Entity>(m_alive.size() - 1);
+    }
+
+    // Removes every component of the entity. Its transform node stays in the hierarchy, unreferenced.
+    void destroy(const Entity e) {
+        if (e >= m_alive.size() || !m_alive[e]) {
+            return;
+        }
+        m_transforms.remove(e);
+        m_orbits.remove(e);
+        m_renders.remove(e);
+        m_physics.remove(e);
+        m_labels.remove(e);
+        m_alive[e] = 0;
+        m_free.push_back(e);
+    }
+
+    void clear() {
+        m_transforms.clear();
+        m_orbits.clear();
+        m_renders.clear();
+        m_physics.clear();
+        m_labels.clear();
+        m_alive.clear();
+        m_free.clear();
+    }
+
+    inline uint32_t getNumEntities() const { return static_cast<uint32_t>(m_alive.size() - m_free.size()); }
+    inline bool isAlive(const Entity e) const { return e < m_alive.size() && m_alive[e]; }
+
+    inline TransformPool& getTransforms() { return m_transforms; }
+    inline OrbitPool& getOrbits() { return m_orbits; }
+    inline RenderPool& getRenders() { return m_renders; }
+    inline PhysicsPool& getPhysics() { return m_physics; }
+    inline LabelPool& getLabels() { return m_labels; }
+
+private:
+    TransformPool m_transforms;
+    OrbitPool m_orbits;
+    RenderPool m_renders;
+    PhysicsPool m_physics;
+    LabelPool m_labels;
+    std::vector<uint8_t> m_alive;
+    std::vector<Entity> m_free;
+};
+
+// A pass over some component pools. Reads and writes are ComponentType masks; a system must not touch
+// other pools, so that systems with disjoint sets can run at the same time.
+class System {
+public:
+    virtual ~System() {}
+    virtual uint32_t getReads() const = 0;
+    virtual uint32_t getWrites() const = 0;
+    virtual bool needsMainThread() const { return false; } // e.g., issues OpenGL calls
+    virtual void run(EntityRegistry& registry) = 0;
+};
+
+// Systems run in the order they were added. Consecutive systems that neither write what another one reads
+// or writes form a group, whose systems may run in parallel; groups run one after the other.
+class SystemSchedule {
+public:
+    void add(System* system) {
+        const bool joins = !m_groups.empty() && !conflicts(m_groups.back(), system);
+        if (!joins) {
+            m_groups.push_back(std::vector<System*>());
+        }
+        m_groups.back().push_back(system);
+    }
+
+    void clear() { m_groups.clear(); }
+    inline size_t getNumGroups() const { return m_groups.size(); }
+
+    // Runs every system, from the main thread. With jobs, the systems of a group run as jobs, except the ones
+    // bound to the main thread which run on it meanwhile; without, one after the other.
+    void run(EntityRegistry& registry, JobSystem* jobs) {
+        for (size_t g = 0; g < m_groups.size(); ++g) {
+            const std::vector<System*>& group = m_groups[g];
+            if (!jobs || group.size() == 1) {
+                for (size_t s = 0; s < group.size(); ++s) {
+                    group[s]->run(registry);
+                }
+                continue;
+            }
+            JobCounter done;
+            for (size_t s = 0; s < group.size(); ++s) {
+                if (!group[s]->needsMainThread()) {
+                    System* system = group[s];
+                    jobs->run(done, [system, &registry]() { system->run(registry); });
+                }
+            }
+            for (size_t s = 0; s < group.size(); ++s) {
+                if (group[s]->needsMainThread()) {
+                    group[s]->run(registry);
+                }
+            }
+            jobs->wait(done);
+        }
+    }
+
+private:
+    static bool conflicts(const std::vector<System*>& group, const System* system) {
+        for (size_t s = 0; s < group.size(); ++s) {
+            const System* other = group[s];
+            if ((other->getWrites() & (system->getReads() | system->getWrites())) || (system->getWrites() & other->getReads())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::vector<System*> > m_groups;
+};
+
+#endif // ENTITIES_H
@@ -0,0 +1,247 @@
+// ----------------------------------------------------------------------------
+// ephemeris.h
+//
+// Description: Planetary ephemeris evaluated from Chebyshev coefficients.
+//              tools/ephemeris_compiler.cpp converts JPL DE-style ASCII
+//              tables into the binary layout below; at runtime the file is
+//              memory-mapped and evaluated in place.
+// ----------------------------------------------------------------------------
+
+#ifndef EPHEMERIS_H
+#define EPHEMERIS_H
+
+#include "mapped_file.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Bodies in the order of the DE coefficient layout (GROUP 1050).
+enum EphemerisBody {
+    kEphMercury = 0,
+    kEphVenus,
+    kEphEarthMoonBarycenter,
+    kEphMars,
+    kEphJupiter,
+    kEphSaturn,
+    kEphUranus,
+    kEphNeptune,
+    kEphPluto,
+    kEphMoonGeocentric,
+    kEphSun,
+    kEphNutations,
+    kEphLibrations,
+    kEphNumBodies
+};
+
+const static double kJulianDateJ2000 = 2451545.0;
+
+// ---- Binary file layout ----------------------------------------------------
+// [EphemerisFileHeader][padding up to coefficientOffset][numRecords * coefficientsPerRecord doubles]
+// Record i covers [startJD + i * intervalDays, startJD + (i + 1) * intervalDays).
+
+const static char kEphemerisMagic[8] = { 'E', 'P', 'H', 'B', 'I', 'N', '0', '1' };
+
+struct EphemerisBodyLayout {
+    uint32_t offset;         // index of the first coefficient of the body inside a record
+    uint32_t numCoeffs;      // Chebyshev coefficients per component
+    uint32_t numSubintervals; // granules the record interval is split into
+    uint32_t numComponents;  // 3 for positions, 2 for nutations (0 if absent)
+};
+
+struct EphemerisFileHeader {
+    char magic[8];
+    uint32_t numBodies;
+    uint32_t coefficientsPerRecord;
+    uint64_t numRecords;
+    uint64_t coefficientOffset; // byte offset of the first record, 64-byte aligned
+    double startJD;
+    double endJD;
+    double intervalDays;
+    double au;    // km per astronomical unit
+    double emrat; // Earth/Moon mass ratio
+    EphemerisBodyLayout bodies[kEphNumBodies];
+};
+
+// ---- Runtime evaluation -----------------------------------------------------
+
+class Ephemeris {
+public:
+    // Maps a binary file produced by tools/ephemeris_compiler. Returns false on a missing or malformed file.
+    bool open(const std::string& filename) {
+        close();
+        if (!m_file.open(filename)) {
+            return false;
+        }
+        const EphemerisFileHeader* header = m_file.at<EphemerisFileHeader>(0);
+        if (!header || std::memcmp(header->magic, kEphemerisMagic, sizeof(kEphemerisMagic)) != 0 ||
+            header->numBodies != kEphNumBodies || !(header->intervalDays > 0.0) || !(header->endJD >= header->startJD) ||
+            header->numRecords == 0 || header->coefficientsPerRecord == 0 ||
+            header->numRecords > m_file.size() / sizeof(double) / header->coefficientsPerRecord) {
+            close();
+            return false;
+        }
+        // Every granule of a body present stays inside its record
+        for (int b = 0; b < kEphNumBodies; ++b) {
+            const EphemerisBodyLayout& layout = header->bodies[b];
+            if (layout.numComponents == 0) {
+                continue;
+            }
+            if (layout.numSubintervals == 0 ||
+                uint64_t(layout.offset) + uint64_t(layout.numCoeffs) * layout.numComponents * layout.numSubintervals > header->coefficientsPerRecord) {
+                close();
+                return false;
+            }
+        }
+        const double* coeffs = m_file.at<double>(static_cast<size_t>(header->coefficientOffset),
+            static_cast<size_t>(header->numRecords * header->coefficientsPerRecord));
+        if (!coeffs) {
+            close();
+            return false;
+        }
+        m_header = header;
+        m_coeffs = coeffs;
+        return true;
+    }
+
+    void close() {
+        m_file.close();
+        m_header = nullptr;
+        m_coeffs = nullptr;
+        for (int b = 0; b < kEphNumBodies; ++b) {
+            m_cache[b] = SegmentCache();
+        }
+    }
+
+    inline bool isOpen() const { return m_header != nullptr; }
+    inline double getStartJD() const { return m_header->startJD; }
+    inline double getEndJD() const { return m_header->endJD; }
+    inline double getAU() const { return m_header->au; }
+    inline double getEarthMoonRatio() const { return m_header->emrat; }
+    inline bool hasBody(EphemerisBody body) const { return body >= 0 && body < kEphNumBodies && m_header->bodies[body].numComponents >= 3; }
+
+    // Evaluates the raw table entry of a body: solar-system barycentric position in km and velocity
+    // in km/day (geocentric for the Moon). Returns false outside of the covered time span, or for a body
+    // out of the table.
+    bool evaluate(EphemerisBody body, double jd, glm::dvec3& position, glm::dvec3& velocity) {
+        if (body < 0 || body >= kEphNumBodies) {
+            return false;
+        }
+        const SegmentCache* seg = findSegment(body, jd);
+        if (!seg) {
+            return false;
+        }
+        const EphemerisBodyLayout& layout = m_header->bodies[body];
+        const uint32_t n = layout.numCoeffs;
+
+        // Chebyshev polynomials T_k(tc) and their derivatives, both by recurrence
+        double t[kMaxCoeffs];
+        double dt[kMaxCoeffs];
+        const double tc = 2.0 * (jd - seg->start) / seg->span - 1.0;
+        t[0] = 1.0;
+        t[1] = tc;
+        dt[0] = 0.0;
+        dt[1] = 1.0;
+        for (uint32_t k = 2; k < n; ++k) {
+            t[k] = 2.0 * tc * t[k - 1] - t[k - 2];
+            dt[k] = 2.0 * tc * dt[k - 1] + 2.0 * t[k - 1] - dt[k - 2];
+        }
+
+        const double velocityScale = 2.0 / seg->span;
+        for (int c = 0; c < 3; ++c) {
+            const double* coeffs = seg->coeffs + c * n;
+            double p = 0.0;
+            double v = 0.0;
+            for (uint32_t k = 0; k < n; ++k) {
+                p += coeffs[k] * t[k];
+                v += coeffs[k] * dt[k];
+            }
+            position[c] = p;
+            velocity[c] = v * velocityScale;
+        }
+        return true;
+    }
+
+    // Barycentric position/velocity of the Earth and the Moon, derived from the Earth-Moon barycenter.
+    bool evaluateEarthMoon(double jd, glm::dvec3& earthPos, glm::dvec3& earthVel, glm::dvec3& moonPos, glm::dvec3& moonVel) {
+        glm::dvec3 embPos, embVel, moonGeoPos, moonGeoVel;
+        if (!evaluate(kEphEarthMoonBarycenter, jd, embPos, embVel) || !evaluate(kEphMoonGeocentric, jd, moonGeoPos, moonGeoVel)) {
+            return false;
+        }
+        const double moonFraction = 1.0 / (1.0 + m_header->emrat);
+        earthPos = embPos - moonGeoPos * moonFraction;
+        earthVel = embVel - moonGeoVel * moonFraction;
+        moonPos = earthPos + moonGeoPos;
+        moonVel = earthVel + moonGeoVel;
+        return true;
+    }
+
+    // Barycentric state of a body itself: kEphEarthMoonBarycenter stands for the Earth and kEphMoonGeocentric
+    // for the Moon, both resolved from the barycenter; the other entries are returned as they are.
+    bool evaluateBody(EphemerisBody body, double jd, glm::dvec3& position, glm::dvec3& velocity) {
+        if (body != kEphEarthMoonBarycenter && body != kEphMoonGeocentric) {
+            return evaluate(body, jd, position, velocity);
+        }
+        glm::dvec3 earthPos, earthVel, moonPos, moonVel;
+        if (!evaluateEarthMoon(jd, earthPos, earthVel, moonPos, moonVel)) {
+            return false;
+        }
+        position = (body == kEphEarthMoonBarycenter) ? earthPos : moonPos;
+        velocity = (body == kEphEarthMoonBarycenter) ? earthVel : moonVel;
+        return true;
+    }
+
+private:
+    const static uint32_t kMaxCoeffs = 32;
+
+    // Last granule looked up for a body; successive epochs almost always fall in the same one.
+    struct SegmentCache {
+        uint64_t record = 0;
+        uint32_t sub = 0;
+        double start = 0.0;
+        double span = -1.0;
+        const double* coeffs = nullptr;
+    };
+
+    // The granule is found from jd alone, the cache only skipping its setup: an epoch on the boundary of two
+    // granules gets the same coefficients whatever was looked up before, as bit-exact replays require.
+    const SegmentCache* findSegment(EphemerisBody body, double jd) {
+        const EphemerisBodyLayout& layout = m_header->bodies[body];
+        if (layout.numComponents < 3 || layout.numCoeffs < 2 || layout.numCoeffs > kMaxCoeffs ||
+            !(jd >= m_header->startJD && jd <= m_header->endJD)) { // NaN too
+            return nullptr;
+        }
+
+        uint64_t record = static_cast<uint64_t>((jd - m_header->startJD) / m_header->intervalDays);
+        if (record >= m_header->numRecords) {
+            record = m_header->numRecords - 1; // jd == endJD belongs to the last record
+        }
+        const double recordStart = m_header->startJD + record * m_header->intervalDays;
+        const double span = m_header->intervalDays / layout.numSubintervals;
+        uint32_t sub = static_cast<uint32_t>(std::max((jd - recordStart) / span, 0.0)); // recordStart may round past jd
+        if (sub >= layout.numSubintervals) {
+            sub = layout.numSubintervals - 1;
+        }
+
+        SegmentCache& cache = m_cache[body];
+        if (cache.coeffs && cache.record == record && cache.sub == sub) {
+            return &cache;
+        }
+        cache.record = record;
+        cache.sub = sub;
+        cache.start = recordStart + sub * span;
+        cache.span = span;
+        cache.coeffs = m_coeffs + record * m_header->coefficientsPerRecord + layout.offset + sub * layout.numCoeffs * layout.numComponents;
+        return &cache;
+    }
+
+    MappedFile m_file;
+    const EphemerisFileHeader* m_header = nullptr;
+    const double* m_coeffs = nullptr;
+    SegmentCache m_cache[kEphNumBodies];
+};
+
+#endif // EPHEMERIS_H
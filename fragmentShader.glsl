@@ -7,15 +7,45 @@ in vec2 UV;
 // Values that stay constant for the whole mesh.
 uniform sampler2D myTextureSampler;
 
+// Virtual texture, sampled through the indirection instead (see virtual_texture.h)
+uniform int virtualTexture;      // 1 if the mesh has one
+uniform usampler2D vtIndirection; // per tile of each level: slot (xy), level of the tile in the slot (z), resident (w)
+uniform sampler2D vtCache;        // the slots, kTilePadded texels wide
+uniform vec4 vtSize;              // texels (xy) and tiles (zw) of level 0
+uniform int vtLevels;
+uniform float vtSlotsPerSide;
+
+const float kTileSize = 128.0;
+const float kTileBorder = 4.0;
+const float kTilePadded = kTileSize + 2.0 * kTileBorder;
+
 in vec3 fPos;
 in vec3 fNormal;
 in vec3 lightDirection;
 in vec3 LightDirection_cameraspace;
 in vec3 light;
 
+vec3 sampleVirtualTexture(vec2 uv) {
+    vec2 texel = uv * vtSize.xy;
+    vec2 dx = dFdx(texel), dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+    int level = int(clamp(floor(lod), 0.0, float(vtLevels - 1)));
+    uv = clamp(uv, 0.0, 1.0);
+    ivec2 tiles = max(ivec2(vtSize.zw) >> level, ivec2(1));
+    uvec4 entry = texelFetch(vtIndirection, min(ivec2(uv * vec2(tiles)), tiles - 1), level);
+    if (entry.w == 0u) {
+        return vec3(0.5); // nothing resident yet
+    }
+    // The tile in the slot may be an ancestor: position in it at its own level
+    vec2 residentTiles = vec2(max(ivec2(vtSize.zw) >> int(entry.z), ivec2(1)));
+    vec2 position = uv * residentTiles;
+    vec2 inTile = position - min(floor(position), residentTiles - 1.0);
+    vec2 cacheTexel = vec2(entry.xy) * kTilePadded + kTileBorder + inTile * kTileSize;
+    return textureLod(vtCache, cacheTexel / (vtSlotsPerSide * kTilePadded), 0.0).rgb;
+}
 
 void main() {
-vec3 texColor = texture(myTextureSampler, UV).rgb; // sample the texture color
+vec3 texColor = virtualTexture != 0 ? sampleVirtualTexture(UV) : texture(myTextureSampler, UV).rgb; // sample the texture color
 vec3 result = light * texColor;
 color = vec4(result, 1.0);
 
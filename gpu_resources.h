@@ -0,0 +1,229 @@
+// ----------------------------------------------------------------------------
+// gpu_resources.h
+//
+// Description: Owning handles of OpenGL objects (buffers, vertex arrays,
+//              textures, framebuffers, programs), movable but not copyable:
+//              the object is deleted with its last owner, or explicitly with
+//              reset() while the context is alive. Each handle is accounted,
+//              with the bytes of storage it was given, in a category of the
+//              process-wide GpuResourceManager, which reports totals and, at
+//              shutdown, the objects still alive.
+//
+//              Handles must be created and reset on the thread of the context.
+// ----------------------------------------------------------------------------
+
+#ifndef GPU_RESOURCES_H
+#define GPU_RESOURCES_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+enum GpuCategory {
+    kGpuMeshes = 0,
+    kGpuTextures,
+    kGpuStars,     // star field and star octree
+    kGpuImpostors,
+    kGpuTrails,
+    kGpuPicking,
+    kGpuPrograms,
+    kGpuNumCategories
+};
+
+class GpuResourceManager {
+public:
+    inline void add(const GpuCategory category) { ++m_counts[category]; }
+    inline void remove(const GpuCategory category) { --m_counts[category]; }
+
+    void resize(const GpuCategory category, const size_t oldBytes, const size_t newBytes) {
+        m_bytes[category] += newBytes;
+        m_bytes[category] -= oldBytes;
+        m_totalBytes += newBytes;
+        m_totalBytes -= oldBytes;
+        if (m_totalBytes > m_peakBytes) {
+            m_peakBytes = m_totalBytes;
+        }
+    }
+
+    inline uint64_t getCount(const GpuCategory category) const { return m_counts[category]; }
+    inline uint64_t getBytes(const GpuCategory category) const { return m_bytes[category]; }
+    inline uint64_t getTotalBytes() const { return m_totalBytes; }
+    inline uint64_t getPeakBytes() const { return m_peakBytes; }
+
+    inline static const char* getName(const GpuCategory category) {
+        static const char* names[kGpuNumCategories] = { "meshes", "textures", "stars", "impostors", "trails", "picking", "programs" };
+        return names[category];
+    }
+
+    // One line per category holding objects, then the total.
+    void report(std::ostream& out) const {
+        for (int c = 0; c < kGpuNumCategories; ++c) {
+            if (m_counts[c] > 0) {
+                out << "  " << getName(static_cast<GpuCategory>(c)) << ": " << m_counts[c] << " objects, " << formatMiB(m_bytes[c]) << " MiB" << std::endl;
+            }
+        }
+        out << "  total: " << formatMiB(m_totalBytes) << " MiB (peak " << formatMiB(m_peakBytes) << " MiB)" << std::endl;
+    }
+
+    // At shutdown, once everything was released: reports the categories still holding objects. Returns whether
+    // there were any.
+    bool reportLeaks(std::ostream& out) const {
+        bool leaks = false;
+        for (int c = 0; c < kGpuNumCategories; ++c) {
+            if (m_counts[c] > 0) {
+                out << "WARNING: leaked " << m_counts[c] << " GPU objects (" << m_bytes[c] << " bytes) of "
+                    << getName(static_cast<GpuCategory>(c)) << std::endl;
+                leaks = true;
+            }
+        }
+        return leaks;
+    }
+
+private:
+    inline static double formatMiB(const uint64_t bytes) { return static_cast<double>(bytes) / (1024.0 * 1024.0); }
+
+    uint64_t m_counts[kGpuNumCategories] = {};
+    uint64_t m_bytes[kGpuNumCategories] = {};
+    uint64_t m_totalBytes = 0;
+    uint64_t m_peakBytes = 0;
+};
+
+inline GpuResourceManager& getGpuResources() {
+    static GpuResourceManager manager;
+    return manager;
+}
+
+// Base of the handles: one object of one kind, and the bytes accounted for it.
+class GpuObject {
+public:
+    GpuObject() {}
+    ~GpuObject() { reset(); }
+
+    GpuObject(GpuObject&& other) noexcept { take(other); }
+    GpuObject& operator=(GpuObject&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    inline GLuint get() const { return m_id; }
+    inline size_t getBytes() const { return m_bytes; }
+
+    // Accounts the storage of the object, for the ones whose size is not known to their handle.
+    void setBytes(const size_t bytes) {
+        if (m_id) {
+            getGpuResources().resize(m_category, m_bytes, bytes);
+            m_bytes = bytes;
+        }
+    }
+
+    void reset() {
+        if (!m_id) {
+            return;
+        }
+        switch (m_kind) {
+        case kBuffer: glDeleteBuffers(1, &m_id); break;
+        case kVertexArray: glDeleteVertexArrays(1, &m_id); break;
+        case kTexture: glDeleteTextures(1, &m_id); break;
+        case kFramebuffer: glDeleteFramebuffers(1, &m_id); break;
+        case kRenderbuffer: glDeleteRenderbuffers(1, &m_id); break;
+        case kProgram: glDeleteProgram(m_id); break;
+        }
+        setBytes(0);
+        getGpuResources().remove(m_category);
+        m_id = 0;
+    }
+
+protected:
+    enum Kind { kBuffer, kVertexArray, kTexture, kFramebuffer, kRenderbuffer, kProgram };
+
+    void adopt(const Kind kind, const GLuint id, const GpuCategory category) {
+        reset();
+        m_kind = kind;
+        m_id = id;
+        m_category = category;
+        getGpuResources().add(category);
+    }
+
+private:
+    GpuObject(const GpuObject&);
+    GpuObject& operator=(const GpuObject&);
+
+    void take(GpuObject& other) {
+        m_kind = other.m_kind;
+        m_id = other.m_id;
+        m_category = other.m_category;
+        m_bytes = other.m_bytes;
+        other.m_id = 0;
+        other.m_bytes = 0;
+    }
+
+    Kind m_kind = kBuffer;
+    GLuint m_id = 0;
+    GpuCategory m_category = kGpuMeshes;
+    size_t m_bytes = 0;
+};
+
+class GpuBuffer : public GpuObject {
+public:
+    void create(const GpuCategory category) {
+        GLuint id;
+        glGenBuffers(1, &id);
+        adopt(kBuffer, id, category);
+    }
+
+    // Binds the buffer to the target and (re)allocates its storage, accounted.
+    void setData(const GLenum target, const size_t bytes, const void* data, const GLenum usage) {
+        glBindBuffer(target, get());
+        glBufferData(target, bytes, data, usage);
+        setBytes(bytes);
+    }
+};
+
+class GpuVertexArray : public GpuObject {
+public:
+    void create(const GpuCategory category) {
+        GLuint id;
+        glGenVertexArrays(1, &id);
+        adopt(kVertexArray, id, category);
+    }
+};
+
+// Storage is accounted by the uploader with setBytes: only it knows the levels and the format.
+class GpuTexture : public GpuObject {
+public:
+    void create(const GpuCategory category) {
+        GLuint id;
+        glGenTextures(1, &id);
+        adopt(kTexture, id, category);
+    }
+};
+
+class GpuFramebuffer : public GpuObject {
+public:
+    void create(const GpuCategory category) {
+        GLuint id;
+        glGenFramebuffers(1, &id);
+        adopt(kFramebuffer, id, category);
+    }
+};
+
+class GpuRenderbuffer : public GpuObject {
+public:
+    void create(const GpuCategory category) {
+        GLuint id;
+        glGenRenderbuffers(1, &id);
+        adopt(kRenderbuffer, id, category);
+    }
+};
+
+class GpuProgram : public GpuObject {
+public:
+    void create() { adopt(kProgram, glCreateProgram(), kGpuPrograms); }
+};
+
+#endif // GPU_RESOURCES_H
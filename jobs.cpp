@@ -0,0 +1,36 @@
+// ----------------------------------------------------------------------------
+// jobs.cpp
+//
+// Description: Platform specific part of JobSystem (the priority of the
+//              workers of a background system). Kept out of the header so
+//              that <windows.h> does not leak into the OpenGL translation unit.
+// ----------------------------------------------------------------------------
+
+#include "jobs.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifdef _WIN32
+
+void lowerCurrentThreadPriority() { SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL); }
+
+#elif defined(__APPLE__)
+
+void lowerCurrentThreadPriority() { pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0); }
+
+#else
+
+const static int kJobLowPriorityNice = 10; // of the background workers, 0 being the default
+
+// Linux keeps a niceness per thread: with 0, setpriority only changes the calling one.
+void lowerCurrentThreadPriority() { setpriority(PRIO_PROCESS, 0, kJobLowPriorityNice); }
+
+#endif
@@ -0,0 +1,276 @@
+// ----------------------------------------------------------------------------
+// jobs.h
+//
+// Description: Work-stealing job system for the per-frame CPU work. Every
+//              worker thread owns a deque of jobs: it pushes and pops at the
+//              back, most recent first while its data is still in cache, and
+//              idle workers steal from the front of the others, oldest first,
+//              which are usually the largest pieces of work left. The threads
+//              that are not workers (the render and simulation ones) share
+//              queue 0; only what must stay on the main thread, like OpenGL
+//              calls, is kept out of jobs.
+//
+//              A job decrements a JobCounter when it finishes. Waiting on a
+//              counter runs the jobs it counts meanwhile, and only those, so
+//              that jobs can submit jobs and wait for them, and a wait of the
+//              render thread never picks up a simulation step; a job can also
+//              be held until a counter gets to zero, which chains dependent
+//              work without blocking a thread. Without workers, jobs run on
+//              the thread that submits them.
+//
+//              Long background work, like the texture loads, goes to a system
+//              of its own whose workers run at a lower priority than the other
+//              threads, so that it never holds up a frame.
+// ----------------------------------------------------------------------------
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Lowers the scheduling priority of the calling thread below the other threads of the process (jobs.cpp).
+void lowerCurrentThreadPriority();
+
+const static size_t kJobChunksPerThread = 4; // ranges of a parallel for, per thread: enough to balance uneven ones
+
+class JobCounter;
+
+struct Job {
+    std::function<void()> work;
+    JobCounter* counter;
+};
+
+// Jobs submitted against the counter and not finished yet. A counter can be reused once waited on.
+class JobCounter {
+public:
+    JobCounter() : m_pending(0) {}
+
+    inline bool isDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+
+    JobCounter(const JobCounter&);
+    JobCounter& operator=(const JobCounter&);
+
+    std::atomic<uint32_t> m_pending;
+    std::mutex m_mutex;       // orders the last decrement with the jobs being held
+    std::vector<Job> m_held;  // submitted once the counter gets to zero
+};
+
+class JobSystem {
+public:
+    ~JobSystem() { stop(); }
+
+    // Starts the worker threads; the callers of wait() run jobs too, so numWorkers is usually one less than
+    // the number of cores. With 0, jobs run on the thread that submits them. With lowPriority, the workers run
+    // below the other threads.
+    void start(const unsigned numWorkers, const bool lowPriority = false) {
+        stop();
+        m_queues.clear();
+        for (unsigned q = 0; q <= numWorkers; ++q) {
+            m_queues.push_back(std::unique_ptr<JobQueue>(new JobQueue()));
+        }
+        m_stopping = false;
+        for (unsigned w = 1; w <= numWorkers; ++w) {
+            m_workers.push_back(std::thread(&JobSystem::workerLoop, this, w, lowPriority));
+        }
+    }
+
+    // Joins the workers. Jobs must all have been waited on.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (size_t w = 0; w < m_workers.size(); ++w) {
+            m_workers[w].join();
+        }
+        m_workers.clear();
+        m_queues.clear();
+    }
+
+    inline unsigned getNumThreads() const { return static_cast<unsigned>(std::max<size_t>(m_queues.size(), 1)); } // workers and callers
+
+    // Submits a job, counted by the counter until it finishes.
+    void run(JobCounter& counter, std::function<void()> work) {
+        counter.m_pending.fetch_add(1);
+        Job job = { std::move(work), &counter };
+        push(std::move(job));
+    }
+
+    // Submits a job that starts once `prerequisite` gets to zero (right away if it is already there).
+    void runAfter(JobCounter& prerequisite, JobCounter& counter, std::function<void()> work) {
+        counter.m_pending.fetch_add(1);
+        Job job = { std::move(work), &counter };
+        {
+            std::lock_guard<std::mutex> lock(prerequisite.m_mutex);
+            if (prerequisite.m_pending.load() > 0) {
+                prerequisite.m_held.push_back(std::move(job));
+                return;
+            }
+        }
+        push(std::move(job));
+    }
+
+    // Runs the jobs of the counter until it gets to zero.
+    void wait(JobCounter& counter) {
+        const unsigned queue = getCurrentQueue();
+        while (!counter.isDone()) {
+            if (!tryRunJob(queue, &counter)) {
+                std::this_thread::yield(); // the last jobs run elsewhere, or are held
+            }
+        }
+        std::lock_guard<std::mutex> lock(counter.m_mutex); // the finishing job is done with the counter too
+    }
+
+    // Calls body(first, last) on consecutive ranges covering [begin, end), of `grain` items at least, in
+    // parallel, and returns once all of them are done. The caller takes a range itself.
+    template <typename Body>
+    void parallelFor(const size_t begin, const size_t end, const size_t grain, const Body& body) {
+        if (end <= begin) {
+            return;
+        }
+        const size_t count = end - begin;
+        const size_t chunks = std::min(m_queues.size() * kJobChunksPerThread, count / std::max<size_t>(grain, 1));
+        if (chunks <= 1) {
+            body(begin, end);
+            return;
+        }
+        JobCounter counter;
+        const size_t size = count / chunks;
+        const size_t remainder = count % chunks;
+        size_t first = begin;
+        for (size_t c = 0; c + 1 < chunks; ++c) {
+            const size_t last = first + size + (c < remainder ? 1 : 0);
+            run(counter, [&body, first, last]() { body(first, last); });
+            first = last;
+        }
+        body(first, end);
+        wait(counter);
+    }
+
+private:
+    struct JobQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    struct JobThread {
+        const JobSystem* system;
+        unsigned queue;
+    };
+
+    inline static JobThread& getCurrentThread() {
+        static thread_local JobThread thread = { nullptr, 0 };
+        return thread;
+    }
+
+    // Queue of the calling thread: its own for a worker, the shared one (0) otherwise.
+    inline unsigned getCurrentQueue() const {
+        const JobThread& thread = getCurrentThread();
+        return thread.system == this ? thread.queue : 0;
+    }
+
+    void push(Job job) {
+        if (m_queues.empty()) {
+            execute(job);
+            return;
+        }
+        m_queued.fetch_add(1);
+        JobQueue& queue = *m_queues[getCurrentQueue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        if (m_sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(m_wakeMutex); // a worker about to sleep sees the job, or is woken
+            m_wake.notify_one();
+        }
+    }
+
+    // Own jobs first, newest first; then the oldest job of another queue. With a counter, only the jobs it
+    // counts. Returns whether one ran.
+    bool tryRunJob(const unsigned self, const JobCounter* counter) {
+        const size_t n = m_queues.size();
+        Job job;
+        bool found = false;
+        for (size_t k = 0; k < n && !found; ++k) {
+            JobQueue& queue = *m_queues[(self + k) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            const size_t size = queue.jobs.size();
+            for (size_t j = 0; j < size && !found; ++j) {
+                const std::deque<Job>::iterator it = queue.jobs.begin() + (k == 0 ? size - 1 - j : j);
+                if (!counter || it->counter == counter) {
+                    job = std::move(*it);
+                    queue.jobs.erase(it);
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            return false;
+        }
+        m_queued.fetch_sub(1);
+        execute(job);
+        return true;
+    }
+
+    // Runs the job, then releases the jobs held on its counter if it was the last one.
+    void execute(Job& job) {
+        job.work();
+        JobCounter& counter = *job.counter;
+        std::vector<Job> released;
+        {
+            std::lock_guard<std::mutex> lock(counter.m_mutex);
+            if (counter.m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                released.swap(counter.m_held);
+            }
+        }
+        for (size_t j = 0; j < released.size(); ++j) {
+            push(std::move(released[j]));
+        }
+    }
+
+    void workerLoop(const unsigned queue, const bool lowPriority) {
+        JobThread& thread = getCurrentThread();
+        thread.system = this;
+        thread.queue = queue;
+        if (lowPriority) {
+            lowerCurrentThreadPriority();
+        }
+        while (true) {
+            if (tryRunJob(queue, nullptr)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_sleeping.fetch_add(1);
+            m_wake.wait(lock, [this]() { return m_stopping || m_queued.load() > 0; });
+            m_sleeping.fetch_sub(1);
+            if (m_stopping) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<JobQueue> > m_queues; // 0: threads that are not workers
+    std::vector<std::thread> m_workers;
+    std::atomic<int> m_queued{0};   // jobs in the queues
+    std::atomic<int> m_sleeping{0}; // workers waiting for jobs
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false; // under m_wakeMutex
+};
+
+#endif // JOBS_H
@@ -0,0 +1,189 @@
+// ----------------------------------------------------------------------------
+// jpeg_bands.h
+//
+// Description: Parallel decoding of large baseline JPEGs with restart
+//              markers. stb_image decodes an image on one thread, with its
+//              IDCT, chroma upsampling and color conversion already on SSE2;
+//              what is left is to use the other cores. A restart marker resets
+//              the state of the entropy decoder, so when the restart interval
+//              is a whole number of rows of MCUs, the image splits into bands
+//              that are valid JPEGs of their own: the headers, with the height
+//              of the band, followed by its intervals. Bands are decoded by
+//              jobs (see jobs.h), each also decoding the interval around it and
+//              dropping its rows, so that the chroma upsampling at its edges
+//              sees the same neighbors as in the whole image: the result is
+//              identical to stbi_load_from_memory.
+//
+//              Encoders write such files with one restart per row of MCUs,
+//              e.g. cjpeg -restart 1; other JPEGs are left to stb_image.
+// ----------------------------------------------------------------------------
+
+#ifndef JPEG_BANDS_H
+#define JPEG_BANDS_H
+
+#include "jobs.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+const static uint32_t kJpegBandMinRows = 256; // image rows per band at least, so that the context rows stay a small part of it
+
+struct JpegRestartLayout {
+    uint32_t width;
+    uint32_t height;
+    uint32_t components;      // 1 (grey) or 3 (YCbCr)
+    size_t heightOffset;      // of the height in the frame header
+    uint32_t intervalRows;    // image rows per restart interval
+    size_t headerSize;        // bytes before the entropy-coded data
+    std::vector<size_t> intervalBegins; // entropy-coded data of each interval, without its restart marker
+    std::vector<size_t> intervalEnds;
+};
+
+inline uint32_t readJpeg16(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) << 8 | p[1];
+}
+
+// Layout of a baseline JPEG of one interleaved scan whose restart intervals are whole rows of MCUs. Returns
+// false for any other (progressive, arithmetic coded, without restarts, several scans, truncated...).
+inline bool parseJpegRestartLayout(const unsigned char* data, const size_t size, JpegRestartLayout& layout) {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+    size_t p = 2;
+    uint32_t restartInterval = 0, maxH = 1, maxV = 1;
+    bool frame = false;
+    for (;;) {
+        if (p + 4 > size || data[p] != 0xFF) {
+            return false;
+        }
+        const unsigned char marker = data[p + 1];
+        if (marker == 0xFF) {
+            ++p; // fill byte
+            continue;
+        }
+        const uint32_t length = readJpeg16(data + p + 2);
+        if (length < 2 || p + 2 + length > size) {
+            return false;
+        }
+        const unsigned char* segment = data + p + 4;
+        if (marker == 0xC0 || marker == 0xC1) {
+            layout.components = length >= 8 ? segment[5] : 0;
+            if (layout.components != 1 && layout.components != 3) {
+                return false;
+            }
+            if (length < 8 + 3 * layout.components) {
+                return false;
+            }
+            layout.heightOffset = p + 5;
+            layout.height = readJpeg16(segment + 1);
+            layout.width = readJpeg16(segment + 3);
+            for (uint32_t c = 0; c < layout.components; ++c) {
+                maxH = std::max<uint32_t>(maxH, segment[7 + 3 * c] >> 4);
+                maxV = std::max<uint32_t>(maxV, segment[7 + 3 * c] & 15);
+            }
+            frame = layout.height > 0 && layout.width > 0; // a height of 0 comes later, in a DNL marker
+        }
+        else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            return false; // progressive, lossless or arithmetic coded
+        }
+        else if (marker == 0xDD && length >= 4) {
+            restartInterval = readJpeg16(segment);
+        }
+        else if (marker == 0xDA) {
+            if (!frame || segment[0] != layout.components) {
+                return false; // not interleaved: one scan per component
+            }
+            p += 2 + length;
+            break;
+        }
+        p += 2 + length;
+    }
+    if (layout.components == 1) {
+        maxH = maxV = 1; // a single component has one block per MCU whatever its sampling
+    }
+    const uint32_t mcusPerRow = (layout.width + 8 * maxH - 1) / (8 * maxH);
+    const uint32_t mcuRows = (layout.height + 8 * maxV - 1) / (8 * maxV);
+    if (restartInterval == 0 || restartInterval % mcusPerRow != 0) {
+        return false;
+    }
+    layout.intervalRows = restartInterval / mcusPerRow * 8 * maxV;
+    layout.headerSize = p;
+
+    // Intervals end at a restart marker, the last one at the end of the image; 0xFF00 is a stuffed 0xFF
+    layout.intervalBegins.clear();
+    layout.intervalEnds.clear();
+    size_t begin = p;
+    for (; p + 1 < size; ++p) {
+        if (data[p] != 0xFF || data[p + 1] == 0x00 || data[p + 1] == 0xFF) {
+            continue;
+        }
+        layout.intervalBegins.push_back(begin);
+        layout.intervalEnds.push_back(p);
+        if (data[p + 1] < 0xD0 || data[p + 1] > 0xD7) {
+            break;
+        }
+        begin = p + 2;
+        ++p;
+    }
+    const uint32_t numIntervals = (mcuRows + restartInterval / mcusPerRow - 1) / (restartInterval / mcusPerRow);
+    return p + 1 < size && data[p + 1] == 0xD9 && layout.intervalBegins.size() == numIntervals;
+}
+
+// Decodes a JPEG as stbi_load_from_memory does with 0 requested components, in bands decoded by the jobs.
+// Returns null, leaving the image to stb_image, when it has no such layout, is too small to be worth it,
+// or a band fails. The pixels are freed with stbi_image_free.
+inline unsigned char* decodeJpegBands(const unsigned char* data, const size_t size, int* width, int* height, int* components,
+                                      JobSystem& jobs) {
+    JpegRestartLayout layout;
+    if (!parseJpegRestartLayout(data, size, layout) || layout.height < 2 * kJpegBandMinRows) {
+        return nullptr;
+    }
+    const size_t rowBytes = size_t(layout.width) * layout.components;
+    // STBI_FREE is free, unless overridden, which this project does not
+    unsigned char* pixels = static_cast<unsigned char*>(std::malloc(rowBytes * layout.height));
+    if (!pixels) {
+        return nullptr;
+    }
+    const size_t numIntervals = layout.intervalBegins.size();
+    const size_t grain = std::max<size_t>((kJpegBandMinRows + layout.intervalRows - 1) / layout.intervalRows, 1);
+    std::atomic<bool> failed(false);
+    jobs.parallelFor(0, numIntervals, grain, [&](const size_t first, const size_t last) {
+        // The band, and one interval of context on each side
+        const size_t contextFirst = first > 0 ? first - 1 : 0;
+        const size_t contextLast = std::min(last + 1, numIntervals);
+        const uint32_t top = static_cast<uint32_t>(contextFirst * layout.intervalRows);
+        const uint32_t bottom = static_cast<uint32_t>(std::min<size_t>(contextLast * layout.intervalRows, layout.height));
+        std::vector<unsigned char> band(data, data + layout.headerSize);
+        band[layout.heightOffset] = static_cast<unsigned char>((bottom - top) >> 8);
+        band[layout.heightOffset + 1] = static_cast<unsigned char>((bottom - top) & 0xFF);
+        band.insert(band.end(), data + layout.intervalBegins[contextFirst], data + layout.intervalEnds[contextLast - 1]);
+        band.push_back(0xFF);
+        band.push_back(0xD9);
+        int w, h, c;
+        unsigned char* decoded = stbi_load_from_memory(band.data(), static_cast<int>(band.size()), &w, &h, &c, 0);
+        if (!decoded || w != static_cast<int>(layout.width) || h != static_cast<int>(bottom - top) || c != static_cast<int>(layout.components)) {
+            stbi_image_free(decoded);
+            failed.store(true, std::memory_order_relaxed);
+            return;
+        }
+        const size_t firstRow = first * layout.intervalRows;
+        const size_t lastRow = std::min<size_t>(last * layout.intervalRows, layout.height);
+        std::memcpy(pixels + firstRow * rowBytes, decoded + (firstRow - top) * rowBytes, (lastRow - firstRow) * rowBytes);
+        stbi_image_free(decoded);
+    });
+    if (failed.load()) {
+        std::free(pixels);
+        return nullptr;
+    }
+    *width = static_cast<int>(layout.width);
+    *height = static_cast<int>(layout.height);
+    *components = static_cast<int>(layout.components);
+    return pixels;
+}
+
+#endif // JPEG_BANDS_H
@@ -34,24 +34,82 @@
 #include <sstream>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-
-// constants
-const static float kSizeSun = 1;
-const static float kSizeEarth = 0.5;
-const static float kSizeMoon = 0.25;
-const static float kRadOrbitEarth = 10;
-const static float kRadOrbitMoon = 2;
+#undef STB_IMAGE_IMPLEMENTATION // compiled once, here: the headers that include it only need the declarations
+
+#include "asset_pack.h"
+#include "culling.h"
+#include "entities.h"
+#include "ephemeris.h"
+#include "gpu_resources.h"
+#include "jobs.h"
+#include "picking.h"
+#include "point_octree.h"
+#include "points.h"
+#include "recorder.h"
+#include "scene.h"
+#include "simulation.h"
+#include "sphere.h"
+#include "starfield.h"
+#include "textures.h"
+#include "trails.h"
+#include "triple_buffer.h"
+#include "virtual_texture.h"
+#include "world.h"
+
+// Scene (see scene.h; authored in media/scenes/*.json and compiled by tools/scene_compiler.cpp)
+const static char* kDefaultSceneFilename = "media/scenes/solar_system.scene";
+const static char* kDefaultAssetPackFilename = "media/assets.pack"; // built by tools/asset_packer.cpp
+const static char* kDefaultStarCatalogFilename = "media/stars.bin"; // built by tools/star_compiler.cpp
+const static double kSceneUnitsPerParsec = 3.0856775814913673e13; // km, the unit of the ephemeris
+const static uint32_t kPinnedSource = kEphNumBodies; // trajectory source id never evaluated: the body stays in place
+
+// Simulation: a fixed number of macro steps per second, so that runs are reproducible and can be
+// recorded/replayed (see recorder.h). Time warp scales the size of the macro steps, and the adaptive
+// integrator subdivides them per body as the dynamics require. The simulation runs on its own thread and
+// hands its state to the renderer through a triple buffer of snapshots, so each runs at its own rate.
+const static double kSimulationStepsPerSecond = 240.0;
+const static int kMaxStepsPerBatch = 64; // beyond this, simulated time is dropped instead of spiraling
+const static double kTimeWarpFactor = 10.0; // per key press
+const static double kMaxTimeWarp = 1.0e6;
+const static double kSimulationTolerance = 1e-9;
+const static double kSimulationBudgetPerBatch = 0.05; // seconds given to a batch of steps before publishing it
+
+// Orbit trails: one sample per body every few macro steps, kept on the GPU (see trails.h)
+const static uint32_t kMaxTrails = 512;
+const static uint32_t kTrailSamples = 2048;
+const static uint64_t kTrailSampleInterval = 2; // macro steps between two samples
+
+// Bodies projecting to fewer pixels (diameter) are drawn as points instead of meshes (see points.h)
+const static float kImpostorPixelSize = 2.0f;
+
+// Picking: bodies within a few pixels of the cursor are hit, so that the ones drawn as points can be picked
+const static double kPickTolerancePixels = 3.0;
+const static size_t kMaxPickCandidates = 64; // drawn into the pick buffer, nearest first
+
+// Systems of a group run as parallel jobs past this number of entities; below, jobs cost more than they save
+const static uint32_t kParallelSystemsEntities = 4096;
+const static size_t kRenderJobGrain = 256; // entities per job of the render queue build
+
+// Virtual textures (see virtual_texture.h): each one streams into a cache of this many tiles squared
+const static uint32_t kVirtualTextureSlotsPerSide = 32; // 1024 tiles, 9.5 MB in BC1
+const static GLint kVirtualIndirectionUnit = 1;
+const static GLint kVirtualCacheUnit = 2;
 
 // Window parameters
 GLFWwindow* g_window = nullptr;
 
 // GPU objects
-GLuint g_program = 0; // A GPU program contains at least a vertex shader and a fragment shader
+GpuProgram g_program; // A GPU program contains at least a vertex shader and a fragment shader
 
 // OpenGL identifiers
 GLuint g_vao = 0;
@@ -73,10 +131,106 @@ glm::mat4 projMatrix;
 glm::mat4 M;
 
 void loadShader(GLuint program, GLenum type, const std::string& shaderFilename);
-GLuint loadTextureFromFileToGPU(const std::string& filename);
-GLuint g_earthTexID = 0;
-GLuint g_sunTexID = 0;
-GLuint g_moonTexID = 0;
+GpuTexture createColorTexture(const glm::vec3& color);
+
+AssetPack g_assets; // textures, shaders and meshes, preferred to their source files when present
+Ephemeris g_ephemeris;
+
+// Drives bodies from the ephemeris; source ids are EphemerisBody values (see Ephemeris::evaluateBody). Simulation
+// time is in days since the start epoch, wrapped over the span of the file; the ecliptic plane (x, y) is mapped
+// onto the scene plane (x, -z).
+class EphemerisTrajectories : public TrajectorySource {
+public:
+    EphemerisTrajectories(Ephemeris& ephemeris, double startJD) : m_ephemeris(ephemeris), m_startJD(startJD) {}
+
+    inline void setStartJD(const double jd) { m_startJD = jd; }
+
+    bool evaluate(uint32_t sourceId, double time, glm::dvec3& position, glm::dvec3& velocity) override {
+        if (!m_ephemeris.isOpen() || sourceId >= kEphNumBodies) {
+            return false;
+        }
+        const double span = m_ephemeris.getEndJD() - m_startJD;
+        if (!(span > 0.0)) {
+            return false; // nothing to wrap over
+        }
+        const double jd = m_startJD + std::fmod(time, span);
+        glm::dvec3 p, v;
+        if (!m_ephemeris.evaluateBody(static_cast<EphemerisBody>(sourceId), jd, p, v)) {
+            return false;
+        }
+        position = glm::dvec3(p.x, p.z, -p.y);
+        velocity = glm::dvec3(v.x, v.z, -v.y);
+        return true;
+    }
+
+private:
+    Ephemeris& m_ephemeris;
+    double m_startJD;
+};
+
+JobSystem g_jobs; // per-frame CPU work: simulation, transforms, culling, render queue (see jobs.h)
+JobSystem g_loadJobs; // texture loads, below the per-frame work
+Simulation g_simulation;
+SimulationRecorder g_recorder;
+SimulationReplay g_replay;
+bool g_replaying = false;
+double g_simulationTimeScale = 1.0; // simulated time units per second, without time warp
+double g_simulationStep = 1.0 / kSimulationStepsPerSecond; // macro step size without time warp
+double g_simulationLag = 0.0; // real time not yet simulated, in seconds
+double g_lastUpdateTime = 0.0;
+
+// Events of the simulation for the renderer, numbered in order of occurrence: each snapshot carries the ones
+// from the last snapshot known to be picked up, so that none is lost when the renderer skips snapshots, and
+// the renderer skips the ones it already applied.
+template <typename T>
+struct SnapshotEvents {
+    uint64_t first = 0; // number of the first event held
+    size_t stride = 1;  // values per event
+    std::vector<T> values;
+
+    inline uint64_t end() const { return first + values.size() / stride; }
+    void trim(const uint64_t newFirst) {
+        if (newFirst > first) {
+            values.erase(values.begin(), values.begin() + static_cast<std::ptrdiff_t>((newFirst - first) * stride));
+            first = newFirst;
+        }
+    }
+};
+
+// State of the simulation after a batch of steps, immutable once published.
+struct SimulationSnapshot {
+    uint64_t stepCount = 0;
+    double time = 0.0;
+    std::vector<glm::dvec3> positions;
+    std::vector<double> radii;
+    std::vector<uint8_t> absorbed;
+    SnapshotEvents<glm::dvec3> trailSamples; // positions of every body per sample
+    SnapshotEvents<glm::ivec3> viewInputs;   // replayed (key, action, mods)
+};
+
+// Once the simulation thread runs, it alone touches g_simulation, g_recorder and g_replay; the renderer
+// only sees the snapshots, and sends the live inputs through g_simulationInputs.
+TripleBuffer<SimulationSnapshot> g_snapshots;
+std::thread g_simulationThread;
+std::atomic<bool> g_simulationRunning(false);
+std::mutex g_simulationInputsMutex;
+std::vector<glm::ivec3> g_simulationInputs; // (key, action, mods) not yet recorded and applied
+SnapshotEvents<glm::dvec3> g_trailEvents;     // simulation thread: not known to be picked up yet
+SnapshotEvents<glm::ivec3> g_viewInputEvents;
+uint64_t g_appliedTrailSamples = 0;           // render thread: events applied
+uint64_t g_appliedViewInputs = 0;
+Scene g_scene;
+EntityRegistry g_entities; // bodies, and anything else drawn or simulated (see entities.h)
+TextureLoader g_textures; // one per texture of the scene, requested at process start
+std::vector<uint32_t> g_sceneTextureSlots; // per texture of the scene: slot in g_textures
+std::vector<uint32_t> g_sceneVirtualTextures; // per texture of the scene: index in g_virtualTextures, or RenderPool::kNoVirtualTexture
+std::vector<std::unique_ptr<VirtualTexture> > g_virtualTextures; // scene textures tiled for streaming, too large to load whole
+std::vector<GpuTexture> g_colorTextures; // flat colors, for the bodies without a texture
+TrailRenderer g_trails;
+bool g_trailsVisible = true;
+bool g_pickPending = false; // a click not yet serviced by the renderer
+glm::dvec2 g_pickCursor(0.0); // in framebuffer pixels, from the top left
+bool g_exactPicking = false;  // through the pick buffer rather than the bounding spheres only
 
 // Basic camera model
 class Camera {
@@ -89,11 +243,15 @@ public:
     inline void setNear(const float n) { m_near = n; }
     inline float getFar() const { return m_far; }
     inline void setFar(const float n) { m_far = n; }
-    inline void setPosition(const glm::vec3& p) { m_pos = p; }
-    inline glm::vec3 getPosition() { return m_pos; }
+    inline void setPosition(const glm::dvec3& p) { m_pos = p; }
+    inline glm::dvec3 getPosition() const { return m_pos; }
+    inline void setTarget(const glm::dvec3& t) { m_target = t; }
+    inline glm::dvec3 getTarget() const { return m_target; }
 
+    // Rotation-only view matrix: the camera is the origin of the render space, world positions are
+    // rebased on it in double precision before being handed to the GPU (see world.h).
     inline glm::mat4 computeViewMatrix() const {
-        return glm::lookAt(m_pos, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+        return glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(glm::normalize(m_target - m_pos)), glm::vec3(0, 1, 0));
     }
 
     // Returns the projection matrix stemming from the camera intrinsic parameter.
@@ -103,7 +261,8 @@ public:
     }
 
 private:
-    glm::vec3 m_pos = glm::vec3(0, 0, 0);
+    glm::dvec3 m_pos = glm::dvec3(0, 0, 0);
+    glm::dvec3 m_target = glm::dvec3(0, 0, 0);
     float m_fov = 45.f;        // Field of view, in degrees
     float m_aspectRatio = 1.f; // Ratio between the width and the height of the image
     float m_near = 0.1f; // Distance before which geometry is excluded from the rasterization process
@@ -117,7 +276,7 @@ void initGPUprogram();
 class Mesh {
 public:
     GLuint g_earthTexID = 0;
-    GLuint m_texCoordVbo = 0;
+    GpuBuffer m_texCoordVbo;
     std::vector<unsigned int> indices;
     void init(float radius) {
 
@@ -127,113 +286,56 @@ public:
         //this->initGPUprogram();
     } // should properly set up the geometry buffer
 
+    // Uploads a mesh baked by tools/asset_packer straight from the mapping of the pack.
+    void init(const PackedMesh* mesh) {
+        this->initGPUgeometry(AssetPack::getArray<float>(mesh, mesh->positionsOffset), AssetPack::getArray<float>(mesh, mesh->normalsOffset),
+                              AssetPack::getArray<float>(mesh, mesh->texCoordsOffset), mesh->numVertices,
+                              AssetPack::getArray<unsigned int>(mesh, mesh->indicesOffset), mesh->numIndices);
+    }
+
     void initGPUgeometry() {
+        this->initGPUgeometry(this->m_vertexPositions.data(), this->m_vertexNormals.data(), this->m_vertexTexCoords.data(),
+                              this->m_vertexPositions.size() / 3, this->indices.data(), this->indices.size());
+    }
+
+    void initGPUgeometry(const float* positions, const float* normals, const float* texCoords, size_t numVertices,
+                         const unsigned int* triangleIndices, size_t numIndices) {
+        this->m_numIndices = numIndices;
         // Create a single handle, vertex array object that contains attributes,
         // vertex buffer objects (e.g., vertex's position, normal, and color)
-#ifdef _MY_OPENGL_IS_33_
-        glGenVertexArrays(1, &this->m_vao); // If your system doesn't support OpenGL 4.5, you should use this instead of glCreateVertexArrays.
-#else
-        glCreateVertexArrays(1, &this->m_vao);
-#endif
-        glBindVertexArray(this->m_vao);
+        this->m_vao.create(kGpuMeshes);
+        glBindVertexArray(this->m_vao.get());
 
         // Generate a GPU buffer to store the positions of the vertices
-        size_t vertexBufferSize = sizeof(float) * this->m_vertexPositions.size(); // Gather the size of the buffer from the CPU-side vector
-#ifdef _MY_OPENGL_IS_33_
-        glGenBuffers(1, &this->m_posVbo);
-        glBindBuffer(GL_ARRAY_BUFFER, this->m_posVbo);
-        glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, this->m_vertexPositions.data(), GL_DYNAMIC_READ);
+        size_t vertexBufferSize = sizeof(float) * 3 * numVertices; // Gather the size of the buffer from the CPU-side vector
+        this->m_posVbo.create(kGpuMeshes);
+        this->m_posVbo.setData(GL_ARRAY_BUFFER, vertexBufferSize, positions, GL_DYNAMIC_READ);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
         glEnableVertexAttribArray(0);
 
         // Normals
-        glGenBuffers(1, &this->m_normalVbo);
-        glBindBuffer(GL_ARRAY_BUFFER, this->m_normalVbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * this->m_vertexNormals.size(), this->m_vertexNormals.data(), GL_DYNAMIC_READ);
+        this->m_normalVbo.create(kGpuMeshes);
+        this->m_normalVbo.setData(GL_ARRAY_BUFFER, sizeof(float) * 3 * numVertices, normals, GL_DYNAMIC_READ);
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
         glEnableVertexAttribArray(1);
 
         // UV map
-        glGenBuffers(1, &this->m_texCoordVbo);
-        glBindBuffer(GL_ARRAY_BUFFER, this->m_texCoordVbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * this->m_vertexTexCoords.size(), this->m_vertexTexCoords.data(), GL_STATIC_DRAW);
+        this->m_texCoordVbo.create(kGpuMeshes);
+        this->m_texCoordVbo.setData(GL_ARRAY_BUFFER, sizeof(float) * 2 * numVertices, texCoords, GL_STATIC_DRAW);
         glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
         glEnableVertexAttribArray(2);
 
-#else
-        glCreateBuffers(1, &this->m_posVbo);
-        glBindBuffer(GL_ARRAY_BUFFER, this->m_posVbo);
-        glNamedBufferStorage(this->m_posVbo, vertexBufferSize, this->m_vertexPositions.data(), GL_DYNAMIC_STORAGE_BIT); // Create a data storage on the GPU and fill it from a CPU array
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
-        glEnableVertexAttribArray(0);
-#endif
-
         // Same for an index buffer object that stores the list of indices of the
         // triangles forming the mesh
-        size_t indexBufferSize = sizeof(unsigned int) * this->indices.size();
-#ifdef _MY_OPENGL_IS_33_
-        glGenBuffers(1, &this->m_ibo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->m_ibo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, this->indices.data(), GL_DYNAMIC_READ);
-#else
-        glCreateBuffers(1, &g_ibo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ibo);
-        glNamedBufferStorage(g_ibo, indexBufferSize, this->indices.data(), GL_DYNAMIC_STORAGE_BIT);
-#endif
+        size_t indexBufferSize = sizeof(unsigned int) * numIndices;
+        this->m_ibo.create(kGpuMeshes);
+        this->m_ibo.setData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, triangleIndices, GL_DYNAMIC_READ);
 
         glBindVertexArray(0); // deactivate the VAO for now, will be activated again when rendering
     }
 
-    std::shared_ptr<Mesh> genSphere(const float radius, const size_t resolution = 24, int texFlag = 1) {
-
-        // phiValues that range from 0 up to 360
-        // tetaValues that range from 0 up to 180
-        float step = 2 * PI / (resolution - 1);
-        float x = 0;
-        float y = 0;
-        float z = 0;
-        unsigned int vertexCounter = 0;
-        float textureCoefficient = 1.0f / (resolution - 1);
-        for (int i = 0; i < resolution; i++) {
-            float phi = PI - (i * step);
-
-            for (int j = 0; j < resolution; j++) {
-
-                float theta = PI - (j * step / 2);
-                x = (radius * sin(theta) * cos(phi));
-                z = radius * sin(phi) * sin(theta);
-                y = radius * cos(theta);
-                this->m_vertexNormals.push_back(x);
-                this->m_vertexNormals.push_back(y);
-                this->m_vertexNormals.push_back(z);
-                if (vertexCounter + resolution < resolution * resolution) {
-                    this->indices.push_back(vertexCounter);
-                    this->indices.push_back(vertexCounter + resolution);
-                    this->indices.push_back(vertexCounter + resolution + 1);
-                    this->indices.push_back(vertexCounter);
-                    this->indices.push_back(vertexCounter + resolution + 1);
-                    this->indices.push_back(vertexCounter + 1);
-
-                }
-                else {
-                    this->indices.push_back(vertexCounter);
-                    this->indices.push_back(resolution * resolution);
-                    this->indices.push_back(resolution * resolution);
-                }
-
-                this->m_vertexPositions.push_back(x);
-                this->m_vertexPositions.push_back(y);
-                this->m_vertexPositions.push_back(z);
-
-                this->m_vertexTexCoords.push_back(i * textureCoefficient);
-                this->m_vertexTexCoords.push_back(1 - j * textureCoefficient);
-                //std::cout << x << " " << y << " " << z << std::endl;
-
-                vertexCounter = vertexCounter + 1;
-            }
-
-        }
-
+    std::shared_ptr<Mesh> genSphere(const float radius, const size_t resolution = kSphereResolution, int texFlag = 1) {
+        generateSphere(radius, resolution, this->m_vertexPositions, this->m_vertexNormals, this->m_vertexTexCoords, this->indices);
         return NULL;
     }
 
@@ -242,15 +344,21 @@ public:
         glBindTexture(GL_TEXTURE_2D, texID);
         glUniform1i(texID, 0);
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-        glUniformMatrix4fv(glGetUniformLocation(g_program, "transformationMatrix"), 1, GL_FALSE, glm::value_ptr(transformationMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(g_program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(g_program, "M"), 1, GL_FALSE, glm::value_ptr(M));
+        glUniformMatrix4fv(glGetUniformLocation(g_program.get(), "transformationMatrix"), 1, GL_FALSE, glm::value_ptr(transformationMatrix));
+        glUniformMatrix4fv(glGetUniformLocation(g_program.get(), "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
+        glUniformMatrix4fv(glGetUniformLocation(g_program.get(), "M"), 1, GL_FALSE, glm::value_ptr(M));
         glBindVertexArray(this->get_m_vao());     // activate the VAO storing geometry data
-        glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0); // Call for rendering: stream the current GPU geometry through the current GPU program
+        glDrawElements(GL_TRIANGLES, this->m_numIndices, GL_UNSIGNED_INT, 0); // Call for rendering: stream the current GPU geometry through the current GPU program
+    }
+
+    // Draws the geometry with the current program, for passes that set their own uniforms.
+    void draw() {
+        glBindVertexArray(this->m_vao.get());
+        glDrawElements(GL_TRIANGLES, this->m_numIndices, GL_UNSIGNED_INT, 0);
     }
 
     GLuint get_m_vao() {
-        return this->m_vao;
+        return this->m_vao.get();
     }
 
     // ...
@@ -258,58 +366,479 @@ private:
     std::vector<float> m_vertexPositions;
     std::vector<float> m_vertexNormals;
     std::vector<float> m_vertexTexCoords;
-    GLuint m_vao = 0;
-    GLuint m_posVbo = 0;
-    GLuint m_normalVbo = 0;
-    GLuint m_ibo = 0;
+    GpuVertexArray m_vao;
+    GpuBuffer m_posVbo;
+    GpuBuffer m_normalVbo;
+    GpuBuffer m_ibo;
+    size_t m_numIndices = 0;
 
     // ...
 };
 
+// Copies the state of the simulated bodies, from the latest snapshot, into their physics components.
+class PhysicsSyncSystem : public System {
+public:
+    uint32_t getReads() const override { return 0; }
+    uint32_t getWrites() const override { return kComponentPhysics; }
+
+    void run(EntityRegistry& registry) override {
+        PhysicsPool& physics = registry.getPhysics();
+        const SimulationSnapshot& snapshot = g_snapshots.getFront();
+        for (uint32_t p = 0; p < physics.size(); ++p) {
+            const uint32_t id = physics.bodies[p];
+            if (id >= snapshot.positions.size()) {
+                continue;
+            }
+            const uint8_t absorbed = snapshot.absorbed[id];
+            physics.positions[p] = snapshot.positions[id];
+            physics.radii[p] = snapshot.radii[id];
+            physics.newlyAbsorbed[p] = absorbed && !physics.absorbed[p];
+            physics.absorbed[p] = absorbed;
+        }
+    }
+};
+
+// Simulated entities are placed by the simulation, and entities spin about their tilted axis; only the nodes
+// that moved are recomputed, with the nodes attached to them.
+class TransformSystem : public System {
+public:
+    uint32_t getReads() const override { return kComponentPhysics; }
+    uint32_t getWrites() const override { return kComponentTransform; }
+
+    void run(EntityRegistry& registry) override {
+        TransformPool& transforms = registry.getTransforms();
+        TransformHierarchy& hierarchy = transforms.getHierarchy();
+        const PhysicsPool& physics = registry.getPhysics();
+        for (uint32_t p = 0; p < physics.size(); ++p) {
+            const uint32_t t = transforms.findSlot(physics.getEntity(p));
+            if (t != ComponentPool::kNoSlot) {
+                hierarchy.setLocalTranslation(transforms.nodes[t], physics.positions[p]);
+                hierarchy.setLocalScale(transforms.nodes[t], glm::vec3(static_cast<float>(physics.radii[p])));
+            }
+        }
+        const double time = g_snapshots.getFront().time;
+        for (uint32_t t = 0; t < transforms.size(); ++t) {
+            if (transforms.spinPeriods[t] > 0.0) {
+                const float spinAngle = static_cast<float>(2.0 * PI * std::fmod(time / transforms.spinPeriods[t], 1.0));
+                hierarchy.setLocalRotation(transforms.nodes[t], glm::angleAxis(transforms.axialTilts[t], glm::vec3(0.0f, 0.0f, 1.0f)) *
+                                                                glm::angleAxis(spinAngle, glm::vec3(0.0f, 1.0f, 0.0f)));
+            }
+        }
+        hierarchy.update(&g_jobs);
+    }
+};
+
+// Reports the bodies merged since the previous frame.
+class MergeReportSystem : public System {
+public:
+    uint32_t getReads() const override { return kComponentPhysics | kComponentLabel; }
+    uint32_t getWrites() const override { return 0; }
+
+    void run(EntityRegistry& registry) override {
+        const PhysicsPool& physics = registry.getPhysics();
+        const LabelPool& labels = registry.getLabels();
+        for (uint32_t p = 0; p < physics.size(); ++p) {
+            if (physics.newlyAbsorbed[p]) {
+                const uint32_t l = labels.findSlot(physics.getEntity(p));
+                std::cout << (l != ComponentPool::kNoSlot ? labels.texts[l] : "A body") << " merged into another body" << std::endl;
+            }
+        }
+    }
+};
+
+// Keeps the camera at a fixed offset from an entity, looking at it.
+class CameraFollowSystem : public System {
+public:
+    inline void follow(const Entity e, const glm::dvec3& offset) { m_followed = e; m_offset = offset; }
+
+    uint32_t getReads() const override { return kComponentTransform; }
+    uint32_t getWrites() const override { return 0; }
+    bool needsMainThread() const override { return true; } // the renderer reads the camera
+
+    void run(EntityRegistry& registry) override {
+        TransformPool& transforms = registry.getTransforms();
+        const uint32_t t = transforms.findSlot(m_followed);
+        if (t != ComponentPool::kNoSlot) {
+            const glm::dvec3 followed = transforms.getHierarchy().getWorldTranslation(transforms.nodes[t]);
+            g_camera.setTarget(followed);
+            g_camera.setPosition(followed + m_offset);
+        }
+    }
+
+private:
+    Entity m_followed = kNoEntity;
+    glm::dvec3 m_offset = glm::dvec3(0.0);
+};
+
+// Draws the entities with a render component and a transform that are in the view frustum, camera-relative
+// (see world.h); the first emissive one lights the scene. Entities smaller on screen than the impostor size
+// are drawn as points, all in one draw. A pending click picks the entity under the cursor. The bounding
+// spheres, the culling and the queue of draws are computed by jobs; only their submission stays here.
+class RenderSystem : public System {
+public:
+    void init() {
+        m_points.init();
+        m_pickBuffer.init();
+        m_feedback.init();
+    }
+    void clear() {
+        m_feedback.clear();
+        m_pickBuffer.clear();
+        m_points.clear();
+        m_meshes.clear();
+    }
+
+    inline void setStarField(StarFieldRenderer* starField) { m_starField = starField; }
+    inline void setOctree(PointOctreeStreamer* octree) { m_octree = octree; }
+    inline void setVirtualTextures(const std::vector<std::unique_ptr<VirtualTexture> >* textures) { m_virtualTextures = textures; }
+    inline void setTextureLoader(TextureLoader* textures) { m_textures = textures; }
+
+    inline void setImpostorSize(const float pixels) { m_impostorSize = pixels; }
+    inline float getImpostorSize() const { return m_impostorSize; }
+    inline size_t getLastNumPoints() const { return m_points.getNumPoints(); }
+    inline Entity getPicked() const { return m_picked; }
+
+    // Takes ownership of the mesh, released by clear().
+    inline uint32_t addMesh(std::unique_ptr<Mesh> mesh) {
+        m_meshes.push_back(std::move(mesh));
+        return static_cast<uint32_t>(m_meshes.size() - 1);
+    }
+
+    uint32_t getReads() const override { return kComponentTransform | kComponentRender | kComponentPhysics; }
+    uint32_t getWrites() const override { return 0; }
+    bool needsMainThread() const override { return true; }
+
+    void run(EntityRegistry& registry) override {
+        TransformPool& transforms = registry.getTransforms();
+        const TransformHierarchy& hierarchy = transforms.getHierarchy();
+        const RenderPool& renders = registry.getRenders();
+        const PhysicsPool& physics = registry.getPhysics();
+
+        // Render space: everything is rebased on the camera before dropping to float
+        const glm::dvec3 camPosition = g_camera.getPosition();
+        viewMatrix = g_camera.computeViewMatrix();
+        projMatrix = g_camera.computeProjectionMatrix();
+
+        // Projected diameter in pixels of a sphere of radius r at distance d: 2 r / d * pixelsPerRadian
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        const double pixelsPerRadian = viewport[3] / (2.0 * std::tan(0.5 * glm::radians(static_cast<double>(g_camera.getFov()))));
+
+        if (m_starField) {
+            m_starField->render(projMatrix * viewMatrix);
+        }
+        if (m_octree) {
+            m_octree->render(projMatrix * viewMatrix, camPosition, pixelsPerRadian);
+        }
+        glUseProgram(g_program.get()); // the trail pass switches programs
+        uint32_t light = 0;
+        while (light + 1 < renders.size() && !renders.emissive[light]) {
+            ++light;
+        }
+        const uint32_t lightTransform = renders.size() > 0 ? transforms.findSlot(renders.getEntity(light)) : ComponentPool::kNoSlot;
+        glm::dvec3 lightWorld(0.0);
+        if (lightTransform != ComponentPool::kNoSlot) {
+            lightWorld = hierarchy.getWorldTranslation(transforms.nodes[lightTransform]);
+            const glm::vec3 lightPos = toCameraRelative(lightWorld, camPosition);
+            glUniform3f(glGetUniformLocation(g_program.get(), "lightPos"), lightPos[0], lightPos[1], lightPos[2]);
+        }
+        glUniform1f(glGetUniformLocation(g_program.get(), "logDepthCoef"), computeLogDepthCoefficient(g_camera.getFar()));
+
+        // Bounding spheres of the unit meshes, culled against the frustum; the hierarchy is refit to them
+        m_centers.resize(renders.size());
+        m_radii.resize(renders.size());
+        g_jobs.parallelFor(0, renders.size(), kRenderJobGrain, [&](size_t first, size_t last) {
+            for (size_t r = first; r < last; ++r) {
+                const Entity e = renders.getEntity(static_cast<uint32_t>(r));
+                const uint32_t p = physics.findSlot(e);
+                const uint32_t t = transforms.findSlot(e);
+                if ((p != ComponentPool::kNoSlot && physics.absorbed[p]) || t == ComponentPool::kNoSlot) {
+                    m_centers[r] = glm::dvec3(0.0);
+                    m_radii[r] = -1.0; // merged into another body, or nowhere to draw
+                    continue;
+                }
+                const glm::vec3& scale = hierarchy.getLocalScale(transforms.nodes[t]);
+                m_centers[r] = hierarchy.getWorldTranslation(transforms.nodes[t]);
+                m_radii[r] = std::max(scale.x, std::max(scale.y, scale.z));
+            }
+        });
+        m_culler.update(m_centers, m_radii);
+        m_culler.cull(computeFrustum(projMatrix * viewMatrix), camPosition, m_visible, &g_jobs);
+
+        // Render queue, in visible order
+        m_queue.resize(m_visible.size());
+        g_jobs.parallelFor(0, m_visible.size(), kRenderJobGrain, [&](size_t first, size_t last) {
+            for (size_t v = first; v < last; ++v) {
+                const uint32_t r = m_visible[v];
+                DrawItem& item = m_queue[v];
+                item.render = r;
+                const double distance = glm::length(m_centers[r] - camPosition);
+                const double diameter = 2.0 * m_radii[r] / distance * pixelsPerRadian;
+                item.diameter = static_cast<float>(diameter);
+                item.impostor = distance > m_radii[r] && diameter < m_impostorSize;
+                if (item.impostor) {
+                    const glm::dvec3 toLight = lightWorld - m_centers[r];
+                    const glm::dvec3 toCamera = camPosition - m_centers[r];
+                    const bool lit = !renders.emissive[r] && glm::length(toLight) > 0.0;
+                    const float phaseAngle = lit ? static_cast<float>(std::acos(glm::clamp(glm::dot(glm::normalize(toLight), glm::normalize(toCamera)), -1.0, 1.0))) : 0.0f;
+                    const float brightness = lit ? computeDiskBrightness(phaseAngle) : 1.0f;
+                    item.pointPosition = glm::vec3(-toCamera);
+                    item.pointColor = renders.colors[r] * brightness;
+                    continue;
+                }
+                const uint32_t node = transforms.nodes[transforms.getSlot(renders.getEntity(r))];
+                item.model = computeCameraRelativeModel(hierarchy.getWorldTranslation(node), camPosition, hierarchy.computeRotationScale(node));
+            }
+        });
+
+        if (m_virtualTextures && !m_virtualTextures->empty()) {
+            updateVirtualTextures(renders);
+        }
+
+        m_points.begin();
+        for (size_t q = 0; q < m_queue.size(); ++q) {
+            const DrawItem& item = m_queue[q];
+            if (item.impostor) {
+                m_points.add(item.pointPosition, item.diameter, item.pointColor);
+                continue;
+            }
+            // The equator wraps the width of the texture: about pi diameters of pixels at the limb facing the camera
+            const uint32_t textureSlot = renders.textureSlots[item.render];
+            GLuint texture = renders.textures[item.render];
+            if (m_textures && textureSlot != RenderPool::kNoTextureSlot) {
+                m_textures->require(textureSlot, static_cast<float>(PI) * item.diameter);
+                texture = m_textures->getTexture(textureSlot); // replaced when its residency changes
+            }
+            M = item.model;
+            const glm::mat4 transformationMatrix = projMatrix * viewMatrix * M;
+            glUniform1i(glGetUniformLocation(g_program.get(), "sunFlag"), renders.emissive[item.render]);
+            const uint32_t virtualTexture = renders.virtualTextures[item.render];
+            glUniform1i(glGetUniformLocation(g_program.get(), "virtualTexture"), virtualTexture != RenderPool::kNoVirtualTexture);
+            if (virtualTexture != RenderPool::kNoVirtualTexture) {
+                (*m_virtualTextures)[virtualTexture]->bind(g_program.get(), kVirtualIndirectionUnit, kVirtualCacheUnit);
+            }
+            m_meshes[renders.meshes[item.render]]->render(transformationMatrix, texture);
+        }
+        m_points.render(projMatrix * viewMatrix, computeLogDepthCoefficient(g_camera.getFar()));
+
+        if (g_pickPending) {
+            g_pickPending = false;
+            pick(registry, viewport, camPosition, pixelsPerRadian);
+        }
+    }
+
+private:
+    // A visible entity, ready to submit: a mesh with its camera-relative model matrix, or an impostor.
+    struct DrawItem {
+        glm::mat4 model;
+        glm::vec3 pointPosition; // camera-relative
+        float diameter;          // projected, in pixels
+        glm::vec3 pointColor;
+        uint32_t render;
+        bool impostor;
+    };
+
+    // Hands the oldest feedback read back to the virtual textures, uploads the tiles they streamed in, and
+    // draws the feedback of the visible meshes with one. The tiles seen this frame are requested a few frames
+    // later, when its read back is done.
+    void updateVirtualTextures(const RenderPool& renders) {
+        const std::vector<std::unique_ptr<VirtualTexture> >& textures = *m_virtualTextures;
+        if (m_feedback.collect(m_feedbackEntries)) {
+            size_t e = 0; // entries are sorted: those of a texture are contiguous
+            for (uint32_t v = 0; v < textures.size(); ++v) {
+                const size_t first = e;
+                while (e < m_feedbackEntries.size() && (m_feedbackEntries[e] >> 28) == v) {
+                    ++e;
+                }
+                textures[v]->processFeedback(m_feedbackEntries.data() + first, m_feedbackEntries.data() + e);
+            }
+        }
+        for (size_t v = 0; v < textures.size(); ++v) {
+            textures[v]->update();
+        }
+
+        bool begun = false;
+        for (size_t q = 0; q < m_queue.size(); ++q) {
+            const DrawItem& item = m_queue[q];
+            const uint32_t virtualTexture = renders.virtualTextures[item.render];
+            if (item.impostor || virtualTexture == RenderPool::kNoVirtualTexture) {
+                continue;
+            }
+            if (!begun) {
+                m_feedback.begin(projMatrix * viewMatrix, computeLogDepthCoefficient(g_camera.getFar()));
+                begun = true;
+            }
+            m_feedback.setObject(item.model, virtualTexture, textures[virtualTexture]->getHeader());
+            m_meshes[renders.meshes[item.render]]->draw();
+        }
+        if (begun) {
+            m_feedback.end();
+            glUseProgram(g_program.get());
+        }
+    }
+
+    // Picks the entity under the cursor: the nearest bounding sphere hit by the ray through it, or, in exact
+    // mode, the nearest surface among the meshes whose spheres are hit, drawn into the pick buffer.
+    void pick(EntityRegistry& registry, const GLint viewport[4], const glm::dvec3& camPosition, const double pixelsPerRadian) {
+        TransformPool& transforms = registry.getTransforms();
+        const TransformHierarchy& hierarchy = transforms.getHierarchy();
+        const RenderPool& renders = registry.getRenders();
+        const LabelPool& labels = registry.getLabels();
+        const glm::dvec3 direction = computePickDirection(g_pickCursor.x, g_pickCursor.y, viewport, projMatrix * viewMatrix);
+        const double tolerance = kPickTolerancePixels / pixelsPerRadian;
+
+        RayHit hit;
+        bool found = false;
+        if (g_exactPicking && m_pickBuffer.isAvailable()) {
+            m_culler.collectRayHits(camPosition, direction, tolerance, m_pickHits);
+            const size_t candidates = std::min(m_pickHits.size(), kMaxPickCandidates);
+            m_pickBuffer.begin(computePickMatrix(g_pickCursor.x, g_pickCursor.y, viewport) * projMatrix * viewMatrix,
+                               computeLogDepthCoefficient(g_camera.getFar()));
+            for (size_t c = 0; c < candidates; ++c) {
+                const uint32_t r = m_pickHits[c].sphere;
+                const uint32_t node = transforms.nodes[transforms.getSlot(renders.getEntity(r))];
+                m_pickBuffer.setObject(static_cast<uint32_t>(c),
+                                       computeCameraRelativeModel(hierarchy.getWorldTranslation(node), camPosition, hierarchy.computeRotationScale(node)));
+                m_meshes[renders.meshes[r]]->draw();
+            }
+            float distance;
+            const uint32_t c = m_pickBuffer.end(distance);
+            glUseProgram(g_program.get());
+            if (c < candidates) {
+                hit = m_pickHits[c];
+                hit.distance = distance;
+                hit.point = camPosition + static_cast<double>(distance) * direction;
+                found = true;
+            }
+            // Missing every surface, the cursor may still be on a body smaller than a pixel: fall back to spheres
+        }
+        if (!found) {
+            found = m_culler.intersectRay(camPosition, direction, tolerance, hit);
+        }
+        if (!found) {
+            m_picked = kNoEntity;
+            std::cout << "Picked nothing" << std::endl;
+            return;
+        }
+        m_picked = renders.getEntity(hit.sphere);
+        const uint32_t l = labels.findSlot(m_picked);
+        std::cout << "Picked " << (l != ComponentPool::kNoSlot ? labels.texts[l] : "a body") << " at (" << hit.point.x << ", "
+                  << hit.point.y << ", " << hit.point.z << ")" << std::endl;
+    }
+
+    std::vector<std::unique_ptr<Mesh> > m_meshes;
+    StarFieldRenderer* m_starField = nullptr; // background, if any
+    PointOctreeStreamer* m_octree = nullptr;
+    const std::vector<std::unique_ptr<VirtualTexture> >* m_virtualTextures = nullptr;
+    TextureLoader* m_textures = nullptr; // told the levels the textures are drawn with
+    VirtualTextureFeedback m_feedback;
+    std::vector<uint32_t> m_feedbackEntries;
+    PointRenderer m_points;
+    float m_impostorSize = kImpostorPixelSize;
+    FrustumCuller m_culler;
+    std::vector<glm::dvec3> m_centers; // per render slot
+    std::vector<double> m_radii;
+    std::vector<uint32_t> m_visible;
+    std::vector<DrawItem> m_queue;
+    PickBuffer m_pickBuffer;
+    std::vector<RayHit> m_pickHits;
+    Entity m_picked = kNoEntity;
+};
+
 
-GLuint loadTextureFromFileToGPU(const std::string& filename) {
-    int width, height, numComponents;
-    // Loading the image in CPU memory using stb_image
-    unsigned char* data = stbi_load(
-        filename.c_str(),
-        &width, &height,
-        &numComponents, // 1 for a 8 bit grey-scale image, 3 for 24bits RGB image, 4 for 32bits RGBA image
-        0);
-
-    GLuint texID;
-    glGenTextures(1, &texID); // generate an OpenGL texture container
-    glBindTexture(GL_TEXTURE_2D, texID); // activate the texture
-    // Setup the texture filtering option and repeat mode; check www.opengl.org for details.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // Fill the GPU texture with the data stored in the CPU image
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-
-    // Free useless CPU memory
-    stbi_image_free(data);
-    glBindTexture(GL_TEXTURE_2D, 0); // unbind the texture
-
-    return texID;
+// 1x1 texture of a flat color, for the bodies without a texture.
+GpuTexture createColorTexture(const glm::vec3& color) {
+    const glm::u8vec3 texel(glm::clamp(color, 0.0f, 1.0f) * 255.0f);
+    GpuTexture tex;
+    tex.create(kGpuTextures);
+    glBindTexture(GL_TEXTURE_2D, tex.get());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, &texel[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    tex.setBytes(sizeof(texel));
+    return tex;
 }
 
 // Executed each time the window is resized. Adjust the aspect ratio and the rendering viewport to the current window.
-void windowSizeCallback(GLFWwindow* window, int width, int height) {
+void windowSizeCallback(GLFWwindow* /*window*/, int width, int height) {
     g_camera.setAspectRatio(static_cast<float>(width) / static_cast<float>(height));
     glViewport(0, 0, (GLint)width, (GLint)height); // Dimension of the rendering region in the window
 }
 
-// Executed each time a key is entered.
-void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+// Applies the view part of a key event, either live or replayed from a recording. Render thread.
+void handleViewKey(int key, int action, int /*mods*/) {
     if (action == GLFW_PRESS && key == GLFW_KEY_W) {
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     }
     else if (action == GLFW_PRESS && key == GLFW_KEY_F) {
         glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
     }
-    else if (action == GLFW_PRESS && (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q)) {
+    else if (action == GLFW_PRESS && key == GLFW_KEY_T) {
+        g_trailsVisible = !g_trailsVisible;
+    }
+}
+
+// Applies the simulation part of a key event, either live or replayed from a recording. Simulation thread.
+void handleSimulationKey(int key, int action, int /*mods*/) {
+    if (action == GLFW_PRESS && (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD || key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT)) {
+        // Time warp: the macro step size is part of the simulation state, so replays follow it exactly
+        const bool faster = (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD);
+        const double current = std::pow(kTimeWarpFactor, std::floor(std::log(g_simulation.getStepSize() / g_simulationStep) / std::log(kTimeWarpFactor) + 0.5));
+        const double warp = glm::clamp(faster ? current * kTimeWarpFactor : current / kTimeWarpFactor, 1.0, kMaxTimeWarp);
+        g_simulation.setStepSize(g_simulationStep * warp);
+        std::cout << "Time warp: x" << warp << std::endl;
+    }
+}
+
+class ReplayKeyHandler : public ReplayInputHandler {
+public:
+    void onReplayInput(int key, int action, int mods) override {
+        handleSimulationKey(key, action, mods);
+        g_viewInputEvents.values.push_back(glm::ivec3(key, action, mods)); // for the renderer
+    }
+};
+ReplayKeyHandler g_replayKeyHandler;
+
+// Executed each time a key is entered.
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (action == GLFW_PRESS && (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q)) {
         glfwSetWindowShouldClose(window, true); // Closes the application if the escape key is pressed
+        return;
+    }
+    if (action == GLFW_PRESS && key == GLFW_KEY_G) {
+        std::cout << "GPU memory:" << std::endl; // not an input of the simulation: neither recorded nor replayed
+        getGpuResources().report(std::cout);
+        return;
+    }
+    if (action == GLFW_PRESS && key == GLFW_KEY_P) {
+        g_exactPicking = !g_exactPicking; // not an input of the simulation either
+        std::cout << "Picking: " << (g_exactPicking ? "exact surfaces" : "bounding spheres") << std::endl;
+        return;
+    }
+    if (g_replaying) {
+        return; // the recorded inputs are replayed instead
+    }
+    handleViewKey(key, action, mods);
+    std::lock_guard<std::mutex> lock(g_simulationInputsMutex); // recorded and applied by the simulation thread
+    g_simulationInputs.push_back(glm::ivec3(key, action, mods));
+}
+
+// A left click asks the renderer to pick the entity under the cursor, on the next frame.
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int /*mods*/) {
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) {
+        return;
+    }
+    double x, y;
+    int windowWidth, windowHeight, framebufferWidth, framebufferHeight;
+    glfwGetCursorPos(window, &x, &y);
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    if (windowWidth > 0 && windowHeight > 0) {
+        g_pickCursor = glm::dvec2(x * framebufferWidth / windowWidth, y * framebufferHeight / windowHeight); // high DPI screens
+        g_pickPending = true;
     }
 }
 
@@ -348,6 +877,7 @@ void initGLFW() {
     glfwMakeContextCurrent(g_window);
     glfwSetWindowSizeCallback(g_window, windowSizeCallback);
     glfwSetKeyCallback(g_window, keyCallback);
+    glfwSetMouseButtonCallback(g_window, mouseButtonCallback);
 }
 
 void initOpenGL() {
@@ -362,7 +892,7 @@ void initOpenGL() {
     glEnable(GL_CULL_FACE); // Enables face culling (based on the orientation defined by the CW/CCW enumeration).
     glDepthFunc(GL_LESS);   // Specify the depth test for the z-buffer
     glEnable(GL_DEPTH_TEST);      // Enable the z-buffer test in the rasterization
-    glClearColor(0.7f, 0.7f, 0.7f, 1.0f); // specify the background color, used any time the framebuffer is cleared
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // space: the star field is drawn over it
 }
 
 // Loads the content of an ASCII file in a standard C++ string
@@ -376,9 +906,17 @@ std::string file2String(const std::string& filename) {
 // Loads and compile a shader, before attaching it to a program
 void loadShader(GLuint program, GLenum type, const std::string& shaderFilename) {
     GLuint shader = glCreateShader(type); // Create the shader, e.g., a vertex shader to be applied to every single vertex of a mesh
-    std::string shaderSourceString = file2String(shaderFilename); // Loads the shader source from a file to a C++ string
-    const GLchar* shaderSource = (const GLchar*)shaderSourceString.c_str(); // Interface the C++ string through a C pointer
-    glShaderSource(shader, 1, &shaderSource, NULL); // load the vertex shader code
+    size_t packedLength;
+    const char* packedSource = g_assets.findShader(shaderFilename, packedLength);
+    if (packedSource) {
+        const GLint length = static_cast<GLint>(packedLength);
+        glShaderSource(shader, 1, &packedSource, &length); // straight from the mapping of the pack
+    }
+    else {
+        std::string shaderSourceString = file2String(shaderFilename); // Loads the shader source from a file to a C++ string
+        const GLchar* shaderSource = (const GLchar*)shaderSourceString.c_str(); // Interface the C++ string through a C pointer
+        glShaderSource(shader, 1, &shaderSource, NULL); // load the vertex shader code
+    }
     glCompileShader(shader);
     GLint success;
     GLchar infoLog[512];
@@ -392,12 +930,15 @@ void loadShader(GLuint program, GLenum type, const std::string& shaderFilename)
 }
 
 void initGPUprogram() {
-    g_program = glCreateProgram(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
-    loadShader(g_program, GL_VERTEX_SHADER, "vertexShader.glsl");
-    loadShader(g_program, GL_FRAGMENT_SHADER, "fragmentShader.glsl");
-    glLinkProgram(g_program); // The main GPU program is ready to be handle streams of polygons
-
-    glUseProgram(g_program);
+    g_program.create(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
+    loadShader(g_program.get(), GL_VERTEX_SHADER, "vertexShader.glsl");
+    loadShader(g_program.get(), GL_FRAGMENT_SHADER, "fragmentShader.glsl");
+    glLinkProgram(g_program.get()); // The main GPU program is ready to be handle streams of polygons
+
+    glUseProgram(g_program.get());
+    // Samplers of different types may not share a unit, even unused: the virtual texture ones get theirs for good
+    glUniform1i(glGetUniformLocation(g_program.get(), "vtIndirection"), kVirtualIndirectionUnit);
+    glUniform1i(glGetUniformLocation(g_program.get(), "vtCache"), kVirtualCacheUnit);
 }
 
 void initCamera() {
@@ -405,7 +946,7 @@ void initCamera() {
     glfwGetWindowSize(g_window, &width, &height);
     g_camera.setAspectRatio(static_cast<float>(width) / static_cast<float>(height));
 
-    g_camera.setPosition(glm::vec3(0.0, 8.0, 30.0));
+    g_camera.setPosition(glm::dvec3(0.0, 8.0, 30.0));
     g_camera.setNear(0.1);
     g_camera.setFar(80.1);
 }
@@ -420,8 +961,16 @@ void init() {
     // The lines above are commented cause I (R. Benatti) deleted their codes just to clean a bit
 }
 
+// Releases everything on the GPU while the context is alive, then reports what was not.
 void clear() {
-    glDeleteProgram(g_program);
+    g_trails.clear();
+    g_entities.clear();
+    g_colorTextures.clear();
+    g_virtualTextures.clear();
+    g_textures.clear();
+    g_assets.close();
+    g_program.reset();
+    getGpuResources().reportLeaks(std::cerr);
     glfwDestroyWindow(g_window);
     glfwTerminate();
 }
@@ -439,111 +988,441 @@ void render(GLuint render_vao, size_t indicesSize, glm::mat4 transformationMatri
 }
 */
 
-void update(const float currentTimeInSec) {
+// Records and applies the live inputs received since the previous batch, at the current step.
+void applySimulationInputs() {
+    static std::vector<glm::ivec3> inputs;
+    inputs.clear();
+    {
+        std::lock_guard<std::mutex> lock(g_simulationInputsMutex);
+        inputs.swap(g_simulationInputs);
+    }
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        g_recorder.recordInput(g_simulation.getStepCount(), inputs[i].x, inputs[i].y, inputs[i].z);
+        handleSimulationKey(inputs[i].x, inputs[i].y, inputs[i].z);
+    }
 }
 
+// Fills the back snapshot with the current state and the pending events, and publishes it. Once the previous
+// snapshot is known to be picked up, its events are no longer sent.
+void publishSnapshot() {
+    SimulationSnapshot& snapshot = g_snapshots.getBack();
+    snapshot.stepCount = g_simulation.getStepCount();
+    snapshot.time = g_simulation.getTime();
+    snapshot.positions = g_simulation.getPositions();
+    snapshot.radii = g_simulation.getRadii();
+    snapshot.absorbed.resize(g_simulation.getNumBodies());
+    for (uint32_t i = 0; i < snapshot.absorbed.size(); ++i) {
+        snapshot.absorbed[i] = g_simulation.isAbsorbed(i) ? 1 : 0;
+    }
+    snapshot.trailSamples = g_trailEvents;
+    snapshot.viewInputs = g_viewInputEvents;
+    static uint64_t previousTrailEnd = 0, previousViewInputEnd = 0; // events of the previous snapshot
+    const uint64_t trailEnd = g_trailEvents.end();
+    const uint64_t viewInputEnd = g_viewInputEvents.end();
+    if (!g_snapshots.publish()) {
+        g_trailEvents.trim(previousTrailEnd);
+        g_viewInputEvents.trim(previousViewInputEnd);
+    }
+    previousTrailEnd = trailEnd;
+    previousViewInputEnd = viewInputEnd;
+}
+
+// Advances the simulation by macro steps up to the current time.
+void update(const double currentTimeInSec) {
+    const double stepPeriod = 1.0 / kSimulationStepsPerSecond;
+    g_simulationLag += currentTimeInSec - g_lastUpdateTime;
+    g_lastUpdateTime = currentTimeInSec;
+    int steps = 0;
+    while (g_simulationLag >= stepPeriod && steps < kMaxStepsPerBatch && glfwGetTime() - currentTimeInSec < kSimulationBudgetPerBatch) {
+        if (g_replaying) {
+            if (g_simulation.getStepCount() >= g_replay.getLastStep()) {
+                g_simulationLag = 0.0; // end of the recording: hold the last state
+                break;
+            }
+            const bool diverged = g_replay.hasDiverged();
+            if (!g_replay.stepForward(g_simulation, &g_replayKeyHandler) && !diverged) {
+                std::cerr << "WARNING: replay diverged from the recording at step " << g_simulation.getStepCount() << std::endl;
+            }
+        }
+        else {
+            g_simulation.step();
+            g_recorder.recordStep(g_simulation);
+        }
+        if (g_simulation.getStepCount() % kTrailSampleInterval == 0 && g_simulation.getNumBodies() >= g_trailEvents.stride) {
+            // Only the bodies with a trail: the first kMaxTrails, uploaded by the renderer
+            std::vector<glm::dvec3>& samples = g_trailEvents.values;
+            const std::vector<glm::dvec3>& positions = g_simulation.getPositions();
+            samples.insert(samples.end(), positions.begin(), positions.begin() + static_cast<std::ptrdiff_t>(g_trailEvents.stride));
+        }
+        g_simulationLag -= stepPeriod;
+        ++steps;
+    }
+    if (g_simulationLag >= stepPeriod) {
+        g_simulationLag = 0.0; // out of budget: the simulation runs slower than real time
+    }
+}
+
+// Simulation thread: runs the steps due, publishes the state, and sleeps until the next step is due, at its
+// own rate whatever the frame rate.
+void simulationLoop() {
+    const double stepPeriod = 1.0 / kSimulationStepsPerSecond;
+    while (g_simulationRunning.load()) {
+        applySimulationInputs();
+        const uint64_t stepCount = g_simulation.getStepCount();
+        update(glfwGetTime());
+        if (g_simulation.getStepCount() != stepCount) {
+            publishSnapshot();
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(std::max(stepPeriod - g_simulationLag, 0.0)));
+    }
+}
+
+// Render thread: takes the latest snapshot, if there is a new one, and applies the events not applied yet.
+void pickUpSnapshot() {
+    if (!g_snapshots.update()) {
+        return;
+    }
+    const SimulationSnapshot& snapshot = g_snapshots.getFront();
+    const SnapshotEvents<glm::ivec3>& inputs = snapshot.viewInputs;
+    for (uint64_t e = std::max(g_appliedViewInputs, inputs.first); e < inputs.end(); ++e) {
+        const glm::ivec3& input = inputs.values[static_cast<size_t>(e - inputs.first)];
+        handleViewKey(input.x, input.y, input.z);
+    }
+    g_appliedViewInputs = std::max(g_appliedViewInputs, inputs.end());
+    const SnapshotEvents<glm::dvec3>& samples = snapshot.trailSamples;
+    for (uint64_t e = std::max(g_appliedTrailSamples, samples.first); e < samples.end(); ++e) {
+        g_trails.append(&samples.values[static_cast<size_t>((e - samples.first) * samples.stride)], static_cast<uint32_t>(samples.stride));
+    }
+    g_appliedTrailSamples = std::max(g_appliedTrailSamples, samples.end());
+}
+
+// Loads the open scene, whose textures were requested: camera, and one entity per body, parents first, drawn
+// with the given mesh. Bodies
+// bound to the ephemeris are driven by it when it is available; otherwise they are placed on their orbit like
+// the others. Attached bodies are not simulated, they follow their parent. Returns the entity of each body.
+std::vector<Entity> loadScene(const std::string& filename, EphemerisTrajectories& ephemerisTrajectories, const uint32_t mesh) {
+    const SceneFileHeader& header = g_scene.getHeader();
+    if (g_scene.getEphemerisFile()) {
+        if (g_ephemeris.open(g_scene.getEphemerisFile())) {
+            std::cout << "Using ephemeris " << g_scene.getEphemerisFile() << " (JD " << g_ephemeris.getStartJD() << " to " << g_ephemeris.getEndJD() << ")" << std::endl;
+            // J2000 when the file covers it, its start otherwise: either leaves a span to wrap over
+            const bool coversJ2000 = kJulianDateJ2000 >= g_ephemeris.getStartJD() && kJulianDateJ2000 < g_ephemeris.getEndJD();
+            ephemerisTrajectories.setStartJD(coversJ2000 ? kJulianDateJ2000 : g_ephemeris.getStartJD());
+        }
+        else {
+            std::cerr << "WARNING: cannot open the ephemeris " << g_scene.getEphemerisFile() << ", bodies follow their orbits instead" << std::endl;
+        }
+    }
+    g_simulation.setTrajectorySource(&ephemerisTrajectories);
+
+    g_colorTextures.clear();
+    const uint32_t numBodies = g_scene.getNumBodies();
+    std::map<uint32_t, GLuint> colorTextures; // bodies of the same color share their texture
+    std::vector<Entity> entities(numBodies);
+    TransformPool& transforms = g_entities.getTransforms();
+    TransformHierarchy& hierarchy = transforms.getHierarchy();
+    PhysicsPool& physics = g_entities.getPhysics();
+    for (uint32_t i = 0; i < numBodies; ++i) {
+        const SceneBody& body = g_scene.getBody(i);
+        const glm::vec3 color(body.color[0], body.color[1], body.color[2]);
+        GLuint texture = 0;
+        uint32_t textureSlot = RenderPool::kNoTextureSlot;
+        uint32_t virtualTexture = RenderPool::kNoVirtualTexture;
+        if (body.texture != kSceneNone && g_sceneVirtualTextures[body.texture] != RenderPool::kNoVirtualTexture) {
+            virtualTexture = g_sceneVirtualTextures[body.texture];
+        }
+        else if (body.texture != kSceneNone) {
+            textureSlot = g_sceneTextureSlots[body.texture];
+            texture = g_textures.getTexture(textureSlot);
+        }
+        else {
+            const glm::u8vec3 key(glm::clamp(color, 0.0f, 1.0f) * 255.0f);
+            GLuint& colorTexture = colorTextures[(key.r << 16) | (key.g << 8) | key.b];
+            if (colorTexture == 0) {
+                g_colorTextures.push_back(createColorTexture(color));
+                colorTexture = g_colorTextures.back().get();
+            }
+            texture = colorTexture;
+        }
+        const Entity entity = g_entities.create();
+        entities[i] = entity;
+        g_entities.getLabels().add(entity, g_scene.getName(i));
+        g_entities.getRenders().add(entity, mesh, texture, color, (body.flags & kSceneBodyEmissive) != 0, virtualTexture, textureSlot);
+
+        // Attached bodies only exist in the transform hierarchy, in the frame of their parent
+        const Entity parent = body.parent != kSceneNone ? entities[body.parent] : kNoEntity;
+        const uint32_t parentNode = parent != kNoEntity ? transforms.nodes[transforms.getSlot(parent)] : TransformHierarchy::kNone;
+        const float axialTilt = static_cast<float>(body.axialTilt);
+        const glm::quat tilt = glm::angleAxis(axialTilt, glm::vec3(0.0f, 0.0f, 1.0f));
+        const glm::vec3 scale(static_cast<float>(body.radius));
+        glm::dvec3 position(body.position[0], body.position[1], body.position[2]);
+        if (body.flags & kSceneBodyAttached) {
+            transforms.add(entity, hierarchy.add(parentNode, false, position, tilt, scale), axialTilt, body.spinPeriod);
+            continue;
+        }
+
+        glm::dvec3 origin(0.0), originVelocity(0.0);
+        double parentMu = 0.0;
+        if (parent != kNoEntity) {
+            const uint32_t parentId = physics.bodies[physics.getSlot(parent)]; // simulated: checked by Scene::open
+            origin = g_simulation.getPosition(parentId);
+            originVelocity = g_simulation.getVelocity(parentId);
+            parentMu = g_simulation.getMu(parentId);
+        }
+        glm::dvec3 velocity(body.velocity[0], body.velocity[1], body.velocity[2]);
+        if (body.orbit.semiMajorAxis > 0.0) {
+            computeOrbitState(body.orbit, parentMu, 0.0, position, velocity);
+        }
+        uint32_t id;
+        if (g_ephemeris.isOpen() && body.ephemerisBody != kSceneNone) {
+            id = g_simulation.addDrivenBody(body.ephemerisBody, body.mu, body.radius);
+        }
+        else if (body.flags & kSceneBodyPinned) {
+            id = g_simulation.addDrivenBody(kPinnedSource, body.mu, body.radius, origin + position);
+        }
+        else {
+            id = g_simulation.addBody(origin + position, originVelocity + velocity, body.mu, body.radius);
+        }
+        physics.add(entity, id);
+        g_entities.getOrbits().add(entity, parent, body.orbit, id < kMaxTrails ? id : OrbitPool::kNoTrail, color);
+        transforms.add(entity, hierarchy.add(parentNode, true, g_simulation.getPosition(id), tilt, scale), axialTilt, body.spinPeriod);
+    }
+
+    g_simulationTimeScale = header.timeScale;
+    g_camera.setNear(static_cast<float>(header.cameraNear));
+    g_camera.setFar(static_cast<float>(header.cameraFar));
+    g_camera.setPosition(glm::dvec3(header.cameraPosition[0], header.cameraPosition[1], header.cameraPosition[2]));
+    g_camera.setTarget(glm::dvec3(header.cameraTarget[0], header.cameraTarget[1], header.cameraTarget[2]));
+    std::cout << "Loaded " << filename << ": " << numBodies << " bodies, " << g_scene.getNumTextures() << " textures" << std::endl;
+    return entities;
+}
 
 int main(int argc, char** argv) {
+    // Command line: --scene <file> loads another scene, --assets <file> another asset pack, --stars <file>
+    // another star catalog, --octree <file> streams a star octree instead of it, --record <file> writes a
+    // recording of the run, --replay <file> [--seek <time>] plays one back, --texture-budget <MiB> sets the memory
+    // of the textures (0 for no limit)
+    std::string sceneFilename = kDefaultSceneFilename;
+    std::string assetPackFilename = kDefaultAssetPackFilename;
+    std::string starCatalogFilename = kDefaultStarCatalogFilename;
+    std::string octreeFilename;
+    std::string recordFilename;
+    std::string replayFilename;
+    double seekTime = 0.0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--scene") {
+            sceneFilename = argv[i + 1];
+        }
+        else if (option == "--assets") {
+            assetPackFilename = argv[i + 1];
+        }
+        else if (option == "--stars") {
+            starCatalogFilename = argv[i + 1];
+        }
+        else if (option == "--octree") {
+            octreeFilename = argv[i + 1];
+        }
+        else if (option == "--record") {
+            recordFilename = argv[i + 1];
+        }
+        else if (option == "--replay") {
+            replayFilename = argv[i + 1];
+        }
+        else if (option == "--seek") {
+            seekTime = std::atof(argv[i + 1]);
+        }
+        else if (option == "--texture-budget") {
+            g_textures.setBudget(static_cast<size_t>(std::max(std::atof(argv[i + 1]), 0.0) * (1 << 20)));
+        }
+    }
+
+    // One mapping for the startup assets; without a pack, they are loaded from their source files
+    if (!g_assets.open(assetPackFilename)) {
+        std::cerr << "WARNING: cannot open the asset pack " << assetPackFilename << " (build it with tools/asset_packer), loading the source files" << std::endl;
+    }
+
+    // The main thread runs jobs whenever it waits for them: one worker less than there are cores
+    g_jobs.start(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    // Decodes and encodes of hundreds of milliseconds: on workers of their own, which the frames preempt
+    g_loadJobs.start(std::max(std::thread::hardware_concurrency(), 1u) - 1, true);
+
+    // Texture decodes start now and overlap the creation of the window; until a texture is uploaded, its
+    // placeholder is drawn
+    if (!g_scene.open(sceneFilename)) {
+        std::cerr << "ERROR: cannot load the scene " << sceneFilename << " (missing or not built by tools/scene_compiler)" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    // Tiled textures are streamed instead, from their first frame on
+    g_textures.setJobSystem(&g_loadJobs);
+    g_sceneTextureSlots.assign(g_scene.getNumTextures(), 0);
+    g_sceneVirtualTextures.assign(g_scene.getNumTextures(), static_cast<uint32_t>(RenderPool::kNoVirtualTexture));
+    for (uint32_t t = 0; t < g_scene.getNumTextures(); ++t) {
+        const char* filename = g_scene.getTexture(t);
+        if (isVirtualTextureFile(filename)) {
+            std::unique_ptr<VirtualTexture> texture(new VirtualTexture());
+            if (g_virtualTextures.size() < kMaxVirtualTextures && texture->open(filename)) {
+                g_sceneVirtualTextures[t] = static_cast<uint32_t>(g_virtualTextures.size());
+                g_virtualTextures.push_back(std::move(texture));
+                continue;
+            }
+            std::cerr << "WARNING: cannot open the virtual texture " << filename << " (missing, more than " << kMaxVirtualTextures
+                      << ", or not built by tools/texture_tiler)" << std::endl;
+        }
+        g_sceneTextureSlots[t] = g_textures.request(filename, g_assets.findTexture(filename));
+    }
 
     initGLFW();
     initOpenGL();
     initGPUprogram();
-    g_earthTexID = loadTextureFromFileToGPU("media/earth.jpg");
-    g_moonTexID = loadTextureFromFileToGPU("media/moon.jpg");
-    g_sunTexID = loadTextureFromFileToGPU("media/sun.jpg");
-    int radius = 1;
-
-    Mesh* terra = new Mesh();
-    terra->init(radius * kSizeEarth);
+    g_textures.initGPU();
+    for (size_t v = 0; v < g_virtualTextures.size(); ++v) {
+        if (!g_virtualTextures[v]->initGPU(kVirtualTextureSlotsPerSide)) {
+            std::cerr << "ERROR: cannot read the coarsest tiles of " << g_virtualTextures[v]->getFilename() << ", drawn grey" << std::endl;
+        }
+    }
 
-    Mesh* lua = new Mesh();
-    lua->init(radius * kSizeMoon);
+    // Every body is the same unit sphere, scaled by its radius
+    RenderSystem renderSystem;
+    renderSystem.init();
+    std::unique_ptr<Mesh> sphere(new Mesh());
+    const PackedMesh* packedSphere = g_assets.findMesh("sphere");
+    if (packedSphere) {
+        sphere->init(packedSphere);
+    }
+    else {
+        sphere->init(1.0f);
+    }
+    const uint32_t sphereMesh = renderSystem.addMesh(std::move(sphere));
+    renderSystem.setVirtualTextures(&g_virtualTextures);
+    renderSystem.setTextureLoader(&g_textures);
+
+    // The sky: the catalog is mapped, not parsed, and stays open for changes of the magnitude limit
+    StarCatalog starCatalog;
+    StarFieldRenderer starField;
+    if (starCatalog.open(starCatalogFilename)) {
+        starField.init(starCatalog);
+        renderSystem.setStarField(&starField);
+        std::cout << "Loaded " << starField.getNumStars() << " stars from " << starCatalogFilename << std::endl;
+    }
+    else {
+        std::cerr << "WARNING: cannot open the star catalog " << starCatalogFilename << " (build it with tools/star_compiler)" << std::endl;
+    }
 
-    Mesh* sol = new Mesh();
-    sol->init(radius * kSizeSun);
+    // A star octree, for catalogs too large for memory, streams in place of the star field (see point_octree.h)
+    PointOctreeStreamer octree;
+    if (!octreeFilename.empty()) {
+        if (octree.open(octreeFilename)) {
+            octree.setUnitScale(kSceneUnitsPerParsec);
+            renderSystem.setStarField(nullptr);
+            renderSystem.setOctree(&octree);
+            std::cout << "Streaming " << octree.getNumNodes() << " octree nodes from " << octreeFilename << std::endl;
+        }
+        else {
+            std::cerr << "WARNING: cannot open the star octree " << octreeFilename << " (build it with tools/octree_compiler)" << std::endl;
+        }
+    }
 
     initCamera();
+    EphemerisTrajectories ephemerisTrajectories(g_ephemeris, 0.0);
+    const std::vector<Entity> sceneEntities = loadScene(sceneFilename, ephemerisTrajectories, sphereMesh);
+
+    g_simulationStep = g_simulationTimeScale / kSimulationStepsPerSecond;
+    g_simulation.setStepSize(g_simulationStep);
+    g_simulation.setIntegrator(kIntegratorAdaptive);
+    g_simulation.setTolerance(kSimulationTolerance);
+    // Bodies meeting within a macro step, before their collision is resolved, pull at most as hard as at the
+    // surface of the smallest one
+    double smallestRadius = 0.0;
+    for (uint32_t id = 0; id < g_simulation.getNumBodies(); ++id) {
+        const double radius = g_simulation.getRadius(id);
+        if (radius > 0.0 && (smallestRadius == 0.0 || radius < smallestRadius)) {
+            smallestRadius = radius;
+        }
+    }
+    g_simulation.setSoftening(smallestRadius);
+    g_simulation.setCollisionResponse(kCollisionMerge);
+    g_simulation.setJobSystem(&g_jobs);
+
+    if (!replayFilename.empty()) {
+        if (!g_replay.open(replayFilename) || !g_replay.seekTime(g_simulation, seekTime, &g_replayKeyHandler)) {
+            std::cerr << "ERROR: cannot replay " << replayFilename << " (missing file, or recorded with another scene)" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        g_replaying = true;
+    }
+    else if (!recordFilename.empty()) {
+        if (g_recorder.open(recordFilename, g_simulationStep)) {
+            g_recorder.recordStep(g_simulation); // initial keyframe, so that a replay can start from time 0
+        }
+        else {
+            std::cerr << "ERROR: cannot write " << recordFilename << std::endl;
+        }
+    }
 
+    // Trails of the first bodies, with the color of their material; samples are stored in float relative
+    // to the first body (usually the central star)
+    const OrbitPool& orbits = g_entities.getOrbits();
+    g_trails.init(kMaxTrails, kTrailSamples);
+    if (g_entities.getPhysics().size() > 0) {
+        g_trails.setAnchor(g_simulation.getPosition(g_entities.getPhysics().bodies[0]));
+    }
+    for (uint32_t o = 0; o < orbits.size(); ++o) {
+        if (orbits.trails[o] != OrbitPool::kNoTrail) {
+            g_trails.setColor(orbits.trails[o], orbits.colors[o]);
+        }
+    }
+    g_trails.append(g_simulation.getPositions().data(), static_cast<uint32_t>(g_simulation.getNumBodies()));
+
+    // From here on, the simulation belongs to its thread
+    g_trailEvents.stride = std::max<size_t>(std::min<size_t>(g_simulation.getNumBodies(), kMaxTrails), 1);
+    publishSnapshot();
+    g_lastUpdateTime = glfwGetTime();
+    g_simulationRunning = true;
+    g_simulationThread = std::thread(simulationLoop);
+
+    // Per frame: sync the simulation, place and report, then draw
+    PhysicsSyncSystem physicsSyncSystem;
+    TransformSystem transformSystem;
+    MergeReportSystem mergeReportSystem;
+    CameraFollowSystem cameraFollowSystem;
+    const uint32_t cameraFollow = g_scene.getHeader().cameraFollow;
+    if (cameraFollow != kSceneNone) {
+        cameraFollowSystem.follow(sceneEntities[cameraFollow], g_camera.getPosition());
+    }
+    SystemSchedule schedule;
+    schedule.add(&physicsSyncSystem);
+    schedule.add(&transformSystem);
+    schedule.add(&mergeReportSystem);
+    schedule.add(&cameraFollowSystem);
+    schedule.add(&renderSystem);
 
     //init(); // Your initialization code (user interface, OpenGL states, scene with geometry, material, lights, etc)
     viewMatrix = g_camera.computeViewMatrix();
     projMatrix = g_camera.computeProjectionMatrix();
 
-    const float orbitPeriodTerra = 10.0f;
-    const float spinPeriodTerra = orbitPeriodTerra / 2;
-    const float omegaOrbitTerra = 360.0f / orbitPeriodTerra;
-    const float omegaSpinTerra = 360.0f / spinPeriodTerra;
-
-    const float orbitPeriodLua = spinPeriodTerra / 2.0f;
-    const float spinPeriodLua = orbitPeriodLua;
-    const float omegaOrbitLua = 360.0f / orbitPeriodLua;
-    const float omegaSpinLua = omegaOrbitLua;
-
     while (!glfwWindowShouldClose(g_window)) {
-        update(static_cast<float>(glfwGetTime()));
+        pickUpSnapshot();
+        g_textures.update();
         //init(); // Your initialization code (user interface, OpenGL states, scene with geometry, material, lights, etc)
-        viewMatrix = g_camera.computeViewMatrix();
-        projMatrix = g_camera.computeProjectionMatrix();
-        float currentTime = glfwGetTime();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Erase the color and z buffers.
-        // theta = wt o w = 2*PI/period
-
-        GLuint m_vao = sol->get_m_vao();
-
-        //sol->render(transformationMatrix, g_earthTexID);
-        M = glm::mat4(1.0);
-        glm::mat4 transformationMatrix = projMatrix * viewMatrix * M;
-        glUniform1i(glGetUniformLocation(g_program, "sunFlag"), 1);
-        sol->render(transformationMatrix, g_sunTexID);
-
-        m_vao = terra->get_m_vao();
-
-        float spinAngleTerra = omegaSpinTerra * currentTime;
-        float orbitAngleTerra = omegaOrbitTerra * currentTime;
-        glm::vec4 center = glm::vec4(10.0f, 0.0f, 0.0f, 1.0f);
-        glm::mat4 orbitMatrix = glm::rotate(glm::radians(orbitAngleTerra), glm::vec3(0.0f, 1.0f, 0.0f));
-        center = orbitMatrix * center;
-        glm::vec3 vec3CenterTerra = glm::vec3(center);
-        /*
-        transformationMatrix = glm::translate(projMatrix * viewMatrix, vec3CenterTerra);
-        */
-        M = glm::translate(vec3CenterTerra);
-        //M = glm::translate(glm::vec3(10.0f, 0.0f, 0.0f));
-        float spinAngleLua = omegaSpinLua * currentTime;
-        glm::mat4 rotateMatrix = glm::rotate(glm::radians(spinAngleLua), glm::vec3(0.0f, 1.0f, 0.0f));
-        rotateMatrix = rotateMatrix * glm::rotate(glm::radians(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        M = M * rotateMatrix;
-
-        transformationMatrix = projMatrix * viewMatrix * M;
-        //terra->render(transformationMatrix, g_earthTexID);
-        glUniform1i(glGetUniformLocation(g_program, "sunFlag"), 0);
-        terra->render(transformationMatrix, g_earthTexID);
-
-
-        float orbitAngleLua = omegaOrbitLua * currentTime;
-        center = glm::vec4(2.0f, 0.0f, 0.0f, 1.0f);
-        orbitMatrix = glm::rotate(glm::radians(orbitAngleLua), glm::vec3(0.0f, 1.0f, 0.0f));
-        center = orbitMatrix * center;
-        glm::vec3 vec3CenterLua = glm::vec3(center);
-        vec3CenterLua = vec3CenterLua + vec3CenterTerra;
-        m_vao = lua->get_m_vao();
-        M = glm::translate(vec3CenterLua);
-
-        rotateMatrix = glm::rotate(glm::radians(spinAngleTerra), glm::vec3(0.0f, 1.0f, 0.0f));
-        rotateMatrix = rotateMatrix * glm::rotate(glm::radians(23.5f), glm::vec3(0.0f, 0.0f, 1.0f));
-        M = M * rotateMatrix;
-
-        transformationMatrix = projMatrix * viewMatrix * M;
-        //glm::mat4 rotationMatrix = glm::rotate(1.0f , glm::vec3(0.0f, 1.0f, 0.0f));
-        glUniform1i(glGetUniformLocation(g_program, "sunFlag"), 0);
-        lua->render(transformationMatrix, g_moonTexID);
-
-        const glm::vec3 camPosition = g_camera.getPosition();
-        glUniform3f(glGetUniformLocation(g_program, "camPos"), camPosition[0], camPosition[1], camPosition[2]);
+        schedule.run(g_entities, g_entities.getNumEntities() >= kParallelSystemsEntities ? &g_jobs : nullptr);
+
+        // Trails last: they are blended over the bodies without writing depth
+        if (g_trailsVisible) {
+            g_trails.render(projMatrix * viewMatrix, g_camera.getPosition(), computeLogDepthCoefficient(g_camera.getFar()));
+        }
 
         glfwSwapBuffers(g_window);
         glfwPollEvents();
     }
+    g_simulationRunning = false;
+    g_simulationThread.join();
+    renderSystem.clear();
+    octree.close();
+    starField.clear();
     clear();
+    g_loadJobs.stop();
+    g_jobs.stop();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
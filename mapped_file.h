@@ -0,0 +1,49 @@
+// ----------------------------------------------------------------------------
+// mapped_file.h
+//
+// Description: Read-only memory mapping of a whole file. Binary assets built
+//              by the tools/ programs are consumed in place through this
+//              class, so nothing is parsed or copied at startup.
+// ----------------------------------------------------------------------------
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+class MappedFile {
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+
+    // Maps the whole file in memory. Returns false if the file cannot be opened or is empty.
+    bool open(const std::string& filename);
+    void close();
+
+    inline bool isOpen() const { return m_data != nullptr; }
+    inline const unsigned char* data() const { return m_data; }
+    inline size_t size() const { return m_size; }
+
+    // Returns a typed pointer at the given byte offset, or nullptr if [offset, offset + count * sizeof(T)) is outside of the file.
+    template <typename T>
+    const T* at(size_t offset, size_t count = 1) const {
+        if (offset > m_size || count > (m_size - offset) / sizeof(T)) {
+            return nullptr;
+        }
+        return reinterpret_cast<const T*>(m_data + offset);
+    }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_fileHandle = nullptr;
+    void* m_mappingHandle = nullptr;
+#endif
+};
+
+#endif // MAPPED_FILE_H
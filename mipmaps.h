@@ -0,0 +1,135 @@
+// ----------------------------------------------------------------------------
+// mipmaps.h
+//
+// Description: Mipmap levels computed on the CPU: baked into the asset pack by
+//              tools/asset_packer.cpp, into the virtual textures by
+//              tools/texture_tiler.cpp, and at runtime by textures.h for a
+//              texture that is not in the pack. Each level is the 2x2 box
+//              filter of the previous one, averaged in linear light: the color
+//              channels of the images are sRGB encoded, and averaging the
+//              encoded values darkens contrasted detail (terminators, cloud
+//              edges, rings) as the body recedes. Colors are decoded through a
+//              table, averaged and encoded back through another; alpha is
+//              averaged as it is. The averages run on SSE2 when it is
+//              available, four channels at a time.
+// ----------------------------------------------------------------------------
+
+#ifndef MIPMAPS_H
+#define MIPMAPS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPMAPS_SSE2
+#endif
+
+const static uint32_t kMipEncodeSteps = 16384; // linear values per step of the encoding table: exact to the byte
+
+struct MipTables {
+    float decode[256];                          // sRGB byte to linear, in [0, 1]
+    unsigned char encode[kMipEncodeSteps + 1];  // linear, times kMipEncodeSteps, to sRGB byte
+};
+
+inline const MipTables& getMipTables() {
+    struct Builder {
+        MipTables tables;
+        Builder() {
+            for (int i = 0; i < 256; ++i) {
+                const double c = i / 255.0;
+                tables.decode[i] = static_cast<float>(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            for (uint32_t i = 0; i <= kMipEncodeSteps; ++i) {
+                const double l = static_cast<double>(i) / kMipEncodeSteps;
+                const double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+                tables.encode[i] = static_cast<unsigned char>(std::min(c * 255.0 + 0.5, 255.0));
+            }
+        }
+    };
+    static const Builder builder; // built once, thread-safe
+    return builder.tables;
+}
+
+// Whether the channel holds alpha, which is linear: the last one of luminance-alpha and RGBA images.
+inline bool isAlphaChannel(const uint32_t channel, const uint32_t components) {
+    return (components == 2 || components == 4) && channel == components - 1;
+}
+
+// Next mipmap level of a tightly packed 8 bit image: each texel is the mean, in linear light, of the 2x2 (or
+// 2x1 at odd edges) texels it covers.
+inline void downsampleGammaCorrect(const unsigned char* src, const uint32_t width, const uint32_t height, const uint32_t components,
+                                   std::vector<unsigned char>& dst, uint32_t& dstWidth, uint32_t& dstHeight) {
+    const MipTables& tables = getMipTables();
+    dstWidth = std::max(width / 2, 1u);
+    dstHeight = std::max(height / 2, 1u);
+    dst.resize(size_t(dstWidth) * dstHeight * components);
+
+    // Linear values of the two source rows, then their sums; each channel is scaled to its encoding: the
+    // steps of the table for colors, bytes for alpha
+    const size_t rowSize = size_t(width) * components;
+    std::vector<float> rows(2 * rowSize);
+    float* row0 = rows.data();
+    float* row1 = row0 + rowSize;
+    float scales[4];
+    for (uint32_t c = 0; c < 4; ++c) {
+        scales[c] = 0.25f * (c < components && isAlphaChannel(c, components) ? 255.0f : static_cast<float>(kMipEncodeSteps));
+    }
+    for (uint32_t y = 0; y < dstHeight; ++y) {
+        const unsigned char* src0 = src + size_t(std::min(2 * y, height - 1)) * rowSize;
+        const unsigned char* src1 = src + size_t(std::min(2 * y + 1, height - 1)) * rowSize;
+        for (size_t i = 0; i < rowSize; ++i) {
+            const uint32_t c = static_cast<uint32_t>(i % components);
+            const bool alpha = isAlphaChannel(c, components);
+            row0[i] = alpha ? src0[i] / 255.0f : tables.decode[src0[i]];
+            row1[i] = alpha ? src1[i] / 255.0f : tables.decode[src1[i]];
+        }
+        size_t i = 0;
+#ifdef MIPMAPS_SSE2
+        for (; i + 4 <= rowSize; i += 4) {
+            _mm_storeu_ps(row0 + i, _mm_add_ps(_mm_loadu_ps(row0 + i), _mm_loadu_ps(row1 + i)));
+        }
+#endif
+        for (; i < rowSize; ++i) {
+            row0[i] += row1[i];
+        }
+
+        unsigned char* out = dst.data() + size_t(y) * dstWidth * components;
+#ifdef MIPMAPS_SSE2
+        if (components == 4) {
+            const __m128 scale = _mm_loadu_ps(scales);
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128 limit = _mm_set_ps(255.0f, static_cast<float>(kMipEncodeSteps), static_cast<float>(kMipEncodeSteps),
+                                          static_cast<float>(kMipEncodeSteps));
+            for (uint32_t x = 0; x < dstWidth; ++x) {
+                const uint32_t x1 = std::min(2 * x + 1, width - 1);
+                const __m128 sum = _mm_add_ps(_mm_loadu_ps(row0 + size_t(2 * x) * 4), _mm_loadu_ps(row0 + size_t(x1) * 4));
+                int32_t encoded[4];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(encoded),
+                                 _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(_mm_mul_ps(sum, scale), half), limit))); // rounded like below
+                out[4 * x + 0] = tables.encode[encoded[0]];
+                out[4 * x + 1] = tables.encode[encoded[1]];
+                out[4 * x + 2] = tables.encode[encoded[2]];
+                out[4 * x + 3] = static_cast<unsigned char>(encoded[3]);
+            }
+            continue;
+        }
+#endif
+        for (uint32_t x = 0; x < dstWidth; ++x) {
+            const uint32_t x0 = 2 * x, x1 = std::min(2 * x + 1, width - 1);
+            for (uint32_t c = 0; c < components; ++c) {
+                const float sum = row0[size_t(x0) * components + c] + row0[size_t(x1) * components + c];
+                if (isAlphaChannel(c, components)) {
+                    out[x * components + c] = static_cast<unsigned char>(std::min(sum * scales[c] + 0.5f, 255.0f));
+                }
+                else {
+                    out[x * components + c] = tables.encode[std::min(static_cast<uint32_t>(sum * scales[c] + 0.5f), kMipEncodeSteps)];
+                }
+            }
+        }
+    }
+}
+
+#endif // MIPMAPS_H
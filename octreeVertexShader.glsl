@@ -0,0 +1,31 @@
+#version 330 core
+// One point per star of a resident octree node (see point_octree.h)
+layout(location=0) in vec3 vPosition; // parsecs, relative to the center of the node
+layout(location=1) in float vAbsMagnitude;
+layout(location=2) in float vColorIndex; // B-V
+uniform mat4 projView;
+uniform vec3 nodeOffset; // center of the node relative to the camera, in scene units
+uniform float unitScale; // scene units per parsec
+
+out vec4 fColor;
+
+// Blackbody color of the temperature given by the color index, as in starVertexShader.glsl
+vec3 colorOfIndex(float bv) {
+float t = 4600.0 * (1.0 / (0.92 * bv + 1.7) + 1.0 / (0.92 * bv + 0.62)) / 100.0;
+float r = (t <= 66.0) ? 1.0 : 1.292936 * pow(t - 60.0, -0.1332047);
+float g = (t <= 66.0) ? 0.3900816 * log(t) - 0.6318414 : 1.1298909 * pow(t - 60.0, -0.0755148);
+float b = (t >= 66.0) ? 1.0 : ((t <= 19.0) ? 0.0 : 0.5432068 * log(t - 10.0) - 1.1962541);
+return clamp(vec3(r, g, b), 0.0, 1.0);
+}
+
+void main() {
+vec3 position = nodeOffset + vPosition * unitScale;
+// Apparent magnitude from the current distance: m = M + 5 log10(d / 10 pc)
+float distance = max(length(position) / unitScale, 1e-6);
+float magnitude = vAbsMagnitude + 5.0 * log(distance * 0.1) / log(10.0);
+float flux = pow(10.0, -0.4 * magnitude);
+gl_PointSize = clamp(2.0 * sqrt(flux), 1.0, 5.0);
+fColor = vec4(colorOfIndex(vColorIndex), clamp(pow(flux, 0.35), 0.0, 1.0));
+gl_Position = projView * vec4(position, 1.0);
+gl_Position.z = 0.0; // depth is not tested; keeps the star inside the clip volume whatever the far plane
+}
@@ -0,0 +1,11 @@
+#version 330 core
+in vec3 fPos;
+uniform uint objectId;
+
+layout(location=0) out uint id;
+layout(location=1) out float distance; // from the camera
+
+void main() {
+    id = objectId;
+    distance = length(fPos);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+layout(location=0) in vec3 vPos;
+uniform mat4 pickProjView; // pick matrix * projection * view, camera-relative (see world.h)
+uniform mat4 model;        // relative to the camera
+uniform float logDepthCoef; // 2 / log2(far + 1)
+
+out vec3 fPos; // relative to the camera
+
+void main() {
+    vec4 p = model * vec4(vPos, 1.0);
+    fPos = p.xyz;
+    gl_Position = pickProjView * p;
+    // Same logarithmic depth as vertexShader.glsl, so that the nearest surface wins
+    gl_Position.z = (log2(max(1e-6, 1.0 + gl_Position.w)) * logDepthCoef - 1.0) * gl_Position.w;
+}
@@ -0,0 +1,151 @@
+// ----------------------------------------------------------------------------
+// picking.h
+//
+// Description: Selection of the body under the cursor. The cursor defines a
+//              ray from the camera, tested against the bounding spheres of the
+//              frustum culler (see culling.h) in logarithmic time. For exact
+//              hits on the rendered meshes rather than on their spheres, the
+//              candidates along the ray can be drawn into a one-pixel ID buffer
+//              restricted to the cursor, which gives the nearest one and its
+//              distance.
+// ----------------------------------------------------------------------------
+
+#ifndef PICKING_H
+#define PICKING_H
+
+#include "gpu_resources.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+void loadShader(GLuint program, GLenum type, const std::string& shaderFilename); // main.cpp
+
+const static uint32_t kNoPick = 0xFFFFFFFFu;
+
+// Unit direction, in world axes, of the ray through a pixel (window coordinates, origin at the top left) of
+// the viewport, for the camera-relative projection * view (see world.h). The ray starts at the camera.
+inline glm::dvec3 computePickDirection(const double x, const double y, const GLint viewport[4], const glm::mat4& projView) {
+    const double ndcX = 2.0 * (x - viewport[0]) / viewport[2] - 1.0;
+    const double ndcY = 1.0 - 2.0 * (y - viewport[1]) / viewport[3];
+    const glm::dmat4 inverse = glm::inverse(glm::dmat4(projView));
+    const glm::dvec4 p = inverse * glm::dvec4(ndcX, ndcY, 1.0, 1.0);
+    return glm::normalize(glm::dvec3(p) / p.w); // the camera is the origin
+}
+
+// Projection of the pixel (window coordinates) onto a whole 1x1 viewport: applied before the projection, like
+// gluPickMatrix.
+inline glm::mat4 computePickMatrix(const double x, const double y, const GLint viewport[4]) {
+    const double pixelX = x - viewport[0];
+    const double pixelY = viewport[3] - (y - viewport[1]); // OpenGL rows go up
+    glm::mat4 pick(1.0f);
+    pick[0][0] = static_cast<float>(viewport[2]);
+    pick[1][1] = static_cast<float>(viewport[3]);
+    pick[3][0] = static_cast<float>(viewport[2] - 2.0 * pixelX);
+    pick[3][1] = static_cast<float>(viewport[3] - 2.0 * pixelY);
+    return pick;
+}
+
+// One pixel target holding the ID and the distance from the camera of the nearest surface drawn.
+class PickBuffer {
+public:
+    void init() {
+        m_program.create();
+        loadShader(m_program.get(), GL_VERTEX_SHADER, "pickVertexShader.glsl");
+        loadShader(m_program.get(), GL_FRAGMENT_SHADER, "pickFragmentShader.glsl");
+        glLinkProgram(m_program.get());
+
+        m_ids.create(kGpuPicking);
+        glBindTexture(GL_TEXTURE_2D, m_ids.get());
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, 1, 1, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        m_ids.setBytes(sizeof(uint32_t));
+        m_distances.create(kGpuPicking);
+        glBindTexture(GL_TEXTURE_2D, m_distances.get());
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, 1, 1, 0, GL_RED, GL_FLOAT, nullptr);
+        m_distances.setBytes(sizeof(float));
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_depth.create(kGpuPicking);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_depth.get());
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 1, 1);
+        m_depth.setBytes(4);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        m_framebuffer.create(kGpuPicking);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer.get());
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_ids.get(), 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_distances.get(), 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth.get());
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "WARNING: the pick buffer is not supported, picking falls back to bounding spheres" << std::endl;
+            m_framebuffer.reset();
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void clear() {
+        m_framebuffer.reset();
+        m_depth.reset();
+        m_distances.reset();
+        m_ids.reset();
+        m_program.reset();
+    }
+
+    inline bool isAvailable() const { return m_framebuffer.get() != 0; }
+
+    // Starts drawing into the pixel; pickProjView is computePickMatrix * the camera-relative projection * view.
+    void begin(const glm::mat4& pickProjView, const float logDepthCoef) {
+        glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer.get());
+        glViewport(0, 0, 1, 1);
+        const GLuint noId[4] = { kNoPick, 0, 0, 0 };
+        const GLfloat noDistance[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        const GLfloat farDepth = 1.0f;
+        glClearBufferuiv(GL_COLOR, 0, noId);
+        glClearBufferfv(GL_COLOR, 1, noDistance);
+        glClearBufferfv(GL_DEPTH, 0, &farDepth);
+        glUseProgram(m_program.get());
+        glUniformMatrix4fv(glGetUniformLocation(m_program.get(), "pickProjView"), 1, GL_FALSE, glm::value_ptr(pickProjView));
+        glUniform1f(glGetUniformLocation(m_program.get(), "logDepthCoef"), logDepthCoef);
+        m_modelLocation = glGetUniformLocation(m_program.get(), "model");
+        m_idLocation = glGetUniformLocation(m_program.get(), "objectId");
+    }
+
+    // The object drawn next (by binding its vertex array and drawing it) and its camera-relative model matrix.
+    void setObject(const uint32_t id, const glm::mat4& model) {
+        glUniformMatrix4fv(m_modelLocation, 1, GL_FALSE, glm::value_ptr(model));
+        glUniform1ui(m_idLocation, id);
+    }
+
+    // Reads the nearest object back (kNoPick if none) and restores the default framebuffer. Waits for the GPU:
+    // call once per pick, not per frame.
+    uint32_t end(float& distance) {
+        uint32_t id = kNoPick;
+        distance = 0.0f;
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, &id);
+        glReadBuffer(GL_COLOR_ATTACHMENT1);
+        glReadPixels(0, 0, 1, 1, GL_RED, GL_FLOAT, &distance);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+        return id;
+    }
+
+private:
+    GpuProgram m_program;
+    GpuTexture m_ids;
+    GpuTexture m_distances;
+    GpuRenderbuffer m_depth;
+    GpuFramebuffer m_framebuffer;
+    GLint m_modelLocation = -1;
+    GLint m_idLocation = -1;
+    GLint m_savedViewport[4] = { 0, 0, 0, 0 };
+};
+
+#endif // PICKING_H
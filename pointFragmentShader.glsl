@@ -0,0 +1,13 @@
+#version 330 core
+in vec4 fColor;
+in float fSize;
+out vec4 color;
+
+void main() {
+// Round sprites once they span several pixels; a single pixel is kept whole
+vec2 d = gl_PointCoord - vec2(0.5);
+if (fSize > 1.5 && dot(d, d) > 0.25) {
+	discard;
+}
+color = fColor;
+}
@@ -0,0 +1,17 @@
+#version 330 core
+// One point per body too small for its mesh (see points.h)
+layout(location=0) in vec4 vPositionSize; // camera-relative position, diameter in pixels
+layout(location=1) in vec4 vColorCoverage; // lit color, fraction of the pixel covered
+uniform mat4 projView;
+uniform float logDepthCoef; // 2 / log2(far + 1)
+
+out vec4 fColor;
+out float fSize;
+
+void main() {
+fColor = vColorCoverage;
+fSize = vPositionSize.w;
+gl_PointSize = vPositionSize.w;
+gl_Position = projView * vec4(vPositionSize.xyz, 1.0);
+gl_Position.z = (log2(max(1e-6, 1.0 + gl_Position.w)) * logDepthCoef - 1.0) * gl_Position.w;
+}
@@ -0,0 +1,432 @@
+// ----------------------------------------------------------------------------
+// point_octree.h
+//
+// Description: Out-of-core level-of-detail octree of stars, for datasets far
+//              larger than memory. tools/octree_compiler.cpp builds the file;
+//              each node holds the brightest (absolute magnitude) of the points
+//              of its cube that no ancestor took, so drawing a node and its
+//              ancestors gives a representative subset of the stars of its cube.
+//
+//              At runtime the node table is read at open; points are streamed
+//              per node by a background I/O thread, in the order of their screen
+//              space error, and uploaded a few nodes per frame. Resident nodes
+//              are kept under a point budget, evicting the least recently used.
+//              The render loop never waits: a node that is not resident yet is
+//              simply not refined.
+// ----------------------------------------------------------------------------
+
+#ifndef POINT_OCTREE_H
+#define POINT_OCTREE_H
+
+#include "culling.h"
+#include "gpu_resources.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+void loadShader(GLuint program, GLenum type, const std::string& shaderFilename); // main.cpp
+
+// ---- Binary file layout ----------------------------------------------------
+// [PointOctreeHeader][padding][numPoints * OctreePoint][numNodes * OctreeNode]
+// Node 0 is the root; the points of a node are contiguous.
+
+const static char kPointOctreeMagic[8] = { 'O', 'C', 'T', 'B', 'I', 'N', '0', '1' };
+const static uint32_t kOctreeNone = 0xFFFFFFFFu;
+
+struct OctreePoint {
+    float position[3];   // parsecs, relative to the center of the node, in scene axes (see star_catalog.h)
+    float absMagnitude;
+    float colorIndex;    // B-V
+};
+
+struct OctreeNode {
+    double center[3];    // parsecs
+    double halfSize;
+    uint64_t firstPoint;
+    uint32_t numPoints;
+    uint32_t depth;
+    uint32_t children[8]; // node indices, or kOctreeNone
+};
+
+struct PointOctreeHeader {
+    char magic[8];
+    uint32_t numNodes;
+    uint32_t pointSize; // sizeof(OctreePoint)
+    uint64_t numPoints;
+    uint64_t pointsOffset;
+    uint64_t nodesOffset;
+};
+
+// ---- Runtime streaming ------------------------------------------------------
+
+class PointOctreeStreamer {
+public:
+    PointOctreeStreamer() {}
+    ~PointOctreeStreamer() { close(); }
+
+    // Reads the node table and starts the I/O thread. Returns false on a missing or malformed file.
+    bool open(const std::string& filename) {
+        close();
+        std::ifstream file(filename.c_str(), std::ios::binary);
+        PointOctreeHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, kPointOctreeMagic, sizeof(kPointOctreeMagic)) != 0 ||
+            header.pointSize != sizeof(OctreePoint) || header.numNodes == 0) {
+            return false;
+        }
+        m_nodes.resize(header.numNodes);
+        file.seekg(static_cast<std::streamoff>(header.nodesOffset));
+        if (!file.read(reinterpret_cast<char*>(m_nodes.data()), m_nodes.size() * sizeof(OctreeNode)) ||
+            !validNodes(header.numPoints)) {
+            m_nodes.clear();
+            return false;
+        }
+        m_filename = filename;
+        m_pointsOffset = header.pointsOffset;
+        m_states.assign(m_nodes.size(), kUnloaded);
+        m_lastUsed.assign(m_nodes.size(), 0);
+        m_gpu.clear();
+        m_gpu.resize(m_nodes.size());
+
+        m_program.create();
+        loadShader(m_program.get(), GL_VERTEX_SHADER, "octreeVertexShader.glsl");
+        loadShader(m_program.get(), GL_FRAGMENT_SHADER, "octreeFragmentShader.glsl");
+        glLinkProgram(m_program.get());
+
+        m_stop = false;
+        m_ioThread = std::thread(&PointOctreeStreamer::ioLoop, this);
+        return true;
+    }
+
+    void close() {
+        if (m_ioThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_all();
+            m_ioThread.join();
+        }
+        for (size_t n = 0; n < m_gpu.size(); ++n) {
+            releaseNode(static_cast<uint32_t>(n));
+        }
+        m_program.reset();
+        m_nodes.clear();
+        m_states.clear();
+        m_lastUsed.clear();
+        m_gpu.clear();
+        m_requests.clear();
+        m_completed.clear();
+        m_residentPoints = 0;
+    }
+
+    inline bool isOpen() const { return !m_nodes.empty(); }
+    inline size_t getNumNodes() const { return m_nodes.size(); }
+    inline uint64_t getResidentPoints() const { return m_residentPoints; }
+    inline uint32_t getLastDrawnNodes() const { return m_drawnNodes; }
+    inline uint64_t getLastDrawnPoints() const { return m_drawnPoints; }
+
+    inline void setPointBudget(const uint64_t points) { m_pointBudget = points; }
+    inline void setMaxError(const float pixels) { m_maxError = pixels; }       // spacing of the points on screen
+    inline void setUnitScale(const double sceneUnitsPerParsec) { m_unitScale = sceneUnitsPerParsec; }
+    inline void setUploadsPerFrame(const uint32_t nodes) { m_uploadsPerFrame = nodes; }
+
+    // Uploads the nodes read since the last frame, selects the nodes to draw by screen-space error, draws the
+    // resident ones and requests the missing ones. Never blocks on I/O. Drawn as a background, like the star
+    // field: call right after clearing.
+    void render(const glm::mat4& projView, const glm::dvec3& cameraPosition, const double pixelsPerRadian) {
+        if (!isOpen()) {
+            return;
+        }
+        ++m_frame;
+        uploadCompleted();
+
+        const Frustum frustum = computeFrustum(projView);
+        m_drawList.clear();
+        m_wanted.clear();
+        m_stack.clear();
+        m_stack.push_back(0);
+        while (!m_stack.empty()) {
+            const uint32_t n = m_stack.back();
+            m_stack.pop_back();
+            const OctreeNode& node = m_nodes[n];
+            const glm::dvec3 center = glm::dvec3(node.center[0], node.center[1], node.center[2]) * m_unitScale - cameraPosition;
+            const double radius = node.halfSize * 1.7320508 * m_unitScale;
+            if (!sphereInFrustum(frustum, glm::vec3(center), static_cast<float>(radius))) {
+                continue;
+            }
+            if (m_states[n] == kFailed) {
+                continue;
+            }
+            m_lastUsed[n] = m_frame;
+            const double error = computeError(node, glm::length(center) - radius, pixelsPerRadian);
+            if (m_states[n] != kResident) {
+                m_wanted.push_back(Request(n, static_cast<float>(error)));
+                continue; // coarse before fine: children wait for their parent
+            }
+            m_drawList.push_back(n);
+            if (error > m_maxError) {
+                for (int c = 0; c < 8; ++c) {
+                    if (node.children[c] != kOctreeNone) {
+                        m_stack.push_back(node.children[c]);
+                    }
+                }
+            }
+        }
+        publishRequests();
+        evict();
+        draw(projView, cameraPosition);
+    }
+
+private:
+    enum NodeState { kUnloaded = 0, kRequested, kResident, kFailed }; // failed reads are neither drawn nor retried
+
+    struct Request {
+        Request() {}
+        Request(uint32_t n, float p) : node(n), priority(p) {}
+        uint32_t node;
+        float priority; // screen-space error
+    };
+
+    struct Completed {
+        uint32_t node;
+        std::vector<OctreePoint> points;
+        bool failed;
+    };
+
+    struct GpuNode {
+        GpuVertexArray vao;
+        GpuBuffer vbo;
+    };
+
+    static bool lowerPriority(const Request& a, const Request& b) { return a.priority < b.priority; }
+
+    // Points of every node inside the file, children inside the table and one level deeper, so that the
+    // traversal ends.
+    bool validNodes(const uint64_t numPoints) const {
+        for (size_t n = 0; n < m_nodes.size(); ++n) {
+            const OctreeNode& node = m_nodes[n];
+            if (node.numPoints > numPoints || node.firstPoint > numPoints - node.numPoints) {
+                return false;
+            }
+            for (int c = 0; c < 8; ++c) {
+                const uint32_t child = node.children[c];
+                if (child != kOctreeNone && (child >= m_nodes.size() || m_nodes[child].depth != node.depth + 1)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Spacing of the points of the node on screen, in pixels, seen from the given distance.
+    double computeError(const OctreeNode& node, const double distance, const double pixelsPerRadian) const {
+        if (distance <= 0.0) {
+            return HUGE_VAL; // inside: always refine
+        }
+        const double spacing = 2.0 * node.halfSize * m_unitScale / std::cbrt(static_cast<double>(std::max(node.numPoints, 1u)));
+        return spacing / distance * pixelsPerRadian;
+    }
+
+    // The far plane is ignored: stars are drawn whatever their distance, like the star field.
+    static bool sphereInFrustum(const Frustum& frustum, const glm::vec3& center, const float radius) {
+        for (int p = 0; p < 6; ++p) {
+            if (p != 4 && glm::dot(glm::vec3(frustum.planes[p]), center) + frustum.planes[p].w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Replaces the queue of the I/O thread with the nodes wanted this frame, most urgent last. Queued nodes that
+    // are not wanted anymore go back to unloaded; the ones being read complete anyway.
+    void publishRequests() {
+        std::sort(m_wanted.begin(), m_wanted.end(), lowerPriority);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t k = 0; k < m_requests.size(); ++k) {
+                m_states[m_requests[k].node] = kUnloaded;
+            }
+            m_requests.clear();
+            for (size_t k = 0; k < m_wanted.size(); ++k) {
+                const uint32_t n = m_wanted[k].node;
+                if (m_states[n] == kUnloaded) {
+                    m_states[n] = kRequested;
+                    m_requests.push_back(m_wanted[k]);
+                }
+            }
+        }
+        m_wake.notify_one();
+    }
+
+    void ioLoop() {
+        std::ifstream file(m_filename.c_str(), std::ios::binary);
+        for (;;) {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this] { return m_stop || !m_requests.empty(); });
+                if (m_stop) {
+                    return;
+                }
+                request = m_requests.back();
+                m_requests.pop_back();
+            }
+            const OctreeNode& node = m_nodes[request.node];
+            std::vector<OctreePoint> points(node.numPoints);
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(m_pointsOffset + node.firstPoint * sizeof(OctreePoint)));
+            const bool failed = !file.read(reinterpret_cast<char*>(points.data()), points.size() * sizeof(OctreePoint));
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_completed.push_back(Completed());
+            m_completed.back().node = request.node;
+            m_completed.back().failed = failed;
+            if (!failed) {
+                m_completed.back().points.swap(points);
+            }
+        }
+    }
+
+    void uploadCompleted() {
+        std::vector<Completed> ready;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const size_t count = std::min<size_t>(m_completed.size(), m_uploadsPerFrame);
+            for (size_t k = 0; k < count; ++k) {
+                ready.push_back(Completed());
+                ready.back().node = m_completed[k].node;
+                ready.back().failed = m_completed[k].failed;
+                ready.back().points.swap(m_completed[k].points);
+            }
+            m_completed.erase(m_completed.begin(), m_completed.begin() + count);
+        }
+        for (size_t k = 0; k < ready.size(); ++k) {
+            if (ready[k].failed) {
+                m_states[ready[k].node] = kFailed; // no buffer, and not counted in the budget
+                continue;
+            }
+            const std::vector<OctreePoint>& points = ready[k].points;
+            GpuNode& gpu = m_gpu[ready[k].node];
+            gpu.vao.create(kGpuStars);
+            glBindVertexArray(gpu.vao.get());
+            gpu.vbo.create(kGpuStars);
+            gpu.vbo.setData(GL_ARRAY_BUFFER, points.size() * sizeof(OctreePoint), points.data(), GL_STATIC_DRAW);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(OctreePoint), reinterpret_cast<void*>(offsetof(OctreePoint, position)));
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(OctreePoint), reinterpret_cast<void*>(offsetof(OctreePoint, absMagnitude)));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(OctreePoint), reinterpret_cast<void*>(offsetof(OctreePoint, colorIndex)));
+            glEnableVertexAttribArray(2);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            m_residentPoints += m_nodes[ready[k].node].numPoints;
+            m_states[ready[k].node] = kResident;
+        }
+    }
+
+    // Least recently used nodes first, never the ones drawn this frame nor the root.
+    void evict() {
+        if (m_residentPoints <= m_pointBudget) {
+            return;
+        }
+        m_evictable.clear();
+        for (uint32_t n = 1; n < m_nodes.size(); ++n) {
+            if (m_states[n] == kResident && m_lastUsed[n] != m_frame) {
+                m_evictable.push_back(n);
+            }
+        }
+        std::sort(m_evictable.begin(), m_evictable.end(), [this](uint32_t a, uint32_t b) { return m_lastUsed[a] < m_lastUsed[b]; });
+        for (size_t k = 0; k < m_evictable.size() && m_residentPoints > m_pointBudget; ++k) {
+            const uint32_t n = m_evictable[k];
+            releaseNode(n);
+            m_residentPoints -= m_nodes[n].numPoints;
+            m_states[n] = kUnloaded;
+        }
+    }
+
+    void releaseNode(const uint32_t n) {
+        m_gpu[n].vao.reset();
+        m_gpu[n].vbo.reset();
+    }
+
+    void draw(const glm::mat4& projView, const glm::dvec3& cameraPosition) {
+        m_drawnNodes = 0;
+        m_drawnPoints = 0;
+        if (m_drawList.empty()) {
+            return;
+        }
+        glUseProgram(m_program.get());
+        glUniformMatrix4fv(glGetUniformLocation(m_program.get(), "projView"), 1, GL_FALSE, glm::value_ptr(projView));
+        glUniform1f(glGetUniformLocation(m_program.get(), "unitScale"), static_cast<float>(m_unitScale));
+        const GLint nodeOffsetLocation = glGetUniformLocation(m_program.get(), "nodeOffset");
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        for (size_t k = 0; k < m_drawList.size(); ++k) {
+            const OctreeNode& node = m_nodes[m_drawList[k]];
+            const GpuNode& gpu = m_gpu[m_drawList[k]];
+            if (m_states[m_drawList[k]] != kResident) {
+                continue;
+            }
+            // Camera-relative center of the node, in double before dropping to float (see world.h)
+            const glm::vec3 offset(glm::dvec3(node.center[0], node.center[1], node.center[2]) * m_unitScale - cameraPosition);
+            glUniform3f(nodeOffsetLocation, offset[0], offset[1], offset[2]);
+            glBindVertexArray(gpu.vao.get());
+            glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(node.numPoints));
+            ++m_drawnNodes;
+            m_drawnPoints += node.numPoints;
+        }
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+
+    // Render thread only
+    std::string m_filename;
+    uint64_t m_pointsOffset = 0;
+    std::vector<OctreeNode> m_nodes; // read-only once open: shared with the I/O thread
+    std::vector<uint8_t> m_states; // NodeState
+    std::vector<uint64_t> m_lastUsed; // frame
+    std::vector<GpuNode> m_gpu;
+    std::vector<uint32_t> m_drawList;
+    std::vector<Request> m_wanted;
+    std::vector<uint32_t> m_stack;
+    std::vector<uint32_t> m_evictable;
+    GpuProgram m_program;
+    uint64_t m_frame = 0;
+    uint64_t m_residentPoints = 0;
+    uint64_t m_pointBudget = 8000000;
+    uint32_t m_uploadsPerFrame = 8;
+    float m_maxError = 2.0f;
+    double m_unitScale = 1.0;
+    uint32_t m_drawnNodes = 0;
+    uint64_t m_drawnPoints = 0;
+
+    // Shared with the I/O thread, under m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_ioThread;
+    std::vector<Request> m_requests; // most urgent last
+    std::vector<Completed> m_completed;
+    bool m_stop = false;
+};
+
+#endif // POINT_OCTREE_H
@@ -0,0 +1,125 @@
+// ----------------------------------------------------------------------------
+// points.h
+//
+// Description: Impostors of the bodies too small on screen to be worth a
+//              mesh: each one is a point sprite of the projected size of the
+//              body, at least one pixel, whose alpha is the fraction of that
+//              pixel the body covers. Its color is the mean color of the body
+//              times the brightness of its lit disk, so that a body fades into
+//              a point without popping. All of them go in a single draw.
+// ----------------------------------------------------------------------------
+
+#ifndef POINTS_H
+#define POINTS_H
+
+#include "gpu_resources.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+void loadShader(GLuint program, GLenum type, const std::string& shaderFilename); // main.cpp
+
+const static float kPointAmbient = 0.5f; // ambient term of vertexShader.glsl
+
+// Brightness of the disk of a Lambertian sphere lit by a white light, averaged over the disk: the ambient
+// term plus the diffuse one, 2/3 at full phase times the Lambert phase function of the phase angle (radians,
+// between the directions to the light and to the viewer). The specular highlight is neglected.
+inline float computeDiskBrightness(const float phaseAngle) {
+    const float pi = 3.14159265f;
+    const float a = glm::clamp(phaseAngle, 0.0f, pi);
+    const float phase = ((pi - a) * std::cos(a) + std::sin(a)) / pi;
+    return kPointAmbient + (2.0f / 3.0f) * phase;
+}
+
+class PointRenderer {
+public:
+    void init() {
+        m_program.create();
+        loadShader(m_program.get(), GL_VERTEX_SHADER, "pointVertexShader.glsl");
+        loadShader(m_program.get(), GL_FRAGMENT_SHADER, "pointFragmentShader.glsl");
+        glLinkProgram(m_program.get());
+
+        // Interleaved (camera-relative position, diameter in pixels) and (color, coverage)
+        m_vao.create(kGpuImpostors);
+        glBindVertexArray(m_vao.get());
+        m_vbo.create(kGpuImpostors);
+        glBindBuffer(GL_ARRAY_BUFFER, m_vbo.get());
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Point), 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Point), reinterpret_cast<void*>(sizeof(glm::vec4)));
+        glEnableVertexAttribArray(1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void clear() {
+        m_vao.reset();
+        m_vbo.reset();
+        m_program.reset();
+        m_capacity = 0;
+        m_points.clear();
+    }
+
+    inline void begin() { m_points.clear(); }
+    inline size_t getNumPoints() const { return m_points.size(); }
+
+    // A body of the given camera-relative position, projected diameter (pixels) and color.
+    void add(const glm::vec3& position, const float diameter, const glm::vec3& color) {
+        Point p;
+        const float size = std::max(diameter, 1.0f);
+        const float coverage = (diameter < 1.0f) ? 0.785398f * diameter * diameter : 1.0f; // disk area, in pixels
+        p.positionSize = glm::vec4(position, size);
+        p.colorCoverage = glm::vec4(color, coverage);
+        m_points.push_back(p);
+    }
+
+    // Draws the points added since begin(), blended over the meshes without writing depth.
+    void render(const glm::mat4& projView, const float logDepthCoef) {
+        if (m_points.empty()) {
+            return;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, m_vbo.get());
+        if (m_points.size() > m_capacity) {
+            m_capacity = std::max(m_points.size(), 2 * m_capacity);
+            m_vbo.setData(GL_ARRAY_BUFFER, m_capacity * sizeof(Point), nullptr, GL_STREAM_DRAW);
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, 0, m_points.size() * sizeof(Point), m_points.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glUseProgram(m_program.get());
+        glUniformMatrix4fv(glGetUniformLocation(m_program.get(), "projView"), 1, GL_FALSE, glm::value_ptr(projView));
+        glUniform1f(glGetUniformLocation(m_program.get(), "logDepthCoef"), logDepthCoef);
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(m_vao.get());
+        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(m_points.size()));
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+
+private:
+    struct Point {
+        glm::vec4 positionSize;
+        glm::vec4 colorCoverage;
+    };
+
+    GpuProgram m_program;
+    GpuVertexArray m_vao;
+    GpuBuffer m_vbo;
+    size_t m_capacity = 0; // points the buffer holds
+    std::vector<Point> m_points;
+};
+
+#endif // POINTS_H
@@ -0,0 +1,450 @@
+// ----------------------------------------------------------------------------
+// recorder.h
+//
+// Description: Deterministic recording and replay of the simulation.
+//
+//              The recorder writes the state of every body (position,
+//              velocity, mu, radius, integrator level) every
+//              `snapshotInterval` steps, plus the
+//              input events with the step they happened at. Every
+//              `keyframeInterval`-th snapshot is stored raw; the others are
+//              XOR-delta encoded against the previous snapshot, which only
+//              keeps the bytes of each double that actually changed.
+//
+//              The replay seeks by restoring the nearest keyframe at or before
+//              the target and re-simulating forward with the recorded inputs.
+//              Every recorded snapshot met on the way is compared bit for bit
+//              with the re-simulated state, so a divergence is reported at the
+//              first step where it shows up.
+// ----------------------------------------------------------------------------
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "mapped_file.h"
+#include "simulation.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// ---- File layout -------------------------------------------------------------
+// [RecordingHeader] then chunks: [uint8 tag][uint64 step][uint32 payload size][payload]
+//   kChunkKeyframe: double time, double step size, uint32 count, count * kValuesPerBody raw doubles
+//   kChunkDelta:    double time, double step size, uint32 count, count * kValuesPerBody XOR-encoded doubles
+//   kChunkInput:    int32 key, int32 action, int32 mods
+// Snapshots are taken right after the step they are tagged with; inputs tagged with step s happened
+// after step s and before step s + 1.
+
+const static char kRecordingMagic[8] = { 'S', 'I', 'M', 'R', 'E', 'C', '0', '2' };
+
+struct RecordingHeader {
+    char magic[8];
+    uint32_t snapshotInterval;
+    uint32_t keyframeInterval;
+    double stepSize;
+};
+
+enum RecordingChunk {
+    kChunkKeyframe = 'K',
+    kChunkDelta = 'D',
+    kChunkInput = 'I'
+};
+
+const static size_t kValuesPerBody = 10; // position (3), velocity (3), mu, radius, level, absorbed
+
+// Receives the recorded input events during a replay.
+class ReplayInputHandler {
+public:
+    virtual ~ReplayInputHandler() {}
+    virtual void onReplayInput(int key, int action, int mods) = 0;
+};
+
+namespace recording {
+
+inline uint64_t doubleToBits(const double d) {
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+inline double bitsToDouble(const uint64_t bits) {
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// Flattens the per-body state in the order of the snapshot payload.
+inline void packState(const SimulationState& state, std::vector<double>& values) {
+    const size_t n = state.positions.size();
+    values.resize(n * kValuesPerBody);
+    for (size_t i = 0; i < n; ++i) {
+        double* v = &values[i * kValuesPerBody];
+        const glm::dvec3& p = state.positions[i];
+        const glm::dvec3& u = state.velocities[i];
+        v[0] = p.x; v[1] = p.y; v[2] = p.z;
+        v[3] = u.x; v[4] = u.y; v[5] = u.z;
+        v[6] = state.mus[i];
+        v[7] = state.radii[i];
+        v[8] = state.levels[i];
+        v[9] = state.absorbed[i];
+    }
+}
+
+inline void unpackState(const std::vector<double>& values, SimulationState& state) {
+    const size_t n = values.size() / kValuesPerBody;
+    state.positions.resize(n);
+    state.velocities.resize(n);
+    state.mus.resize(n);
+    state.radii.resize(n);
+    state.levels.resize(n);
+    state.absorbed.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        const double* v = &values[i * kValuesPerBody];
+        state.positions[i] = glm::dvec3(v[0], v[1], v[2]);
+        state.velocities[i] = glm::dvec3(v[3], v[4], v[5]);
+        state.mus[i] = v[6];
+        state.radii[i] = v[7];
+        state.levels[i] = static_cast<uint8_t>(v[8]);
+        state.absorbed[i] = static_cast<uint8_t>(v[9]);
+    }
+}
+
+// XOR of the value with its previous one: a control byte (leading zero bytes << 4 | trailing zero bytes)
+// followed by the remaining significant bytes, most significant first. Unchanged values cost one byte.
+inline void encodeDelta(const uint64_t bits, const uint64_t previous, std::vector<unsigned char>& out) {
+    const uint64_t x = bits ^ previous;
+    if (x == 0) {
+        out.push_back(0x80);
+        return;
+    }
+    int lead = 0;
+    while (lead < 8 && ((x >> (56 - 8 * lead)) & 0xFF) == 0) {
+        ++lead;
+    }
+    int trail = 0;
+    while (trail < 8 && ((x >> (8 * trail)) & 0xFF) == 0) {
+        ++trail;
+    }
+    out.push_back(static_cast<unsigned char>((lead << 4) | trail));
+    for (int b = 7 - lead; b >= trail; --b) {
+        out.push_back(static_cast<unsigned char>((x >> (8 * b)) & 0xFF));
+    }
+}
+
+inline bool decodeDelta(const unsigned char*& in, const unsigned char* end, const uint64_t previous, uint64_t& bits) {
+    if (in >= end) {
+        return false;
+    }
+    const unsigned char control = *in++;
+    const int lead = control >> 4;
+    const int trail = control & 0x0F;
+    if (lead == 8) {
+        bits = previous;
+        return true;
+    }
+    if (lead + trail > 8 || end - in < 8 - lead - trail) {
+        return false;
+    }
+    uint64_t x = 0;
+    for (int b = 7 - lead; b >= trail; --b) {
+        x |= static_cast<uint64_t>(*in++) << (8 * b);
+    }
+    bits = previous ^ x;
+    return true;
+}
+
+} // namespace recording
+
+class SimulationRecorder {
+public:
+    ~SimulationRecorder() { close(); }
+
+    bool open(const std::string& filename, const double stepSize, const uint32_t snapshotInterval = 1, const uint32_t keyframeInterval = 256) {
+        close();
+        m_out.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+        if (!m_out) {
+            return false;
+        }
+        RecordingHeader header;
+        std::memcpy(header.magic, kRecordingMagic, sizeof(kRecordingMagic));
+        header.snapshotInterval = snapshotInterval > 0 ? snapshotInterval : 1;
+        header.keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+        header.stepSize = stepSize;
+        m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        m_header = header;
+        m_snapshotCount = 0;
+        m_previous.clear();
+        return static_cast<bool>(m_out);
+    }
+
+    void close() {
+        if (m_out.is_open()) {
+            m_out.close();
+        }
+    }
+
+    inline bool isOpen() const { return m_out.is_open(); }
+
+    void recordInput(const uint64_t step, const int key, const int action, const int mods) {
+        if (!isOpen()) {
+            return;
+        }
+        const int32_t payload[3] = { key, action, mods };
+        writeChunk(kChunkInput, step, payload, sizeof(payload));
+    }
+
+    // To be called after every simulation step; only every snapshotInterval-th step is stored.
+    void recordStep(const Simulation& sim) {
+        if (!isOpen() || sim.getStepCount() % m_header.snapshotInterval != 0) {
+            return;
+        }
+        sim.saveState(m_state);
+        recording::packState(m_state, m_current);
+        const uint32_t count = static_cast<uint32_t>(sim.getNumBodies());
+
+        m_payload.clear();
+        appendRaw(m_payload, &m_state.time, sizeof(m_state.time));
+        appendRaw(m_payload, &m_state.stepSize, sizeof(m_state.stepSize));
+        appendRaw(m_payload, &count, sizeof(count));
+
+        // A keyframe on cadence, and whenever the body count changed (merges, spawns)
+        const bool keyframe = (m_snapshotCount % m_header.keyframeInterval == 0) || m_previous.size() != m_current.size();
+        if (keyframe) {
+            appendRaw(m_payload, m_current.data(), m_current.size() * sizeof(double));
+        }
+        else {
+            for (size_t i = 0; i < m_current.size(); ++i) {
+                recording::encodeDelta(recording::doubleToBits(m_current[i]), recording::doubleToBits(m_previous[i]), m_payload);
+            }
+        }
+        writeChunk(keyframe ? kChunkKeyframe : kChunkDelta, sim.getStepCount(), m_payload.data(), m_payload.size());
+        m_previous.swap(m_current);
+        ++m_snapshotCount;
+    }
+
+private:
+    static void appendRaw(std::vector<unsigned char>& out, const void* data, const size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    void writeChunk(const RecordingChunk tag, const uint64_t step, const void* payload, const size_t size) {
+        const uint8_t tagByte = static_cast<uint8_t>(tag);
+        const uint32_t payloadSize = static_cast<uint32_t>(size);
+        m_out.write(reinterpret_cast<const char*>(&tagByte), sizeof(tagByte));
+        m_out.write(reinterpret_cast<const char*>(&step), sizeof(step));
+        m_out.write(reinterpret_cast<const char*>(&payloadSize), sizeof(payloadSize));
+        m_out.write(static_cast<const char*>(payload), size);
+    }
+
+    std::ofstream m_out;
+    RecordingHeader m_header;
+    SimulationState m_state;
+    uint64_t m_snapshotCount = 0;
+    std::vector<double> m_previous;
+    std::vector<double> m_current;
+    std::vector<unsigned char> m_payload;
+};
+
+class SimulationReplay {
+public:
+    // Maps a recording and indexes its chunks. The state of a replay is the one of the simulation it drives.
+    bool open(const std::string& filename) {
+        m_chunks.clear();
+        m_keyframes.clear();
+        if (!m_file.open(filename)) {
+            return false;
+        }
+        const RecordingHeader* header = m_file.at<RecordingHeader>(0);
+        if (!header || std::memcmp(header->magic, kRecordingMagic, sizeof(kRecordingMagic)) != 0) {
+            m_file.close();
+            return false;
+        }
+        m_header = *header;
+
+        // A recording cut short (e.g., a crash) is still usable up to its last complete chunk
+        size_t offset = sizeof(RecordingHeader);
+        const size_t chunkHeaderSize = sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint32_t);
+        while (offset + chunkHeaderSize <= m_file.size()) {
+            Chunk chunk;
+            chunk.tag = m_file.data()[offset];
+            std::memcpy(&chunk.step, m_file.data() + offset + 1, sizeof(chunk.step));
+            uint32_t payloadSize;
+            std::memcpy(&payloadSize, m_file.data() + offset + 1 + sizeof(uint64_t), sizeof(payloadSize));
+            chunk.payload = offset + chunkHeaderSize;
+            chunk.size = payloadSize;
+            if (payloadSize > m_file.size() - chunk.payload) {
+                break;
+            }
+            if (chunk.tag == kChunkKeyframe) {
+                m_keyframes.push_back(m_chunks.size());
+            }
+            m_chunks.push_back(chunk);
+            offset = chunk.payload + payloadSize;
+        }
+        m_cursor = 0;
+        m_diverged = false;
+        return !m_keyframes.empty();
+    }
+
+    inline double getInitialStepSize() const { return m_header.stepSize; }
+    inline bool hasDiverged() const { return m_diverged; }
+    inline uint64_t getLastStep() const { return m_chunks.empty() ? 0 : m_chunks.back().step; }
+
+    // Restores the last keyframe at or before targetStep, then re-simulates up to targetStep, replaying the
+    // recorded inputs. Returns false if there is no keyframe before the target or the body count mismatches.
+    bool seek(Simulation& sim, const uint64_t targetStep, ReplayInputHandler* handler) {
+        size_t k = m_keyframes.size();
+        while (k > 0 && m_chunks[m_keyframes[k - 1]].step > targetStep) {
+            --k;
+        }
+        if (k == 0) {
+            return false;
+        }
+        const size_t keyframeChunk = m_keyframes[k - 1];
+        std::vector<double> values;
+        SimulationState state;
+        if (!decodeSnapshot(keyframeChunk, values, state.time, state.stepSize) || values.size() != sim.getNumBodies() * kValuesPerBody) {
+            return false;
+        }
+        state.stepCount = m_chunks[keyframeChunk].step;
+        recording::unpackState(values, state);
+        sim.restoreState(state);
+        m_snapshot.swap(values);
+        m_cursor = keyframeChunk + 1;
+        m_diverged = false;
+        dispatchInputs(sim.getStepCount(), handler);
+        while (sim.getStepCount() < targetStep) {
+            stepForward(sim, handler);
+        }
+        return true;
+    }
+
+    // Seeks to the last recorded snapshot at or before the given simulation time (the step size may vary
+    // during a run, e.g., with time warp, so steps and times are not proportional).
+    bool seekTime(Simulation& sim, const double time, ReplayInputHandler* handler) {
+        uint64_t target = 0;
+        for (size_t c = 0; c < m_chunks.size(); ++c) {
+            double chunkTime;
+            if ((m_chunks[c].tag == kChunkKeyframe || m_chunks[c].tag == kChunkDelta) && m_chunks[c].size >= sizeof(chunkTime)) {
+                std::memcpy(&chunkTime, m_file.data() + m_chunks[c].payload, sizeof(chunkTime)); // stored raw in both kinds
+                if (chunkTime > time) {
+                    break;
+                }
+                target = m_chunks[c].step;
+            }
+        }
+        return seek(sim, target, handler);
+    }
+
+    // Advances the simulation by one step, replays the inputs of the new step and checks it against the
+    // recording. Returns false once the replay has diverged from the recording.
+    bool stepForward(Simulation& sim, ReplayInputHandler* handler) {
+        sim.step();
+        const uint64_t step = sim.getStepCount();
+        while (m_cursor < m_chunks.size() && m_chunks[m_cursor].step <= step) {
+            const Chunk& chunk = m_chunks[m_cursor];
+            if (chunk.step == step && (chunk.tag == kChunkKeyframe || chunk.tag == kChunkDelta)) {
+                verify(sim, m_cursor);
+            }
+            else if (chunk.tag == kChunkInput && handler && chunk.step == step) {
+                dispatchInput(chunk, handler);
+            }
+            ++m_cursor;
+        }
+        return !m_diverged;
+    }
+
+private:
+    struct Chunk {
+        uint8_t tag;
+        uint64_t step;
+        size_t payload;
+        size_t size;
+    };
+
+    // Decodes a keyframe, or a delta against m_snapshot (the previous snapshot of the stream).
+    bool decodeSnapshot(const size_t chunkIndex, std::vector<double>& values, double& time, double& stepSize) const {
+        const Chunk& chunk = m_chunks[chunkIndex];
+        const unsigned char* in = m_file.data() + chunk.payload;
+        const unsigned char* end = in + chunk.size;
+        uint32_t count;
+        if (chunk.size < sizeof(time) + sizeof(stepSize) + sizeof(count)) {
+            return false;
+        }
+        std::memcpy(&time, in, sizeof(time));
+        std::memcpy(&stepSize, in + sizeof(time), sizeof(stepSize));
+        std::memcpy(&count, in + sizeof(time) + sizeof(stepSize), sizeof(count));
+        in += sizeof(time) + sizeof(stepSize) + sizeof(count);
+        values.resize(static_cast<size_t>(count) * kValuesPerBody);
+        if (chunk.tag == kChunkKeyframe) {
+            if (static_cast<size_t>(end - in) != values.size() * sizeof(double)) {
+                return false;
+            }
+            std::memcpy(values.data(), in, values.size() * sizeof(double));
+            return true;
+        }
+        if (m_snapshot.size() != values.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < values.size(); ++i) {
+            uint64_t bits;
+            if (!recording::decodeDelta(in, end, recording::doubleToBits(m_snapshot[i]), bits)) {
+                return false;
+            }
+            values[i] = recording::bitsToDouble(bits);
+        }
+        return true;
+    }
+
+    void verify(const Simulation& sim, const size_t chunkIndex) {
+        std::vector<double> recorded;
+        double time = 0.0;
+        double stepSize = 0.0;
+        if (!decodeSnapshot(chunkIndex, recorded, time, stepSize)) {
+            m_diverged = true;
+            return;
+        }
+        sim.saveState(m_state);
+        recording::packState(m_state, m_current);
+        if (recorded.size() != m_current.size() || recording::doubleToBits(time) != recording::doubleToBits(sim.getTime()) ||
+            recording::doubleToBits(stepSize) != recording::doubleToBits(sim.getStepSize()) ||
+            std::memcmp(recorded.data(), m_current.data(), recorded.size() * sizeof(double)) != 0) {
+            m_diverged = true;
+        }
+        m_snapshot.swap(recorded);
+    }
+
+    void dispatchInputs(const uint64_t step, ReplayInputHandler* handler) {
+        while (m_cursor < m_chunks.size() && m_chunks[m_cursor].step == step && m_chunks[m_cursor].tag == kChunkInput) {
+            if (handler) {
+                dispatchInput(m_chunks[m_cursor], handler);
+            }
+            ++m_cursor;
+        }
+    }
+
+    void dispatchInput(const Chunk& chunk, ReplayInputHandler* handler) const {
+        int32_t payload[3];
+        if (chunk.size != sizeof(payload)) {
+            return;
+        }
+        std::memcpy(payload, m_file.data() + chunk.payload, sizeof(payload));
+        handler->onReplayInput(payload[0], payload[1], payload[2]);
+    }
+
+    MappedFile m_file;
+    RecordingHeader m_header;
+    std::vector<Chunk> m_chunks;
+    std::vector<size_t> m_keyframes;
+    std::vector<double> m_snapshot; // last decoded snapshot, reference of the next delta
+    std::vector<double> m_current;
+    SimulationState m_state;
+    size_t m_cursor = 0;
+    bool m_diverged = false;
+};
+
+#endif // RECORDER_H
@@ -0,0 +1,206 @@
+// ----------------------------------------------------------------------------
+// scene.h
+//
+// Description: Scene description: bodies with their parent, orbit, physical
+//              properties and material. Scenes are authored in JSON and
+//              converted by tools/scene_compiler.cpp into the binary layout
+//              below, which is memory-mapped and used in place at runtime.
+// ----------------------------------------------------------------------------
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "ephemeris.h"
+#include "mapped_file.h"
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// ---- Binary file layout ----------------------------------------------------
+// [SceneFileHeader][numBodies * SceneBody][numTextures * uint32 string offsets][string table]
+// Bodies are sorted depth first: each body comes right before its subtree.
+// Strings are NUL-terminated, offsets are relative to the string table.
+
+const static char kSceneMagic[8] = { 'S', 'C', 'N', 'B', 'I', 'N', '0', '1' };
+const static uint32_t kSceneNone = 0xFFFFFFFFu; // no parent, no texture, no ephemeris body, no string
+
+enum SceneBodyFlags {
+    kSceneBodyEmissive = 1 << 0, // lights the scene and is drawn unlit
+    kSceneBodyPinned = 1 << 1,   // stays at its initial position
+    kSceneBodyAttached = 1 << 2  // not simulated: fixed in the rotating frame of its parent (see transforms.h)
+};
+
+// Keplerian elements relative to the parent; angles in radians, in the scene plane (x, -z) with y up.
+struct SceneOrbit {
+    double semiMajorAxis; // 0 for no orbit: the body is placed at its position relative to the parent
+    double eccentricity;
+    double inclination;
+    double ascendingNode;
+    double argumentOfPeriapsis;
+    double meanAnomaly; // at time 0
+};
+
+struct SceneBody {
+    uint32_t name;           // string offset
+    uint32_t parent;         // body index, or kSceneNone
+    uint32_t texture;        // texture index, or kSceneNone to use the color
+    uint32_t ephemerisBody;  // EphemerisBody driving the body when an ephemeris is available, or kSceneNone
+    uint32_t flags;
+    uint32_t padding;
+    double radius;
+    double mu;               // gravitational parameter, in scene units
+    double spinPeriod;       // sidereal rotation, in scene time units; 0 for none
+    double axialTilt;        // radians
+    double position[3];      // relative to the parent when there is no orbit, in its rotating frame when attached
+    double velocity[3];
+    float color[4];          // flat color without texture, and color of the orbit trail
+    SceneOrbit orbit;
+};
+
+struct SceneFileHeader {
+    char magic[8];
+    uint32_t numBodies;
+    uint32_t numTextures;
+    uint64_t bodiesOffset;
+    uint64_t texturesOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint32_t ephemerisFile; // string offset, or kSceneNone
+    uint32_t cameraFollow;  // body index the camera follows, or kSceneNone
+    double timeScale;       // scene time units per second of animation
+    double cameraPosition[3]; // offset from the followed body, or absolute position
+    double cameraTarget[3];   // ignored when following a body
+    double cameraNear;
+    double cameraFar;
+};
+
+// ---- Runtime access -----------------------------------------------------------
+
+class Scene {
+public:
+    // Maps a binary file produced by tools/scene_compiler. Returns false on a missing or malformed file.
+    bool open(const std::string& filename) {
+        close();
+        if (!m_file.open(filename)) {
+            return false;
+        }
+        const SceneFileHeader* header = m_file.at<SceneFileHeader>(0);
+        if (!header || std::memcmp(header->magic, kSceneMagic, sizeof(kSceneMagic)) != 0) {
+            close();
+            return false;
+        }
+        const SceneBody* bodies = m_file.at<SceneBody>(static_cast<size_t>(header->bodiesOffset), header->numBodies);
+        const uint32_t* textures = m_file.at<uint32_t>(static_cast<size_t>(header->texturesOffset), header->numTextures);
+        const char* strings = m_file.at<char>(static_cast<size_t>(header->stringsOffset), static_cast<size_t>(header->stringsSize));
+        if (!bodies || !textures || !strings || header->stringsSize == 0 || strings[header->stringsSize - 1] != '\0') {
+            close();
+            return false;
+        }
+        m_header = header;
+        m_bodies = bodies;
+        m_textures = textures;
+        m_strings = strings;
+        if ((header->ephemerisFile != kSceneNone && !validString(header->ephemerisFile)) ||
+            (header->cameraFollow != kSceneNone && header->cameraFollow >= header->numBodies)) {
+            close();
+            return false;
+        }
+        for (uint32_t i = 0; i < header->numBodies; ++i) {
+            // A simulated body is placed relative to a simulated parent
+            const bool parentAttached = bodies[i].parent != kSceneNone && bodies[i].parent < i &&
+                                        (bodies[bodies[i].parent].flags & kSceneBodyAttached) != 0;
+            if (!validString(bodies[i].name) || (bodies[i].parent != kSceneNone && bodies[i].parent >= i) ||
+                (parentAttached && !(bodies[i].flags & kSceneBodyAttached)) ||
+                (bodies[i].texture != kSceneNone && bodies[i].texture >= header->numTextures) ||
+                (bodies[i].ephemerisBody != kSceneNone && bodies[i].ephemerisBody >= kEphNumBodies)) {
+                close();
+                return false;
+            }
+        }
+        for (uint32_t t = 0; t < header->numTextures; ++t) {
+            if (!validString(textures[t])) {
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void close() {
+        m_file.close();
+        m_header = nullptr;
+        m_bodies = nullptr;
+        m_textures = nullptr;
+        m_strings = nullptr;
+    }
+
+    inline bool isOpen() const { return m_header != nullptr; }
+    inline const SceneFileHeader& getHeader() const { return *m_header; }
+    inline uint32_t getNumBodies() const { return m_header->numBodies; }
+    inline const SceneBody& getBody(const uint32_t i) const { return m_bodies[i]; }
+    inline const char* getName(const uint32_t i) const { return m_strings + m_bodies[i].name; }
+    inline uint32_t getNumTextures() const { return m_header->numTextures; }
+    inline const char* getTexture(const uint32_t t) const { return m_strings + m_textures[t]; }
+    inline const char* getEphemerisFile() const { return m_header->ephemerisFile != kSceneNone ? m_strings + m_header->ephemerisFile : nullptr; }
+
+    // Index of the body with the given name, or kSceneNone.
+    uint32_t findBody(const std::string& name) const {
+        for (uint32_t i = 0; i < m_header->numBodies; ++i) {
+            if (name == getName(i)) {
+                return i;
+            }
+        }
+        return kSceneNone;
+    }
+
+private:
+    inline bool validString(const uint32_t offset) const { return offset < m_header->stringsSize; }
+
+    MappedFile m_file;
+    const SceneFileHeader* m_header = nullptr;
+    const SceneBody* m_bodies = nullptr;
+    const uint32_t* m_textures = nullptr;
+    const char* m_strings = nullptr;
+};
+
+// State relative to the parent of a body on a Keplerian orbit around a parent of gravitational parameter
+// mu, at time t. Orbital planes are in the ecliptic convention (x, y) mapped onto the scene plane (x, -z).
+inline void computeOrbitState(const SceneOrbit& orbit, const double mu, const double t, glm::dvec3& position, glm::dvec3& velocity) {
+    const double a = orbit.semiMajorAxis;
+    const double e = orbit.eccentricity;
+    const double n = std::sqrt(mu / (a * a * a)); // mean motion
+
+    // Kepler's equation M = E - e sin E, by Newton iterations
+    const double meanAnomaly = orbit.meanAnomaly + n * t;
+    double E = (e < 0.8) ? meanAnomaly : 3.14159265358979323846;
+    for (int k = 0; k < 16; ++k) {
+        const double delta = (E - e * std::sin(E) - meanAnomaly) / (1.0 - e * std::cos(E));
+        E -= delta;
+        if (std::fabs(delta) < 1e-14) {
+            break;
+        }
+    }
+    const double cosE = std::cos(E);
+    const double sinE = std::sin(E);
+    const double b = a * std::sqrt(1.0 - e * e);
+    const double r = a * (1.0 - e * cosE);
+    const glm::dvec2 p(a * (cosE - e), b * sinE); // in the orbital plane, periapsis along x
+    const glm::dvec2 v(-a * n * sinE * a / r, b * n * cosE * a / r);
+
+    // Orbital plane to ecliptic: Rz(ascendingNode) * Rx(inclination) * Rz(argumentOfPeriapsis)
+    const double cw = std::cos(orbit.argumentOfPeriapsis), sw = std::sin(orbit.argumentOfPeriapsis);
+    const double cO = std::cos(orbit.ascendingNode), sO = std::sin(orbit.ascendingNode);
+    const double ci = std::cos(orbit.inclination), si = std::sin(orbit.inclination);
+    const glm::dvec3 px(cO * cw - sO * sw * ci, sO * cw + cO * sw * ci, sw * si);
+    const glm::dvec3 py(-cO * sw - sO * cw * ci, -sO * sw + cO * cw * ci, cw * si);
+    const glm::dvec3 pos = p.x * px + p.y * py;
+    const glm::dvec3 vel = v.x * px + v.y * py;
+    position = glm::dvec3(pos.x, pos.z, -pos.y);
+    velocity = glm::dvec3(vel.x, vel.z, -vel.y);
+}
+
+#endif // SCENE_H
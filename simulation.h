@@ -0,0 +1,651 @@
+// ----------------------------------------------------------------------------
+// simulation.h
+//
+// Description: Gravitational simulation of the bodies of the scene. State is
+//              kept in double precision, structure-of-arrays. Bodies are either
+//              integrated (dynamic) or driven by a TrajectorySource such as the
+//              ephemeris; driven bodies still attract the dynamic ones.
+//
+//              The simulation advances by macro steps of a given size. Two
+//              integrators are available: a fixed-step leapfrog, and an
+//              adaptive embedded Runge-Kutta (Dormand-Prince 5(4)) with
+//              individual block timesteps, where every body steps at
+//              stepSize / 2^level and the level follows its own error.
+//
+//              The step is deterministic: every acceleration is summed over the
+//              attractors in index order and depends only on committed states,
+//              so the result does not depend on how the loop over bodies is split:
+//              with a job system, it is split across threads.
+//
+//              After each macro step, colliding bodies are found with a
+//              broadphase (collision.h) and either merged or bounced. Merged
+//              bodies are not removed, so that ids stay valid: they are marked
+//              as absorbed and no longer take part in the simulation.
+// ----------------------------------------------------------------------------
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "collision.h"
+#include "jobs.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Prescribed trajectories, e.g., an ephemeris. Units are the ones of the simulation.
+class TrajectorySource {
+public:
+    virtual ~TrajectorySource() {}
+    virtual bool evaluate(uint32_t sourceId, double time, glm::dvec3& position, glm::dvec3& velocity) = 0;
+};
+
+// Everything needed to continue a simulation bit for bit (see recorder.h).
+struct SimulationState {
+    uint64_t stepCount = 0;
+    double time = 0.0;
+    double stepSize = 0.0;
+    std::vector<glm::dvec3> positions;
+    std::vector<glm::dvec3> velocities;
+    std::vector<double> mus;
+    std::vector<double> radii;
+    std::vector<uint8_t> levels;
+    std::vector<uint8_t> absorbed;
+};
+
+// Fraction of the acceleration of a body above which an attractor is a significant perturber: the body
+// then steps at most twice as coarsely as the attractor, whose motion is otherwise only extrapolated.
+const static double kPerturberFraction = 0.01;
+
+// Finest adaptive step by default, stepSize / 2^16: a body takes at most 65536 steps per macro step, even
+// when it meets another one before the collision is resolved.
+const static int kSimulationMaxLevel = 16;
+
+// Bodies per job at least: each one sums over every attractor, so a few dozen are worth a job.
+const static size_t kSimulationJobGrain = 32;
+
+enum SimulationIntegrator {
+    kIntegratorLeapfrog = 0, // kick-drift-kick, fixed step; symplectic, cheap, blows up on close approaches
+    kIntegratorAdaptive      // Dormand-Prince 5(4) with per-body block timesteps and error control
+};
+
+enum CollisionResponse {
+    kCollisionNone = 0, // bodies pass through each other
+    kCollisionMerge,    // the lighter body is absorbed; mass, momentum and volume are conserved
+    kCollisionBounce    // impulse along the line of centers, with a coefficient of restitution
+};
+
+class Simulation {
+public:
+    const static uint32_t kNotDriven = 0xFFFFFFFFu;
+
+    // mu is the gravitational parameter G * mass of the body, in the units chosen by the caller.
+    uint32_t addBody(const glm::dvec3& position, const glm::dvec3& velocity, double mu, double radius) {
+        m_positions.push_back(position);
+        m_velocities.push_back(velocity);
+        m_accelerations.push_back(glm::dvec3(0.0));
+        m_mus.push_back(mu);
+        m_radii.push_back(radius);
+        m_sourceIds.push_back(static_cast<uint32_t>(kNotDriven));
+        m_levels.push_back(0);
+        m_absorbed.push_back(0);
+        m_accelerationsValid = false;
+        return static_cast<uint32_t>(m_positions.size() - 1);
+    }
+
+    // Adds a body that follows sourceId of the trajectory source instead of being integrated. Without a
+    // source (or outside of its time span), a driven body keeps its current state, i.e., it is pinned.
+    uint32_t addDrivenBody(uint32_t sourceId, double mu, double radius, const glm::dvec3& position = glm::dvec3(0.0)) {
+        const uint32_t id = addBody(position, glm::dvec3(0.0), mu, radius);
+        m_sourceIds[id] = sourceId;
+        updateDrivenBody(id, m_time, m_positions[id], m_velocities[id]);
+        return id;
+    }
+
+    void clear() {
+        m_positions.clear();
+        m_velocities.clear();
+        m_accelerations.clear();
+        m_mus.clear();
+        m_radii.clear();
+        m_sourceIds.clear();
+        m_levels.clear();
+        m_absorbed.clear();
+        m_time = 0.0;
+        m_stepCount = 0;
+        m_accelerationsValid = false;
+    }
+
+    inline void setTrajectorySource(TrajectorySource* source) { m_source = source; }
+    inline void setJobSystem(JobSystem* jobs) { m_jobs = jobs; } // nullptr: everything on the calling thread
+    inline void setIntegrator(const SimulationIntegrator integrator) { m_integrator = integrator; }
+    inline SimulationIntegrator getIntegrator() const { return m_integrator; }
+    inline void setSoftening(const double eps) { m_softening2 = eps * eps; }
+    inline void setTolerance(const double tolerance) { m_tolerance = tolerance; } // relative error allowed per body step
+    inline void setMaxLevel(const int level) { m_maxLevel = std::min(level, 48); } // finest step: stepSize / 2^level
+    inline void setCollisionResponse(const CollisionResponse response) { m_collisionResponse = response; }
+    inline CollisionResponse getCollisionResponse() const { return m_collisionResponse; }
+    inline void setRestitution(const double e) { m_restitution = e; } // 1: elastic bounces, 0: bodies stick
+    inline void setStepSize(const double dt) { m_stepSize = dt; }
+    inline double getStepSize() const { return m_stepSize; }
+    inline void setTime(const double t) { m_time = t; }
+    inline double getTime() const { return m_time; }
+    inline uint64_t getStepCount() const { return m_stepCount; }
+    inline size_t getNumBodies() const { return m_positions.size(); }
+    inline bool isDriven(const uint32_t id) const { return m_sourceIds[id] != kNotDriven; }
+    inline bool isAbsorbed(const uint32_t id) const { return m_absorbed[id] != 0; }
+
+    inline const glm::dvec3& getPosition(const uint32_t id) const { return m_positions[id]; }
+    inline const glm::dvec3& getVelocity(const uint32_t id) const { return m_velocities[id]; }
+    inline double getMu(const uint32_t id) const { return m_mus[id]; }
+    inline double getRadius(const uint32_t id) const { return m_radii[id]; }
+    inline int getLevel(const uint32_t id) const { return m_levels[id]; }
+    inline const std::vector<glm::dvec3>& getPositions() const { return m_positions; }
+    inline const std::vector<glm::dvec3>& getVelocities() const { return m_velocities; }
+    inline const std::vector<double>& getMus() const { return m_mus; }
+    inline const std::vector<double>& getRadii() const { return m_radii; }
+
+    inline void setPosition(const uint32_t id, const glm::dvec3& p) { m_positions[id] = p; m_accelerationsValid = false; }
+    inline void setVelocity(const uint32_t id, const glm::dvec3& v) { m_velocities[id] = v; }
+    inline void setMu(const uint32_t id, const double mu) { m_mus[id] = mu; m_accelerationsValid = false; }
+    inline void setRadius(const uint32_t id, const double r) { m_radii[id] = r; }
+
+    // Statistics of the last macro step of the adaptive integrator
+    inline uint64_t getLastBodySteps() const { return m_lastBodySteps; }
+    inline uint64_t getLastRejections() const { return m_lastRejections; }
+    inline const std::vector<CollisionContact>& getLastContacts() const { return m_contacts; }
+    inline uint64_t getLastCandidatePairs() const { return m_broadphase.getLastCandidatePairs(); }
+
+    void saveState(SimulationState& state) const {
+        state.stepCount = m_stepCount;
+        state.time = m_time;
+        state.stepSize = m_stepSize;
+        state.positions = m_positions;
+        state.velocities = m_velocities;
+        state.mus = m_mus;
+        state.radii = m_radii;
+        state.levels = m_levels;
+        state.absorbed = m_absorbed;
+    }
+
+    // Restores a state saved from a simulation with the same setup (same bodies, same driven ones).
+    void restoreState(const SimulationState& state) {
+        m_stepCount = state.stepCount;
+        m_time = state.time;
+        m_stepSize = state.stepSize;
+        m_positions = state.positions;
+        m_velocities = state.velocities;
+        m_mus = state.mus;
+        m_radii = state.radii;
+        m_levels = state.levels;
+        m_absorbed = state.absorbed;
+        m_accelerations.assign(m_positions.size(), glm::dvec3(0.0));
+        m_accelerationsValid = false;
+    }
+
+    // Advances by one macro step of the current step size.
+    void step() { step(m_stepSize); }
+
+    void step(const double dt) {
+        if (m_collisionResponse != kCollisionNone) {
+            m_stepStart = m_positions;
+        }
+        if (m_integrator == kIntegratorAdaptive) {
+            stepAdaptive(dt);
+        }
+        else {
+            stepLeapfrog(dt);
+        }
+        if (m_collisionResponse != kCollisionNone) {
+            resolveCollisions(dt);
+        }
+        else {
+            m_contacts.clear();
+        }
+        ++m_stepCount;
+    }
+
+    // Gravitational acceleration at a point due to every massive body but `self` (kNotDriven for none).
+    glm::dvec3 computeAcceleration(const glm::dvec3& position, const uint32_t self) const {
+        glm::dvec3 acc(0.0);
+        for (size_t k = 0; k < m_attractors.size(); ++k) {
+            const uint32_t j = m_attractors[k];
+            if (j != self) {
+                acc += pairAcceleration(m_positions[j] - position, m_mus[j]);
+            }
+        }
+        return acc;
+    }
+
+private:
+    inline glm::dvec3 pairAcceleration(const glm::dvec3& d, const double mu) const {
+        const double r2 = glm::dot(d, d) + m_softening2;
+        const double invR = 1.0 / std::sqrt(r2);
+        return (mu * invR * invR * invR) * d;
+    }
+
+    // Integrated by the simulation: neither driven nor absorbed
+    inline bool isDynamic(const size_t i) const { return m_sourceIds[i] == kNotDriven && !m_absorbed[i]; }
+
+    void updateDrivenBody(const uint32_t id, const double time, glm::dvec3& position, glm::dvec3& velocity) {
+        if (m_source) {
+            m_source->evaluate(m_sourceIds[id], time, position, velocity);
+        }
+    }
+
+    void collectAttractors() {
+        // Massless particles do not attract anything: only loop over massive bodies
+        m_attractors.clear();
+        for (size_t j = 0; j < m_mus.size(); ++j) {
+            if (m_mus[j] != 0.0) {
+                m_attractors.push_back(static_cast<uint32_t>(j));
+            }
+        }
+    }
+
+    // Calls body(first, last) over [0, n): split across the jobs when there are enough bodies to share.
+    template <typename Body>
+    void forBodies(const size_t n, const Body& body) {
+        if (m_jobs) {
+            m_jobs->parallelFor(0, n, kSimulationJobGrain, body);
+        }
+        else {
+            body(0, n);
+        }
+    }
+
+    void computeAccelerations() {
+        collectAttractors();
+        forBodies(m_positions.size(), [this](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                m_accelerations[i] = isDynamic(i) ? computeAcceleration(m_positions[i], static_cast<uint32_t>(i)) : glm::dvec3(0.0);
+            }
+        });
+        m_accelerationsValid = true;
+    }
+
+    // ---- Collisions ----
+    //
+    // Contacts are applied in the order of their time of contact; a body takes part in at most one
+    // response per step, later contacts of the same body are left to the next step.
+
+    void resolveCollisions(const double dt) {
+        m_broadphase.findContacts(m_stepStart, m_positions, m_radii, m_contacts);
+        if (m_contacts.empty()) {
+            return;
+        }
+        m_collided.assign(m_positions.size(), 0);
+        size_t applied = 0;
+        for (size_t k = 0; k < m_contacts.size(); ++k) {
+            const CollisionContact& contact = m_contacts[k];
+            const uint32_t i = contact.first;
+            const uint32_t j = contact.second;
+            if (m_collided[i] || m_collided[j] || (isDriven(i) && isDriven(j))) {
+                continue; // driven bodies follow their trajectories whatever happens
+            }
+            m_collided[i] = m_collided[j] = 1;
+            if (m_collisionResponse == kCollisionMerge) {
+                merge(i, j);
+            }
+            else {
+                bounce(i, j, contact.time, dt);
+            }
+            m_contacts[applied++] = contact;
+        }
+        m_contacts.resize(applied);
+        m_accelerationsValid = false;
+    }
+
+    // Share of a response taken by body i against body j: driven bodies act as infinitely massive.
+    inline double responseWeight(const uint32_t i, const uint32_t j) const {
+        if (isDriven(i)) {
+            return 0.0;
+        }
+        if (isDriven(j)) {
+            return 1.0;
+        }
+        const double total = m_mus[i] + m_mus[j];
+        return total > 0.0 ? m_mus[j] / total : 0.5;
+    }
+
+    void merge(uint32_t i, uint32_t j) {
+        // The survivor is the driven or the most massive body (the lower index on a tie)
+        if (isDriven(j) || (!isDriven(i) && m_mus[j] > m_mus[i])) {
+            std::swap(i, j);
+        }
+        const double wi = 1.0 - responseWeight(i, j);
+        const double wj = 1.0 - wi;
+        if (!isDriven(i)) {
+            m_positions[i] = wi * m_positions[i] + wj * m_positions[j];
+            m_velocities[i] = wi * m_velocities[i] + wj * m_velocities[j];
+        }
+        m_mus[i] += m_mus[j];
+        m_radii[i] = std::cbrt(m_radii[i] * m_radii[i] * m_radii[i] + m_radii[j] * m_radii[j] * m_radii[j]);
+        m_levels[i] = std::max(m_levels[i], m_levels[j]);
+
+        m_absorbed[j] = 1;
+        m_positions[j] = m_positions[i];
+        m_velocities[j] = glm::dvec3(0.0);
+        m_accelerations[j] = glm::dvec3(0.0);
+        m_mus[j] = 0.0;
+        m_radii[j] = 0.0;
+    }
+
+    // Impulse along the line of centers at the time of contact, then straight motion for the rest of the step.
+    void bounce(const uint32_t i, const uint32_t j, const double contactTime, const double dt) {
+        const glm::dvec3 pi = glm::mix(m_stepStart[i], m_positions[i], contactTime);
+        const glm::dvec3 pj = glm::mix(m_stepStart[j], m_positions[j], contactTime);
+        const glm::dvec3 d = pj - pi;
+        const double distance = glm::length(d);
+        if (distance == 0.0) {
+            return;
+        }
+        const glm::dvec3 normal = d / distance;
+        const double approach = glm::dot(m_velocities[j] - m_velocities[i], normal);
+        if (approach >= 0.0) {
+            return; // already separating, e.g., overlapping since a previous step
+        }
+        const double impulse = (1.0 + m_restitution) * approach;
+        const double wi = responseWeight(i, j);
+        const double wj = 1.0 - wi;
+        const double remaining = (1.0 - contactTime) * dt;
+        if (!isDriven(i)) {
+            m_velocities[i] += (impulse * wi) * normal;
+            m_positions[i] = pi + remaining * m_velocities[i];
+        }
+        if (!isDriven(j)) {
+            m_velocities[j] -= (impulse * wj) * normal;
+            m_positions[j] = pj + remaining * m_velocities[j];
+        }
+    }
+
+    // ---- Leapfrog ----
+
+    void stepLeapfrog(const double dt) {
+        if (!m_accelerationsValid) {
+            computeAccelerations();
+        }
+        const size_t n = m_positions.size();
+        for (size_t i = 0; i < n; ++i) {
+            if (isDynamic(i)) {
+                m_velocities[i] += 0.5 * dt * m_accelerations[i];
+                m_positions[i] += dt * m_velocities[i];
+            }
+        }
+        m_time += dt;
+        for (size_t i = 0; i < n; ++i) {
+            if (m_sourceIds[i] != kNotDriven) {
+                updateDrivenBody(static_cast<uint32_t>(i), m_time, m_positions[i], m_velocities[i]);
+            }
+        }
+        computeAccelerations();
+        for (size_t i = 0; i < n; ++i) {
+            if (isDynamic(i)) {
+                m_velocities[i] += 0.5 * dt * m_accelerations[i];
+            }
+        }
+    }
+
+    // ---- Adaptive block timesteps ----
+    //
+    // The macro step is split in 2^m_maxLevel ticks; a body at level k steps by 2^(m_maxLevel - k) ticks
+    // and may only coarsen at a tick aligned on its coarser step. All bodies due at the same tick step
+    // together from the committed states (Jacobi style), attractors being predicted at the stage times:
+    // driven bodies by cubic Hermite interpolation over the macro step, dynamic ones by a second-order
+    // Taylor expansion from their last committed state.
+
+    struct BodyStepResult {
+        glm::dvec3 position;
+        glm::dvec3 velocity;
+        glm::dvec3 acceleration;
+        int level;
+        uint64_t ticks;
+        uint32_t rejections;
+    };
+
+    glm::dvec3 predictPosition(const uint32_t j, const double t) const {
+        if (m_sourceIds[j] != kNotDriven) {
+            const double dt = m_macroStep;
+            const double s = t / dt;
+            const double s2 = s * s;
+            const double s3 = s2 * s;
+            return (2.0 * s3 - 3.0 * s2 + 1.0) * m_drivenStart[j] + (s3 - 2.0 * s2 + s) * dt * m_drivenStartVelocity[j] +
+                   (-2.0 * s3 + 3.0 * s2) * m_drivenEnd[j] + (s3 - s2) * dt * m_drivenEndVelocity[j];
+        }
+        const double tau = t - m_bodyTick[j] * m_tickSize;
+        return m_positions[j] + tau * m_velocities[j] + (0.5 * tau * tau) * m_accelerations[j];
+    }
+
+    // Acceleration of body i at position x and time t (relative to the start of the macro step).
+    glm::dvec3 accelerationAt(const uint32_t i, const glm::dvec3& x, const double t) const {
+        glm::dvec3 acc(0.0);
+        for (size_t k = 0; k < m_attractors.size(); ++k) {
+            const uint32_t j = m_attractors[k];
+            if (j != i) {
+                acc += pairAcceleration(predictPosition(j, t) - x, m_mus[j]);
+            }
+        }
+        return acc;
+    }
+
+    // Coarsest level allowed to body i by its significant dynamic perturbers (one level above the finest).
+    int perturberLevel(const uint32_t i, const glm::dvec3& acceleration, const double t) const {
+        const double threshold = kPerturberFraction * kPerturberFraction * glm::dot(acceleration, acceleration);
+        int level = 0;
+        for (size_t k = 0; k < m_attractors.size(); ++k) {
+            const uint32_t j = m_attractors[k];
+            if (j != i && isDynamic(j) && m_levels[j] > level + 1) {
+                const glm::dvec3 a = pairAcceleration(predictPosition(j, t) - m_positions[i], m_mus[j]);
+                if (glm::dot(a, a) > threshold) {
+                    level = m_levels[j] - 1;
+                }
+            }
+        }
+        return level;
+    }
+
+    // One body step with error control, retried at finer levels until accepted.
+    BodyStepResult integrateBody(const uint32_t i, const uint64_t tick) const {
+        // Dormand-Prince 5(4) tableau
+        static const double c[7] = { 0.0, 1.0 / 5.0, 3.0 / 10.0, 4.0 / 5.0, 8.0 / 9.0, 1.0, 1.0 };
+        static const double a[7][6] = {
+            { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
+            { 1.0 / 5.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
+            { 3.0 / 40.0, 9.0 / 40.0, 0.0, 0.0, 0.0, 0.0 },
+            { 44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0, 0.0, 0.0, 0.0 },
+            { 19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0, 0.0, 0.0 },
+            { 9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0, 0.0 },
+            { 35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0 } };
+        // 5th order weights minus the embedded 4th order ones
+        static const double e[7] = { 71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0 };
+
+        BodyStepResult result;
+        result.rejections = 0;
+        int level = m_levels[i];
+        const double t0 = tick * m_tickSize;
+        const glm::dvec3 x0 = m_positions[i];
+        const glm::dvec3 v0 = m_velocities[i];
+        const glm::dvec3 a0 = accelerationAt(i, x0, t0);
+        const int minLevel = perturberLevel(i, a0, t0);
+        level = std::max(level, minLevel);
+
+        while (true) {
+            const uint64_t ticks = uint64_t(1) << (m_maxLevel - level);
+            const double h = ticks * m_tickSize;
+            glm::dvec3 kx[7], kv[7]; // stage derivatives of position (velocities) and velocity (accelerations)
+            kx[0] = v0;
+            kv[0] = a0;
+            glm::dvec3 x, v;
+            for (int s = 1; s < 7; ++s) {
+                x = x0;
+                v = v0;
+                for (int m = 0; m < s; ++m) {
+                    x += (h * a[s][m]) * kx[m];
+                    v += (h * a[s][m]) * kv[m];
+                }
+                kx[s] = v;
+                kv[s] = accelerationAt(i, x, t0 + c[s] * h);
+            }
+            // The last stage is evaluated at the 5th order solution (FSAL): x, v and kv[6] are the new state
+            glm::dvec3 errX(0.0), errV(0.0);
+            for (int m = 0; m < 7; ++m) {
+                errX += (h * e[m]) * kx[m];
+                errV += (h * e[m]) * kv[m];
+            }
+            // Floored at the tolerance of the softening length over the step, so that a body barely moving, or
+            // close to another one, is not held to an error of zero
+            const double floorX = m_tolerance * std::sqrt(m_softening2);
+            const double scaleX = std::max(m_tolerance * glm::length(x - x0), floorX);
+            const double scaleV = std::max(m_tolerance * glm::length(v - v0), floorX / h);
+            const double err = std::max(glm::length(errX) / std::max(scaleX, DBL_MIN), glm::length(errV) / std::max(scaleV, DBL_MIN));
+
+            if (err > 1.0 && level < m_maxLevel) {
+                ++level; // rejected: retry with half the step
+                ++result.rejections;
+                continue;
+            }
+
+            result.position = x;
+            result.velocity = v;
+            result.acceleration = kv[6];
+            result.ticks = ticks;
+            // Next level from the usual step size controller, coarsening only on an aligned tick
+            const double factor = err > 0.0 ? 0.9 * std::pow(err, -0.2) : 5.0;
+            int nextLevel = level;
+            if (factor < 1.0 && level < m_maxLevel) {
+                ++nextLevel;
+            }
+            else if (factor >= 2.0 && level > 0 && ((tick + ticks) % (ticks * 2)) == 0) {
+                --nextLevel;
+            }
+            result.level = std::max(nextLevel, minLevel);
+            return result;
+        }
+    }
+
+    void stepAdaptive(const double dt) {
+        const size_t n = m_positions.size();
+        collectAttractors();
+        m_macroStep = dt;
+        m_tickSize = dt / static_cast<double>(uint64_t(1) << m_maxLevel);
+        m_lastBodySteps = 0;
+        m_lastRejections = 0;
+
+        // Driven bodies: states at both ends of the macro step, interpolated in between
+        m_drivenStart.assign(m_positions.begin(), m_positions.end());
+        m_drivenStartVelocity.assign(m_velocities.begin(), m_velocities.end());
+        m_drivenEnd = m_drivenStart;
+        m_drivenEndVelocity = m_drivenStartVelocity;
+        for (size_t i = 0; i < n; ++i) {
+            if (m_sourceIds[i] != kNotDriven) {
+                updateDrivenBody(static_cast<uint32_t>(i), m_time + dt, m_drivenEnd[i], m_drivenEndVelocity[i]);
+            }
+        }
+
+        // Dynamic bodies all start at tick 0, with their acceleration for the Taylor predictor
+        m_bodyTick.assign(n, 0);
+        m_nextTick.assign(n, 0);
+        forBodies(n, [this](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                if (isDynamic(i)) {
+                    m_levels[i] = static_cast<uint8_t>(std::min<int>(m_levels[i], m_maxLevel));
+                    m_accelerations[i] = accelerationAt(static_cast<uint32_t>(i), m_positions[i], 0.0);
+                }
+            }
+        });
+
+        const uint64_t endTick = uint64_t(1) << m_maxLevel;
+        uint64_t tick = 0;
+        std::vector<uint32_t> active;
+        std::vector<BodyStepResult> results;
+        while (true) {
+            active.clear();
+            uint64_t next = endTick;
+            for (size_t i = 0; i < n; ++i) {
+                if (isDynamic(i) && m_nextTick[i] < endTick) {
+                    next = std::min(next, m_nextTick[i]);
+                }
+            }
+            if (next >= endTick) {
+                break;
+            }
+            tick = next;
+            for (size_t i = 0; i < n; ++i) {
+                if (isDynamic(i) && m_nextTick[i] == tick) {
+                    active.push_back(static_cast<uint32_t>(i));
+                }
+            }
+
+            // Each active body only reads committed states: this loop can be split freely
+            results.resize(active.size());
+            forBodies(active.size(), [this, &active, &results, tick](size_t first, size_t last) {
+                for (size_t k = first; k < last; ++k) {
+                    results[k] = integrateBody(active[k], tick);
+                }
+            });
+            for (size_t k = 0; k < active.size(); ++k) {
+                const uint32_t i = active[k];
+                const BodyStepResult& r = results[k];
+                m_positions[i] = r.position;
+                m_velocities[i] = r.velocity;
+                m_accelerations[i] = r.acceleration;
+                m_bodyTick[i] = tick + r.ticks;
+                m_nextTick[i] = tick + r.ticks;
+                m_levels[i] = static_cast<uint8_t>(r.level);
+                m_lastBodySteps += 1;
+                m_lastRejections += r.rejections;
+            }
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            if (m_sourceIds[i] != kNotDriven) {
+                m_positions[i] = m_drivenEnd[i];
+                m_velocities[i] = m_drivenEndVelocity[i];
+            }
+        }
+        m_time += dt;
+        m_accelerationsValid = false; // the leapfrog recomputes them from the positions
+    }
+
+    std::vector<glm::dvec3> m_positions;
+    std::vector<glm::dvec3> m_velocities;
+    std::vector<glm::dvec3> m_accelerations;
+    std::vector<double> m_mus;
+    std::vector<double> m_radii;
+    std::vector<uint32_t> m_sourceIds;
+    std::vector<uint8_t> m_levels;
+    std::vector<uint8_t> m_absorbed;
+    std::vector<uint32_t> m_attractors;
+    TrajectorySource* m_source = nullptr;
+    JobSystem* m_jobs = nullptr;
+    SimulationIntegrator m_integrator = kIntegratorLeapfrog;
+    double m_softening2 = 0.0;
+    double m_tolerance = 1e-10;
+    int m_maxLevel = kSimulationMaxLevel;
+    double m_stepSize = 1.0;
+    double m_time = 0.0;
+    uint64_t m_stepCount = 0;
+    bool m_accelerationsValid = false;
+    CollisionResponse m_collisionResponse = kCollisionNone;
+    double m_restitution = 0.5;
+
+    // Collision scratch
+    CollisionGrid m_broadphase;
+    std::vector<glm::dvec3> m_stepStart;
+    std::vector<CollisionContact> m_contacts;
+    std::vector<uint8_t> m_collided;
+
+    // Adaptive integrator scratch
+    std::vector<glm::dvec3> m_drivenStart, m_drivenStartVelocity, m_drivenEnd, m_drivenEndVelocity;
+    std::vector<uint64_t> m_bodyTick, m_nextTick;
+    double m_macroStep = 0.0;
+    double m_tickSize = 0.0;
+    uint64_t m_lastBodySteps = 0;
+    uint64_t m_lastRejections = 0;
+};
+
+#endif // SIMULATION_H
@@ -0,0 +1,68 @@
+// ----------------------------------------------------------------------------
+// sphere.h
+//
+// Description: Geometry of the UV sphere the bodies are drawn with. Shared by
+//              the Mesh of main.cpp and tools/asset_packer.cpp, which bakes it
+//              so that the application does not build it at startup.
+// ----------------------------------------------------------------------------
+
+#ifndef SPHERE_H
+#define SPHERE_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+const static size_t kSphereResolution = 24; // vertices per parallel and per meridian
+
+// Appends the vertices (positions, normals, texture coordinates) and triangles of a sphere of the given radius.
+inline void generateSphere(const float radius, const size_t resolution, std::vector<float>& positions, std::vector<float>& normals,
+                           std::vector<float>& texCoords, std::vector<unsigned int>& indices) {
+    // phiValues that range from 0 up to 360
+    // tetaValues that range from 0 up to 180
+    const double pi = 3.14159265;
+    float step = 2 * pi / (resolution - 1);
+    float x = 0;
+    float y = 0;
+    float z = 0;
+    unsigned int vertexCounter = 0;
+    float textureCoefficient = 1.0f / (resolution - 1);
+    for (size_t i = 0; i < resolution; i++) {
+        float phi = pi - (i * step);
+
+        for (size_t j = 0; j < resolution; j++) {
+
+            float theta = pi - (j * step / 2);
+            x = (radius * sin(theta) * cos(phi));
+            z = radius * sin(phi) * sin(theta);
+            y = radius * cos(theta);
+            normals.push_back(x);
+            normals.push_back(y);
+            normals.push_back(z);
+            if (vertexCounter + resolution < resolution * resolution) {
+                indices.push_back(vertexCounter);
+                indices.push_back(vertexCounter + resolution);
+                indices.push_back(vertexCounter + resolution + 1);
+                indices.push_back(vertexCounter);
+                indices.push_back(vertexCounter + resolution + 1);
+                indices.push_back(vertexCounter + 1);
+            }
+            else {
+                indices.push_back(vertexCounter);
+                indices.push_back(resolution * resolution);
+                indices.push_back(resolution * resolution);
+            }
+
+            positions.push_back(x);
+            positions.push_back(y);
+            positions.push_back(z);
+
+            texCoords.push_back(i * textureCoefficient);
+            texCoords.push_back(1 - j * textureCoefficient);
+
+            vertexCounter = vertexCounter + 1;
+        }
+    }
+}
+
+#endif // SPHERE_H
@@ -0,0 +1,10 @@
+#version 330 core
+in vec4 fColor;
+out vec4 color;
+
+void main() {
+// Soft round sprites
+vec2 d = gl_PointCoord - vec2(0.5);
+float falloff = clamp(1.0 - 4.0 * dot(d, d), 0.0, 1.0);
+color = vec4(fColor.rgb, fColor.a * falloff);
+}
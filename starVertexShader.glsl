@@ -0,0 +1,29 @@
+#version 330 core
+// One point per star, at infinity (see starfield.h)
+layout(location=0) in vec3 vDirection;
+layout(location=1) in float vMagnitude;
+layout(location=2) in float vColorIndex; // B-V
+uniform mat4 projView;
+uniform float magnitudeLimit;
+
+out vec4 fColor;
+
+// Blackbody color of the temperature given by the color index (Ballesteros 2012), normalized to the brightest
+// channel
+vec3 colorOfIndex(float bv) {
+float t = 4600.0 * (1.0 / (0.92 * bv + 1.7) + 1.0 / (0.92 * bv + 0.62)) / 100.0;
+float r = (t <= 66.0) ? 1.0 : 1.292936 * pow(t - 60.0, -0.1332047);
+float g = (t <= 66.0) ? 0.3900816 * log(t) - 0.6318414 : 1.1298909 * pow(t - 60.0, -0.0755148);
+float b = (t >= 66.0) ? 1.0 : ((t <= 19.0) ? 0.0 : 0.5432068 * log(t - 10.0) - 1.1962541);
+return clamp(vec3(r, g, b), 0.0, 1.0);
+}
+
+void main() {
+// Flux relative to a magnitude 0 star; perceived brightness grows slower, and bright stars get larger
+float flux = pow(10.0, -0.4 * vMagnitude);
+float fade = clamp((magnitudeLimit - vMagnitude) * 2.0, 0.0, 1.0); // no popping at the limit
+gl_PointSize = clamp(2.0 * sqrt(flux), 1.0, 5.0);
+fColor = vec4(colorOfIndex(vColorIndex), clamp(pow(flux, 0.35), 0.08, 1.0) * fade);
+gl_Position = projView * vec4(vDirection, 0.0);
+gl_Position.z = 0.0; // depth is not tested; keeps the star inside the clip volume whatever the far plane
+}
@@ -0,0 +1,97 @@
+// ----------------------------------------------------------------------------
+// star_catalog.h
+//
+// Description: Star catalog: direction, visual magnitude and B-V color index
+//              of each star. tools/star_compiler.cpp converts HYG/Hipparcos
+//              style CSV catalogs into the binary layout below, which is
+//              memory-mapped and uploaded as is at runtime.
+// ----------------------------------------------------------------------------
+
+#ifndef STAR_CATALOG_H
+#define STAR_CATALOG_H
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// ---- Binary file layout ----------------------------------------------------
+// [StarCatalogHeader][numStars * StarRecord]
+// Stars are sorted by increasing magnitude (brightest first), so the stars brighter than a limit are a prefix.
+
+const static char kStarCatalogMagic[8] = { 'S', 'T', 'A', 'R', 'B', 'I', 'N', '1' };
+
+struct StarRecord {
+    float direction[3]; // unit vector in scene space: equatorial (x, y, z) mapped to (x, z, -y), as the ephemeris
+    float magnitude;    // apparent visual magnitude
+    float colorIndex;   // B-V
+};
+
+struct StarCatalogHeader {
+    char magic[8];
+    uint32_t numStars;
+    uint32_t recordSize; // sizeof(StarRecord)
+    uint64_t starsOffset;
+};
+
+// ---- Runtime access -----------------------------------------------------------
+
+class StarCatalog {
+public:
+    // Maps a binary file produced by tools/star_compiler. Returns false on a missing or malformed file.
+    bool open(const std::string& filename) {
+        close();
+        if (!m_file.open(filename)) {
+            return false;
+        }
+        const StarCatalogHeader* header = m_file.at<StarCatalogHeader>(0);
+        if (!header || std::memcmp(header->magic, kStarCatalogMagic, sizeof(kStarCatalogMagic)) != 0 ||
+            header->recordSize != sizeof(StarRecord)) {
+            close();
+            return false;
+        }
+        const StarRecord* stars = m_file.at<StarRecord>(static_cast<size_t>(header->starsOffset), header->numStars);
+        if (!stars) {
+            close();
+            return false;
+        }
+        m_header = header;
+        m_stars = stars;
+        return true;
+    }
+
+    void close() {
+        m_file.close();
+        m_header = nullptr;
+        m_stars = nullptr;
+    }
+
+    inline bool isOpen() const { return m_header != nullptr; }
+    inline uint32_t getNumStars() const { return m_header->numStars; }
+    inline const StarRecord* getStars() const { return m_stars; }
+    inline const StarRecord& getStar(const uint32_t i) const { return m_stars[i]; }
+
+    // Number of stars at most as faint as the given magnitude.
+    uint32_t countBrighterThan(const float magnitude) const {
+        uint32_t lo = 0;
+        uint32_t hi = m_header->numStars;
+        while (lo < hi) {
+            const uint32_t mid = lo + (hi - lo) / 2;
+            if (m_stars[mid].magnitude <= magnitude) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+private:
+    MappedFile m_file;
+    const StarCatalogHeader* m_header = nullptr;
+    const StarRecord* m_stars = nullptr;
+};
+
+#endif // STAR_CATALOG_H
@@ -0,0 +1,108 @@
+// ----------------------------------------------------------------------------
+// starfield.h
+//
+// Description: Sky background drawn from a star catalog (see star_catalog.h):
+//              the mapped records are uploaded once as a vertex buffer, and
+//              every star brighter than the magnitude limit is a point sprite
+//              of one draw call, sized and colored by the vertex shader from its
+//              magnitude and color index. Stars are at infinity: only the
+//              rotation of the camera moves them.
+// ----------------------------------------------------------------------------
+
+#ifndef STARFIELD_H
+#define STARFIELD_H
+
+#include "gpu_resources.h"
+#include "star_catalog.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+void loadShader(GLuint program, GLenum type, const std::string& shaderFilename); // main.cpp
+
+class StarFieldRenderer {
+public:
+    // Uploads the stars of an open catalog; the catalog can be closed afterwards.
+    void init(const StarCatalog& catalog) {
+        m_program.create();
+        loadShader(m_program.get(), GL_VERTEX_SHADER, "starVertexShader.glsl");
+        loadShader(m_program.get(), GL_FRAGMENT_SHADER, "starFragmentShader.glsl");
+        glLinkProgram(m_program.get());
+
+        m_vao.create(kGpuStars);
+        glBindVertexArray(m_vao.get());
+        m_vbo.create(kGpuStars);
+        m_vbo.setData(GL_ARRAY_BUFFER, catalog.getNumStars() * sizeof(StarRecord), catalog.getStars(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(StarRecord), reinterpret_cast<void*>(offsetof(StarRecord, direction)));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(StarRecord), reinterpret_cast<void*>(offsetof(StarRecord, magnitude)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(StarRecord), reinterpret_cast<void*>(offsetof(StarRecord, colorIndex)));
+        glEnableVertexAttribArray(2);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        m_numStars = catalog.getNumStars();
+        m_numVisible = catalog.countBrighterThan(m_magnitudeLimit);
+        m_catalog = &catalog;
+    }
+
+    void clear() {
+        m_vao.reset();
+        m_vbo.reset();
+        m_program.reset();
+        m_numStars = m_numVisible = 0;
+        m_catalog = nullptr;
+    }
+
+    inline uint32_t getNumStars() const { return m_numStars; }
+    inline uint32_t getNumVisible() const { return m_numVisible; }
+
+    // Faintest magnitude drawn; the catalog must still be open.
+    void setMagnitudeLimit(const float magnitude) {
+        m_magnitudeLimit = magnitude;
+        if (m_catalog && m_catalog->isOpen()) {
+            m_numVisible = m_catalog->countBrighterThan(magnitude);
+        }
+    }
+
+    // Draws the sky behind everything: call first, right after clearing. projView is the camera-relative
+    // projection * view (see world.h), whose rotation is all that matters at infinity.
+    void render(const glm::mat4& projView) {
+        if (m_numVisible == 0) {
+            return;
+        }
+        glUseProgram(m_program.get());
+        glUniformMatrix4fv(glGetUniformLocation(m_program.get(), "projView"), 1, GL_FALSE, glm::value_ptr(projView));
+        glUniform1f(glGetUniformLocation(m_program.get(), "magnitudeLimit"), m_magnitudeLimit);
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE); // overlapping stars add up
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(m_vao.get());
+        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(m_numVisible));
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+
+private:
+    GpuProgram m_program;
+    GpuVertexArray m_vao;
+    GpuBuffer m_vbo;
+    uint32_t m_numStars = 0;
+    uint32_t m_numVisible = 0; // brightest first: the first ones
+    float m_magnitudeLimit = 12.0f; // the whole of HYG (~120k stars)
+    const StarCatalog* m_catalog = nullptr;
+};
+
+#endif // STARFIELD_H
@@ -0,0 +1,135 @@
+// ----------------------------------------------------------------------------
+// texture_cache.h
+//
+// Description: Disk cache of the scene textures in BC1 (see bc1.h), a file
+//              next to each source image holding its whole mip chain as GPU
+//              blocks, with the hash of the source it was encoded from. The
+//              first run encodes it; later runs map it and hand the blocks to
+//              OpenGL as they are, with no image to decode, and the texture
+//              takes 6 times less memory than in RGB. A cache whose hash does
+//              not match its source is stale and encoded again.
+// ----------------------------------------------------------------------------
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "asset_pack.h"
+#include "bc1.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// ---- Binary file layout ----------------------------------------------------
+// [TextureCacheHeader][padding][level 0 blocks][padding][level 1 blocks]...
+// Offsets are from the start of the file, levels start on kTextureCacheAlignment boundaries.
+
+const static char kTextureCacheMagic[8] = { 'T', 'E', 'X', 'C', 'A', 'C', 'H', '1' };
+const static char* kTextureCacheExtension = ".texcache"; // appended to the name of the source
+const static uint64_t kTextureCacheAlignment = 16;
+
+enum TextureCacheFormat {
+    kTextureCacheBC1 = 1 // opaque RGB
+};
+
+struct TextureCacheHeader {
+    char magic[8];
+    uint64_t sourceHash; // FNV-1a of the bytes of the source file
+    uint64_t sourceSize;
+    uint32_t format;     // TextureCacheFormat
+    uint32_t numLevels;  // down to 1x1
+    PackedTextureLevel levels[kMaxTextureLevels]; // sizes are of the blocks
+};
+
+// Contents of a cache file, built in memory by the encoder and then written, or mapped from the disk: levels
+// are read the same way from both.
+class TextureCache {
+public:
+    // Maps the cache of the source, if it exists and was encoded from the same bytes. Returns false otherwise.
+    bool open(const std::string& filename, const uint64_t sourceHash, const uint64_t sourceSize) {
+        close();
+        if (!m_file.open(filename)) {
+            return false;
+        }
+        const TextureCacheHeader* header = m_file.at<TextureCacheHeader>(0);
+        if (!header || std::memcmp(header->magic, kTextureCacheMagic, sizeof(kTextureCacheMagic)) != 0 ||
+            header->sourceHash != sourceHash || header->sourceSize != sourceSize || header->format != kTextureCacheBC1 ||
+            header->numLevels == 0 || header->numLevels > kMaxTextureLevels) {
+            close();
+            return false;
+        }
+        for (uint32_t l = 0; l < header->numLevels; ++l) {
+            const PackedTextureLevel& level = header->levels[l];
+            if (level.size != computeBC1Size(level.width, level.height) || !m_file.at<unsigned char>(static_cast<size_t>(level.offset), static_cast<size_t>(level.size))) {
+                close();
+                return false;
+            }
+        }
+        m_header = header;
+        return true;
+    }
+
+    void close() {
+        m_file.close();
+        std::vector<unsigned char>().swap(m_blob);
+        m_header = nullptr;
+    }
+
+    // Encodes the levels, tightly packed RGB from the full image down to 1x1, in memory. encodeRows(level,
+    // rgb, blocks) must call encodeBC1 on all the rows of blocks of the level (a PackedTextureLevel), possibly
+    // in parallel.
+    template <typename EncodeRows>
+    void encode(const std::vector<const unsigned char*>& levels, uint32_t width, uint32_t height, const uint64_t sourceHash,
+                const uint64_t sourceSize, const EncodeRows& encodeRows) {
+        close();
+        TextureCacheHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, kTextureCacheMagic, sizeof(kTextureCacheMagic));
+        header.sourceHash = sourceHash;
+        header.sourceSize = sourceSize;
+        header.format = kTextureCacheBC1;
+        header.numLevels = static_cast<uint32_t>(std::min<size_t>(levels.size(), kMaxTextureLevels));
+        uint64_t offset = sizeof(TextureCacheHeader);
+        for (uint32_t l = 0; l < header.numLevels; ++l) {
+            PackedTextureLevel& level = header.levels[l];
+            offset = (offset + kTextureCacheAlignment - 1) / kTextureCacheAlignment * kTextureCacheAlignment;
+            level.width = width;
+            level.height = height;
+            level.offset = offset;
+            level.size = computeBC1Size(width, height);
+            offset += level.size;
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
+        m_blob.assign(static_cast<size_t>(offset), 0);
+        std::memcpy(m_blob.data(), &header, sizeof(header));
+        m_header = reinterpret_cast<const TextureCacheHeader*>(m_blob.data());
+        for (uint32_t l = 0; l < header.numLevels; ++l) {
+            encodeRows(header.levels[l], levels[l], m_blob.data() + header.levels[l].offset);
+        }
+    }
+
+    // Writes what encode() built. Returns false if the file cannot be written.
+    bool write(const std::string& filename) const {
+        std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(m_blob.data()), m_blob.size());
+        return static_cast<bool>(out);
+    }
+
+    inline bool isOpen() const { return m_header != nullptr; }
+    inline const TextureCacheHeader& getHeader() const { return *m_header; }
+    inline const unsigned char* getLevel(const uint32_t level) const {
+        return reinterpret_cast<const unsigned char*>(m_header) + m_header->levels[level].offset;
+    }
+
+private:
+    MappedFile m_file;
+    std::vector<unsigned char> m_blob; // encoded, not mapped
+    const TextureCacheHeader* m_header = nullptr;
+};
+
+#endif // TEXTURE_CACHE_H
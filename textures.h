@@ -0,0 +1,768 @@
+// ----------------------------------------------------------------------------
+// textures.h
+//
+// Description: Asynchronous loading of the scene textures. Textures are
+//              requested at process start, before there is an OpenGL context,
+//              and loaded by jobs meanwhile (see jobs.h), all at once. Once
+//              the context exists, every texture gets its OpenGL name with a
+//              placeholder texel, so that the renderer can bind it right away,
+//              and its image starts uploading on the first frame after its
+//              load finishes. The first frame waits for no load, and all of
+//              them are done after about the longest one.
+//
+//              Textures are sampled trilinearly from a full mip chain, the one
+//              baked in the pack or else one computed by the load (see
+//              mipmaps.h), and anisotropically where the driver supports it: a
+//              distant body reads a few texels of a small level rather than
+//              scattered ones of the full image.
+//
+//              Opaque images are stored in BC1 in a disk cache next to their
+//              source (see texture_cache.h), encoded by the first run: later
+//              runs upload the blocks and decode nothing.
+//
+//              Uploads go through a ring of pixel unpack buffers (see
+//              upload_ring.h), coarse levels first and in bands of rows, under
+//              a budget of bytes per frame; the base level of the texture
+//              follows the finest complete one. A large texture sharpens over
+//              a few frames, and no frame waits for a transfer.
+//
+//              Residency: the renderer tells, per frame, how many texels
+//              across each texture is drawn with (see require()), from the
+//              projected size of its bodies; it needs the level of about that
+//              width, and no finer one. A texture is allocated from its first
+//              needed level down, which becomes its level 0: the cache or pack
+//              levels stay mapped. A texture changes residency into a second
+//              texture: the levels both have are copied on the GPU, the finer
+//              ones staged like its first upload, and the texture drawn until
+//              then is replaced once the new one is complete, with no frame
+//              drawn from fewer levels than either; losing levels replaces it
+//              right away, with nothing staged. Finer levels stream in as
+//              bodies approach; while the textures go over their budget of
+//              memory, those of the bodies not drawn for the longest lose the
+//              levels they no longer need, and when what they need does not
+//              fit either, every texture drops the same number of levels.
+//              Off-screen, a texture keeps its levels of at most
+//              kTextureResidentMinSize texels.
+// ----------------------------------------------------------------------------
+
+#ifndef TEXTURES_H
+#define TEXTURES_H
+
+#include "asset_pack.h"
+#include "gpu_resources.h"
+#include "jobs.h"
+#include "jpeg_bands.h"
+#include "mipmaps.h"
+#include "stb_image.h"
+#include "texture_cache.h"
+#include "upload_ring.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// GL_EXT_texture_filter_anisotropic (core in OpenGL 4.6), not in the loader generated for 3.3
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT 0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
+#endif
+// GL_EXT_texture_compression_s3tc, likewise
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+const static unsigned char kPlaceholderTexel[3] = { 128, 128, 128 }; // neutral grey, until the image is there
+const static size_t kTextureEncodeJobRows = 16; // rows of BC1 blocks per encode job
+const static float kTextureAnisotropy = 8.0f; // samples along the stretched axis, for the limbs seen at grazing angles
+const static size_t kTextureUploadBytesPerFrame = 4 << 20; // staged per frame, about 1 ms of transfer
+const static size_t kTextureBudgetBytes = size_t(512) << 20; // default memory of the textures, levels and placeholders
+const static uint32_t kTextureResidentMinSize = 64; // texels: the levels up to this size stay resident when not drawn
+
+// Whether the context exposes the extension, from the list of OpenGL 3.
+inline bool hasGLExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint e = 0; e < count; ++e) {
+        const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, e));
+        if (extension && std::strcmp(extension, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Anisotropy the textures are sampled with: kTextureAnisotropy within the limit of the driver, 1 (isotropic)
+// without the extension.
+inline float queryTextureAnisotropy() {
+    if (!hasGLExtension("GL_EXT_texture_filter_anisotropic") && !hasGLExtension("GL_ARB_texture_filter_anisotropic")) {
+        return 1.0f;
+    }
+    GLfloat limit = 1.0f;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &limit);
+    return std::min(kTextureAnisotropy, limit);
+}
+
+// Trilinear (and anisotropic above 1) sampling of the bound texture, whose levels go up to maxLevel.
+inline void setMipmapFiltering(const GLint maxLevel, const float anisotropy) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+    if (anisotropy > 1.0f) {
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisotropy);
+    }
+}
+
+class TextureLoader {
+public:
+    // Loads run as jobs of this system; without one, they run in request().
+    inline void setJobSystem(JobSystem* jobs) { m_jobs = jobs; }
+
+    // Starts loading a texture: from its cache if it is up to date, from the pack if it is there (packed may be
+    // null), from its file otherwise. Needs no OpenGL context. Returns the slot of the texture.
+    uint32_t request(const std::string& filename, const PackedTexture* packed) {
+        m_slots.push_back(std::unique_ptr<Slot>(new Slot()));
+        Slot& slot = *m_slots.back();
+        slot.filename = filename;
+        slot.packed = packed;
+        Slot* loaded = &slot; // slots are on the heap: the pointer outlives the growth of m_slots
+        if (m_jobs) {
+            m_jobs->run(m_loads, [this, loaded]() { load(*loaded); });
+        }
+        else {
+            load(*loaded);
+        }
+        ++m_loading;
+        return static_cast<uint32_t>(m_slots.size() - 1);
+    }
+
+    // With the context: names every texture requested, with the placeholder for content.
+    void initGPU() {
+        m_ring.init(kTextureUploadBytesPerFrame);
+        m_anisotropy = queryTextureAnisotropy();
+        m_compressed = hasGLExtension("GL_EXT_texture_compression_s3tc");
+        if (!m_compressed) {
+            std::cerr << "WARNING: BC1 textures are not supported, the texture caches are decompressed on upload" << std::endl;
+        }
+        for (size_t s = 0; s < m_slots.size(); ++s) {
+            Slot& slot = *m_slots[s];
+            if (slot.texture.get()) {
+                continue;
+            }
+            slot.texture.create(kGpuTextures);
+            glBindTexture(GL_TEXTURE_2D, slot.texture.get());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, kPlaceholderTexel);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            slot.texture.setBytes(sizeof(kPlaceholderTexel));
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Memory the textures may take, in bytes; 0 for no limit.
+    inline void setBudget(const size_t bytes) { m_budget = bytes; }
+    inline size_t getBudget() const { return m_budget; }
+    // Of the levels allocated or about to be.
+    inline size_t getResidentBytes() const { return m_residentBytes; }
+
+    // While drawing a frame: the texture is drawn across about this many pixels along its width. The finest
+    // level it needs is the one of about that width, as of the next update().
+    inline void require(const uint32_t slot, const float texels) {
+        Slot& s = *m_slots[slot];
+        s.requiredWidth = std::max(s.requiredWidth, texels);
+        s.lastRequired = m_frame;
+    }
+
+    // Per frame, on the thread of the context: queues the textures loaded since the last call, changes the
+    // residency of the others for the last frame, and stages the next bands of the queued ones within the
+    // budget, in place of their placeholder. Returns the number of textures not completely uploaded yet.
+    uint32_t update() {
+        for (size_t s = 0; m_loading > 0 && s < m_slots.size(); ++s) {
+            Slot& slot = *m_slots[s];
+            if (slot.queued || !slot.texture.get() || !slot.loaded.load(std::memory_order_acquire)) {
+                continue;
+            }
+            slot.queued = true;
+            if (prepareUpload(slot)) {
+                slot.firstLevel = slot.managed ? findNeededLevel(slot) : 0;
+                queueUpload(slot);
+            }
+            else {
+                finishUpload(slot); // keeps the placeholder
+            }
+        }
+        updateResidency();
+        if (!m_uploads.empty()) {
+            stageUploads();
+        }
+        ++m_frame;
+        return m_loading;
+    }
+
+    inline uint32_t getNumTextures() const { return static_cast<uint32_t>(m_slots.size()); }
+    // The name changes with the residency of the texture: read it when drawing.
+    inline GLuint getTexture(const uint32_t slot) const { return m_slots[slot]->texture.get(); }
+
+    // Waits for the loads in flight, then releases everything; while the context is alive and the job system
+    // runs.
+    void clear() {
+        waitForLoads();
+        m_uploads.clear();
+        m_slots.clear();
+        m_ring.clear();
+        m_copyBuffer.reset();
+        m_loading = 0;
+        m_residentBytes = 0;
+    }
+
+private:
+    // How the levels of a texture are staged
+    enum UploadKind {
+        kUploadBlocks = 0,    // BC1 blocks, as they are
+        kUploadDecodedBlocks, // BC1 blocks decoded to RGB, without driver support
+        kUploadTexels         // uncompressed texels
+    };
+
+    struct UploadLevel {
+        const unsigned char* data;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct Slot {
+        std::string filename;
+        const PackedTexture* packed = nullptr;
+        TextureCache cache;              // BC1 levels, mapped or just encoded, kept for changes of residency
+        unsigned char* pixels = nullptr; // decoded and not cached, until uploaded
+        int width = 0;
+        int height = 0;
+        int components = 0;              // decoded, or of the levels uploaded
+        const char* failure = nullptr;   // reason of a failed decode; stb_image keeps it per thread
+        std::vector<std::vector<unsigned char> > mips; // levels after the first of pixels
+        bool cacheUnwritable = false;
+        std::atomic<bool> loaded{false}; // the fields above are set
+        GpuTexture texture;
+        GpuTexture staging;    // the levels of a change of residency, replacing texture once complete
+        bool queued = false;   // for its first upload, or failed
+        bool complete = false; // uploaded once, or failed
+
+        // Upload in progress: levels from the coarsest, bands of rows in each
+        UploadKind kind = kUploadTexels;
+        GLenum format = GL_RGB;
+        uint32_t numLevels = 0;
+        UploadLevel levels[kMaxTextureLevels];
+        size_t chainBytes[kMaxTextureLevels]; // allocated from each level to the coarsest
+        uint32_t nextLevel = 0;
+        uint32_t nextRow = 0;
+        bool allocated = false;
+        bool uploading = false; // in the queue
+
+        // Residency: the levels from firstLevel are allocated, or about to be; firstLevel is level 0 of the texture
+        bool managed = false;           // its levels stay readable: from the cache or the pack
+        uint32_t firstLevel = 0;
+        uint32_t neededLevel = 0;       // for the last frame, within the budget
+        float requiredWidth = 0.0f;     // texels across, the most drawn with since the last update
+        uint64_t lastRequired = 0;      // frame
+
+        ~Slot() { stbi_image_free(pixels); }
+    };
+
+    // On a worker: only touches its slot. The cache is keyed by the hash of the source, stored in the pack
+    // for a packed texture, which is then not read at all; if the cache is stale, the source is decoded
+    // (unless the pack has its levels) and encoded, and the cache written for the next runs. Only opaque RGB
+    // images are cached.
+    void load(Slot& slot) {
+        std::vector<unsigned char> source;
+        uint64_t hash, size;
+        if (slot.packed) {
+            hash = slot.packed->sourceHash;
+            size = slot.packed->sourceSize;
+        }
+        else {
+            std::ifstream file(slot.filename.c_str(), std::ios::binary);
+            if (file) {
+                source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            }
+            if (source.empty()) {
+                slot.failure = "cannot read the file";
+                slot.loaded.store(true, std::memory_order_release);
+                return;
+            }
+            hash = hashFNV1a(source.data(), source.size());
+            size = source.size();
+        }
+        const std::string cacheFilename = slot.filename + kTextureCacheExtension;
+        if (slot.cache.open(cacheFilename, hash, size)) {
+            slot.loaded.store(true, std::memory_order_release);
+            return;
+        }
+
+        std::vector<const unsigned char*> levels;
+        std::vector<std::vector<unsigned char> > mips(kMaxTextureLevels);
+        uint32_t width = 0, height = 0;
+        if (slot.packed) {
+            if (slot.packed->components == 3) {
+                for (uint32_t l = 0; l < slot.packed->numLevels; ++l) {
+                    levels.push_back(AssetPack::getLevel(slot.packed, l));
+                }
+                width = slot.packed->levels[0].width;
+                height = slot.packed->levels[0].height;
+            }
+        }
+        else {
+            // Large JPEGs with restart markers decode in bands, on all the workers
+            slot.pixels = m_jobs ? decodeJpegBands(source.data(), source.size(), &slot.width, &slot.height, &slot.components, *m_jobs) : nullptr;
+            if (!slot.pixels) {
+                slot.pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &slot.width, &slot.height, &slot.components, 0);
+            }
+            if (!slot.pixels) {
+                slot.failure = stbi_failure_reason();
+            }
+            else if (slot.components == 3) {
+                width = static_cast<uint32_t>(slot.width);
+                height = static_cast<uint32_t>(slot.height);
+                levels.push_back(slot.pixels);
+                uint32_t w = width, h = height;
+                while ((w > 1 || h > 1) && levels.size() < kMaxTextureLevels) {
+                    std::vector<unsigned char>& mip = mips[levels.size()];
+                    downsampleGammaCorrect(levels.back(), w, h, 3, mip, w, h);
+                    levels.push_back(mip.data());
+                }
+            }
+            else {
+                // Not cached: its levels are computed here too, rather than by the driver on the render thread
+                const uint32_t components = static_cast<uint32_t>(slot.components);
+                const unsigned char* previous = slot.pixels;
+                uint32_t w = static_cast<uint32_t>(slot.width), h = static_cast<uint32_t>(slot.height);
+                while ((w > 1 || h > 1) && slot.mips.size() + 1 < kMaxTextureLevels) {
+                    slot.mips.push_back(std::vector<unsigned char>());
+                    downsampleGammaCorrect(previous, w, h, components, slot.mips.back(), w, h);
+                    previous = slot.mips.back().data();
+                }
+            }
+        }
+        if (!levels.empty()) {
+            JobSystem* jobs = m_jobs;
+            slot.cache.encode(levels, width, height, hash, size,
+                [jobs](const PackedTextureLevel& level, const unsigned char* rgb, unsigned char* blocks) {
+                    const uint32_t rows = (level.height + 3) / 4;
+                    const auto encodeRows = [&](size_t first, size_t last) {
+                        encodeBC1(rgb, level.width, level.height, blocks, static_cast<uint32_t>(first), static_cast<uint32_t>(last));
+                    };
+                    if (jobs) {
+                        jobs->parallelFor(0, rows, kTextureEncodeJobRows, encodeRows);
+                    }
+                    else {
+                        encodeRows(0, rows);
+                    }
+                });
+            slot.cacheUnwritable = !slot.cache.write(cacheFilename);
+            stbi_image_free(slot.pixels);
+            slot.pixels = nullptr;
+        }
+        slot.loaded.store(true, std::memory_order_release);
+    }
+
+    // The levels to upload: the BC1 levels of the cache, decompressed while staged where the driver lacks
+    // the format (unless the pack has the texture), else those of the pack, else those decoded. Returns false
+    // if the load failed.
+    bool prepareUpload(Slot& slot) {
+        if (slot.cacheUnwritable) {
+            std::cerr << "WARNING: cannot write the texture cache " << slot.filename << kTextureCacheExtension << std::endl;
+        }
+        const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        slot.numLevels = 0;
+        if (slot.cache.isOpen() && (m_compressed || !slot.packed)) {
+            const TextureCacheHeader& header = slot.cache.getHeader();
+            slot.kind = m_compressed ? kUploadBlocks : kUploadDecodedBlocks;
+            slot.format = GL_RGB;
+            slot.components = 3;
+            slot.managed = true;
+            for (uint32_t l = 0; l < header.numLevels; ++l) {
+                addLevel(slot, slot.cache.getLevel(l), header.levels[l].width, header.levels[l].height);
+            }
+        }
+        else if (slot.packed) {
+            slot.cache.close(); // BC1 without driver support: the pack is read instead
+            slot.kind = kUploadTexels;
+            slot.managed = true;
+            slot.components = static_cast<int>(slot.packed->components);
+            slot.format = formats[slot.components - 1];
+            for (uint32_t l = 0; l < slot.packed->numLevels; ++l) {
+                addLevel(slot, AssetPack::getLevel(slot.packed, l), slot.packed->levels[l].width, slot.packed->levels[l].height);
+            }
+        }
+        else if (slot.pixels) {
+            slot.kind = kUploadTexels;
+            slot.format = formats[slot.components - 1];
+            uint32_t w = static_cast<uint32_t>(slot.width), h = static_cast<uint32_t>(slot.height);
+            addLevel(slot, slot.pixels, w, h);
+            for (size_t m = 0; m < slot.mips.size(); ++m) {
+                w = std::max(w / 2, 1u);
+                h = std::max(h / 2, 1u);
+                addLevel(slot, slot.mips[m].data(), w, h);
+            }
+        }
+        else {
+            std::cerr << "WARNING: cannot load the texture " << slot.filename << " (" << slot.failure << ")" << std::endl;
+            return false;
+        }
+        for (uint32_t l = slot.numLevels; l-- > 0;) {
+            const size_t bytes = getBandBytes(slot, slot.levels[l].width, slot.levels[l].height);
+            slot.chainBytes[l] = l + 1 < slot.numLevels ? slot.chainBytes[l + 1] + bytes : bytes;
+        }
+        return true;
+    }
+
+    // Stages the levels of the slot from its first one, from the coarsest, in place of its placeholder.
+    void queueUpload(Slot& slot) {
+        slot.nextLevel = slot.numLevels - 1;
+        slot.nextRow = 0;
+        slot.allocated = false;
+        slot.uploading = true;
+        m_uploads.push_back(&slot);
+    }
+
+    // The finest level the slot was drawn with in the last frame: the coarsest one at least as wide as
+    // required, or, not drawn, the one of kTextureResidentMinSize texels.
+    static uint32_t findNeededLevel(const Slot& slot) {
+        uint32_t level = 0;
+        while (level + 1 < slot.numLevels &&
+               std::max(slot.levels[level + 1].width, slot.levels[level + 1].height) >= kTextureResidentMinSize) {
+            ++level;
+        }
+        while (level > 0 && slot.levels[level].width < slot.requiredWidth) {
+            --level;
+        }
+        return level;
+    }
+
+    // The levels every managed texture needs, or coarser ones if they do not fit in the budget; textures go
+    // finer within the budget, and coarser while above it, the least recently drawn first. A texture being
+    // staged keeps its levels until done, and the one it replaces is counted until then.
+    void updateResidency() {
+        m_residentBytes = 0;
+        m_residency.clear();
+        for (size_t s = 0; s < m_slots.size(); ++s) {
+            Slot& slot = *m_slots[s];
+            if (slot.numLevels > 0 && (slot.uploading || slot.complete)) {
+                m_residentBytes += slot.chainBytes[slot.firstLevel] + (slot.staging.get() ? slot.texture.getBytes() : 0);
+                if (slot.managed) {
+                    slot.neededLevel = findNeededLevel(slot);
+                    m_residency.push_back(&slot);
+                }
+            }
+            else {
+                m_residentBytes += slot.texture.getBytes(); // placeholder
+            }
+            slot.requiredWidth = 0.0f;
+        }
+        if (m_residency.empty()) {
+            return;
+        }
+
+        // The same number of levels less for every texture until they fit, the others counted as they are
+        size_t fixedBytes = m_residentBytes;
+        for (size_t r = 0; r < m_residency.size(); ++r) {
+            fixedBytes -= m_residency[r]->chainBytes[m_residency[r]->firstLevel];
+        }
+        for (uint32_t drop = 0; drop < kMaxTextureLevels; ++drop) {
+            size_t bytes = fixedBytes;
+            for (size_t r = 0; r < m_residency.size(); ++r) {
+                const Slot& slot = *m_residency[r];
+                bytes += slot.chainBytes[std::min(slot.neededLevel + drop, slot.numLevels - 1)];
+            }
+            if (m_budget == 0 || bytes <= m_budget || drop + 1 == kMaxTextureLevels) {
+                for (size_t r = 0; r < m_residency.size(); ++r) {
+                    Slot& slot = *m_residency[r];
+                    slot.neededLevel = std::min(slot.neededLevel + drop, slot.numLevels - 1);
+                }
+                break;
+            }
+        }
+
+        // Evictions while above the budget with the finer levels needed, from the texture drawn the longest ago;
+        // a finer texture is staged while the one it replaces is still drawn
+        size_t neededBytes = m_residentBytes;
+        for (size_t r = 0; r < m_residency.size(); ++r) {
+            const Slot& slot = *m_residency[r];
+            if (!slot.uploading && slot.neededLevel < slot.firstLevel) {
+                neededBytes += slot.chainBytes[slot.neededLevel];
+            }
+        }
+        std::sort(m_residency.begin(), m_residency.end(), [](const Slot* a, const Slot* b) { return a->lastRequired < b->lastRequired; });
+        for (size_t r = 0; m_budget > 0 && neededBytes > m_budget && r < m_residency.size(); ++r) {
+            Slot& slot = *m_residency[r];
+            if (!slot.uploading && slot.neededLevel > slot.firstLevel) {
+                neededBytes -= slot.chainBytes[slot.firstLevel] - slot.chainBytes[slot.neededLevel];
+                changeResidency(slot, slot.neededLevel);
+            }
+        }
+        // Then the finer levels that fit, for the texture drawn the most recently first
+        for (size_t r = m_residency.size(); r-- > 0;) {
+            Slot& slot = *m_residency[r];
+            if (!slot.uploading && slot.neededLevel < slot.firstLevel &&
+                (m_budget == 0 || m_residentBytes + slot.chainBytes[slot.neededLevel] <= m_budget)) {
+                changeResidency(slot, slot.neededLevel);
+            }
+        }
+    }
+
+    // Allocates the levels from firstLevel in the staging texture of the complete slot, and copies there the
+    // ones its texture has. With finer levels, they are staged, and the texture drawn until then is replaced
+    // once they are complete; without, it is replaced right away.
+    void changeResidency(Slot& slot, const uint32_t firstLevel) {
+        const uint32_t previousFirst = slot.firstLevel;
+        m_residentBytes += slot.chainBytes[firstLevel];
+        slot.firstLevel = firstLevel;
+        slot.staging.create(kGpuTextures);
+        allocate(slot, slot.staging);
+        copyLevels(slot, previousFirst);
+        if (firstLevel >= previousFirst) {
+            m_residentBytes -= slot.chainBytes[previousFirst];
+            slot.texture = std::move(slot.staging);
+            return;
+        }
+        slot.nextLevel = previousFirst - 1;
+        slot.nextRow = 0;
+        slot.uploading = true;
+        m_uploads.push_back(&slot);
+    }
+
+    // From the texture of the slot, whose levels started at previousFirst, to its staging texture: the levels
+    // both have, read into a buffer then unpacked from it, so that the data never leaves the GPU. The finest
+    // copied level is sampled. With no pixel buffer bound.
+    void copyLevels(Slot& slot, const uint32_t previousFirst) {
+        const uint32_t first = std::max(slot.firstLevel, previousFirst);
+        if (m_copyBuffer.getBytes() < slot.chainBytes[first]) {
+            if (!m_copyBuffer.get()) {
+                m_copyBuffer.create(kGpuTextures);
+            }
+            m_copyBuffer.setData(GL_PIXEL_PACK_BUFFER, slot.chainBytes[first], nullptr, GL_STREAM_COPY);
+        }
+        else {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, m_copyBuffer.get());
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, slot.texture.get());
+        size_t offset = 0;
+        for (uint32_t l = first; l < slot.numLevels; ++l) {
+            void* pixels = reinterpret_cast<void*>(offset); // in the bound buffer
+            if (slot.kind == kUploadBlocks) {
+                glGetCompressedTexImage(GL_TEXTURE_2D, static_cast<GLint>(l - previousFirst), pixels);
+            }
+            else {
+                glGetTexImage(GL_TEXTURE_2D, static_cast<GLint>(l - previousFirst), slot.format, GL_UNSIGNED_BYTE, pixels);
+            }
+            offset += getBandBytes(slot, slot.levels[l].width, slot.levels[l].height);
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_copyBuffer.get());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, slot.staging.get());
+        offset = 0;
+        for (uint32_t l = first; l < slot.numLevels; ++l) {
+            const UploadLevel& level = slot.levels[l];
+            const GLint target = static_cast<GLint>(l - slot.firstLevel);
+            const size_t bytes = getBandBytes(slot, level.width, level.height);
+            const void* pixels = reinterpret_cast<const void*>(offset);
+            if (slot.kind == kUploadBlocks) {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, target, 0, 0, level.width, level.height, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                                          static_cast<GLsizei>(bytes), pixels);
+            }
+            else {
+                glTexSubImage2D(GL_TEXTURE_2D, target, 0, 0, level.width, level.height, slot.format, GL_UNSIGNED_BYTE, pixels);
+            }
+            offset += bytes;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(first - slot.firstLevel));
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static void addLevel(Slot& slot, const unsigned char* data, const uint32_t width, const uint32_t height) {
+        UploadLevel& level = slot.levels[slot.numLevels++];
+        level.data = data;
+        level.width = width;
+        level.height = height;
+    }
+
+    // Rows staged at a time, and their bytes: BC1 comes in rows of blocks.
+    static uint32_t getBandRows(const Slot& slot) { return slot.kind == kUploadTexels ? 1 : 4; }
+    static size_t getBandBytes(const Slot& slot, const uint32_t width, const uint32_t rows) {
+        switch (slot.kind) {
+        case kUploadBlocks:
+            return computeBC1Size(width, rows);
+        case kUploadDecodedBlocks:
+            return size_t(width) * rows * 3;
+        default:
+            return size_t(width) * rows * slot.components;
+        }
+    }
+
+    // Storage of the levels of the slot from its first one in the texture, replacing the placeholder, and only
+    // the coarsest one sampled until the finer ones are complete. With no unpack buffer bound.
+    void allocate(Slot& slot, GpuTexture& texture) {
+        const uint32_t numLevels = slot.numLevels - slot.firstLevel;
+        glBindTexture(GL_TEXTURE_2D, texture.get());
+        setMipmapFiltering(static_cast<GLint>(numLevels - 1), m_anisotropy);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(numLevels - 1));
+        for (uint32_t l = 0; l < numLevels; ++l) {
+            const UploadLevel& level = slot.levels[slot.firstLevel + l];
+            if (slot.kind == kUploadBlocks) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, l, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, level.width, level.height, 0,
+                                       static_cast<GLsizei>(getBandBytes(slot, level.width, level.height)), nullptr);
+            }
+            else {
+                glTexImage2D(GL_TEXTURE_2D, l, slot.format, level.width, level.height, 0, slot.format, GL_UNSIGNED_BYTE, nullptr);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        texture.setBytes(slot.chainBytes[slot.firstLevel]);
+        slot.allocated = true;
+    }
+
+    // Copies the next bands of the queue into the buffer of the frame, within the budget, then issues their
+    // uploads from it. Skips the frame if the buffer is still read by the GPU.
+    void stageUploads() {
+        const Slot& front = *m_uploads.front();
+        const UploadLevel& frontLevel = front.levels[front.nextLevel];
+        if (!m_ring.begin(getBandBytes(front, frontLevel.width, getBandRows(front)))) {
+            return;
+        }
+        m_commands.clear();
+        while (!m_uploads.empty()) {
+            Slot& slot = *m_uploads.front();
+            const UploadLevel& level = slot.levels[slot.nextLevel];
+            const uint32_t bandRows = getBandRows(slot);
+            const size_t bandBytes = getBandBytes(slot, level.width, bandRows);
+            const uint32_t rows = std::min(level.height - slot.nextRow, static_cast<uint32_t>(m_ring.getAvailable() / bandBytes) * bandRows);
+            size_t offset;
+            unsigned char* staged = rows > 0 ? m_ring.allocate(getBandBytes(slot, level.width, rows), offset) : nullptr;
+            if (!staged) {
+                break; // the budget of the frame is spent
+            }
+            if (!slot.allocated) {
+                allocate(slot, slot.texture);
+            }
+            const size_t rowBytes = getBandBytes(slot, level.width, bandRows) / bandRows;
+            if (slot.kind == kUploadDecodedBlocks) {
+                decodeBC1(level.data + size_t(slot.nextRow / 4) * computeBC1Size(level.width, 4), level.width, rows, staged);
+            }
+            else {
+                std::memcpy(staged, level.data + size_t(slot.nextRow) * rowBytes, getBandBytes(slot, level.width, rows));
+            }
+            UploadCommand command;
+            command.slot = &slot;
+            command.level = slot.nextLevel - slot.firstLevel;
+            command.firstRow = slot.nextRow;
+            command.rows = rows;
+            command.offset = offset;
+            m_commands.push_back(command);
+            slot.nextRow += rows;
+            if (slot.nextRow == level.height) {
+                if (slot.nextLevel == slot.firstLevel) {
+                    slot.uploading = false;
+                    m_uploads.pop_front();
+                }
+                else {
+                    --slot.nextLevel;
+                    slot.nextRow = 0;
+                }
+            }
+        }
+
+        m_ring.bind();
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows are tightly packed
+        for (size_t c = 0; c < m_commands.size(); ++c) {
+            const UploadCommand& command = m_commands[c];
+            Slot& slot = *command.slot;
+            const UploadLevel& level = slot.levels[slot.firstLevel + command.level];
+            const void* pixels = reinterpret_cast<const void*>(command.offset); // in the bound buffer
+            glBindTexture(GL_TEXTURE_2D, slot.staging.get() ? slot.staging.get() : slot.texture.get());
+            if (slot.kind == kUploadBlocks) {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, command.level, 0, command.firstRow, level.width, command.rows, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                                          static_cast<GLsizei>(getBandBytes(slot, level.width, command.rows)), pixels);
+            }
+            else {
+                glTexSubImage2D(GL_TEXTURE_2D, command.level, 0, command.firstRow, level.width, command.rows, slot.format, GL_UNSIGNED_BYTE, pixels);
+            }
+            if (command.firstRow + command.rows == level.height) {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(command.level)); // complete: sampled
+                if (command.level == 0) {
+                    if (slot.staging.get()) {
+                        slot.texture = std::move(slot.staging); // drawn from now on, the previous levels released
+                    }
+                    finishUpload(slot);
+                }
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_ring.end();
+    }
+
+    // Once uploaded: releases what was staged from, the buffers own copies of it, unless residency reads it
+    // again.
+    void finishUpload(Slot& slot) {
+        if (slot.complete) {
+            return;
+        }
+        slot.complete = true;
+        if (!slot.managed) {
+            slot.cache.close();
+            stbi_image_free(slot.pixels);
+            slot.pixels = nullptr;
+            std::vector<std::vector<unsigned char> >().swap(slot.mips);
+        }
+        --m_loading;
+    }
+
+    void waitForLoads() {
+        if (m_jobs) {
+            m_jobs->wait(m_loads);
+        }
+    }
+
+    // A band staged in the buffer of the frame
+    struct UploadCommand {
+        Slot* slot;
+        uint32_t level; // of the texture
+        uint32_t firstRow;
+        uint32_t rows;
+        size_t offset;
+    };
+
+    std::vector<std::unique_ptr<Slot> > m_slots;
+    std::deque<Slot*> m_uploads; // loaded, being uploaded in order
+    std::vector<Slot*> m_residency; // managed slots, scratch of updateResidency()
+    std::vector<UploadCommand> m_commands;
+    PixelUploadRing m_ring;
+    GpuBuffer m_copyBuffer; // levels kept by changes of residency, on their way between two textures
+    JobSystem* m_jobs = nullptr;
+    JobCounter m_loads;
+    uint32_t m_loading = 0; // requested and not uploaded yet
+    size_t m_budget = kTextureBudgetBytes;
+    size_t m_residentBytes = 0;
+    uint64_t m_frame = 1; // of the next update; 0 for never required
+    float m_anisotropy = 1.0f;
+    bool m_compressed = false; // BC1 is supported
+};
+
+#endif // TEXTURES_H
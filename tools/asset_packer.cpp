@@ -0,0 +1,194 @@
+// ----------------------------------------------------------------------------
+// asset_packer.cpp
+//
+// Description: Bakes the startup assets into the single file read by
+//              asset_pack.h: images are decoded and their mipmaps computed
+//              (box filter in linear light, see mipmaps.h), shader sources are
+//              copied as is, and the sphere mesh of sphere.h is generated
+//              under the name "sphere". Assets are named by the path they are
+//              given with, which is the path the application loads them from.
+//
+// Usage: asset_packer <output.pack> <image or shader>...
+// ----------------------------------------------------------------------------
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+
+#include "../asset_pack.h"
+#include "../mipmaps.h"
+#include "../sphere.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const static char* kSphereMeshName = "sphere";
+const static uint64_t kLevelAlignment = 16;
+
+static uint64_t alignUp(const uint64_t offset, const uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static bool hasExtension(const std::string& name, const char* extension) {
+    const size_t n = std::strlen(extension);
+    if (name.size() < n) {
+        return false;
+    }
+    std::string end = name.substr(name.size() - n);
+    std::transform(end.begin(), end.end(), end.begin(), ::tolower);
+    return end == extension;
+}
+
+static bool isImage(const std::string& name) {
+    return hasExtension(name, ".jpg") || hasExtension(name, ".jpeg") || hasExtension(name, ".png") || hasExtension(name, ".bmp") ||
+           hasExtension(name, ".tga");
+}
+
+template <typename T>
+static void append(std::vector<unsigned char>& blob, const T* data, const size_t count) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    blob.insert(blob.end(), bytes, bytes + count * sizeof(T));
+}
+
+static bool bakeTexture(const std::string& filename, std::vector<unsigned char>& blob) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    const std::vector<unsigned char> source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    int width, height, components;
+    unsigned char* pixels = source.empty() ? nullptr : stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &width, &height, &components, 0);
+    if (!pixels) {
+        std::cerr << "ERROR: cannot decode " << filename << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+    PackedTexture texture;
+    std::memset(&texture, 0, sizeof(texture));
+    texture.components = static_cast<uint32_t>(components);
+    texture.sourceHash = hashFNV1a(source.data(), source.size()); // the runtime keys the cache with it, not reading the source
+    texture.sourceSize = source.size();
+    std::vector<unsigned char> level(pixels, pixels + size_t(width) * height * components), next;
+    stbi_image_free(pixels);
+
+    blob.assign(sizeof(PackedTexture), 0);
+    uint32_t w = static_cast<uint32_t>(width), h = static_cast<uint32_t>(height);
+    for (;;) {
+        PackedTextureLevel& l = texture.levels[texture.numLevels++];
+        blob.resize(static_cast<size_t>(alignUp(blob.size(), kLevelAlignment)), 0);
+        l.width = w;
+        l.height = h;
+        l.offset = blob.size();
+        l.size = level.size();
+        append(blob, level.data(), level.size());
+        if ((w == 1 && h == 1) || texture.numLevels == kMaxTextureLevels) {
+            break;
+        }
+        downsampleGammaCorrect(level.data(), w, h, texture.components, next, w, h);
+        level.swap(next);
+    }
+    std::memcpy(blob.data(), &texture, sizeof(texture));
+    return true;
+}
+
+static void bakeSphere(std::vector<unsigned char>& blob) {
+    std::vector<float> positions, normals, texCoords;
+    std::vector<unsigned int> indices;
+    generateSphere(1.0f, kSphereResolution, positions, normals, texCoords, indices);
+
+    PackedMesh mesh;
+    mesh.numVertices = static_cast<uint32_t>(positions.size() / 3);
+    mesh.numIndices = static_cast<uint32_t>(indices.size());
+    blob.assign(sizeof(PackedMesh), 0);
+    mesh.positionsOffset = blob.size();
+    append(blob, positions.data(), positions.size());
+    mesh.normalsOffset = blob.size();
+    append(blob, normals.data(), normals.size());
+    mesh.texCoordsOffset = blob.size();
+    append(blob, texCoords.data(), texCoords.size());
+    mesh.indicesOffset = blob.size();
+    append(blob, indices.data(), indices.size());
+    std::memcpy(blob.data(), &mesh, sizeof(mesh));
+}
+
+static bool bakeShader(const std::string& filename, std::vector<unsigned char>& blob) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: cannot read " << filename << std::endl;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string source = buffer.str();
+    blob.assign(source.begin(), source.end());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <output.pack> <image or shader>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<std::string> names(argv + 2, argv + argc);
+    names.push_back(kSphereMeshName);
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (names[i].size() >= kAssetNameSize || (i > 0 && names[i] == names[i - 1])) {
+            std::cerr << "ERROR: asset name too long or given twice: " << names[i] << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::ofstream out(argv[1], std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "ERROR: cannot write " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<AssetPackEntry> entries(names.size());
+    uint64_t offset = sizeof(AssetPackHeader) + entries.size() * sizeof(AssetPackEntry);
+    std::vector<unsigned char> blob;
+    for (size_t i = 0; i < names.size(); ++i) {
+        AssetPackEntry& entry = entries[i];
+        std::memset(&entry, 0, sizeof(entry));
+        std::memcpy(entry.name, names[i].c_str(), names[i].size());
+        bool baked;
+        if (names[i] == kSphereMeshName) {
+            entry.type = kAssetMesh;
+            bakeSphere(blob);
+            baked = true;
+        }
+        else if (isImage(names[i])) {
+            entry.type = kAssetTexture;
+            baked = bakeTexture(names[i], blob);
+        }
+        else {
+            entry.type = kAssetShader;
+            baked = bakeShader(names[i], blob);
+        }
+        if (!baked) {
+            return EXIT_FAILURE;
+        }
+        entry.offset = alignUp(offset, kAssetPackAlignment);
+        entry.size = blob.size();
+        out.seekp(static_cast<std::streamoff>(entry.offset));
+        out.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+        offset = entry.offset + entry.size;
+    }
+
+    AssetPackHeader header;
+    std::memcpy(header.magic, kAssetPackMagic, sizeof(kAssetPackMagic));
+    header.numEntries = static_cast<uint32_t>(entries.size());
+    header.entrySize = sizeof(AssetPackEntry);
+    header.entriesOffset = sizeof(AssetPackHeader);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(AssetPackEntry));
+    if (!out) {
+        std::cerr << "ERROR: failed writing " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Packed " << entries.size() << " assets (" << offset << " bytes) in " << argv[1] << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,67 @@
+// ----------------------------------------------------------------------------
+// csv.h
+//
+// Description: Minimal CSV reading shared by the catalog tools: quoted
+//              fields, columns looked up by the names of the first line.
+// ----------------------------------------------------------------------------
+
+#ifndef TOOLS_CSV_H
+#define TOOLS_CSV_H
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Splits a CSV line; fields may be quoted, with "" for a quote inside.
+inline void splitCsv(const std::string& line, std::vector<std::string>& fields) {
+    fields.clear();
+    std::string field;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        const char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                field += '"';
+                ++i;
+            }
+            else if (c == '"') {
+                quoted = false;
+            }
+            else {
+                field += c;
+            }
+        }
+        else if (c == '"') {
+            quoted = true;
+        }
+        else if (c == ',') {
+            fields.push_back(field);
+            field.clear();
+        }
+        else if (c != '\r') {
+            field += c;
+        }
+    }
+    fields.push_back(field);
+}
+
+inline int findColumn(const std::vector<std::string>& names, const std::string& name) {
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (names[i] == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+// Parses a field as a number; empty or malformed fields return false.
+inline bool parseField(const std::vector<std::string>& fields, const int column, double& value) {
+    if (column < 0 || column >= static_cast<int>(fields.size()) || fields[column].empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    value = std::strtod(fields[column].c_str(), &end);
+    return end != fields[column].c_str();
+}
+
+#endif // TOOLS_CSV_H
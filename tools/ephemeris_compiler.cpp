@@ -0,0 +1,240 @@
+// ----------------------------------------------------------------------------
+// ephemeris_compiler.cpp
+//
+// Description: Converts JPL DE-style ASCII ephemeris tables (header.4xx and
+//              one or more ascp*.4xx data files) into the binary layout read
+//              by ephemeris.h.
+//
+// Usage: ephemeris_compiler <header.4xx> <output.bin> <ascp1.4xx> [ascp2.4xx ...]
+// ----------------------------------------------------------------------------
+
+#include "../ephemeris.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Fortran exponents use 'D' (0.1234D+03); strtod only understands 'E'.
+static double parseFortranDouble(std::string token) {
+    for (size_t i = 0; i < token.size(); ++i) {
+        if (token[i] == 'D' || token[i] == 'd') {
+            token[i] = 'E';
+        }
+    }
+    return std::strtod(token.c_str(), nullptr);
+}
+
+// Reads the lines of a "GROUP xxxx" section, up to the next group or the end of the file.
+static std::vector<std::string> readGroup(const std::string& text, const std::string& group) {
+    std::vector<std::string> lines;
+    const size_t start = text.find("GROUP   " + group);
+    if (start == std::string::npos) {
+        return lines;
+    }
+    std::istringstream stream(text.substr(start));
+    std::string line;
+    std::getline(stream, line); // the GROUP line itself
+    while (std::getline(stream, line)) {
+        if (line.find("GROUP") != std::string::npos) {
+            break;
+        }
+        if (line.find_first_not_of(" \t\r") != std::string::npos) {
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+static std::vector<std::string> tokenize(const std::vector<std::string>& lines) {
+    std::vector<std::string> tokens;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        std::istringstream stream(lines[i]);
+        std::string token;
+        while (stream >> token) {
+            tokens.push_back(token);
+        }
+    }
+    return tokens;
+}
+
+static bool parseHeader(const std::string& filename, EphemerisFileHeader& header) {
+    std::ifstream file(filename.c_str());
+    if (!file) {
+        std::cerr << "ERROR: cannot open " << filename << std::endl;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string text = buffer.str();
+
+    // GROUP 1030: start JD, end JD, record length in days
+    std::vector<std::string> span = tokenize(readGroup(text, "1030"));
+    if (span.size() < 3) {
+        std::cerr << "ERROR: GROUP 1030 missing in " << filename << std::endl;
+        return false;
+    }
+    header.startJD = parseFortranDouble(span[0]);
+    header.endJD = parseFortranDouble(span[1]);
+    header.intervalDays = parseFortranDouble(span[2]);
+
+    // GROUP 1040/1041: constant names and values
+    std::vector<std::string> names = tokenize(readGroup(text, "1040"));
+    std::vector<std::string> values = tokenize(readGroup(text, "1041"));
+    header.au = 149597870.7;
+    header.emrat = 81.30056907419062;
+    for (size_t i = 1; i < names.size() && i < values.size(); ++i) { // first token is the count
+        if (names[i] == "AU") {
+            header.au = parseFortranDouble(values[i]);
+        }
+        else if (names[i] == "EMRAT") {
+            header.emrat = parseFortranDouble(values[i]);
+        }
+    }
+
+    // GROUP 1050: three rows (offset, coefficients, subintervals) with one column per body.
+    // DE4xx headers have 13 columns, newer ones add TT-TDB and more; only the first 13 are kept.
+    std::vector<std::string> layout = readGroup(text, "1050");
+    if (layout.size() < 3) {
+        std::cerr << "ERROR: GROUP 1050 missing in " << filename << std::endl;
+        return false;
+    }
+    std::vector<std::vector<std::string> > rows(3);
+    for (int r = 0; r < 3; ++r) {
+        rows[r] = tokenize(std::vector<std::string>(1, layout[r]));
+    }
+    if (rows[0].size() < static_cast<size_t>(kEphNumBodies) || rows[1].size() != rows[0].size() || rows[2].size() != rows[0].size()) {
+        std::cerr << "ERROR: unexpected GROUP 1050 layout in " << filename << std::endl;
+        return false;
+    }
+    for (int b = 0; b < kEphNumBodies; ++b) {
+        EphemerisBodyLayout& body = header.bodies[b];
+        const int start = std::atoi(rows[0][b].c_str());
+        body.numCoeffs = std::atoi(rows[1][b].c_str());
+        body.numSubintervals = std::atoi(rows[2][b].c_str());
+        body.numComponents = (b == kEphNutations) ? 2 : 3;
+        if (start < 3 || body.numCoeffs == 0 || body.numSubintervals == 0) {
+            body = EphemerisBodyLayout(); // body not present in this ephemeris
+            continue;
+        }
+        body.offset = start - 3; // 1-based in the table, and the two leading JDs of each record are dropped
+    }
+    return true;
+}
+
+// Appends the records of one ascp file; records overlapping what is already stored are skipped.
+static bool appendRecords(const std::string& filename, uint32_t coefficientsPerRecord, double intervalDays,
+                          std::vector<double>& coefficients, double& firstJD, double& nextJD) {
+    std::ifstream file(filename.c_str());
+    if (!file) {
+        std::cerr << "ERROR: cannot open " << filename << std::endl;
+        return false;
+    }
+    std::string token;
+    std::vector<double> record;
+    size_t appended = 0;
+    while (file >> token) { // record number
+        size_t count = 0;
+        if (!(file >> count) || count < 2) {
+            std::cerr << "ERROR: malformed record header in " << filename << std::endl;
+            return false;
+        }
+        record.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (!(file >> token)) {
+                std::cerr << "ERROR: truncated record in " << filename << std::endl;
+                return false;
+            }
+            record[i] = parseFortranDouble(token);
+        }
+        for (size_t pad = count % 3 ? 3 - count % 3 : 0; pad > 0; --pad) {
+            file >> token; // lines always hold three values
+        }
+
+        const double recordStart = record[0];
+        if (coefficients.empty()) {
+            firstJD = recordStart;
+            nextJD = recordStart;
+        }
+        if (recordStart < nextJD - 0.5 * intervalDays) {
+            continue; // duplicated boundary record between consecutive files
+        }
+        if (recordStart > nextJD + 0.5 * intervalDays) {
+            std::cerr << "ERROR: gap in the ephemeris before JD " << recordStart << " in " << filename << std::endl;
+            return false;
+        }
+        if (count - 2 < coefficientsPerRecord) {
+            std::cerr << "ERROR: record shorter than the header layout in " << filename << std::endl;
+            return false;
+        }
+        coefficients.insert(coefficients.end(), record.begin() + 2, record.begin() + 2 + coefficientsPerRecord);
+        nextJD = recordStart + intervalDays;
+        ++appended;
+    }
+    std::cout << filename << ": " << appended << " records" << std::endl;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <header.4xx> <output.bin> <ascp1.4xx> [ascp2.4xx ...]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    EphemerisFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kEphemerisMagic, sizeof(kEphemerisMagic));
+    header.numBodies = kEphNumBodies;
+    if (!parseHeader(argv[1], header)) {
+        return EXIT_FAILURE;
+    }
+
+    uint32_t coefficientsPerRecord = 0;
+    for (int b = 0; b < kEphNumBodies; ++b) {
+        const EphemerisBodyLayout& body = header.bodies[b];
+        const uint32_t end = body.offset + body.numCoeffs * body.numComponents * body.numSubintervals;
+        if (end > coefficientsPerRecord) {
+            coefficientsPerRecord = end;
+        }
+    }
+    header.coefficientsPerRecord = coefficientsPerRecord;
+
+    std::vector<double> coefficients;
+    double firstJD = 0.0;
+    double nextJD = 0.0;
+    for (int i = 3; i < argc; ++i) {
+        if (!appendRecords(argv[i], coefficientsPerRecord, header.intervalDays, coefficients, firstJD, nextJD)) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (coefficients.empty()) {
+        std::cerr << "ERROR: no records found" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The data files may cover less than the span announced by the header
+    header.numRecords = coefficients.size() / coefficientsPerRecord;
+    header.startJD = firstJD;
+    header.endJD = nextJD;
+    header.coefficientOffset = (sizeof(EphemerisFileHeader) + 63) & ~static_cast<uint64_t>(63);
+
+    std::ofstream out(argv[2], std::ios::binary);
+    if (!out) {
+        std::cerr << "ERROR: cannot write " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const std::vector<char> padding(static_cast<size_t>(header.coefficientOffset) - sizeof(header), 0);
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<const char*>(coefficients.data()), coefficients.size() * sizeof(double));
+    if (!out) {
+        std::cerr << "ERROR: failed writing " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Wrote " << header.numRecords << " records (JD " << header.startJD << " to " << header.endJD << ") to " << argv[2] << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,357 @@
+// ----------------------------------------------------------------------------
+// octree_compiler.cpp
+//
+// Description: Builds the level-of-detail point octree read by point_octree.h
+//              from a CSV star catalog of any size (x, y, z in parsecs, absmag
+//              or mag, optional ci), without holding it in memory:
+//
+//              1. the CSV is converted to a temporary binary file, measuring
+//                 the bounding cube;
+//              2. points stream through the top levels of the tree, each node
+//                 keeping its brightest points in a bounded heap and passing
+//                 the others down; what falls out of the last top level is
+//                 appended to one bucket file per cube below it;
+//              3. each bucket, a small fraction of the data, is loaded and its
+//                 subtree built in memory the same way.
+//
+// Usage: octree_compiler <points.csv> <output.oct> [points per node]
+// ----------------------------------------------------------------------------
+
+#include "../point_octree.h"
+#include "csv.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const static uint32_t kDefaultNodeCapacity = 16384;
+const static int kTopLevels = 3;    // levels built while streaming: 1 + 8 + 64 heaps
+const static int kMaxDepth = 24;    // beyond, a node keeps all its points (duplicates)
+const static size_t kBucketFlushSize = 4096;
+const static float kDefaultColorIndex = 0.65f;
+
+struct InputPoint {
+    double position[3];
+    float absMagnitude;
+    float colorIndex;
+    uint64_t sequence; // input order, to break magnitude ties deterministically
+};
+
+// Brightest first
+static bool brighter(const InputPoint& a, const InputPoint& b) {
+    return a.absMagnitude < b.absMagnitude || (a.absMagnitude == b.absMagnitude && a.sequence < b.sequence);
+}
+
+struct Cube {
+    glm::dvec3 center;
+    double halfSize;
+};
+
+static int childOf(const Cube& cube, const double* p) {
+    return (p[0] >= cube.center.x ? 1 : 0) | (p[1] >= cube.center.y ? 2 : 0) | (p[2] >= cube.center.z ? 4 : 0);
+}
+
+// Index of the first node of a level of the top levels, numbered breadth first: 0, 1, 9, 73...
+static size_t levelStart(const int level) {
+    return ((size_t(1) << (3 * level)) - 1) / 7;
+}
+
+static uint32_t depthOf(const size_t node) {
+    uint32_t depth = 0;
+    while (node >= levelStart(depth + 1)) {
+        ++depth;
+    }
+    return depth;
+}
+
+static Cube childCube(const Cube& cube, const int c) {
+    Cube child;
+    child.halfSize = 0.5 * cube.halfSize;
+    child.center = cube.center + child.halfSize * glm::dvec3((c & 1) ? 1.0 : -1.0, (c & 2) ? 1.0 : -1.0, (c & 4) ? 1.0 : -1.0);
+    return child;
+}
+
+class OctreeWriter {
+public:
+    OctreeWriter(std::ofstream& out, const uint64_t pointsOffset) : m_out(out), m_pointsOffset(pointsOffset) {}
+
+    // Appends a node with the given points (made relative to its center) and returns its index.
+    uint32_t addNode(const Cube& cube, const uint32_t depth, const std::vector<InputPoint>& points, size_t first, size_t count) {
+        OctreeNode node;
+        node.center[0] = cube.center.x;
+        node.center[1] = cube.center.y;
+        node.center[2] = cube.center.z;
+        node.halfSize = cube.halfSize;
+        node.firstPoint = m_numPoints;
+        node.numPoints = static_cast<uint32_t>(count);
+        node.depth = depth;
+        std::fill(node.children, node.children + 8, kOctreeNone);
+        m_staging.resize(count);
+        for (size_t k = 0; k < count; ++k) {
+            const InputPoint& p = points[first + k];
+            for (int a = 0; a < 3; ++a) {
+                m_staging[k].position[a] = static_cast<float>(p.position[a] - node.center[a]);
+            }
+            m_staging[k].absMagnitude = p.absMagnitude;
+            m_staging[k].colorIndex = p.colorIndex;
+        }
+        m_out.seekp(static_cast<std::streamoff>(m_pointsOffset + m_numPoints * sizeof(OctreePoint)));
+        m_out.write(reinterpret_cast<const char*>(m_staging.data()), count * sizeof(OctreePoint));
+        m_numPoints += count;
+        m_nodes.push_back(node);
+        return static_cast<uint32_t>(m_nodes.size() - 1);
+    }
+
+    inline OctreeNode& getNode(const uint32_t n) { return m_nodes[n]; }
+    inline const std::vector<OctreeNode>& getNodes() const { return m_nodes; }
+    inline uint64_t getNumPoints() const { return m_numPoints; }
+
+private:
+    std::ofstream& m_out;
+    uint64_t m_pointsOffset;
+    uint64_t m_numPoints = 0;
+    std::vector<OctreeNode> m_nodes;
+    std::vector<OctreePoint> m_staging;
+};
+
+// In-memory build of a subtree: the node keeps the brightest points, the others go to the children.
+static uint32_t buildSubtree(OctreeWriter& writer, std::vector<InputPoint>& points, const size_t first, const size_t count,
+                             const Cube& cube, const uint32_t depth, const uint32_t capacity) {
+    std::sort(points.begin() + first, points.begin() + first + count, brighter);
+    const size_t kept = (depth >= kMaxDepth) ? count : std::min<size_t>(count, capacity);
+    const uint32_t n = writer.addNode(cube, depth, points, first, kept);
+
+    // Partition the rest by child, in place, then recurse
+    size_t begin = first + kept;
+    const size_t end = first + count;
+    for (int c = 0; c < 8 && begin < end; ++c) {
+        const size_t mid = std::partition(points.begin() + begin, points.begin() + end,
+                                          [&cube, c](const InputPoint& p) { return childOf(cube, p.position) == c; }) - points.begin();
+        if (mid > begin) {
+            const uint32_t child = buildSubtree(writer, points, begin, mid - begin, childCube(cube, c), depth + 1, capacity);
+            writer.getNode(n).children[c] = child;
+        }
+        begin = mid;
+    }
+    return n;
+}
+
+// Faintest on top, so that the heap of a node keeps its brightest points
+struct FaintestOnTop {
+    bool operator()(const InputPoint& a, const InputPoint& b) const { return brighter(a, b); }
+};
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <points.csv> <output.oct> [points per node]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string outputFilename = argv[2];
+    const uint32_t capacity = (argc > 3) ? static_cast<uint32_t>(std::atoi(argv[3])) : kDefaultNodeCapacity;
+    if (capacity == 0) {
+        std::cerr << "ERROR: the number of points per node must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // 1. CSV to a temporary binary, with the bounds
+    std::ifstream csv(argv[1]);
+    std::string line;
+    if (!csv || !std::getline(csv, line)) {
+        std::cerr << "ERROR: cannot read " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<std::string> names, fields;
+    splitCsv(line, names);
+    const int xColumn = findColumn(names, "x");
+    const int yColumn = findColumn(names, "y");
+    const int zColumn = findColumn(names, "z");
+    const int absMagColumn = findColumn(names, "absmag");
+    const int magColumn = findColumn(names, "mag");
+    const int ciColumn = findColumn(names, "ci");
+    if (xColumn < 0 || yColumn < 0 || zColumn < 0 || (absMagColumn < 0 && magColumn < 0)) {
+        std::cerr << "ERROR: " << argv[1] << " needs the columns x, y, z and absmag or mag" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string pointsFilename = outputFilename + ".points.tmp";
+    std::ofstream pointsOut(pointsFilename.c_str(), std::ios::binary);
+    glm::dvec3 lo(HUGE_VAL), hi(-HUGE_VAL);
+    uint64_t numPoints = 0;
+    size_t skipped = 0;
+    while (std::getline(csv, line)) {
+        splitCsv(line, fields);
+        double x, y, z, magnitude, colorIndex;
+        if (!parseField(fields, xColumn, x) || !parseField(fields, yColumn, y) || !parseField(fields, zColumn, z)) {
+            ++skipped;
+            continue;
+        }
+        const double distance = std::sqrt(x * x + y * y + z * z);
+        if (!parseField(fields, absMagColumn, magnitude)) {
+            if (!parseField(fields, magColumn, magnitude) || distance <= 0.0) {
+                ++skipped;
+                continue;
+            }
+            magnitude -= 5.0 * std::log10(distance / 10.0);
+        }
+        if (!parseField(fields, ciColumn, colorIndex)) {
+            colorIndex = kDefaultColorIndex;
+        }
+        InputPoint p;
+        p.position[0] = x; // equatorial (x, y, z) to scene axes (x, z, -y), as star_catalog.h
+        p.position[1] = z;
+        p.position[2] = -y;
+        p.absMagnitude = static_cast<float>(magnitude);
+        p.colorIndex = static_cast<float>(colorIndex);
+        p.sequence = numPoints++;
+        lo = glm::min(lo, glm::dvec3(p.position[0], p.position[1], p.position[2]));
+        hi = glm::max(hi, glm::dvec3(p.position[0], p.position[1], p.position[2]));
+        pointsOut.write(reinterpret_cast<const char*>(&p), sizeof(p));
+    }
+    pointsOut.close();
+    if (numPoints == 0) {
+        std::cerr << "ERROR: no points in " << argv[1] << std::endl;
+        std::remove(pointsFilename.c_str());
+        return EXIT_FAILURE;
+    }
+    Cube root;
+    root.center = 0.5 * (lo + hi);
+    const glm::dvec3 span = hi - lo;
+    root.halfSize = 0.5 * std::max(span.x, std::max(span.y, span.z)) * 1.0001 + 1e-9;
+
+    // 2. Stream through the top levels. Cubes are numbered breadth first; the ones of level kTopLevels, below
+    //    the top nodes, are the buckets.
+    const size_t numTopNodes = levelStart(kTopLevels);
+    const size_t numBuckets = levelStart(kTopLevels + 1) - numTopNodes;
+    std::vector<Cube> cubes(1, root);
+    for (size_t k = 0; k < numTopNodes; ++k) {
+        for (int c = 0; c < 8; ++c) {
+            cubes.push_back(childCube(cubes[k], c));
+        }
+    }
+
+    std::vector<std::priority_queue<InputPoint, std::vector<InputPoint>, FaintestOnTop> > heaps(numTopNodes);
+    std::vector<std::vector<InputPoint> > bucketBuffers(numBuckets);
+    std::vector<uint64_t> bucketSizes(numBuckets, 0);
+    std::vector<std::string> bucketFilenames(numBuckets);
+    for (size_t b = 0; b < numBuckets; ++b) {
+        std::ostringstream name;
+        name << outputFilename << ".bucket" << b << ".tmp";
+        bucketFilenames[b] = name.str();
+        std::remove(bucketFilenames[b].c_str());
+    }
+    const auto flushBucket = [&](const size_t b) {
+        std::ofstream bucket(bucketFilenames[b].c_str(), std::ios::binary | std::ios::app);
+        bucket.write(reinterpret_cast<const char*>(bucketBuffers[b].data()), bucketBuffers[b].size() * sizeof(InputPoint));
+        bucketSizes[b] += bucketBuffers[b].size();
+        bucketBuffers[b].clear();
+    };
+
+    std::ifstream pointsIn(pointsFilename.c_str(), std::ios::binary);
+    InputPoint p;
+    while (pointsIn.read(reinterpret_cast<char*>(&p), sizeof(p))) {
+        // The children of node t are 8t + 1 to 8t + 8
+        size_t t = 0;
+        bool kept = false;
+        while (t < numTopNodes) {
+            std::priority_queue<InputPoint, std::vector<InputPoint>, FaintestOnTop>& heap = heaps[t];
+            heap.push(p);
+            if (heap.size() <= capacity) {
+                kept = true;
+                break;
+            }
+            p = heap.top(); // the faintest goes down
+            heap.pop();
+            t = 8 * t + 1 + childOf(cubes[t], p.position);
+        }
+        if (!kept) {
+            const size_t b = t - numTopNodes;
+            bucketBuffers[b].push_back(p);
+            if (bucketBuffers[b].size() >= kBucketFlushSize) {
+                flushBucket(b);
+            }
+        }
+    }
+    pointsIn.close();
+    std::remove(pointsFilename.c_str());
+    for (size_t b = 0; b < numBuckets; ++b) {
+        flushBucket(b);
+    }
+
+    // 3. Write the top nodes, then the subtree of each bucket, then link the top nodes to what is below
+    std::ofstream out(outputFilename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "ERROR: cannot write " << outputFilename << std::endl;
+        return EXIT_FAILURE;
+    }
+    const uint64_t pointsOffset = (sizeof(PointOctreeHeader) + 63) & ~static_cast<uint64_t>(63);
+    OctreeWriter writer(out, pointsOffset);
+    std::vector<uint32_t> topNodes(numTopNodes, kOctreeNone);
+    std::vector<InputPoint> points;
+    for (size_t t = 0; t < numTopNodes; ++t) {
+        points.clear();
+        while (!heaps[t].empty()) {
+            points.push_back(heaps[t].top());
+            heaps[t].pop();
+        }
+        std::sort(points.begin(), points.end(), brighter);
+        if (!points.empty() || t == 0) {
+            topNodes[t] = writer.addNode(cubes[t], depthOf(t), points, 0, points.size());
+        }
+    }
+    std::vector<uint32_t> bucketRoots(numBuckets, kOctreeNone);
+    for (size_t b = 0; b < numBuckets; ++b) {
+        if (bucketSizes[b] == 0) {
+            std::remove(bucketFilenames[b].c_str());
+            continue;
+        }
+        points.resize(static_cast<size_t>(bucketSizes[b]));
+        std::ifstream bucket(bucketFilenames[b].c_str(), std::ios::binary);
+        bucket.read(reinterpret_cast<char*>(points.data()), points.size() * sizeof(InputPoint));
+        bucket.close();
+        std::remove(bucketFilenames[b].c_str());
+        bucketRoots[b] = buildSubtree(writer, points, 0, points.size(), cubes[numTopNodes + b], kTopLevels, capacity);
+    }
+    // Bottom-up, so that a top node is kept when anything below it is
+    for (size_t t = numTopNodes; t-- > 0;) {
+        bool any = false;
+        uint32_t children[8];
+        for (int c = 0; c < 8; ++c) {
+            const size_t child = 8 * t + 1 + c;
+            children[c] = (child < numTopNodes) ? topNodes[child] : bucketRoots[child - numTopNodes];
+            any = any || children[c] != kOctreeNone;
+        }
+        if (topNodes[t] == kOctreeNone && any) {
+            topNodes[t] = writer.addNode(cubes[t], depthOf(t), points, 0, 0); // empty, but leads to points
+        }
+        if (topNodes[t] != kOctreeNone) {
+            std::copy(children, children + 8, writer.getNode(topNodes[t]).children);
+        }
+    }
+
+    // The root must be node 0: it was added first
+    PointOctreeHeader header;
+    std::memcpy(header.magic, kPointOctreeMagic, sizeof(kPointOctreeMagic));
+    header.numNodes = static_cast<uint32_t>(writer.getNodes().size());
+    header.pointSize = sizeof(OctreePoint);
+    header.numPoints = writer.getNumPoints();
+    header.pointsOffset = pointsOffset;
+    header.nodesOffset = pointsOffset + header.numPoints * sizeof(OctreePoint);
+    out.seekp(static_cast<std::streamoff>(header.nodesOffset));
+    out.write(reinterpret_cast<const char*>(writer.getNodes().data()), writer.getNodes().size() * sizeof(OctreeNode));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!out) {
+        std::cerr << "ERROR: failed writing " << outputFilename << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Wrote " << header.numPoints << " points in " << header.numNodes << " nodes (" << skipped << " skipped) to "
+              << outputFilename << std::endl;
+    return EXIT_SUCCESS;
+}
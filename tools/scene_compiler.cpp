@@ -0,0 +1,490 @@
+// ----------------------------------------------------------------------------
+// scene_compiler.cpp
+//
+// Description: Converts a JSON scene description into the binary layout read
+//              by scene.h. See media/scenes/*.json for examples; the keys are:
+//
+//   timeScale   scene time units per second of animation (default 1)
+//   timeUnit    seconds per scene time unit; "mu" values are given per second
+//               squared and converted (default 1)
+//   ephemeris   binary ephemeris driving the bodies that have an "ephemeris" key
+//   camera      { position, target, near, far, follow }; with "follow", the
+//               position is an offset from that body
+//   bodies      array of { name, parent, radius, mu, texture, color, emissive,
+//               pinned, attached, ephemeris, spinPeriod, axialTilt, position,
+//               velocity,
+//               orbit: { semiMajorAxis, eccentricity, inclination,
+//               ascendingNode, argumentOfPeriapsis, meanAnomaly, period } }
+//               Angles are in degrees. A parent without "mu" gets the one
+//               giving its first child the "period" of its orbit. Attached
+//               bodies are not simulated: they ride on their parent at their
+//               "position" in its rotating frame (stations, landers).
+//               A "texture" ending in .vtex is a tiled virtual texture, built
+//               by texture_tiler and streamed (see virtual_texture.h).
+//
+// Usage: scene_compiler <scene.json> <output.scene>
+// ----------------------------------------------------------------------------
+
+#include "../ephemeris.h"
+#include "../scene.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const static double kDegreesToRadians = 3.14159265358979323846 / 180.0;
+
+// ---- Minimal JSON reader ---------------------------------------------------------
+
+struct JsonValue {
+    enum Type { kNull, kBool, kNumber, kString, kArray, kObject };
+
+    Type type = kNull;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue> > members;
+
+    const JsonValue* find(const std::string& key) const {
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i].first == key) {
+                return &members[i].second;
+            }
+        }
+        return nullptr;
+    }
+};
+
+class JsonParser {
+public:
+    JsonParser(const std::string& text, const std::string& filename) : m_text(text), m_filename(filename) {}
+
+    JsonValue parse() {
+        JsonValue value = parseValue();
+        skipSpaces();
+        if (m_pos != m_text.size()) {
+            fail("trailing characters");
+        }
+        return value;
+    }
+
+private:
+    void fail(const std::string& message) const {
+        const size_t line = 1 + std::count(m_text.begin(), m_text.begin() + std::min(m_pos, m_text.size()), '\n');
+        std::cerr << "ERROR: " << m_filename << ":" << line << ": " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    void skipSpaces() {
+        while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+            ++m_pos;
+        }
+    }
+
+    void expect(const char c) {
+        skipSpaces();
+        if (m_pos >= m_text.size() || m_text[m_pos] != c) {
+            fail(std::string("expected '") + c + "'");
+        }
+        ++m_pos;
+    }
+
+    bool accept(const char c) {
+        skipSpaces();
+        if (m_pos < m_text.size() && m_text[m_pos] == c) {
+            ++m_pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool acceptWord(const char* word) {
+        const size_t length = std::strlen(word);
+        if (m_text.compare(m_pos, length, word) == 0) {
+            m_pos += length;
+            return true;
+        }
+        return false;
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string s;
+        while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+            char c = m_text[m_pos++];
+            if (c == '\\' && m_pos < m_text.size()) {
+                c = m_text[m_pos++];
+                switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u': fail("\\u escapes are not supported"); break;
+                default: break; // \" \\ \/
+                }
+            }
+            s += c;
+        }
+        expect('"');
+        return s;
+    }
+
+    JsonValue parseValue() {
+        skipSpaces();
+        if (m_pos >= m_text.size()) {
+            fail("unexpected end of file");
+        }
+        JsonValue value;
+        const char c = m_text[m_pos];
+        if (c == '{') {
+            value.type = JsonValue::kObject;
+            ++m_pos;
+            if (!accept('}')) {
+                do {
+                    skipSpaces();
+                    const std::string key = parseString();
+                    expect(':');
+                    value.members.push_back(std::make_pair(key, parseValue()));
+                } while (accept(','));
+                expect('}');
+            }
+        }
+        else if (c == '[') {
+            value.type = JsonValue::kArray;
+            ++m_pos;
+            if (!accept(']')) {
+                do {
+                    value.items.push_back(parseValue());
+                } while (accept(','));
+                expect(']');
+            }
+        }
+        else if (c == '"') {
+            value.type = JsonValue::kString;
+            value.string = parseString();
+        }
+        else if (acceptWord("true")) {
+            value.type = JsonValue::kBool;
+            value.boolean = true;
+        }
+        else if (acceptWord("false")) {
+            value.type = JsonValue::kBool;
+        }
+        else if (acceptWord("null")) {
+            value.type = JsonValue::kNull;
+        }
+        else {
+            const char* begin = m_text.c_str() + m_pos;
+            char* end = nullptr;
+            value.type = JsonValue::kNumber;
+            value.number = std::strtod(begin, &end);
+            if (end == begin) {
+                fail("unexpected character");
+            }
+            m_pos += end - begin;
+        }
+        return value;
+    }
+
+    const std::string& m_text;
+    std::string m_filename;
+    size_t m_pos = 0;
+};
+
+// ---- Scene conversion ----------------------------------------------------------------
+
+static std::string g_filename;
+
+static void fail(const std::string& message) {
+    std::cerr << "ERROR: " << g_filename << ": " << message << std::endl;
+    std::exit(EXIT_FAILURE);
+}
+
+static double getNumber(const JsonValue& object, const char* key, const double fallback) {
+    const JsonValue* v = object.find(key);
+    if (!v) {
+        return fallback;
+    }
+    if (v->type != JsonValue::kNumber) {
+        fail(std::string("\"") + key + "\" must be a number");
+    }
+    return v->number;
+}
+
+static bool getBool(const JsonValue& object, const char* key) {
+    const JsonValue* v = object.find(key);
+    return v && v->type == JsonValue::kBool && v->boolean;
+}
+
+static std::string getString(const JsonValue& object, const char* key) {
+    const JsonValue* v = object.find(key);
+    if (!v) {
+        return std::string();
+    }
+    if (v->type != JsonValue::kString) {
+        fail(std::string("\"") + key + "\" must be a string");
+    }
+    return v->string;
+}
+
+static void getVector(const JsonValue& object, const char* key, double* out, const size_t size) {
+    const JsonValue* v = object.find(key);
+    if (!v) {
+        return;
+    }
+    if (v->type != JsonValue::kArray || v->items.size() != size) {
+        fail(std::string("\"") + key + "\" must be an array of " + std::to_string(size) + " numbers");
+    }
+    for (size_t i = 0; i < size; ++i) {
+        if (v->items[i].type != JsonValue::kNumber) {
+            fail(std::string("\"") + key + "\" must be an array of numbers");
+        }
+        out[i] = v->items[i].number;
+    }
+}
+
+static uint32_t parseEphemerisBody(const std::string& name) {
+    static const char* names[] = { "mercury", "venus", "earth", "mars", "jupiter", "saturn", "uranus", "neptune", "pluto", "moon", "sun" };
+    // Earth and Moon go through the Earth-Moon barycenter entries (see Ephemeris::evaluateBody)
+    static const EphemerisBody bodies[] = { kEphMercury, kEphVenus, kEphEarthMoonBarycenter, kEphMars, kEphJupiter, kEphSaturn,
+                                            kEphUranus, kEphNeptune, kEphPluto, kEphMoonGeocentric, kEphSun };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (name == names[i]) {
+            return bodies[i];
+        }
+    }
+    fail("unknown ephemeris body \"" + name + "\"");
+    return kSceneNone;
+}
+
+class StringTable {
+public:
+    uint32_t add(const std::string& s) {
+        std::map<std::string, uint32_t>::const_iterator it = m_offsets.find(s);
+        if (it != m_offsets.end()) {
+            return it->second;
+        }
+        const uint32_t offset = static_cast<uint32_t>(m_data.size());
+        m_data.insert(m_data.end(), s.begin(), s.end());
+        m_data.push_back('\0');
+        m_offsets[s] = offset;
+        return offset;
+    }
+    inline const std::vector<char>& data() const { return m_data; }
+
+private:
+    std::vector<char> m_data;
+    std::map<std::string, uint32_t> m_offsets;
+};
+
+// Depth-first ordering: every body comes right before its subtree (see transforms.h).
+static void orderBody(size_t i, const std::vector<std::vector<size_t> >& children, std::vector<size_t>& order) {
+    order.push_back(i);
+    for (size_t c = 0; c < children[i].size(); ++c) {
+        orderBody(children[i][c], children, order);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <scene.json> <output.scene>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    g_filename = argv[1];
+    std::ifstream file(argv[1]);
+    if (!file) {
+        std::cerr << "ERROR: cannot open " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string text = buffer.str();
+    const JsonValue root = JsonParser(text, g_filename).parse();
+    if (root.type != JsonValue::kObject) {
+        fail("the scene must be a JSON object");
+    }
+    const JsonValue* bodiesJson = root.find("bodies");
+    if (!bodiesJson || bodiesJson->type != JsonValue::kArray || bodiesJson->items.empty()) {
+        fail("\"bodies\" must be a non-empty array");
+    }
+    const std::vector<JsonValue>& items = bodiesJson->items;
+    const size_t n = items.size();
+    const double timeUnit = getNumber(root, "timeUnit", 1.0);
+
+    // Names and parents, in file order
+    std::map<std::string, size_t> indices;
+    for (size_t i = 0; i < n; ++i) {
+        if (items[i].type != JsonValue::kObject) {
+            fail("bodies must be JSON objects");
+        }
+        const std::string name = getString(items[i], "name");
+        if (name.empty() || indices.count(name)) {
+            fail("every body needs a unique \"name\" (\"" + name + "\")");
+        }
+        indices[name] = i;
+    }
+    std::vector<int> parents(n, -1);
+    for (size_t i = 0; i < n; ++i) {
+        const std::string parent = getString(items[i], "parent");
+        if (!parent.empty()) {
+            if (!indices.count(parent)) {
+                fail("unknown parent \"" + parent + "\"");
+            }
+            parents[i] = static_cast<int>(indices[parent]);
+        }
+    }
+    std::vector<std::vector<size_t> > children(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (parents[i] >= 0) {
+            children[parents[i]].push_back(i);
+        }
+    }
+    std::vector<size_t> order;
+    for (size_t i = 0; i < n; ++i) {
+        if (parents[i] < 0) {
+            orderBody(i, children, order);
+        }
+    }
+    if (order.size() != n) {
+        fail("cycle in the parent relationships");
+    }
+    std::vector<uint32_t> remap(n);
+    for (size_t k = 0; k < n; ++k) {
+        remap[order[k]] = static_cast<uint32_t>(k);
+    }
+
+    StringTable strings;
+    std::vector<uint32_t> textures;
+    std::map<std::string, uint32_t> textureIndices;
+    std::vector<SceneBody> bodies(n);
+    std::vector<bool> hasMu(n, false);
+    for (size_t k = 0; k < n; ++k) {
+        const JsonValue& json = items[order[k]];
+        SceneBody& body = bodies[k];
+        std::memset(&body, 0, sizeof(body));
+        body.name = strings.add(getString(json, "name"));
+        body.parent = parents[order[k]] >= 0 ? remap[parents[order[k]]] : kSceneNone;
+        body.radius = getNumber(json, "radius", 1.0);
+        hasMu[k] = json.find("mu") != nullptr;
+        body.mu = getNumber(json, "mu", 0.0) * timeUnit * timeUnit;
+        body.spinPeriod = getNumber(json, "spinPeriod", 0.0);
+        body.axialTilt = getNumber(json, "axialTilt", 0.0) * kDegreesToRadians;
+        body.flags = (getBool(json, "emissive") ? kSceneBodyEmissive : 0) | (getBool(json, "pinned") ? kSceneBodyPinned : 0) |
+                     (getBool(json, "attached") ? kSceneBodyAttached : 0);
+        if (body.flags & kSceneBodyAttached) {
+            if (body.parent == kSceneNone || json.find("orbit") || json.find("ephemeris")) {
+                fail("attached bodies need a \"parent\", and have neither \"orbit\" nor \"ephemeris\"");
+            }
+        }
+        else if (body.parent != kSceneNone && (bodies[body.parent].flags & kSceneBodyAttached)) {
+            fail("bodies attached to their parent can only have attached children");
+        }
+        getVector(json, "position", body.position, 3);
+        getVector(json, "velocity", body.velocity, 3);
+        double color[3] = { 1.0, 1.0, 1.0 };
+        getVector(json, "color", color, 3);
+        for (int c = 0; c < 3; ++c) {
+            body.color[c] = static_cast<float>(color[c]);
+        }
+        body.color[3] = 1.0f;
+
+        const std::string texture = getString(json, "texture");
+        body.texture = kSceneNone;
+        if (!texture.empty()) {
+            if (!textureIndices.count(texture)) {
+                textureIndices[texture] = static_cast<uint32_t>(textures.size());
+                textures.push_back(strings.add(texture));
+            }
+            body.texture = textureIndices[texture];
+        }
+        const std::string ephemerisBody = getString(json, "ephemeris");
+        body.ephemerisBody = ephemerisBody.empty() ? kSceneNone : parseEphemerisBody(ephemerisBody);
+
+        if (const JsonValue* orbit = json.find("orbit")) {
+            if (body.parent == kSceneNone) {
+                fail("\"orbit\" needs a \"parent\"");
+            }
+            body.orbit.semiMajorAxis = getNumber(*orbit, "semiMajorAxis", 0.0);
+            body.orbit.eccentricity = getNumber(*orbit, "eccentricity", 0.0);
+            body.orbit.inclination = getNumber(*orbit, "inclination", 0.0) * kDegreesToRadians;
+            body.orbit.ascendingNode = getNumber(*orbit, "ascendingNode", 0.0) * kDegreesToRadians;
+            body.orbit.argumentOfPeriapsis = getNumber(*orbit, "argumentOfPeriapsis", 0.0) * kDegreesToRadians;
+            body.orbit.meanAnomaly = getNumber(*orbit, "meanAnomaly", 0.0) * kDegreesToRadians;
+            if (body.orbit.semiMajorAxis <= 0.0 || body.orbit.eccentricity < 0.0 || body.orbit.eccentricity >= 1.0) {
+                fail("orbits need a positive \"semiMajorAxis\" and an \"eccentricity\" in [0, 1)");
+            }
+            // Parent mass from the period of the orbit (Kepler's third law)
+            const double period = getNumber(*orbit, "period", 0.0);
+            if (period > 0.0 && !hasMu[body.parent]) {
+                const double a = body.orbit.semiMajorAxis;
+                const double omega = 2.0 * 3.14159265358979323846 / period;
+                bodies[body.parent].mu = omega * omega * a * a * a;
+                hasMu[body.parent] = true;
+            }
+        }
+    }
+    for (size_t k = 0; k < n; ++k) {
+        if (bodies[k].orbit.semiMajorAxis > 0.0 && bodies[bodies[k].parent].mu <= 0.0) {
+            fail("the parent of \"" + getString(items[order[k]], "name") + "\" has no \"mu\" for its orbit");
+        }
+    }
+
+    SceneFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kSceneMagic, sizeof(kSceneMagic));
+    header.numBodies = static_cast<uint32_t>(n);
+    header.numTextures = static_cast<uint32_t>(textures.size());
+    header.timeScale = getNumber(root, "timeScale", 1.0);
+    const std::string ephemeris = getString(root, "ephemeris");
+    header.ephemerisFile = ephemeris.empty() ? kSceneNone : strings.add(ephemeris);
+    header.cameraFollow = kSceneNone;
+    header.cameraPosition[2] = 10.0;
+    header.cameraNear = 0.1;
+    header.cameraFar = 100.0;
+    if (const JsonValue* camera = root.find("camera")) {
+        getVector(*camera, "position", header.cameraPosition, 3);
+        getVector(*camera, "target", header.cameraTarget, 3);
+        header.cameraNear = getNumber(*camera, "near", header.cameraNear);
+        header.cameraFar = getNumber(*camera, "far", header.cameraFar);
+        const std::string follow = getString(*camera, "follow");
+        if (!follow.empty()) {
+            if (!indices.count(follow)) {
+                fail("unknown camera \"follow\" body \"" + follow + "\"");
+            }
+            header.cameraFollow = remap[indices[follow]];
+        }
+    }
+
+    const std::vector<char>& stringData = strings.data();
+    header.bodiesOffset = sizeof(SceneFileHeader);
+    header.texturesOffset = header.bodiesOffset + n * sizeof(SceneBody);
+    header.stringsOffset = header.texturesOffset + textures.size() * sizeof(uint32_t);
+    header.stringsSize = stringData.size();
+
+    std::ofstream out(argv[2], std::ios::binary);
+    if (!out) {
+        std::cerr << "ERROR: cannot write " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(bodies.data()), bodies.size() * sizeof(SceneBody));
+    out.write(reinterpret_cast<const char*>(textures.data()), textures.size() * sizeof(uint32_t));
+    out.write(stringData.data(), stringData.size());
+    if (!out) {
+        std::cerr << "ERROR: failed writing " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Wrote " << n << " bodies and " << textures.size() << " textures to " << argv[2] << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+// ----------------------------------------------------------------------------
+// star_compiler.cpp
+//
+// Description: Converts a HYG/Hipparcos style CSV star catalog into the
+//              binary layout read by star_catalog.h. The first line names the
+//              columns; directions are taken from the x, y, z columns when
+//              present, from ra (hours) and dec (degrees) otherwise, along with
+//              mag and ci (B-V). Stars without a magnitude, and the Sun of HYG
+//              (at distance 0 in the dist column), are skipped.
+//
+// Usage: star_compiler <catalog.csv> <output.bin> [faintest magnitude]
+// ----------------------------------------------------------------------------
+
+#include "../star_catalog.h"
+#include "csv.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const static float kDefaultColorIndex = 0.65f; // solar, for the stars without one
+
+static bool brighter(const StarRecord& a, const StarRecord& b) {
+    return a.magnitude < b.magnitude;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <catalog.csv> <output.bin> [faintest magnitude]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const double faintest = (argc > 3) ? std::atof(argv[3]) : HUGE_VAL;
+
+    std::ifstream file(argv[1]);
+    if (!file) {
+        std::cerr << "ERROR: cannot open " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string line;
+    std::vector<std::string> fields;
+    if (!std::getline(file, line)) {
+        std::cerr << "ERROR: " << argv[1] << " is empty" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<std::string> names;
+    splitCsv(line, names);
+    const int xColumn = findColumn(names, "x");
+    const int yColumn = findColumn(names, "y");
+    const int zColumn = findColumn(names, "z");
+    const int raColumn = findColumn(names, "ra");
+    const int decColumn = findColumn(names, "dec");
+    const int magColumn = findColumn(names, "mag");
+    const int ciColumn = findColumn(names, "ci");
+    const int distColumn = findColumn(names, "dist");
+    const bool cartesian = xColumn >= 0 && yColumn >= 0 && zColumn >= 0;
+    if (magColumn < 0 || (!cartesian && (raColumn < 0 || decColumn < 0))) {
+        std::cerr << "ERROR: " << argv[1] << " needs the columns mag and either x, y, z or ra, dec" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<StarRecord> stars;
+    size_t skipped = 0;
+    while (std::getline(file, line)) {
+        splitCsv(line, fields);
+        double magnitude, x, y, z, distance;
+        if (!parseField(fields, magColumn, magnitude) || magnitude > faintest ||
+            (parseField(fields, distColumn, distance) && distance <= 0.0)) {
+            ++skipped; // faint, or the Sun
+            continue;
+        }
+        if (cartesian) {
+            if (!parseField(fields, xColumn, x) || !parseField(fields, yColumn, y) || !parseField(fields, zColumn, z)) {
+                ++skipped;
+                continue;
+            }
+        }
+        else {
+            double ra, dec;
+            if (!parseField(fields, raColumn, ra) || !parseField(fields, decColumn, dec)) {
+                ++skipped;
+                continue;
+            }
+            const double alpha = ra * 3.14159265358979323846 / 12.0;
+            const double delta = dec * 3.14159265358979323846 / 180.0;
+            x = std::cos(delta) * std::cos(alpha);
+            y = std::cos(delta) * std::sin(alpha);
+            z = std::sin(delta);
+        }
+        const double length = std::sqrt(x * x + y * y + z * z);
+        if (length == 0.0) {
+            ++skipped;
+            continue;
+        }
+        double colorIndex;
+        if (!parseField(fields, ciColumn, colorIndex)) {
+            colorIndex = kDefaultColorIndex;
+        }
+        StarRecord star;
+        star.direction[0] = static_cast<float>(x / length);
+        star.direction[1] = static_cast<float>(z / length);
+        star.direction[2] = static_cast<float>(-y / length);
+        star.magnitude = static_cast<float>(magnitude);
+        star.colorIndex = static_cast<float>(colorIndex);
+        stars.push_back(star);
+    }
+    std::stable_sort(stars.begin(), stars.end(), brighter);
+
+    StarCatalogHeader header;
+    std::memcpy(header.magic, kStarCatalogMagic, sizeof(kStarCatalogMagic));
+    header.numStars = static_cast<uint32_t>(stars.size());
+    header.recordSize = sizeof(StarRecord);
+    header.starsOffset = sizeof(StarCatalogHeader);
+
+    std::ofstream out(argv[2], std::ios::binary);
+    if (!out) {
+        std::cerr << "ERROR: cannot write " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(stars.data()), stars.size() * sizeof(StarRecord));
+    if (!out) {
+        std::cerr << "ERROR: failed writing " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Wrote " << stars.size() << " stars (" << skipped << " skipped) to " << argv[2] << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+// ----------------------------------------------------------------------------
+// texture_tiler.cpp
+//
+// Description: Cuts a very large image (16k to 32k texels wide planet maps)
+//              into the tiled file streamed by virtual_texture.h. Mip levels
+//              are computed in linear light (see mipmaps.h) down to a level of
+//              a few tiles; each level is cut into tiles of kVirtualTileSize
+//              texels plus a border of their neighbors, wrapping around in
+//              longitude and clamped at the poles, and each tile is encoded in
+//              BC1 (see bc1.h), one row of tiles per job (see jobs.h). JPEGs
+//              with restart markers are decoded in parallel (see jpeg_bands.h).
+//
+//              Both sides of the image must be a power of two multiple of
+//              kVirtualTileSize. The whole image is decoded in memory: about
+//              1.5 GB for 32768x16384.
+//
+// Usage: texture_tiler <image> <output.vtex>
+// ----------------------------------------------------------------------------
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION
+
+#include "../jobs.h"
+#include "../jpeg_bands.h"
+#include "../mipmaps.h"
+#include "../virtual_texture.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+const static uint64_t kTilesAlignment = 4096; // tiles start on a page
+
+static bool isPowerOfTwo(const uint32_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+// Padded texels of the tile (x, y) of an RGB level, wrapping horizontally and clamped vertically.
+static void extractTile(const unsigned char* rgb, const uint32_t width, const uint32_t height, const uint32_t x, const uint32_t y,
+                        unsigned char* tile) {
+    for (uint32_t ty = 0; ty < kVirtualTilePadded; ++ty) {
+        const int64_t sy = int64_t(y) * kVirtualTileSize + ty - kVirtualTileBorder;
+        const uint32_t row = static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(sy, 0), height - 1));
+        for (uint32_t tx = 0; tx < kVirtualTilePadded; ++tx) {
+            const int64_t sx = int64_t(x) * kVirtualTileSize + tx - kVirtualTileBorder;
+            const uint32_t column = static_cast<uint32_t>((sx % width + width) % width);
+            std::memcpy(tile + (size_t(ty) * kVirtualTilePadded + tx) * 3, rgb + (size_t(row) * width + column) * 3, 3);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <image> <output.vtex>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    JobSystem jobs;
+    jobs.start(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    std::ifstream file(argv[1], std::ios::binary);
+    const std::vector<unsigned char> source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    int width, height, components;
+    unsigned char* pixels = decodeJpegBands(source.data(), source.size(), &width, &height, &components, jobs);
+    if (!pixels || components != 3) {
+        stbi_image_free(pixels);
+        pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &width, &height, &components, 3);
+    }
+    if (!pixels) {
+        std::cerr << "ERROR: cannot decode " << argv[1] << ": " << stbi_failure_reason() << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<unsigned char> level(pixels, pixels + size_t(width) * height * 3), next;
+    stbi_image_free(pixels);
+
+    VirtualTextureHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kVirtualTextureMagic, sizeof(kVirtualTextureMagic));
+    header.width = static_cast<uint32_t>(width);
+    header.height = static_cast<uint32_t>(height);
+    header.tileSize = kVirtualTileSize;
+    header.tileBorder = kVirtualTileBorder;
+    header.tileBytes = kVirtualTileBytes;
+    if (header.width % kVirtualTileSize != 0 || header.height % kVirtualTileSize != 0 || !isPowerOfTwo(header.width / kVirtualTileSize) ||
+        !isPowerOfTwo(header.height / kVirtualTileSize) || header.width / kVirtualTileSize > 4096 || header.height / kVirtualTileSize > 4096) {
+        std::cerr << "ERROR: " << argv[1] << " is " << width << "x" << height << ": both sides must be a power of two multiple of "
+                  << kVirtualTileSize << ", up to " << 4096 * kVirtualTileSize << std::endl;
+        return EXIT_FAILURE;
+    }
+    uint64_t numTiles = 0;
+    for (uint32_t tilesX = header.width / kVirtualTileSize, tilesY = header.height / kVirtualTileSize;; tilesX /= 2, tilesY /= 2) {
+        VirtualTextureLevel& l = header.levels[header.numLevels++];
+        l.tilesX = tilesX;
+        l.tilesY = tilesY;
+        l.firstTile = numTiles;
+        numTiles += uint64_t(tilesX) * tilesY;
+        if (uint64_t(tilesX) * tilesY <= kMaxVirtualCoarseTiles || tilesX == 1 || tilesY == 1 || header.numLevels == kMaxVirtualLevels) {
+            break;
+        }
+    }
+    const VirtualTextureLevel& coarsest = header.levels[header.numLevels - 1];
+    if (uint64_t(coarsest.tilesX) * coarsest.tilesY > kMaxVirtualCoarseTiles) {
+        std::cerr << "ERROR: " << argv[1] << " is too elongated: its coarsest level would have more than " << kMaxVirtualCoarseTiles
+                  << " tiles" << std::endl;
+        return EXIT_FAILURE;
+    }
+    header.tilesOffset = (sizeof(header) + kTilesAlignment - 1) / kTilesAlignment * kTilesAlignment;
+
+    std::ofstream out(argv[2], std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "ERROR: cannot write " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint32_t w = header.width, h = header.height;
+    std::vector<unsigned char> tiles;
+    for (uint32_t l = 0; l < header.numLevels; ++l) {
+        if (l > 0) {
+            downsampleGammaCorrect(level.data(), w, h, 3, next, w, h);
+            level.swap(next);
+        }
+        const VirtualTextureLevel& tileLevel = header.levels[l];
+        tiles.resize(size_t(tileLevel.tilesX) * tileLevel.tilesY * kVirtualTileBytes);
+        jobs.parallelFor(0, tileLevel.tilesY, 1, [&](const size_t first, const size_t last) {
+            std::vector<unsigned char> texels(size_t(kVirtualTilePadded) * kVirtualTilePadded * 3);
+            for (size_t y = first; y < last; ++y) {
+                for (uint32_t x = 0; x < tileLevel.tilesX; ++x) {
+                    extractTile(level.data(), w, h, x, static_cast<uint32_t>(y), texels.data());
+                    encodeBC1(texels.data(), kVirtualTilePadded, kVirtualTilePadded,
+                              tiles.data() + (y * tileLevel.tilesX + x) * kVirtualTileBytes, 0, kVirtualTilePadded / 4);
+                }
+            }
+        });
+        out.seekp(static_cast<std::streamoff>(header.tilesOffset + tileLevel.firstTile * kVirtualTileBytes));
+        out.write(reinterpret_cast<const char*>(tiles.data()), tiles.size());
+    }
+    jobs.stop();
+    if (!out) {
+        std::cerr << "ERROR: failed writing " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Tiled " << argv[1] << " into " << numTiles << " tiles over " << header.numLevels << " levels in " << argv[2] << std::endl;
+    return EXIT_SUCCESS;
+}
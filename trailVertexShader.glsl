@@ -0,0 +1,23 @@
+#version 330 core
+// One instance per trail, one vertex per sample, newest first (see trails.h)
+uniform samplerBuffer samples; // slot-major ring: texel = slot * numTrails + trail
+uniform samplerBuffer colors;  // one texel per trail
+uniform mat4 projView;
+uniform vec3 anchorOffset; // anchor of the samples, relative to the camera
+uniform int numTrails;
+uniform int capacity;
+uniform int head; // slot of the newest sample
+uniform int numSamples;
+uniform float logDepthCoef; // 2 / log2(far + 1)
+
+out vec4 fColor;
+
+void main() {
+int age = gl_VertexID;
+int slot = (head - age + capacity) % capacity; // wrap of the ring
+vec4 s = texelFetch(samples, slot * numTrails + gl_InstanceID);
+float fade = 1.0 - float(age) / float(numSamples);
+fColor = vec4(texelFetch(colors, gl_InstanceID).rgb, s.w * fade);
+gl_Position = projView * vec4(s.xyz + anchorOffset, 1.0);
+gl_Position.z = (log2(max(1e-6, 1.0 + gl_Position.w)) * logDepthCoef - 1.0) * gl_Position.w;
+}
@@ -0,0 +1,194 @@
+// ----------------------------------------------------------------------------
+// trails.h
+//
+// Description: Orbit trails drawn from a GPU-resident ring buffer.
+//
+//              Samples live in one texture buffer, slot-major: the samples
+//              of all trails for one step are contiguous, so appending a step
+//              is a single glBufferSubData of numTrails texels and nothing is
+//              ever re-uploaded. All trails are drawn by one instanced line
+//              strip draw; the vertex shader maps (instance, vertex) to
+//              (trail, age), resolves the ring wrap and fades by age.
+//
+//              Samples are stored in float relative to a fixed world anchor;
+//              the anchor is rebased on the camera in double every frame.
+// ----------------------------------------------------------------------------
+
+#ifndef TRAILS_H
+#define TRAILS_H
+
+#include "gpu_resources.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+void loadShader(GLuint program, GLenum type, const std::string& shaderFilename); // main.cpp
+
+class TrailRenderer {
+public:
+    void init(const uint32_t maxTrails, const uint32_t samplesPerTrail) {
+        m_maxTrails = maxTrails;
+        m_capacity = samplesPerTrail;
+        m_head = 0;
+        m_numSamples = 0;
+        m_activeTrails = 0;
+
+        m_program.create();
+        loadShader(m_program.get(), GL_VERTEX_SHADER, "trailVertexShader.glsl");
+        loadShader(m_program.get(), GL_FRAGMENT_SHADER, "trailFragmentShader.glsl");
+        glLinkProgram(m_program.get());
+
+        // Sample ring: capacity * maxTrails RGBA32F texels (xyz relative to the anchor, w = 1 once valid)
+        const std::vector<float> zeros(static_cast<size_t>(m_capacity) * m_maxTrails * 4, 0.0f);
+        m_sampleBuffer.create(kGpuTrails);
+        m_sampleBuffer.setData(GL_TEXTURE_BUFFER, zeros.size() * sizeof(float), zeros.data(), GL_DYNAMIC_DRAW);
+        m_sampleTexture.create(kGpuTrails); // a view of the buffer: no storage of its own
+        glBindTexture(GL_TEXTURE_BUFFER, m_sampleTexture.get());
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_sampleBuffer.get());
+
+        const std::vector<unsigned char> white(static_cast<size_t>(m_maxTrails) * 4, 255);
+        m_colorBuffer.create(kGpuTrails);
+        m_colorBuffer.setData(GL_TEXTURE_BUFFER, white.size(), white.data(), GL_STATIC_DRAW);
+        m_colorTexture.create(kGpuTrails);
+        glBindTexture(GL_TEXTURE_BUFFER, m_colorTexture.get());
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8, m_colorBuffer.get());
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        m_vao.create(kGpuTrails); // no attributes: everything is fetched from the texture buffers
+    }
+
+    void clear() {
+        m_vao.reset();
+        m_sampleTexture.reset();
+        m_colorTexture.reset();
+        m_sampleBuffer.reset();
+        m_colorBuffer.reset();
+        m_program.reset();
+    }
+
+    inline uint32_t getMaxTrails() const { return m_maxTrails; }
+    inline void setAnchor(const glm::dvec3& anchor) { m_anchor = anchor; }
+
+    void setColor(const uint32_t trail, const glm::vec3& color) {
+        if (trail >= m_maxTrails) {
+            return;
+        }
+        const glm::u8vec4 c(glm::clamp(color, 0.0f, 1.0f) * 255.0f, 255);
+        glBindBuffer(GL_TEXTURE_BUFFER, m_colorBuffer.get());
+        glBufferSubData(GL_TEXTURE_BUFFER, trail * sizeof(c), sizeof(c), &c);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // Appends one sample (world position) to each of the first `count` trails.
+    void append(const glm::dvec3* positions, uint32_t count) {
+        if (count > m_maxTrails) {
+            count = m_maxTrails;
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, m_sampleBuffer.get());
+
+        // A trail starting now has no history: its whole column is filled with the first sample, so the
+        // strip collapses onto it instead of reaching for stale or zero texels. Trails start in order, so the
+        // new ones are [m_activeTrails, count): one upload of the whole ring when none has started yet, else
+        // one per slot over their range.
+        if (count > m_activeTrails) {
+            const uint32_t numNew = count - m_activeTrails;
+            const uint32_t stride = m_activeTrails == 0 ? m_maxTrails : numNew; // texels per slot in the staging
+            std::vector<glm::vec4> columns(static_cast<size_t>(m_capacity) * stride, glm::vec4(0.0f));
+            for (uint32_t t = 0; t < numNew; ++t) {
+                const glm::vec4 first(glm::vec3(positions[m_activeTrails + t] - m_anchor), 0.0f);
+                for (uint32_t slot = 0; slot < m_capacity; ++slot) {
+                    columns[static_cast<size_t>(slot) * stride + t] = first;
+                }
+            }
+            if (m_activeTrails == 0) {
+                glBufferSubData(GL_TEXTURE_BUFFER, 0, columns.size() * sizeof(glm::vec4), columns.data());
+            }
+            else {
+                for (uint32_t slot = 0; slot < m_capacity; ++slot) {
+                    glBufferSubData(GL_TEXTURE_BUFFER, texelOffset(slot, m_activeTrails), numNew * sizeof(glm::vec4),
+                                    &columns[static_cast<size_t>(slot) * stride]);
+                }
+            }
+        }
+
+        // Trails beyond `count` (removed bodies) keep their last sample, i.e., they stop growing.
+        m_activeTrails = std::max(m_activeTrails, count);
+        m_staging.resize(count);
+        for (uint32_t t = 0; t < count; ++t) {
+            m_staging[t] = glm::vec4(glm::vec3(positions[t] - m_anchor), 1.0f);
+        }
+        glBufferSubData(GL_TEXTURE_BUFFER, texelOffset(m_head, 0), count * sizeof(glm::vec4), m_staging.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        m_head = (m_head + 1) % m_capacity;
+        if (m_numSamples < m_capacity) {
+            ++m_numSamples;
+        }
+    }
+
+    // Draws every active trail; projView is the camera-relative projection * view (see world.h).
+    void render(const glm::mat4& projView, const glm::dvec3& cameraPosition, const float logDepthCoef) {
+        if (m_numSamples < 2 || m_activeTrails == 0) {
+            return;
+        }
+        const glm::vec3 anchorOffset = glm::vec3(m_anchor - cameraPosition);
+        const int newest = static_cast<int>((m_head + m_capacity - 1) % m_capacity);
+
+        glUseProgram(m_program.get());
+        glUniformMatrix4fv(glGetUniformLocation(m_program.get(), "projView"), 1, GL_FALSE, glm::value_ptr(projView));
+        glUniform3f(glGetUniformLocation(m_program.get(), "anchorOffset"), anchorOffset[0], anchorOffset[1], anchorOffset[2]);
+        glUniform1i(glGetUniformLocation(m_program.get(), "numTrails"), static_cast<int>(m_maxTrails));
+        glUniform1i(glGetUniformLocation(m_program.get(), "capacity"), static_cast<int>(m_capacity));
+        glUniform1i(glGetUniformLocation(m_program.get(), "head"), newest);
+        glUniform1i(glGetUniformLocation(m_program.get(), "numSamples"), static_cast<int>(m_numSamples));
+        glUniform1f(glGetUniformLocation(m_program.get(), "logDepthCoef"), logDepthCoef);
+        glUniform1i(glGetUniformLocation(m_program.get(), "samples"), 0);
+        glUniform1i(glGetUniformLocation(m_program.get(), "colors"), 1);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, m_sampleTexture.get());
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, m_colorTexture.get());
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(m_vao.get());
+        glDrawArraysInstanced(GL_LINE_STRIP, 0, static_cast<GLsizei>(m_numSamples), static_cast<GLsizei>(m_activeTrails));
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+private:
+    inline GLintptr texelOffset(const uint32_t slot, const uint32_t trail) const {
+        return static_cast<GLintptr>((static_cast<size_t>(slot) * m_maxTrails + trail) * sizeof(glm::vec4));
+    }
+
+    GpuProgram m_program;
+    GpuVertexArray m_vao;
+    GpuBuffer m_sampleBuffer;
+    GpuTexture m_sampleTexture;
+    GpuBuffer m_colorBuffer;
+    GpuTexture m_colorTexture;
+    uint32_t m_maxTrails = 0;
+    uint32_t m_capacity = 0;
+    uint32_t m_head = 0; // slot of the next sample
+    uint32_t m_numSamples = 0;
+    uint32_t m_activeTrails = 0;
+    glm::dvec3 m_anchor = glm::dvec3(0.0);
+    std::vector<glm::vec4> m_staging;
+};
+
+#endif // TRAILS_H
@@ -0,0 +1,217 @@
+// ----------------------------------------------------------------------------
+// transforms.h
+//
+// Description: Transform hierarchy stored as flat arrays in depth-first
+//              order: a node comes right before its subtree, so parents are
+//              always updated before their children and a whole subtree can
+//              be skipped by jumping to its end.
+//
+//              Nodes have a local translation (double, see world.h), rotation
+//              and scale. Children follow the translation and rotation of
+//              their parent but not its scale, which only sizes the node
+//              itself (a planet's radius does not stretch its stations).
+//              Absolute nodes are placed in world space directly, whatever
+//              their parent (simulated bodies), while their own children still
+//              follow them.
+//
+//              Setting a local transform marks the node dirty; update() then
+//              recomputes the dirty nodes and their subtrees in one pass. With
+//              a job system, the subtrees small enough to be a job are updated
+//              in parallel once the nodes above them are.
+// ----------------------------------------------------------------------------
+
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include "jobs.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+const static uint32_t kTransformJobNodes = 1024; // nodes per job, at most
+
+class TransformHierarchy {
+public:
+    const static uint32_t kNone = 0xFFFFFFFFu;
+
+    // Appends a node. Nodes must be added depth first: the parent must be the last node added or one of its
+    // ancestors. Returns kNone otherwise.
+    uint32_t add(const uint32_t parent, const bool absolute = false, const glm::dvec3& translation = glm::dvec3(0.0),
+                 const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f)) {
+        const uint32_t id = static_cast<uint32_t>(m_parents.size());
+        if (parent != kNone && (parent >= id || m_subtreeEnds[parent] != id)) {
+            return kNone;
+        }
+        for (uint32_t a = parent; a != kNone; a = m_parents[a]) {
+            m_subtreeEnds[a] = id + 1;
+        }
+        m_parents.push_back(parent);
+        m_absolute.push_back(absolute ? 1 : 0);
+        m_subtreeEnds.push_back(id + 1);
+        m_localTranslations.push_back(translation);
+        m_localRotations.push_back(rotation);
+        m_localScales.push_back(scale);
+        m_worldTranslations.push_back(translation);
+        m_worldRotations.push_back(rotation);
+        m_dirty.push_back(0);
+        m_pending.push_back(0);
+        m_changed.push_back(0);
+        markDirty(id);
+        return id;
+    }
+
+    void clear() {
+        m_parents.clear();
+        m_absolute.clear();
+        m_subtreeEnds.clear();
+        m_localTranslations.clear();
+        m_localRotations.clear();
+        m_localScales.clear();
+        m_worldTranslations.clear();
+        m_worldRotations.clear();
+        m_dirty.clear();
+        m_pending.clear();
+        m_changed.clear();
+    }
+
+    inline size_t getNumNodes() const { return m_parents.size(); }
+    inline uint32_t getParent(const uint32_t i) const { return m_parents[i]; }
+    inline bool isAbsolute(const uint32_t i) const { return m_absolute[i] != 0; }
+    inline uint32_t getSubtreeEnd(const uint32_t i) const { return m_subtreeEnds[i]; }
+
+    // Setting an unchanged value keeps the node clean.
+    inline void setLocalTranslation(const uint32_t i, const glm::dvec3& t) {
+        if (t != m_localTranslations[i]) {
+            m_localTranslations[i] = t;
+            markDirty(i);
+        }
+    }
+    inline void setLocalRotation(const uint32_t i, const glm::quat& r) {
+        if (r != m_localRotations[i]) {
+            m_localRotations[i] = r;
+            markDirty(i);
+        }
+    }
+    inline void setLocalScale(const uint32_t i, const glm::vec3& s) { m_localScales[i] = s; } // not inherited: nothing to propagate
+
+    inline const glm::dvec3& getLocalTranslation(const uint32_t i) const { return m_localTranslations[i]; }
+    inline const glm::quat& getLocalRotation(const uint32_t i) const { return m_localRotations[i]; }
+    inline const glm::vec3& getLocalScale(const uint32_t i) const { return m_localScales[i]; }
+    inline const glm::dvec3& getWorldTranslation(const uint32_t i) const { return m_worldTranslations[i]; }
+    inline const glm::quat& getWorldRotation(const uint32_t i) const { return m_worldRotations[i]; }
+
+    // Rotation and scale of the node in world space, to combine with a camera-relative translation (see world.h).
+    inline glm::mat4 computeRotationScale(const uint32_t i) const {
+        return glm::mat4_cast(m_worldRotations[i]) * glm::scale(glm::mat4(1.0f), m_localScales[i]);
+    }
+
+    // Number of nodes recomputed by the last update
+    inline size_t getLastUpdatedNodes() const { return m_lastUpdated; }
+
+    // Recomputes the world transforms of the dirty nodes and of their subtrees; clean subtrees are skipped.
+    void update(JobSystem* jobs = nullptr) {
+        const uint32_t n = static_cast<uint32_t>(m_parents.size());
+        if (!jobs || jobs->getNumThreads() == 1 || n <= kTransformJobNodes) {
+            m_lastUpdated = updateRange(0, n);
+            return;
+        }
+        // The nodes of subtrees too large for a job are updated here, top down; the subtrees hanging from them
+        // are gathered into ranges of consecutive siblings, which only depend on those nodes
+        m_lastUpdated = 0;
+        m_ranges.clear();
+        uint32_t i = 0;
+        while (i < n) {
+            const uint32_t parent = m_parents[i];
+            const bool parentChanged = parent != kNone && m_changed[parent];
+            if (!m_pending[i] && !parentChanged) {
+                i = m_subtreeEnds[i];
+                continue;
+            }
+            if (m_subtreeEnds[i] - i <= kTransformJobNodes) {
+                if (!m_ranges.empty() && m_ranges.back().second == i && m_subtreeEnds[i] - m_ranges.back().first <= kTransformJobNodes) {
+                    m_ranges.back().second = m_subtreeEnds[i];
+                }
+                else {
+                    m_ranges.push_back(std::make_pair(i, m_subtreeEnds[i]));
+                }
+                i = m_subtreeEnds[i];
+                continue;
+            }
+            m_lastUpdated += updateRange(i, i + 1);
+            ++i;
+        }
+        m_rangeUpdated.assign(m_ranges.size(), 0);
+        jobs->parallelFor(0, m_ranges.size(), 1, [this](size_t first, size_t last) {
+            for (size_t r = first; r < last; ++r) {
+                m_rangeUpdated[r] = updateRange(m_ranges[r].first, m_ranges[r].second);
+            }
+        });
+        for (size_t r = 0; r < m_rangeUpdated.size(); ++r) {
+            m_lastUpdated += m_rangeUpdated[r];
+        }
+    }
+
+private:
+    // Updates the nodes of [first, last), whole subtrees whose ancestors are up to date. Returns the number of
+    // nodes recomputed.
+    size_t updateRange(const uint32_t first, const uint32_t last) {
+        size_t updated = 0;
+        uint32_t i = first;
+        while (i < last) {
+            const uint32_t parent = m_parents[i];
+            const bool parentChanged = parent != kNone && m_changed[parent];
+            if (!m_pending[i] && !parentChanged) {
+                i = m_subtreeEnds[i]; // nothing to do below
+                continue;
+            }
+            const bool recompute = m_dirty[i] || (parentChanged && !m_absolute[i]);
+            if (recompute) {
+                if (parent == kNone || m_absolute[i]) {
+                    m_worldTranslations[i] = m_localTranslations[i];
+                    m_worldRotations[i] = m_localRotations[i];
+                }
+                else {
+                    const glm::dquat parentRotation(m_worldRotations[parent]);
+                    m_worldTranslations[i] = m_worldTranslations[parent] + parentRotation * m_localTranslations[i];
+                    m_worldRotations[i] = m_worldRotations[parent] * m_localRotations[i];
+                }
+                ++updated;
+            }
+            m_changed[i] = recompute ? 1 : 0;
+            m_dirty[i] = 0;
+            m_pending[i] = 0;
+            ++i;
+        }
+        return updated;
+    }
+
+    // The node needs an update, and so does the path down to it.
+    void markDirty(const uint32_t i) {
+        m_dirty[i] = 1;
+        for (uint32_t a = i; a != kNone && !m_pending[a]; a = m_parents[a]) {
+            m_pending[a] = 1;
+        }
+    }
+
+    std::vector<uint32_t> m_parents;
+    std::vector<uint8_t> m_absolute;
+    std::vector<uint32_t> m_subtreeEnds; // one past the last node of the subtree
+    std::vector<glm::dvec3> m_localTranslations;
+    std::vector<glm::quat> m_localRotations;
+    std::vector<glm::vec3> m_localScales;
+    std::vector<glm::dvec3> m_worldTranslations;
+    std::vector<glm::quat> m_worldRotations;
+    std::vector<uint8_t> m_dirty;   // local transform changed
+    std::vector<uint8_t> m_pending; // the node or one of its descendants is dirty
+    std::vector<uint8_t> m_changed; // world transform recomputed by the current update
+    size_t m_lastUpdated = 0;
+    std::vector<std::pair<uint32_t, uint32_t> > m_ranges; // parallel update: node ranges given to jobs
+    std::vector<size_t> m_rangeUpdated;
+};
+
+#endif // TRANSFORMS_H
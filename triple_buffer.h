@@ -0,0 +1,62 @@
+// ----------------------------------------------------------------------------
+// triple_buffer.h
+//
+// Description: Lock-free hand-over of the latest value from one writer thread
+//              to one reader thread. Of three slots, the writer fills one, the
+//              reader reads another, and the third holds the latest value
+//              published; publishing and picking it up are single atomic
+//              exchanges of that slot, so neither thread ever waits for the
+//              other and each runs at its own rate. The reader only sees the
+//              latest value: the ones published in between are dropped. The
+//              writer is told whether its previous value was picked up, which
+//              tells it what the reader has seen.
+// ----------------------------------------------------------------------------
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+template <typename T>
+class TripleBuffer {
+public:
+    // ---- Writer ----
+
+    // Slot being written: the writer owns it until it publishes.
+    inline T& getBack() { return m_slots[m_back]; }
+
+    // Publishes the back slot and takes another one, whose content is stale. Returns whether the previous
+    // publication was dropped, i.e., replaced before the reader picked it up.
+    bool publish() {
+        const uint8_t previous = m_middle.exchange(static_cast<uint8_t>(m_back | kFresh), std::memory_order_acq_rel);
+        m_back = previous & kIndexMask;
+        return (previous & kFresh) != 0;
+    }
+
+    // ---- Reader ----
+
+    // Picks the latest publication up, if there is a new one. Returns whether there was.
+    bool update() {
+        if (!(m_middle.load(std::memory_order_relaxed) & kFresh)) {
+            return false;
+        }
+        const uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = previous & kIndexMask;
+        return true;
+    }
+
+    // Latest value picked up: the reader owns it until the next update.
+    inline const T& getFront() const { return m_slots[m_front]; }
+
+private:
+    const static uint8_t kIndexMask = 3;
+    const static uint8_t kFresh = 4; // published and not picked up yet
+
+    T m_slots[3];
+    uint8_t m_back = 0;                 // writer only
+    std::atomic<uint8_t> m_middle{1};   // slot index, with kFresh
+    uint8_t m_front = 2;                // reader only
+};
+
+#endif // TRIPLE_BUFFER_H
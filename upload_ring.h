@@ -0,0 +1,119 @@
+// ----------------------------------------------------------------------------
+// upload_ring.h
+//
+// Description: Staging of texture uploads through a ring of pixel unpack
+//              buffers. Each frame, the uploader copies at most a budget of
+//              bytes into the next buffer of the ring and issues its uploads
+//              from there: the driver copies them to the textures on the GPU
+//              timeline, instead of the render thread waiting for a transfer
+//              from client memory. A fence after the uploads of a buffer tells
+//              when it may be written again; a buffer still in use skips the
+//              frame rather than waiting for it.
+// ----------------------------------------------------------------------------
+
+#ifndef UPLOAD_RING_H
+#define UPLOAD_RING_H
+
+#include "gpu_resources.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+const static int kUploadRingBuffers = 3; // frames of uploads in flight
+const static size_t kUploadRingAlignment = 16;
+
+class PixelUploadRing {
+public:
+    void init(const size_t bytesPerFrame) {
+        m_capacity = bytesPerFrame;
+        for (int b = 0; b < kUploadRingBuffers; ++b) {
+            m_buffers[b].create(kGpuTextures);
+            m_buffers[b].setData(GL_PIXEL_UNPACK_BUFFER, m_capacity, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    void clear() {
+        for (int b = 0; b < kUploadRingBuffers; ++b) {
+            if (m_fences[b]) {
+                glDeleteSync(m_fences[b]);
+                m_fences[b] = nullptr;
+            }
+            m_buffers[b].reset();
+        }
+        m_mapped = nullptr;
+    }
+
+    inline bool isAvailable() const { return m_buffers[0].get() != 0; }
+    inline size_t getCapacity() const { return m_capacity; }
+
+    // Maps the next buffer, if the GPU is done with its previous uploads, and grows it to hold at least
+    // minBytes. Never waits: returns false if it is still in use, and nothing is uploaded this frame.
+    bool begin(const size_t minBytes) {
+        GpuBuffer& buffer = m_buffers[m_next];
+        if (m_fences[m_next]) {
+            const GLenum status = glClientWaitSync(m_fences[m_next], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                return false;
+            }
+            glDeleteSync(m_fences[m_next]);
+            m_fences[m_next] = nullptr;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.get());
+        if (buffer.getBytes() < minBytes) {
+            buffer.setData(GL_PIXEL_UNPACK_BUFFER, minBytes, nullptr, GL_STREAM_DRAW); // a row larger than the budget
+        }
+        // The fence guarantees the GPU no longer reads it: no need for the driver to synchronize
+        m_mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, buffer.getBytes(),
+                                                                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        m_used = 0;
+        m_limit = std::max(m_capacity, minBytes);
+        return m_mapped != nullptr;
+    }
+
+    // Room for bytes more in the mapped buffer, within the budget of the frame, or null if they do not fit;
+    // offset is where they start, the pixel pointer to give OpenGL once the buffer is bound.
+    unsigned char* allocate(const size_t bytes, size_t& offset) {
+        const size_t start = alignUsed();
+        if (!m_mapped || start + bytes > m_limit) {
+            return nullptr;
+        }
+        offset = start;
+        m_used = start + bytes;
+        return m_mapped + start;
+    }
+
+    // Bytes left in the budget of the frame.
+    inline size_t getAvailable() const { return m_limit - std::min(alignUsed(), m_limit); }
+
+    // Unmaps the buffer and binds it to GL_PIXEL_UNPACK_BUFFER: the uploads issued until end() read from it.
+    void bind() {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[m_next].get());
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        m_mapped = nullptr;
+    }
+
+    // Fences the uploads of the buffer and moves to the next one.
+    void end() {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        m_fences[m_next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_next = (m_next + 1) % kUploadRingBuffers;
+    }
+
+private:
+    inline size_t alignUsed() const { return (m_used + kUploadRingAlignment - 1) / kUploadRingAlignment * kUploadRingAlignment; }
+
+    GpuBuffer m_buffers[kUploadRingBuffers];
+    GLsync m_fences[kUploadRingBuffers] = {};
+    unsigned char* m_mapped = nullptr;
+    size_t m_capacity = 0; // bytes per frame
+    size_t m_limit = 0;    // of this frame: the budget, or the one row above it
+    size_t m_used = 0;
+    int m_next = 0;
+};
+
+#endif // UPLOAD_RING_H
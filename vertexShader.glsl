@@ -5,9 +5,10 @@ layout(location=2) in vec2 vertexUV; // UV mapping
 //uniform mat4 viewMat, projMat, translationMatrix;
 uniform mat4 transformationMatrix;
 uniform mat4 viewMatrix;
-uniform mat4 M;
+uniform mat4 M; // model matrix, relative to the camera (the camera is at the origin, see world.h)
 uniform int sunFlag;
-uniform vec3 camPos;
+uniform vec3 lightPos; // light position relative to the camera
+uniform float logDepthCoef; // 2 / log2(far + 1)
 
 out vec3 fPos;
 out vec3 fNormal; // output to the next stage, will be rasterized thus available per fragment
@@ -23,23 +24,20 @@ void main() {
 
 fPos = vPos;
 
-lightDirection = vec3(0.0f, 0.0f, 0.0f) - fPos;
 fNormal = vNormal; // pass the vertex coordinates to the next stage
 UV = vertexUV;
 gl_Position = transformationMatrix * vec4(vPos, 1.0); // mandatory to rasterize properly
-// Vector that goes from the vertex to the light, in camera space. M is ommited because it's identity.
+// Logarithmic depth, so that one depth buffer covers both nearby and interplanetary distances
+gl_Position.z = (log2(max(1e-6, 1.0 + gl_Position.w)) * logDepthCoef - 1.0) * gl_Position.w;
 
-// In camera space, the camera is at the origin (0,0,0).
-vec3 vertexPosition_cameraspace = (viewMatrix * M * vec4(vPos,1)).xyz;
-EyeDirection_cameraspace = vec3(0,0,0) - vertexPosition_cameraspace;
+// Lighting is computed in camera-relative world space, where the camera sits at the origin.
+vec3 vertexPosition = (M * vec4(vPos, 1)).xyz;
+lightDirection = lightPos - vertexPosition;
+EyeDirection_cameraspace = (viewMatrix * vec4(-vertexPosition, 0)).xyz;
+LightDirection_cameraspace = (viewMatrix * vec4(lightDirection, 0)).xyz;
 
-
-vec3 LightPosition_worldspace = vec3(0.0f, 0.0f, 0.0f);
-vec3 LightPosition_cameraspace = (viewMatrix * vec4(LightPosition_worldspace,1)).xyz;
-LightDirection_cameraspace = LightPosition_cameraspace + EyeDirection_cameraspace;
-
-vec3 n = normalize(vec3(transpose(inverse(M)) * vec4(fNormal, 1.0f)));
-vec3 l = normalize(LightDirection_cameraspace);
+vec3 n = normalize(mat3(transpose(inverse(M))) * fNormal);
+vec3 l = normalize(lightDirection);
 
 // ambiente
 vec3 lightColor = vec3(1.0f, 1.0f, 1.0f);
@@ -51,7 +49,7 @@ float diff = max(dot(n, l), 0.0);
 vec3 diffuse = diff * lightColor;
 
 // especular
-vec3 v = normalize(camPos - fPos);
+vec3 v = normalize(-vertexPosition);
 vec3 r = (2*dot(n, l)*n) - l;
 int shininess = 16;
 float specular_constant = 2.0f;
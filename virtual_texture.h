@@ -0,0 +1,658 @@
+// ----------------------------------------------------------------------------
+// virtual_texture.h
+//
+// Description: Virtual texturing, for planet maps far larger than the memory
+//              they may take on the GPU. tools/texture_tiler.cpp cuts the
+//              image and its mip levels into tiles with a border, each one
+//              compressed in BC1 (see bc1.h). At runtime only the tiles seen
+//              are resident, in the slots of one fixed-size cache texture; an
+//              indirection texture, one texel per tile of each level, gives
+//              the slot of the tile or, while it is missing, of its nearest
+//              resident ancestor, through which fragmentShader.glsl samples.
+//
+//              Which tiles are seen comes from a feedback pass: the bodies
+//              drawn with a virtual texture are rendered again at a fraction
+//              of the resolution, each pixel writing the tile and level it
+//              samples. Its read back, a few frames later and without waiting,
+//              requests the missing tiles, coarse levels first, from a
+//              background I/O thread; tiles are uploaded a few per frame, and
+//              the least recently seen ones give their slot when the cache is
+//              full. The coarsest level stays resident, so there is always
+//              something to sample, and memory stays that of the cache
+//              whatever the size of the image.
+// ----------------------------------------------------------------------------
+
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "bc1.h"
+#include "gpu_resources.h"
+#include "textures.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+void loadShader(GLuint program, GLenum type, const std::string& shaderFilename); // main.cpp
+
+// ---- Binary file layout ----------------------------------------------------
+// [VirtualTextureHeader][padding][tiles of level 0, in rows][tiles of level 1]...
+// Every tile takes kVirtualTileBytes: BC1 blocks of kVirtualTilePadded texels squared, in rows.
+
+const static char kVirtualTextureMagic[8] = { 'V', 'T', 'E', 'X', 'T', 'I', 'L', '1' };
+const static char kVirtualTextureExtension[] = ".vtex"; // scene textures of this extension are virtual
+const static uint32_t kVirtualTileSize = 128;  // texels of a tile, without its border
+const static uint32_t kVirtualTileBorder = 4;  // texels of the neighbors around the tile, for bilinear filtering
+const static uint32_t kVirtualTilePadded = kVirtualTileSize + 2 * kVirtualTileBorder;
+const static uint32_t kVirtualTileBytes = (kVirtualTilePadded / 4) * (kVirtualTilePadded / 4) * kBC1BlockBytes;
+const static uint32_t kMaxVirtualLevels = 16;
+const static uint32_t kMaxVirtualCoarseTiles = 64; // of the coarsest level, which stays resident
+const static uint32_t kNoVirtualSlot = 0xFFFFFFFFu;
+const static uint32_t kNoVirtualTile = 0xFFFFFFFFu;
+
+inline bool isVirtualTextureFile(const std::string& filename) {
+    const size_t n = sizeof(kVirtualTextureExtension) - 1;
+    return filename.size() >= n && filename.compare(filename.size() - n, n, kVirtualTextureExtension) == 0;
+}
+
+struct VirtualTextureLevel {
+    uint32_t tilesX;    // the width of level 0 in tiles, halved per level
+    uint32_t tilesY;
+    uint64_t firstTile; // index of the first tile of the level in the file
+};
+
+struct VirtualTextureHeader {
+    char magic[8];
+    uint32_t width;     // texels of level 0, a power of two multiple of kVirtualTileSize
+    uint32_t height;
+    uint32_t tileSize;  // kVirtualTileSize
+    uint32_t tileBorder; // kVirtualTileBorder
+    uint32_t tileBytes; // kVirtualTileBytes
+    uint32_t numLevels; // down to a level of at most kMaxVirtualCoarseTiles tiles
+    uint64_t tilesOffset;
+    VirtualTextureLevel levels[kMaxVirtualLevels];
+};
+
+// ---- Feedback ----------------------------------------------------------------
+// A pixel of the feedback pass: the virtual texture (4 bits), the level (4 bits) and the tile (12 bits for x,
+// 12 bits for y) it samples; vtFeedbackFragmentShader.glsl packs it the same way. Texture 15 is never used, so
+// that no entry is kVirtualFeedbackNone.
+
+const static uint32_t kMaxVirtualTextures = 15;
+const static uint32_t kVirtualFeedbackNone = 0xFFFFFFFFu;
+const static int kVirtualFeedbackScale = 8; // the pass has 1/8 of the width and height of the viewport
+const static int kVirtualFeedbackBuffers = 3; // read backs in flight
+
+// Low resolution pass writing the tile each pixel of the bodies with a virtual texture samples, read back
+// through a ring of pixel buffers: the read back of a frame is collected once the GPU is done with it.
+class VirtualTextureFeedback {
+public:
+    void init() {
+        m_program.create();
+        loadShader(m_program.get(), GL_VERTEX_SHADER, "vtFeedbackVertexShader.glsl");
+        loadShader(m_program.get(), GL_FRAGMENT_SHADER, "vtFeedbackFragmentShader.glsl");
+        glLinkProgram(m_program.get());
+        m_framebuffer.create(kGpuTextures);
+        for (int b = 0; b < kVirtualFeedbackBuffers; ++b) {
+            m_buffers[b].create(kGpuTextures);
+        }
+    }
+
+    void clear() {
+        for (int b = 0; b < kVirtualFeedbackBuffers; ++b) {
+            if (m_fences[b]) {
+                glDeleteSync(m_fences[b]);
+                m_fences[b] = nullptr;
+            }
+            m_buffers[b].reset();
+        }
+        m_framebuffer.reset();
+        m_depth.reset();
+        m_ids.reset();
+        m_program.reset();
+        m_width = m_height = 0;
+    }
+
+    // Starts drawing into the feedback target, sized from the current viewport.
+    void begin(const glm::mat4& projView, const float logDepthCoef) {
+        glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+        resize(std::max(m_savedViewport[2] / kVirtualFeedbackScale, 1), std::max(m_savedViewport[3] / kVirtualFeedbackScale, 1));
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer.get());
+        glViewport(0, 0, m_width, m_height);
+        const GLuint none[4] = { kVirtualFeedbackNone, 0, 0, 0 };
+        const GLfloat farDepth = 1.0f;
+        glClearBufferuiv(GL_COLOR, 0, none);
+        glClearBufferfv(GL_DEPTH, 0, &farDepth);
+        glUseProgram(m_program.get());
+        glUniformMatrix4fv(glGetUniformLocation(m_program.get(), "projView"), 1, GL_FALSE, glm::value_ptr(projView));
+        glUniform1f(glGetUniformLocation(m_program.get(), "logDepthCoef"), logDepthCoef);
+        // Derivatives are kVirtualFeedbackScale times those of the full resolution pass
+        glUniform1f(glGetUniformLocation(m_program.get(), "lodBias"), -std::log2(static_cast<float>(kVirtualFeedbackScale)));
+    }
+
+    // The object drawn next, by drawing its mesh: its camera-relative model matrix and its virtual texture.
+    void setObject(const glm::mat4& model, const uint32_t texture, const VirtualTextureHeader& header) {
+        glUniformMatrix4fv(glGetUniformLocation(m_program.get(), "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glUniform1ui(glGetUniformLocation(m_program.get(), "vtId"), texture);
+        glUniform4f(glGetUniformLocation(m_program.get(), "vtSize"), static_cast<float>(header.width), static_cast<float>(header.height),
+                    static_cast<float>(header.levels[0].tilesX), static_cast<float>(header.levels[0].tilesY));
+        glUniform1i(glGetUniformLocation(m_program.get(), "vtLevels"), static_cast<GLint>(header.numLevels));
+    }
+
+    // Queues the read back, unless all the buffers are still in flight, and restores the default framebuffer.
+    void end() {
+        const int b = m_next;
+        if (!m_fences[b]) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[b].get());
+            if (m_buffers[b].getBytes() != size_t(m_width) * m_height * sizeof(uint32_t)) {
+                m_buffers[b].setData(GL_PIXEL_PACK_BUFFER, size_t(m_width) * m_height * sizeof(uint32_t), nullptr, GL_STREAM_READ);
+            }
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glReadPixels(0, 0, m_width, m_height, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            m_fences[b] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            m_next = (m_next + 1) % kVirtualFeedbackBuffers;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+    }
+
+    // The oldest read back the GPU is done with, sorted, without repetitions nor empty pixels: the entries of a
+    // virtual texture are contiguous. Never waits; returns false if none is done.
+    bool collect(std::vector<uint32_t>& entries) {
+        const int b = m_oldest;
+        if (!m_fences[b]) {
+            return false;
+        }
+        const GLenum status = glClientWaitSync(m_fences[b], 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            return false;
+        }
+        glDeleteSync(m_fences[b]);
+        m_fences[b] = nullptr;
+        m_oldest = (m_oldest + 1) % kVirtualFeedbackBuffers;
+        const size_t count = m_buffers[b].getBytes() / sizeof(uint32_t);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[b].get());
+        const uint32_t* pixels = static_cast<const uint32_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * sizeof(uint32_t), GL_MAP_READ_BIT));
+        entries.clear();
+        if (pixels) {
+            entries.assign(pixels, pixels + count);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        std::sort(entries.begin(), entries.end());
+        entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+        if (!entries.empty() && entries.back() == kVirtualFeedbackNone) {
+            entries.pop_back();
+        }
+        return true;
+    }
+
+private:
+    void resize(const GLsizei width, const GLsizei height) {
+        if (width == m_width && height == m_height) {
+            return;
+        }
+        m_width = width;
+        m_height = height;
+        m_ids.create(kGpuTextures);
+        glBindTexture(GL_TEXTURE_2D, m_ids.get());
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        m_ids.setBytes(size_t(width) * height * sizeof(uint32_t));
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_depth.create(kGpuTextures);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_depth.get());
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        m_depth.setBytes(size_t(width) * height * 4);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer.get());
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_ids.get(), 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth.get());
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    GpuProgram m_program;
+    GpuFramebuffer m_framebuffer;
+    GpuTexture m_ids;
+    GpuRenderbuffer m_depth;
+    GpuBuffer m_buffers[kVirtualFeedbackBuffers];
+    GLsync m_fences[kVirtualFeedbackBuffers] = {};
+    int m_next = 0;   // buffer of the next read back
+    int m_oldest = 0; // buffer of the next collect
+    GLsizei m_width = 0;
+    GLsizei m_height = 0;
+    GLint m_savedViewport[4] = { 0, 0, 0, 0 };
+};
+
+// ---- Runtime streaming ------------------------------------------------------
+
+class VirtualTexture {
+public:
+    VirtualTexture() {}
+    ~VirtualTexture() { close(); }
+
+    // Reads the header. Needs no OpenGL context. Returns false on a missing or malformed file.
+    bool open(const std::string& filename) {
+        close();
+        std::ifstream file(filename.c_str(), std::ios::binary);
+        VirtualTextureHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, kVirtualTextureMagic, sizeof(kVirtualTextureMagic)) != 0 || header.tileSize != kVirtualTileSize ||
+            header.tileBorder != kVirtualTileBorder || header.tileBytes != kVirtualTileBytes || header.numLevels == 0 ||
+            header.numLevels > kMaxVirtualLevels || header.levels[0].tilesX > 4096 || header.levels[0].tilesY > 4096) {
+            return false;
+        }
+        uint64_t numTiles = 0;
+        for (uint32_t l = 0; l < header.numLevels; ++l) {
+            const VirtualTextureLevel& level = header.levels[l];
+            if (level.firstTile != numTiles || level.tilesX != std::max(header.levels[0].tilesX >> l, 1u) ||
+                level.tilesY != std::max(header.levels[0].tilesY >> l, 1u)) {
+                return false;
+            }
+            numTiles += uint64_t(level.tilesX) * level.tilesY;
+        }
+        const VirtualTextureLevel& coarsest = header.levels[header.numLevels - 1];
+        if (uint64_t(coarsest.tilesX) * coarsest.tilesY > kMaxVirtualCoarseTiles) {
+            return false;
+        }
+        m_header = header;
+        m_filename = filename;
+        m_states.assign(static_cast<size_t>(numTiles), kUnloaded);
+        m_lastUsed.assign(m_states.size(), 0);
+        m_slots.assign(m_states.size(), kNoVirtualSlot);
+        return true;
+    }
+
+    // With the context: allocates the cache, of slotsPerSide squared tiles, and the indirection, loads the
+    // coarsest level and starts the I/O thread. Returns false if a tile of the coarsest level cannot be read.
+    bool initGPU(const uint32_t slotsPerSide) {
+        m_compressed = hasGLExtension("GL_EXT_texture_compression_s3tc");
+        m_slotsPerSide = slotsPerSide;
+        m_slotTiles.assign(size_t(slotsPerSide) * slotsPerSide, kNoVirtualTile);
+        m_slotPinned.assign(m_slotTiles.size(), 0);
+        const GLsizei size = static_cast<GLsizei>(slotsPerSide * kVirtualTilePadded);
+        m_cache.create(kGpuTextures);
+        glBindTexture(GL_TEXTURE_2D, m_cache.get());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, m_compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        m_cache.setBytes(m_compressed ? computeBC1Size(size, size) : size_t(size) * size * 3);
+
+        m_indirectionTexels.resize(m_header.numLevels);
+        m_dirtyRects.assign(m_header.numLevels, DirtyRect());
+        m_indirection.create(kGpuTextures);
+        glBindTexture(GL_TEXTURE_2D, m_indirection.get());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(m_header.numLevels - 1));
+        size_t indirectionBytes = 0;
+        for (uint32_t l = 0; l < m_header.numLevels; ++l) {
+            const VirtualTextureLevel& level = m_header.levels[l];
+            m_indirectionTexels[l].assign(size_t(level.tilesX) * level.tilesY * 4, 0);
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8UI, level.tilesX, level.tilesY, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, m_indirectionTexels[l].data());
+            indirectionBytes += m_indirectionTexels[l].size();
+        }
+        m_indirection.setBytes(indirectionBytes);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // The coarsest level, read now and pinned
+        std::ifstream file(m_filename.c_str(), std::ios::binary);
+        const uint32_t coarsest = m_header.numLevels - 1;
+        const uint32_t numCoarse = m_header.levels[coarsest].tilesX * m_header.levels[coarsest].tilesY;
+        std::vector<unsigned char> data;
+        for (uint32_t t = 0; t < numCoarse; ++t) {
+            const uint32_t tile = static_cast<uint32_t>(m_header.levels[coarsest].firstTile) + t;
+            if (t >= m_slotTiles.size() || !readTile(file, tile, data)) {
+                return false;
+            }
+            m_slotPinned[t] = 1;
+            place(tile, t, data); // the whole indirection depends on the coarsest level
+        }
+        update();
+
+        m_stop = false;
+        m_ioThread = std::thread(&VirtualTexture::ioLoop, this);
+        return true;
+    }
+
+    void close() {
+        if (m_ioThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_all();
+            m_ioThread.join();
+        }
+        m_cache.reset();
+        m_indirection.reset();
+        m_states.clear();
+        m_lastUsed.clear();
+        m_slots.clear();
+        m_slotTiles.clear();
+        m_slotPinned.clear();
+        m_indirectionTexels.clear();
+        m_dirtyRects.clear();
+        m_requests.clear();
+        m_completed.clear();
+        m_residentTiles = 0;
+    }
+
+    inline bool isOpen() const { return !m_states.empty(); }
+    inline const VirtualTextureHeader& getHeader() const { return m_header; }
+    inline const std::string& getFilename() const { return m_filename; }
+    inline uint32_t getResidentTiles() const { return m_residentTiles; }
+    inline void setUploadsPerFrame(const uint32_t tiles) { m_uploadsPerFrame = tiles; }
+
+    // The feedback entries of this texture: marks the tiles seen, with their ancestors, as used, and requests
+    // the missing ones, coarse levels first. Replaces the requests of the previous feedback.
+    void processFeedback(const uint32_t* first, const uint32_t* last) {
+        ++m_frame;
+        m_wanted.clear();
+        for (const uint32_t* e = first; e != last; ++e) {
+            uint32_t level = (*e >> 24) & 15;
+            uint32_t x = *e & 0xFFF;
+            uint32_t y = (*e >> 12) & 0xFFF;
+            for (; level < m_header.numLevels; ++level, x /= 2, y /= 2) {
+                const VirtualTextureLevel& l = m_header.levels[level];
+                if (x >= l.tilesX || y >= l.tilesY) {
+                    break;
+                }
+                const uint32_t tile = static_cast<uint32_t>(l.firstTile) + y * l.tilesX + x;
+                if (m_lastUsed[tile] == m_frame) {
+                    break; // the ancestors were seen already
+                }
+                m_lastUsed[tile] = m_frame;
+                if (m_states[tile] == kUnloaded) {
+                    m_wanted.push_back(Request(tile, level));
+                }
+            }
+        }
+        publishRequests();
+    }
+
+    // Per frame: uploads the tiles read since the last frame, evicting the least recently seen ones when the
+    // cache is full, and updates the entries of the indirection they change. Never blocks on I/O.
+    void update() {
+        uploadCompleted();
+        // Coarse to fine: a tile missing takes the entry of its parent, which is up to date by then
+        for (uint32_t l = m_header.numLevels; l-- > 0;) {
+            const VirtualTextureLevel& level = m_header.levels[l];
+            const DirtyRect& rect = m_dirtyRects[l];
+            std::vector<unsigned char>& texels = m_indirectionTexels[l];
+            for (uint32_t y = rect.y0; y < rect.y1; ++y) {
+                for (uint32_t x = rect.x0; x < rect.x1; ++x) {
+                    unsigned char* entry = &texels[(size_t(y) * level.tilesX + x) * 4];
+                    const uint32_t slot = m_slots[static_cast<size_t>(level.firstTile) + y * level.tilesX + x];
+                    if (slot != kNoVirtualSlot) {
+                        entry[0] = static_cast<unsigned char>(slot % m_slotsPerSide);
+                        entry[1] = static_cast<unsigned char>(slot / m_slotsPerSide);
+                        entry[2] = static_cast<unsigned char>(l);
+                        entry[3] = 1;
+                    }
+                    else if (l + 1 < m_header.numLevels) {
+                        const VirtualTextureLevel& parent = m_header.levels[l + 1];
+                        std::memcpy(entry, &m_indirectionTexels[l + 1][(size_t(std::min(y / 2, parent.tilesY - 1)) * parent.tilesX +
+                                                                        std::min(x / 2, parent.tilesX - 1)) * 4], 4);
+                    }
+                    else {
+                        std::memset(entry, 0, 4); // nothing resident: the shader draws grey
+                    }
+                }
+            }
+        }
+        // Only the rectangles changed, read in place from the texels of their level
+        glBindTexture(GL_TEXTURE_2D, m_indirection.get());
+        for (uint32_t l = 0; l < m_header.numLevels; ++l) {
+            DirtyRect& rect = m_dirtyRects[l];
+            if (rect.x0 >= rect.x1) {
+                continue;
+            }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, static_cast<GLint>(m_header.levels[l].tilesX));
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, static_cast<GLint>(rect.x0));
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, static_cast<GLint>(rect.y0));
+            glTexSubImage2D(GL_TEXTURE_2D, l, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE,
+                            m_indirectionTexels[l].data());
+            rect = DirtyRect();
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Binds the indirection and the cache on the given units, which the vtIndirection and vtCache samplers of
+    // fragmentShader.glsl are set to once, and sets its other uniforms.
+    void bind(const GLuint program, const GLint indirectionUnit, const GLint cacheUnit) const {
+        glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+        glBindTexture(GL_TEXTURE_2D, m_indirection.get());
+        glActiveTexture(GL_TEXTURE0 + cacheUnit);
+        glBindTexture(GL_TEXTURE_2D, m_cache.get());
+        glActiveTexture(GL_TEXTURE0);
+        glUniform4f(glGetUniformLocation(program, "vtSize"), static_cast<float>(m_header.width), static_cast<float>(m_header.height),
+                    static_cast<float>(m_header.levels[0].tilesX), static_cast<float>(m_header.levels[0].tilesY));
+        glUniform1i(glGetUniformLocation(program, "vtLevels"), static_cast<GLint>(m_header.numLevels));
+        glUniform1f(glGetUniformLocation(program, "vtSlotsPerSide"), static_cast<float>(m_slotsPerSide));
+    }
+
+private:
+    enum TileState { kUnloaded = 0, kRequested, kResident };
+
+    struct Request {
+        Request() {}
+        Request(uint32_t t, uint32_t p) : tile(t), priority(p) {}
+        uint32_t tile;
+        uint32_t priority; // level: coarse first
+    };
+
+    struct Completed {
+        uint32_t tile;
+        std::vector<unsigned char> data; // BC1 blocks, or RGB texels without BC1 support; empty if the read failed
+    };
+
+    // Entries of a level to rebuild, [x0, x1) x [y0, y1); empty when x0 >= x1
+    struct DirtyRect {
+        uint32_t x0 = 0xFFFFFFFFu;
+        uint32_t y0 = 0xFFFFFFFFu;
+        uint32_t x1 = 0;
+        uint32_t y1 = 0;
+    };
+
+    static bool lowerPriority(const Request& a, const Request& b) { return a.priority < b.priority; }
+
+    // The tile was placed or evicted: its entry changes, and so may those of its descendants at every finer
+    // level, which take it while they are missing.
+    void markDirty(const uint32_t tile) {
+        uint32_t level = 0;
+        while (level + 1 < m_header.numLevels && tile >= m_header.levels[level + 1].firstTile) {
+            ++level;
+        }
+        const uint32_t index = static_cast<uint32_t>(tile - m_header.levels[level].firstTile);
+        const uint32_t x = index % m_header.levels[level].tilesX;
+        const uint32_t y = index / m_header.levels[level].tilesX;
+        // The last column and row also take the children the parent lookup of update() clamps to them
+        const bool lastX = x + 1 == m_header.levels[level].tilesX;
+        const bool lastY = y + 1 == m_header.levels[level].tilesY;
+        for (uint32_t l = 0; l <= level; ++l) {
+            const uint32_t shift = level - l;
+            const VirtualTextureLevel& finer = m_header.levels[l];
+            DirtyRect& rect = m_dirtyRects[l];
+            rect.x0 = std::min(rect.x0, std::min(x << shift, finer.tilesX - 1));
+            rect.y0 = std::min(rect.y0, std::min(y << shift, finer.tilesY - 1));
+            rect.x1 = std::max(rect.x1, lastX ? finer.tilesX : std::min((x + 1) << shift, finer.tilesX));
+            rect.y1 = std::max(rect.y1, lastY ? finer.tilesY : std::min((y + 1) << shift, finer.tilesY));
+        }
+    }
+
+    // Blocks of the tile, decoded to RGB when BC1 is not supported.
+    bool readTile(std::ifstream& file, const uint32_t tile, std::vector<unsigned char>& data) const {
+        std::vector<unsigned char> blocks(kVirtualTileBytes);
+        file.clear();
+        file.seekg(static_cast<std::streamoff>(m_header.tilesOffset + uint64_t(tile) * kVirtualTileBytes));
+        if (!file.read(reinterpret_cast<char*>(blocks.data()), blocks.size())) {
+            data.clear();
+            return false;
+        }
+        if (m_compressed) {
+            data.swap(blocks);
+        }
+        else {
+            data.resize(size_t(kVirtualTilePadded) * kVirtualTilePadded * 3);
+            decodeBC1(blocks.data(), kVirtualTilePadded, kVirtualTilePadded, data.data());
+        }
+        return true;
+    }
+
+    // Same as point_octree.h: the queue of the I/O thread is replaced by the tiles wanted now, most urgent last.
+    void publishRequests() {
+        std::sort(m_wanted.begin(), m_wanted.end(), lowerPriority);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t k = 0; k < m_requests.size(); ++k) {
+                m_states[m_requests[k].tile] = kUnloaded;
+            }
+            m_requests.clear();
+            for (size_t k = 0; k < m_wanted.size(); ++k) {
+                const uint32_t t = m_wanted[k].tile;
+                if (m_states[t] == kUnloaded) {
+                    m_states[t] = kRequested;
+                    m_requests.push_back(m_wanted[k]);
+                }
+            }
+        }
+        m_wake.notify_one();
+    }
+
+    void ioLoop() {
+        std::ifstream file(m_filename.c_str(), std::ios::binary);
+        for (;;) {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this] { return m_stop || !m_requests.empty(); });
+                if (m_stop) {
+                    return;
+                }
+                request = m_requests.back();
+                m_requests.pop_back();
+            }
+            std::vector<unsigned char> data;
+            readTile(file, request.tile, data);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_completed.push_back(Completed());
+            m_completed.back().tile = request.tile;
+            m_completed.back().data.swap(data);
+        }
+    }
+
+    void uploadCompleted() {
+        std::vector<Completed> ready;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const size_t count = std::min<size_t>(m_completed.size(), m_uploadsPerFrame);
+            for (size_t k = 0; k < count; ++k) {
+                ready.push_back(Completed());
+                ready.back().tile = m_completed[k].tile;
+                ready.back().data.swap(m_completed[k].data);
+            }
+            m_completed.erase(m_completed.begin(), m_completed.begin() + count);
+        }
+        for (size_t k = 0; k < ready.size(); ++k) {
+            const uint32_t slot = allocateSlot();
+            if (ready[k].data.empty() || slot == kNoVirtualSlot) {
+                m_states[ready[k].tile] = kUnloaded; // failed read, or every slot seen this frame: asked again
+                continue;
+            }
+            place(ready[k].tile, slot, ready[k].data);
+        }
+    }
+
+    // A free slot, else the one of the least recently seen tile, unless it was seen by the last feedback.
+    uint32_t allocateSlot() {
+        uint32_t victim = kNoVirtualSlot;
+        for (uint32_t s = 0; s < m_slotTiles.size(); ++s) {
+            const uint32_t tile = m_slotTiles[s];
+            if (tile == kNoVirtualTile) {
+                return s;
+            }
+            if (!m_slotPinned[s] && m_lastUsed[tile] != m_frame && (victim == kNoVirtualSlot || m_lastUsed[tile] < m_lastUsed[m_slotTiles[victim]])) {
+                victim = s;
+            }
+        }
+        if (victim != kNoVirtualSlot) {
+            const uint32_t evicted = m_slotTiles[victim];
+            m_states[evicted] = kUnloaded;
+            m_slots[evicted] = kNoVirtualSlot;
+            m_slotTiles[victim] = kNoVirtualTile;
+            --m_residentTiles;
+            markDirty(evicted);
+        }
+        return victim;
+    }
+
+    void place(const uint32_t tile, const uint32_t slot, const std::vector<unsigned char>& data) {
+        const GLint x = static_cast<GLint>((slot % m_slotsPerSide) * kVirtualTilePadded);
+        const GLint y = static_cast<GLint>((slot / m_slotsPerSide) * kVirtualTilePadded);
+        glBindTexture(GL_TEXTURE_2D, m_cache.get());
+        if (m_compressed) {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, kVirtualTilePadded, kVirtualTilePadded, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                                      kVirtualTileBytes, data.data());
+        }
+        else {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, kVirtualTilePadded, kVirtualTilePadded, GL_RGB, GL_UNSIGNED_BYTE, data.data());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_states[tile] = kResident;
+        m_slots[tile] = slot;
+        m_slotTiles[slot] = tile;
+        ++m_residentTiles;
+        markDirty(tile);
+    }
+
+    // Render thread only
+    VirtualTextureHeader m_header;
+    std::string m_filename;
+    std::vector<uint8_t> m_states;    // TileState, per tile
+    std::vector<uint64_t> m_lastUsed; // feedback that last saw the tile
+    std::vector<uint32_t> m_slots;    // per tile, if resident
+    std::vector<uint32_t> m_slotTiles; // per slot, if used
+    std::vector<uint8_t> m_slotPinned; // coarsest level
+    std::vector<std::vector<unsigned char> > m_indirectionTexels; // per level
+    std::vector<DirtyRect> m_dirtyRects; // per level, since the last update
+    std::vector<Request> m_wanted;
+    GpuTexture m_cache;
+    GpuTexture m_indirection;
+    uint32_t m_slotsPerSide = 0;
+    uint32_t m_residentTiles = 0;
+    uint32_t m_uploadsPerFrame = 16;
+    uint64_t m_frame = 0;
+    bool m_compressed = false; // read-only once the I/O thread runs
+
+    // Shared with the I/O thread, under m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_ioThread;
+    std::vector<Request> m_requests; // most urgent last
+    std::vector<Completed> m_completed;
+    bool m_stop = false;
+};
+
+#endif // VIRTUAL_TEXTURE_H
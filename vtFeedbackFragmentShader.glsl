@@ -0,0 +1,19 @@
+#version 330 core
+in vec2 UV;
+uniform uint vtId;     // index of the virtual texture in the feedback (see virtual_texture.h)
+uniform vec4 vtSize;   // texels (xy) and tiles (zw) of level 0
+uniform int vtLevels;
+uniform float lodBias; // the pass runs at a fraction of the resolution: its derivatives are larger
+
+layout(location=0) out uint entry;
+
+void main() {
+    // Same level as sampleVirtualTexture in fragmentShader.glsl
+    vec2 texel = UV * vtSize.xy;
+    vec2 dx = dFdx(texel), dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+    int level = int(clamp(floor(lod), 0.0, float(vtLevels - 1)));
+    ivec2 tiles = max(ivec2(vtSize.zw) >> level, ivec2(1));
+    ivec2 tile = min(ivec2(clamp(UV, 0.0, 1.0) * vec2(tiles)), tiles - 1);
+    entry = vtId << 28 | uint(level) << 24 | uint(tile.y) << 12 | uint(tile.x);
+}
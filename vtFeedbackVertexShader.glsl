@@ -0,0 +1,15 @@
+#version 330 core
+layout(location=0) in vec3 vPos;
+layout(location=2) in vec2 vertexUV;
+uniform mat4 projView; // projection * view, camera-relative (see world.h)
+uniform mat4 model;    // relative to the camera
+uniform float logDepthCoef; // 2 / log2(far + 1)
+
+out vec2 UV;
+
+void main() {
+    UV = vertexUV;
+    gl_Position = projView * model * vec4(vPos, 1.0);
+    // Same logarithmic depth as vertexShader.glsl, so that only the visible surface writes its tiles
+    gl_Position.z = (log2(max(1e-6, 1.0 + gl_Position.w)) * logDepthCoef - 1.0) * gl_Position.w;
+}
@@ -0,0 +1,37 @@
+// ----------------------------------------------------------------------------
+// world.h
+//
+// Description: Double-precision world space. Body positions are simulated in
+//              doubles and only converted to float once rebased on the camera
+//              origin, so single-precision rendering keeps full accuracy next
+//              to the camera whatever the distance to the world origin.
+// ----------------------------------------------------------------------------
+
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+
+// Model matrix of an object relative to the camera. This is the only place where a world position
+// drops to float: the subtraction happens in double, so the result is exact up to float rounding of
+// the (small) camera-relative offset.
+inline glm::mat4 computeCameraRelativeModel(const glm::dvec3& worldPosition, const glm::dvec3& cameraPosition, const glm::mat4& rotationScale = glm::mat4(1.0f)) {
+    const glm::vec3 offset = glm::vec3(worldPosition - cameraPosition);
+    return glm::translate(glm::mat4(1.0f), offset) * rotationScale;
+}
+
+// A point of the world relative to the camera (e.g., a light position).
+inline glm::vec3 toCameraRelative(const glm::dvec3& worldPosition, const glm::dvec3& cameraPosition) {
+    return glm::vec3(worldPosition - cameraPosition);
+}
+
+// Coefficient of the logarithmic depth written by the vertex shaders: z_ndc = log2(1 + w) * coef - 1.
+// A linear depth buffer cannot cover kilometers to billions of kilometers in one pass.
+inline float computeLogDepthCoefficient(const float farPlane) {
+    return static_cast<float>(2.0 / std::log2(static_cast<double>(farPlane) + 1.0));
+}
+
+#endif // WORLD_H